@@ -167,6 +167,17 @@ enum ndn_dtag {
     NDN_DTAG_SyncConfigSliceList = 125,
     NDN_DTAG_SyncConfigSliceOp = 126,
     NDN_DTAG_SyncNodeDeltas = 127,
+    NDN_DTAG_RateLimit = 128,
+    NDN_DTAG_RateBurst = 129,
+    NDN_DTAG_LinkFragment = 130,
+    NDN_DTAG_FragIndex = 131,
+    NDN_DTAG_FragCount = 132,
+    NDN_DTAG_LinkAck = 133,
+    NDN_DTAG_CoalesceMicros = 134,
+    NDN_DTAG_CoalesceBytes = 135,
+    NDN_DTAG_CongestionMark = 136,
+    NDN_DTAG_ShmRequest = 137,
+    NDN_DTAG_ShmOffer = 138,
     NDN_DTAG_SequenceNumber = 256,
     NDN_DTAG_NDNProtocolDataUnit = 17702112
 };
@@ -36,6 +36,10 @@ struct ndn_face_instance {
     unsigned faceid;
     struct ndn_sockdescr descr;
     int lifetime;
+    int rate_limit;
+    int rate_burst;
+    int coalesce_usec;
+    int coalesce_bytes;
     struct ndn_charbuf *store;
 };
 
@@ -34,6 +34,7 @@ struct hashtb_param {
     hashtb_finalize_proc finalize; /* default is NULL */
     void *finalize_data;           /* default is NULL */
     int orders;                    /* default is 0 */
+    int pool;                      /* default is 0 - see hashtb_pooled */
 }; 
 
 /*
@@ -42,6 +43,19 @@ struct hashtb_param {
 size_t
 hashtb_hash(const unsigned char *key, size_t key_size);
 
+/*
+ * hashtb_hash_more: Continue a hash with more key bytes.
+ * Hashing is incremental, so that
+ *   hashtb_hash(key, n) == hashtb_hash_more(HASHTB_HASH_INIT, key, n)
+ * and the hash of a longer key may be computed from that of its prefix.
+ * This allows the hashes of all the prefixes of a key to be
+ * calculated in a single pass, for use with hashtb_lookup_hashed
+ * and hashtb_seek_hashed.
+ */
+#define HASHTB_HASH_INIT 23
+size_t
+hashtb_hash_more(size_t hash, const unsigned char *key, size_t key_size);
+
 /*
  * hashtb_create: Create a new hash table.
  * The param may be NULL to use the defaults, otherwise
@@ -70,6 +84,17 @@ hashtb_destroy(struct hashtb **ht);
 int
 hashtb_n(struct hashtb *ht);
 
+/*
+ * hashtb_pooled: Get current number of free entries held for reuse.
+ * If the pool parameter is nonzero, the storage of deleted entries is
+ * kept on free lists by size and reused by later hashtb_seek calls,
+ * so that a table with a steady population does not go to the
+ * allocator.  The pool is not allowed to grow much larger than the
+ * table itself.
+ */
+int
+hashtb_pooled(struct hashtb *ht);
+
 /*
  * hashtb_lookup: Find an item
  * Keys are arbitrary data of specified length.
@@ -78,6 +103,13 @@ hashtb_n(struct hashtb *ht);
 void *
 hashtb_lookup(struct hashtb *ht, const void *key, size_t keysize);
 
+/*
+ * hashtb_lookup_hashed: Find an item, given the hashtb_hash of the key
+ */
+void *
+hashtb_lookup_hashed(struct hashtb *ht, const void *key, size_t keysize,
+                     size_t hash);
+
 /* The client owns the memory for an enumerator, normally in a local. */ 
 struct hashtb_enumerator {
     struct hashtb *ht;
@@ -120,6 +152,30 @@ hashtb_seek(struct hashtb_enumerator *hte,
 #define HT_OLD_ENTRY 0
 #define HT_NEW_ENTRY 1
 
+/*
+ * hashtb_seek_hashed: Find or add an item, given the hashtb_hash of the key
+ * Otherwise the same as hashtb_seek.
+ */
+int
+hashtb_seek_hashed(struct hashtb_enumerator *hte,
+                   const void *key, size_t keysize, size_t extsize,
+                   size_t hash);
+
+/*
+ * hashtb_seek_ext: Find or add an item whose extension data is
+ * not contiguous with the key
+ * Otherwise the same as hashtb_seek; for a newly added item the
+ * extlen bytes at ext are copied into the keystore following the key.
+ * This saves the caller from assembling key and extension in a
+ * scratch buffer first.  The remaining extsize - extlen bytes of
+ * the extension are zeroed, and may be used to keep variable-sized
+ * per-item data in the same allocation as the item.
+ */
+int
+hashtb_seek_ext(struct hashtb_enumerator *hte,
+                const void *key, size_t keysize,
+                const void *ext, size_t extlen, size_t extsize);
+
 /*
  * hashtb_delete: Delete an item
  * The item will be unlinked from the table, and will
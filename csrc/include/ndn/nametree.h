@@ -0,0 +1,106 @@
+/**
+ * @file ndn/nametree.h
+ *
+ * In-memory name-ordered index.
+ *
+ * Part of the NDNx C Library.
+ *
+ * Portions Copyright (C) 2013 Regents of the University of California.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 2.1
+ * as published by the Free Software Foundation.
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details. You should have received
+ * a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street,
+ * Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef NDN_NAMETREE_DEFINED
+#define NDN_NAMETREE_DEFINED
+
+#include <stddef.h>
+
+struct ndn_charbuf;
+
+/**
+ * A B+tree that keeps caller-owned entries in name order.
+ *
+ * Each name is indexed by its namekey, in which every component is
+ * represented by a 2-byte big-endian length followed by the component
+ * bytes.  Plain memcmp ordering of namekeys is then the same as the
+ * canonical ordering of the names, so a descent through the tree never
+ * needs to decode ndnb.  Duplicate keys are allowed.
+ *
+ * Leaves are chained in name order and each entry points at its leaf,
+ * so stepping to the next entry and removal need no search.
+ */
+struct ndn_nametree; /* details are private to the implementation */
+struct ndn_nametree_node;
+
+#define NDN_NAMETREE_FANOUT 32
+
+/**
+ * Entries are embedded in the caller's own records.
+ * The key must stay put while the entry is in the tree.
+ */
+struct ndn_nametree_entry {
+    const unsigned char *key;       /**< namekey */
+    size_t keysize;
+    struct ndn_nametree_node *leaf; /**< private to the tree; NULL if not in */
+};
+
+/*
+ * ndn_nametree_create: Make an empty tree
+ */
+struct ndn_nametree *ndn_nametree_create(void);
+
+/*
+ * ndn_nametree_destroy: Free the tree, but not the entries
+ */
+void ndn_nametree_destroy(struct ndn_nametree **);
+
+/*
+ * ndn_nametree_namekey: Append the namekey form of a ndnb Name to dst
+ * Returns 0, or -1 if the Name could not be parsed.
+ */
+int ndn_nametree_namekey(struct ndn_charbuf *dst,
+                         const unsigned char *name, size_t size);
+
+/*
+ * ndn_nametree_insert: Add an entry, after any with the same key
+ * The entry's key must already be filled in.
+ * Returns 0 for success, -1 for failure.
+ */
+int ndn_nametree_insert(struct ndn_nametree *, struct ndn_nametree_entry *);
+
+/*
+ * ndn_nametree_remove: Take an entry out of the tree
+ * It is no error if the entry is not in the tree.
+ */
+void ndn_nametree_remove(struct ndn_nametree *, struct ndn_nametree_entry *);
+
+/*
+ * ndn_nametree_findfirst: Find the first entry not less than key
+ * Returns NULL if there is none.
+ */
+struct ndn_nametree_entry *
+ndn_nametree_findfirst(struct ndn_nametree *,
+                       const unsigned char *key, size_t keysize);
+
+/*
+ * ndn_nametree_next: Step to the next entry in name order
+ * Returns NULL at the end.
+ */
+struct ndn_nametree_entry *ndn_nametree_next(struct ndn_nametree_entry *);
+
+/*
+ * ndn_nametree_check: Verify the structure of the tree
+ * Returns the number of entries, or -1 if something is inconsistent.
+ */
+long ndn_nametree_check(struct ndn_nametree *);
+
+#endif
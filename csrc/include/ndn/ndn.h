@@ -157,6 +157,9 @@ struct ndn *ndn_create(void);
 /*
  * ndn_connect: connect to local ndnd
  * Use NULL for name to get the default.
+ * If NDN_SHM_RING is set in the environment, shared-memory rings of
+ * that many bytes are requested for talking to a local ndnd; traffic
+ * then goes mostly through the rings, which ndn_run watches.
  * Normal return value is the fd for the connection.
  * On error, returns -1.
  */ 
@@ -167,6 +170,8 @@ int ndn_connect(struct ndn *h, const char *name);
  * This is in case the client needs to know the associated
  * file descriptor, e.g. for use in select/poll.
  * The client should not use this fd for actual I/O.
+ * With shared-memory rings in use, polling this fd alone is not enough
+ * to notice incoming traffic; such clients should not set NDN_SHM_RING.
  * Normal return value is the fd for the connection.
  * Returns -1 if the handle is not connected.
  */ 
@@ -0,0 +1,74 @@
+/**
+ * @file ndn/reasm.h
+ *
+ * Reassembly of messages sent in numbered pieces.
+ *
+ * Part of the NDNx C Library.
+ *
+ * Portions Copyright (C) 2013 Regents of the University of California.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 2.1
+ * as published by the Free Software Foundation.
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details. You should have received
+ * a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street,
+ * Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef NDN_REASM_DEFINED
+#define NDN_REASM_DEFINED
+
+#include <stddef.h>
+
+struct ndn_charbuf;
+
+/**
+ * A small table of partial messages, for putting link fragments
+ * back together.
+ *
+ * Each message is known by the sequence number of its first piece.
+ * Pieces may arrive in any order, and more than once.  A partial
+ * message is given up when it has waited too long, when it would
+ * hold too many bytes, or when its slot is needed for a newer message.
+ * A few recently completed messages are remembered so that late
+ * copies of their pieces do not start them over.
+ */
+struct ndn_reasm; /* details are private to the implementation */
+
+#define NDN_REASM_MAXPIECES 32
+
+/*
+ * ndn_reasm_create: Make an empty table
+ * It holds up to nslots partial messages of at most maxbytes each,
+ * and gives up on one timeout microseconds after its first piece came.
+ */
+struct ndn_reasm *ndn_reasm_create(int nslots, size_t maxbytes,
+                                   unsigned timeout);
+
+/*
+ * ndn_reasm_destroy: Free the table and any partial messages
+ */
+void ndn_reasm_destroy(struct ndn_reasm **);
+
+/*
+ * ndn_reasm_add: Add one piece of a message
+ * The piece is number index of count in the message whose first piece
+ * has sequence number seq0.  now is a microsecond clock, which may wrap.
+ * When this piece completes the message, it is appended to dst.
+ * Returns 1 if the message is complete, 0 if the piece was kept or was
+ * already known, or -1 if it was refused.
+ */
+int ndn_reasm_add(struct ndn_reasm *, unsigned seq0, int index, int count,
+                  const unsigned char *piece, size_t size, unsigned now,
+                  struct ndn_charbuf *dst);
+
+/*
+ * ndn_reasm_dropped: Get the number of partial messages given up so far
+ */
+unsigned long ndn_reasm_dropped(struct ndn_reasm *);
+
+#endif
@@ -97,6 +97,7 @@ struct ndn_scheduled_event *ndn_schedule_event(
 /*
  * ndn_schedule_cancel: cancel a scheduled event
  * Cancels the event (calling action with NDN_SCHEDULE_CANCEL set)
+ * The event is freed, and should not be referenced afterwards.
  * Returns -1 if this is not possible.
  */
 int ndn_schedule_cancel(struct ndn_schedule *, struct ndn_scheduled_event *);
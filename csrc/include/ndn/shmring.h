@@ -0,0 +1,120 @@
+/**
+ * @file ndn/shmring.h
+ *
+ * Shared-memory message rings between ndnd and local clients.
+ *
+ * Part of the NDNx C Library.
+ *
+ * Portions Copyright (C) 2013 Regents of the University of California.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 2.1
+ * as published by the Free Software Foundation.
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details. You should have received
+ * a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street,
+ * Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef NDN_SHMRING_DEFINED
+#define NDN_SHMRING_DEFINED
+
+#include <stddef.h>
+
+/**
+ * A pair of single-producer, single-consumer rings in one shared
+ * memory segment, one for each direction, with an eventfd for each
+ * direction to wake up the consumer.
+ *
+ * The side that creates the segment (ndnd) passes the file descriptors
+ * to the other side (a client) over a unix-domain socket.  Messages are
+ * written straight into the shared pages by the producer and read in
+ * place by the consumer, so no system calls are needed while both
+ * sides are busy.
+ */
+struct ndn_shm; /* details are private to the implementation */
+
+#define NDN_SHM_NFDS 3              /**< memfd, and an eventfd per direction */
+#define NDN_SHM_RING_MIN (1 << 16)
+#define NDN_SHM_RING_MAX (1 << 24)
+
+/*
+ * ndn_shm_create: Make a new segment with rings of the given size
+ * The size is rounded up to a power of 2 and clamped.
+ * Returns NULL if shared memory rings are not supported here.
+ */
+struct ndn_shm *ndn_shm_create(size_t ringsize);
+
+/*
+ * ndn_shm_attach: Map a segment made by ndn_shm_create on the other side
+ * The nfds descriptors are those from ndn_shm_fds; on success they
+ * belong to the returned object.
+ */
+struct ndn_shm *ndn_shm_attach(const int *fds, int nfds);
+
+/*
+ * ndn_shm_destroy: Unmap the segment and close the descriptors
+ */
+void ndn_shm_destroy(struct ndn_shm **);
+
+/*
+ * ndn_shm_fds: Get the descriptors to pass to the other side
+ * Returns the number stored in fds, which must have room for NDN_SHM_NFDS.
+ */
+int ndn_shm_fds(struct ndn_shm *, int *fds);
+
+/*
+ * ndn_shm_ring_size: Get the size of each ring, in bytes
+ */
+size_t ndn_shm_ring_size(struct ndn_shm *);
+
+/*
+ * ndn_shm_rx_fd: Get the descriptor to poll for input
+ * It becomes readable when the peer adds a message to an empty ring.
+ */
+int ndn_shm_rx_fd(struct ndn_shm *);
+
+/*
+ * ndn_shm_put: Append a message, given in two pieces, to the output ring
+ * Either piece may be empty.
+ * Returns 0 for success, or -1 if there is not room for it right now.
+ */
+int ndn_shm_put(struct ndn_shm *,
+                const void *data1, size_t size1,
+                const void *data2, size_t size2);
+
+/*
+ * ndn_shm_drained: Check whether the peer has taken everything we put
+ * Returns 1 if the output ring is empty, 0 if not.
+ */
+int ndn_shm_drained(struct ndn_shm *);
+
+/*
+ * ndn_shm_peek: Look at the oldest message in the input ring
+ * On success *msg points into the shared pages, and stays valid until
+ * ndn_shm_consume is called.
+ * Returns 1 if there is a message, 0 if the ring is empty, or -1 if the
+ * ring is damaged.
+ */
+int ndn_shm_peek(struct ndn_shm *, const unsigned char **msg, size_t *size);
+
+/*
+ * ndn_shm_consume: Hand back the space of the message from ndn_shm_peek
+ */
+void ndn_shm_consume(struct ndn_shm *);
+
+/*
+ * ndn_shm_clear_wakeup: Reset the input descriptor before draining the ring
+ */
+void ndn_shm_clear_wakeup(struct ndn_shm *);
+
+/*
+ * ndn_shm_wakeup: Make the input descriptor readable again
+ * Useful for a consumer that stops before the ring is empty.
+ */
+void ndn_shm_wakeup(struct ndn_shm *);
+
+#endif
@@ -28,8 +28,10 @@ LOCAL_C_INCLUDES	+= $(LOCAL_PATH)/../../android/external/openssl-armv5/include
 NDNLIBOBJ := ndn_client.o ndn_charbuf.o ndn_indexbuf.o ndn_coding.o \
 		ndn_dtag_table.o ndn_schedule.o ndn_extend_dict.o \
 		ndn_buf_decoder.o ndn_uri.o ndn_buf_encoder.o ndn_bloom.o \
-		ndn_name_util.o ndn_face_mgmt.o ndn_reg_mgmt.o ndn_digest.o \
-		ndn_interest.o ndn_keystore.o ndn_seqwriter.o ndn_signing.o \
+		ndn_name_util.o ndn_nametree.o ndn_face_mgmt.o ndn_reg_mgmt.o ndn_digest.o \
+		ndn_reasm.o \
+		ndn_interest.o ndn_keystore.o ndn_seqwriter.o ndn_shmring.o \
+		ndn_signing.o \
 		ndn_sockcreate.o ndn_traverse.o \
 		ndn_match.o hashtb.o ndn_merkle_path_asn1.o \
 		ndn_sockaddrutil.o ndn_setup_sockaddr_un.o \
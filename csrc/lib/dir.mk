@@ -19,7 +19,7 @@ LDLIBS = -L$(NDNLIBDIR) $(MORE_LDLIBS) -lndn
 EXPATLIBS = -lexpat
 NDNLIBDIR = ../lib
 
-PROGRAMS = hashtbtest skel_decode_test \
+PROGRAMS = hashtbtest skel_decode_test scheduletest reasmtest shmringtest \
     encodedecodetest signbenchtest basicparsetest ndnbtreetest
 
 BROKEN_PROGRAMS =
@@ -30,23 +30,25 @@ CSRC = ndn_bloom.c \
        ndn_charbuf.c ndn_client.c ndn_coding.c ndn_digest.c ndn_extend_dict.c \
        ndn_dtag_table.c ndn_indexbuf.c ndn_interest.c ndn_keystore.c \
        ndn_match.c ndn_reg_mgmt.c ndn_face_mgmt.c \
-       ndn_merkle_path_asn1.c ndn_name_util.c ndn_schedule.c \
-       ndn_seqwriter.c ndn_signing.c \
+       ndn_merkle_path_asn1.c ndn_name_util.c ndn_nametree.c ndn_reasm.c \
+       ndn_schedule.c ndn_seqwriter.c ndn_shmring.c ndn_signing.c \
        ndn_sockcreate.c ndn_traverse.c ndn_uri.c \
        ndn_verifysig.c ndn_versioning.c \
        ndn_header.c \
        ndn_fetch.c \
        lned.c \
-       encodedecodetest.c hashtb.c hashtbtest.c \
-       signbenchtest.c skel_decode_test.c \
+       encodedecodetest.c hashtb.c hashtbtest.c scheduletest.c \
+       reasmtest.c shmringtest.c signbenchtest.c skel_decode_test.c \
        basicparsetest.c ndnbtreetest.c \
        ndn_sockaddrutil.c ndn_setup_sockaddr_un.c
 LIBS = libndn.a
 LIB_OBJS = ndn_client.o ndn_charbuf.o ndn_indexbuf.o ndn_coding.o \
        ndn_dtag_table.o ndn_schedule.o ndn_extend_dict.o \
        ndn_buf_decoder.o ndn_uri.o ndn_buf_encoder.o ndn_bloom.o \
-       ndn_name_util.o ndn_face_mgmt.o ndn_reg_mgmt.o ndn_digest.o \
-       ndn_interest.o ndn_keystore.o ndn_seqwriter.o ndn_signing.o \
+       ndn_name_util.o ndn_nametree.o ndn_face_mgmt.o ndn_reg_mgmt.o \
+       ndn_digest.o ndn_reasm.o \
+       ndn_interest.o ndn_keystore.o ndn_seqwriter.o ndn_shmring.o \
+       ndn_signing.o \
        ndn_sockcreate.o ndn_traverse.o \
        ndn_match.o hashtb.o ndn_merkle_path_asn1.o \
        ndn_sockaddrutil.o ndn_setup_sockaddr_un.o \
@@ -81,8 +83,14 @@ shlib: $(SHLIBNAME)
 
 lib: libndn.a
 
-test: default encodedecodetest ndnbtreetest
+test: default encodedecodetest ndnbtreetest scheduletest reasmtest shmringtest \
+    hashtbtest skel_decode_test
 	./encodedecodetest -o /dev/null
+	./hashtbtest < /dev/null
+	./scheduletest
+	./reasmtest
+	./shmringtest
+	./skel_decode_test -t
 	./ndnbtreetest
 	./ndnbtreetest - < q.dat
 	$(RM) -R _bt_*
@@ -104,6 +112,15 @@ $(PROGRAMS): libndn.a
 hashtbtest: hashtbtest.o
 	$(CC) $(CFLAGS) -o $@ hashtbtest.o $(LDLIBS)
 
+scheduletest: scheduletest.o
+	$(CC) $(CFLAGS) -o $@ scheduletest.o $(LDLIBS)
+
+reasmtest: reasmtest.o
+	$(CC) $(CFLAGS) -o $@ reasmtest.o $(LDLIBS)
+
+shmringtest: shmringtest.o
+	$(CC) $(CFLAGS) -o $@ shmringtest.o $(LDLIBS)
+
 skel_decode_test: skel_decode_test.o
 	$(CC) $(CFLAGS) -o $@ skel_decode_test.o $(LDLIBS)
 
@@ -192,7 +209,8 @@ ndn_client.o: ndn_client.c ../include/ndn/ndn.h ../include/ndn/coding.h \
   ../include/ndn/ndn_private.h ../include/ndn/ndnd.h \
   ../include/ndn/digest.h ../include/ndn/hashtb.h \
   ../include/ndn/reg_mgmt.h ../include/ndn/schedule.h \
-  ../include/ndn/signing.h ../include/ndn/keystore.h ../include/ndn/uri.h
+  ../include/ndn/shmring.h ../include/ndn/signing.h \
+  ../include/ndn/keystore.h ../include/ndn/uri.h
 ndn_coding.o: ndn_coding.c ../include/ndn/coding.h
 ndn_digest.o: ndn_digest.c ../include/ndn/digest.h
 ndn_extend_dict.o: ndn_extend_dict.c ../include/ndn/charbuf.h \
@@ -218,10 +236,14 @@ ndn_merkle_path_asn1.o: ndn_merkle_path_asn1.c \
 ndn_name_util.o: ndn_name_util.c ../include/ndn/ndn.h \
   ../include/ndn/coding.h ../include/ndn/charbuf.h \
   ../include/ndn/indexbuf.h ../include/ndn/random.h
+ndn_nametree.o: ndn_nametree.c ../include/ndn/ndn.h \
+  ../include/ndn/charbuf.h ../include/ndn/coding.h ../include/ndn/nametree.h
+ndn_reasm.o: ndn_reasm.c ../include/ndn/charbuf.h ../include/ndn/reasm.h
 ndn_schedule.o: ndn_schedule.c ../include/ndn/schedule.h
 ndn_seqwriter.o: ndn_seqwriter.c ../include/ndn/ndn.h \
   ../include/ndn/coding.h ../include/ndn/charbuf.h \
   ../include/ndn/indexbuf.h ../include/ndn/seqwriter.h
+ndn_shmring.o: ndn_shmring.c ../include/ndn/shmring.h
 ndn_signing.o: ndn_signing.c ../include/ndn/merklepathasn1.h \
   ../include/ndn/ndn.h ../include/ndn/coding.h ../include/ndn/charbuf.h \
   ../include/ndn/indexbuf.h ../include/ndn/signing.h \
@@ -257,6 +279,9 @@ hashtbtest.o: hashtbtest.c ../include/ndn/hashtb.h
 signbenchtest.o: signbenchtest.c ../include/ndn/ndn.h \
   ../include/ndn/coding.h ../include/ndn/charbuf.h \
   ../include/ndn/indexbuf.h ../include/ndn/keystore.h
+scheduletest.o: scheduletest.c ../include/ndn/schedule.h
+reasmtest.o: reasmtest.c ../include/ndn/charbuf.h ../include/ndn/reasm.h
+shmringtest.o: shmringtest.c ../include/ndn/shmring.h
 skel_decode_test.o: skel_decode_test.c ../include/ndn/charbuf.h \
   ../include/ndn/coding.h
 basicparsetest.o: basicparsetest.c ../include/ndn/ndn.h \
@@ -265,7 +290,7 @@ basicparsetest.o: basicparsetest.c ../include/ndn/ndn.h \
   ../include/ndn/sockcreate.h ../include/ndn/reg_mgmt.h \
   ../include/ndn/header.h
 ndnbtreetest.o: ndnbtreetest.c ../include/ndn/btree.h \
-  ../include/ndn/charbuf.h ../include/ndn/hashtb.h \
+  ../include/ndn/charbuf.h ../include/ndn/hashtb.h ../include/ndn/nametree.h \
   ../include/ndn/btree_content.h ../include/ndn/ndn.h \
   ../include/ndn/coding.h ../include/ndn/indexbuf.h ../include/ndn/uri.h
 ndn_sockaddrutil.o: ndn_sockaddrutil.c ../include/ndn/charbuf.h \
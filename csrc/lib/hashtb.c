@@ -38,6 +38,11 @@ struct node {
 #define DATA(ht, p) ((void *)((p) + 1))
 #define KEY(ht, p) ((unsigned char *)((p) + 1) + ht->item_size)
 
+/* Entries up to POOL_GRAIN * POOL_BINS bytes may be pooled */
+#define POOL_GRAIN 32
+#define POOL_BINS 32
+#define POOL_SLACK 64
+
 #define CHECKHTE(ht, hte) ((uintptr_t)((hte)->priv[1]) == ~(uintptr_t)(ht))
 #define MARKHTE(ht, hte) ((hte)->priv[1] = (void*)~(uintptr_t)(ht))
 
@@ -49,18 +54,56 @@ struct hashtb {
     int refcount;               /* Number of open enumerators */
     struct node *deferred;      /* deferred cleanup */
     struct hashtb_param param;  /* saved client parameters */
+    int n_pooled;               /* Number of entries on pool lists */
+    struct node *pool[POOL_BINS]; /* free entries, by size */
 };
 
+static struct node *
+node_alloc(struct hashtb *ht, size_t size)
+{
+    struct node *p;
+    size_t b = (size - 1) / POOL_GRAIN;
+    if (ht->param.pool == 0 || b >= POOL_BINS)
+        return(calloc(1, size));
+    p = ht->pool[b];
+    if (p == NULL)
+        return(calloc(1, (b + 1) * POOL_GRAIN));
+    ht->pool[b] = p->link;
+    ht->n_pooled -= 1;
+    memset(p, 0, size);
+    return(p);
+}
+
+static void
+node_free(struct hashtb *ht, struct node *p)
+{
+    size_t size = sizeof(*p) + ht->item_size + p->keysize + p->extsize;
+    size_t b = (size - 1) / POOL_GRAIN;
+    if (ht->param.pool == 0 || b >= POOL_BINS ||
+          ht->n_pooled > ht->n + POOL_SLACK) {
+        free(p);
+        return;
+    }
+    p->link = ht->pool[b];
+    ht->pool[b] = p;
+    ht->n_pooled += 1;
+}
+
 size_t
-hashtb_hash(const unsigned char *key, size_t key_size)
+hashtb_hash_more(size_t h, const unsigned char *key, size_t key_size)
 {
-    size_t h;
     size_t i;
-    for (h = key_size + 23, i = 0; i < key_size; i++)
+    for (i = 0; i < key_size; i++)
         h = ((h << 6) ^ (h >> 27)) + key[i];
     return(h);
 }
 
+size_t
+hashtb_hash(const unsigned char *key, size_t key_size)
+{
+    return(hashtb_hash_more(HASHTB_HASH_INIT, key, key_size));
+}
+
 struct hashtb *
 hashtb_create(size_t item_size, const struct hashtb_param *param)
 {
@@ -99,6 +142,14 @@ hashtb_destroy(struct hashtb **htp)
             hashtb_delete(e);
         hashtb_end(&tmp);
         if ((*htp)->refcount == 0) {
+            struct node *p;
+            int b;
+            for (b = 0; b < POOL_BINS; b++) {
+                while ((p = (*htp)->pool[b]) != NULL) {
+                    (*htp)->pool[b] = p->link;
+                    free(p);
+                }
+            }
             free((*htp)->bucket);
             free(*htp);
             *htp = NULL;
@@ -114,14 +165,27 @@ hashtb_n(struct hashtb *ht)
     return(ht->n);
 }
 
+int
+hashtb_pooled(struct hashtb *ht)
+{
+    return(ht->n_pooled);
+}
+
 void *
 hashtb_lookup(struct hashtb *ht, const void *key, size_t keysize)
+{
+    if (key == NULL)
+        return(NULL);
+    return(hashtb_lookup_hashed(ht, key, keysize, hashtb_hash(key, keysize)));
+}
+
+void *
+hashtb_lookup_hashed(struct hashtb *ht, const void *key, size_t keysize,
+                     size_t h)
 {
     struct node *p;
-    size_t h;
     if (key == NULL)
         return(NULL);
-    h = hashtb_hash(key, keysize);
     for (p = ht->bucket[h % ht->n_buckets]; p != NULL; p = p->link) {
         if (p->hash < h)
             continue;
@@ -194,7 +258,7 @@ hashtb_end(struct hashtb_enumerator *hte)
                 (*f)(hte);
             p = ht->deferred;
             ht->deferred = p->link;
-            free(p);
+            node_free(ht, p);
         }
     }
     hte->priv[0] = 0;
@@ -216,23 +280,61 @@ hashtb_next(struct hashtb_enumerator *hte)
     setpos(hte, pp);
 }
 
+static int seek_common(struct hashtb_enumerator *hte,
+                       const void *key, size_t keysize,
+                       const void *ext, size_t extlen, size_t extsize,
+                       size_t h);
+
 int
 hashtb_seek(struct hashtb_enumerator *hte, const void *key, size_t keysize, size_t extsize)
 {
-    struct node *p = NULL;
-    struct hashtb *ht = hte->ht;
-    struct node **pp;
-    size_t h;
     if (key == NULL) {
         setpos(hte, NULL);
         return(-1);
     }
+    return(hashtb_seek_hashed(hte, key, keysize, extsize,
+                              hashtb_hash(key, keysize)));
+}
+
+int
+hashtb_seek_hashed(struct hashtb_enumerator *hte, const void *key,
+                   size_t keysize, size_t extsize, size_t h)
+{
+    if (key == NULL) {
+        setpos(hte, NULL);
+        return(-1);
+    }
+    return(seek_common(hte, key, keysize,
+                       (const unsigned char *)key + keysize, extsize, extsize,
+                       h));
+}
+
+int
+hashtb_seek_ext(struct hashtb_enumerator *hte,
+                const void *key, size_t keysize,
+                const void *ext, size_t extlen, size_t extsize)
+{
+    if (key == NULL || (ext == NULL && extlen != 0) || extlen > extsize) {
+        setpos(hte, NULL);
+        return(-1);
+    }
+    return(seek_common(hte, key, keysize, ext, extlen, extsize,
+                       hashtb_hash(key, keysize)));
+}
+
+static int
+seek_common(struct hashtb_enumerator *hte,
+            const void *key, size_t keysize,
+            const void *ext, size_t extlen, size_t extsize, size_t h)
+{
+    struct node *p = NULL;
+    struct hashtb *ht = hte->ht;
+    struct node **pp;
     if (ht->refcount == 1 && ht->n > ht->n_buckets * 3) {
         ht->refcount--;
         hashtb_rehash(ht, 2 * ht->n + 1);
         ht->refcount++;
     }
-    h = hashtb_hash(key, keysize);
     pp = &(ht->bucket[h % ht->n_buckets]);
     for (p = *pp; p != NULL; pp = &(p->link), p = p->link) {
         if (p->hash < h)
@@ -244,12 +346,14 @@ hashtb_seek(struct hashtb_enumerator *hte, const void *key, size_t keysize, size
             return(HT_OLD_ENTRY);
         }
     }
-    p = calloc(1, sizeof(*p) + ht->item_size + keysize + extsize);
+    p = node_alloc(ht, sizeof(*p) + ht->item_size + keysize + extsize);
     if (p == NULL) {
         setpos(hte, NULL);
         return(-1);
     }
-    memcpy(KEY(ht, p), key, keysize + extsize);
+    memcpy(KEY(ht, p), key, keysize);
+    if (extlen != 0)
+        memcpy(KEY(ht, p) + keysize, ext, extlen);
     p->hash = h;
     p->keysize = keysize;
     p->extsize = extsize;
@@ -275,7 +379,7 @@ hashtb_delete(struct hashtb_enumerator *hte)
             hashtb_finalize_proc f = ht->param.finalize;
             if (f != NULL)
                 (*f)(hte);
-            free(p);
+            node_free(ht, p);
         }
         else {
             p->link = ht->deferred;
@@ -26,6 +26,15 @@
 #include <string.h>
 #include <ndn/hashtb.h>
 
+#define FAILIF(cond) do if (cond) fatal(__func__, __LINE__); while (0)
+
+static void
+fatal(const char *fn, int lineno)
+{
+    fprintf(stderr, "OOPS - function %s, line %d\n", fn, lineno);
+    exit(1);
+}
+
 static void
 Dump(struct hashtb *h)
 {
@@ -47,6 +56,144 @@ finally(struct hashtb_enumerator *e)
     fprintf(stderr, "%s deleting %s\n", who, (const char *)e->key);
 }
 
+static int n_finalized;
+
+static void
+count_finalize(struct hashtb_enumerator *e)
+{
+    n_finalized++;
+}
+
+/**
+ * Deleted entries go to the pool and are handed out again, cleared,
+ * for keys that need the same amount of storage.
+ */
+static void
+check_pool(void)
+{
+    struct hashtb_param param = {&count_finalize, NULL, 0, 1};
+    struct hashtb *h = hashtb_create(4 * sizeof(unsigned), &param);
+    struct hashtb_enumerator eee;
+    struct hashtb_enumerator *e = &eee;
+    struct hashtb_enumerator eee2;
+    void *old[100];
+    unsigned *v;
+    char key[20];
+    int res;
+    int i;
+    int j;
+
+    FAILIF(h == NULL);
+    hashtb_start(h, e);
+    for (i = 0; i < 100; i++) {
+        snprintf(key, sizeof(key), "key%06d", i);
+        res = hashtb_seek(e, key, strlen(key), 0);
+        FAILIF(res != HT_NEW_ENTRY);
+        v = e->data;
+        v[0] = v[1] = v[2] = v[3] = ~0U;
+        old[i] = e->data;
+    }
+    FAILIF(hashtb_pooled(h) != 0);
+    for (i = 0; i < 100; i++) {
+        snprintf(key, sizeof(key), "key%06d", i);
+        res = hashtb_seek(e, key, strlen(key), 0);
+        FAILIF(res != HT_OLD_ENTRY);
+        hashtb_delete(e);
+    }
+    FAILIF(hashtb_n(h) != 0);
+    FAILIF(n_finalized != 100);
+    /* The pool does not hang on to much more than the table needs */
+    FAILIF(hashtb_pooled(h) == 0 || hashtb_pooled(h) > 100);
+    j = hashtb_pooled(h);
+    for (i = 0; i < j; i++) {
+        snprintf(key, sizeof(key), "new%06d", i);
+        res = hashtb_seek(e, key, strlen(key), 0);
+        FAILIF(res != HT_NEW_ENTRY);
+        v = e->data;
+        FAILIF(v[0] != 0 || v[1] != 0 || v[2] != 0 || v[3] != 0);
+        for (res = 0; res < 100 && old[res] != e->data; res++)
+            continue;
+        FAILIF(res == 100);
+        FAILIF(hashtb_pooled(h) != j - i - 1);
+        FAILIF(memcmp(e->key, key, strlen(key)) != 0);
+    }
+    /* With another enumerator active, deletion is deferred */
+    hashtb_start(h, &eee2);
+    FAILIF(hashtb_seek(e, "new000000", 9, 0) != HT_OLD_ENTRY);
+    hashtb_delete(e);
+    FAILIF(hashtb_n(h) != j - 1);
+    FAILIF(hashtb_pooled(h) != 0 || n_finalized != 100);
+    hashtb_end(&eee2);
+    FAILIF(hashtb_pooled(h) != 0 || n_finalized != 100);
+    hashtb_end(e);
+    FAILIF(hashtb_pooled(h) != 1 || n_finalized != 101);
+    hashtb_destroy(&h);
+    FAILIF(h != NULL);
+}
+
+/**
+ * Callers may supply the hash of the key, built up a piece at a time,
+ * or keep extension data apart from the key.
+ */
+static void
+check_hashed(void)
+{
+    struct hashtb *h = hashtb_create(sizeof(unsigned), NULL);
+    struct hashtb_enumerator eee;
+    struct hashtb_enumerator *e = &eee;
+    const char *path = "/a/bb/ccc/dddd";
+    size_t hash[5];
+    size_t len[5];
+    unsigned *v;
+    int res;
+    int i;
+
+    FAILIF(h == NULL);
+    FAILIF(hashtb_hash((const void *)path, 14) !=
+           hashtb_hash_more(HASHTB_HASH_INIT, (const void *)path, 14));
+    /* The hashes of all the prefixes, in one pass */
+    hash[0] = HASHTB_HASH_INIT;
+    len[0] = 0;
+    for (i = 1; i < 5; i++) {
+        len[i] = strchr(path + len[i - 1] + 1, '/') ?
+                 (size_t)(strchr(path + len[i - 1] + 1, '/') - path) : 14;
+        hash[i] = hashtb_hash_more(hash[i - 1],
+                                   (const void *)(path + len[i - 1]),
+                                   len[i] - len[i - 1]);
+        FAILIF(hash[i] != hashtb_hash((const void *)path, len[i]));
+    }
+    hashtb_start(h, e);
+    for (i = 1; i < 5; i++) {
+        res = hashtb_seek_hashed(e, path, len[i], 0, hash[i]);
+        FAILIF(res != HT_NEW_ENTRY);
+        *(unsigned *)e->data = i;
+    }
+    for (i = 1; i < 5; i++) {
+        v = hashtb_lookup(h, path, len[i]);
+        FAILIF(v == NULL || *v != i);
+        FAILIF(hashtb_lookup_hashed(h, path, len[i], hash[i]) != v);
+        res = hashtb_seek(e, path, len[i], 0);
+        FAILIF(res != HT_OLD_ENTRY || e->data != v);
+    }
+    /* The hash has to be the right one */
+    FAILIF(hashtb_lookup_hashed(h, path, len[1], hash[2]) != NULL);
+    /* Extension data is copied, and the rest of the extension cleared */
+    res = hashtb_seek_ext(e, "k", 1, "xyz", 3, 8);
+    FAILIF(res != HT_NEW_ENTRY);
+    FAILIF(e->keysize != 1 || e->extsize != 8);
+    FAILIF(memcmp(e->key, "kxyz\0\0\0\0", 9) != 0);
+    v = e->data;
+    res = hashtb_seek_ext(e, "k", 1, "abc", 3, 8);
+    FAILIF(res != HT_OLD_ENTRY || e->data != v);
+    FAILIF(memcmp(e->key, "kxyz", 4) != 0);
+    FAILIF(hashtb_lookup_hashed(h, "k", 1, hashtb_hash((const void *)"k", 1)) != v);
+    FAILIF(hashtb_seek_ext(e, "q", 1, "xyz", 4, 3) != -1);
+    FAILIF(hashtb_seek_ext(e, "q", 1, NULL, 1, 3) != -1);
+    FAILIF(hashtb_n(h) != 5);
+    hashtb_end(e);
+    hashtb_destroy(&h);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -58,6 +205,8 @@ main(int argc, char **argv)
     struct hashtb_enumerator eee2;
     struct hashtb_enumerator *e2 = NULL;
     int nest = 0;
+    check_pool();
+    check_hashed();
     while (fgets(buf, sizeof(buf), stdin)) {
         int i = strlen(buf);
         if (i > 0 && buf[i-1] == '\n')
@@ -47,6 +47,7 @@
 #include <ndn/hashtb.h>
 #include <ndn/reg_mgmt.h>
 #include <ndn/schedule.h>
+#include <ndn/shmring.h>
 #include <ndn/signing.h>
 #include <ndn/keystore.h>
 #include <ndn/uri.h>
@@ -85,6 +86,8 @@ struct ndn {
     int tap;
     int running;
     int defer_verification;     /* Client wants to do its own verification */
+    struct ndn_shm *shm;        /* shared-memory rings to ndnd, if any */
+    int shm_spill;              /* using the socket until the ring drains */
 };
 
 struct interests_by_prefix { /* keyed by components of name prefix */
@@ -140,6 +143,8 @@ static void ndn_initiate_prefix_reg(struct ndn *,
 static void finalize_pkey(struct hashtb_enumerator *e);
 static void finalize_keystore(struct hashtb_enumerator *e);
 static int ndn_pushout(struct ndn *h);
+static int ndn_digest_input(struct ndn *h, unsigned char *buf, ssize_t res);
+static void ndn_shm_negotiate(struct ndn *h, long ringsize);
 static void update_ifilt_flags(struct ndn *, struct interest_filter *, int);
 static int update_multifilt(struct ndn *,
                             struct interest_filter *,
@@ -356,6 +361,9 @@ ndn_defer_verification(struct ndn *h, int defer)
  *      environment variables NDN_LOCAL_TRANSPORT, interpreted as is name,
  *      and NDN_LOCAL_PORT if there is no port specified,
  *      or NDN_LOCAL_SOCKNAME and NDN_LOCAL_PORT.
+ *      If NDN_SHM_RING is set to a size in bytes and the connection
+ *      is a unix-domain one, shared-memory rings of that size are
+ *      requested from ndnd for carrying the traffic.
  * @returns the fd for the connection, or -1 for error.
  */
 int
@@ -368,6 +376,7 @@ ndn_connect(struct ndn *h, const char *name)
     struct sockaddr *addr = (struct sockaddr *)&sockaddr;
     int addr_size;
     int res;
+    const char *ring;
 #ifndef NDN_LOCAL_TCP
     const char *s;
 #endif
@@ -419,9 +428,94 @@ ndn_connect(struct ndn *h, const char *name)
     res = fcntl(h->sock, F_SETFL, O_NONBLOCK);
     if (res == -1)
         return(NOTE_ERRNO(h));
+    ring = getenv("NDN_SHM_RING");
+    if (ring != NULL && ring[0] != 0 && sockaddr.ss_family == AF_UNIX)
+        ndn_shm_negotiate(h, atol(ring));
     return(h->sock);
 }
 
+/**
+ * Ask ndnd for shared-memory rings on a new connection.
+ *
+ * ndnd answers with a ShmOffer that carries the descriptors of the
+ * segment and its eventfds.  If it does not answer promptly (an older
+ * ndnd ignores the request), or answers without the descriptors, we
+ * carry on using just the socket.
+ */
+static void
+ndn_shm_negotiate(struct ndn *h, long ringsize)
+{
+    struct ndn_charbuf *c = NULL;
+    struct ndn_skeleton_decoder dd = {0};
+    struct ndn_buf_decoder decoder;
+    struct ndn_buf_decoder *d;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(NDN_SHM_NFDS * sizeof(int))];
+    } cbuf;
+    struct msghdr mh = {0};
+    struct iovec iov;
+    struct cmsghdr *cm;
+    struct pollfd pfd;
+    int fds[NDN_SHM_NFDS];
+    int nfds = 0;
+    int i;
+    unsigned char *buf;
+    ssize_t res;
+    size_t used = 0;
+    
+    if (ringsize <= 0)
+        return;
+    c = ndn_charbuf_create();
+    ndnb_tagged_putf(c, NDN_DTAG_ShmRequest, "%ld", ringsize);
+    res = write(h->sock, c->buf, c->length);
+    if (res != c->length)
+        goto Finish;
+    pfd.fd = h->sock;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 500) != 1)
+        goto Finish;
+    if (h->inbuf == NULL)
+        h->inbuf = ndn_charbuf_create();
+    h->inbuf->length = 0;
+    memset(&h->decoder, 0, sizeof(h->decoder));
+    buf = ndn_charbuf_reserve(h->inbuf, 8800);
+    iov.iov_base = buf;
+    iov.iov_len = h->inbuf->limit - h->inbuf->length;
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cbuf.buf;
+    mh.msg_controllen = sizeof(cbuf.buf);
+    res = recvmsg(h->sock, &mh, 0);
+    if (res <= 0)
+        goto Finish;
+    for (cm = CMSG_FIRSTHDR(&mh); cm != NULL; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+            nfds = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cm), nfds * sizeof(int));
+        }
+    }
+    ndn_skeleton_decode(&dd, buf, res);
+    if (dd.state == 0) {
+        d = ndn_buf_decoder_start(&decoder, buf, dd.index);
+        if (ndn_buf_match_dtag(d, NDN_DTAG_ShmOffer)) {
+            used = dd.index;
+            h->shm = ndn_shm_attach(fds, nfds);
+        }
+    }
+    if (h->shm == NULL) {
+        for (i = 0; i < nfds; i++)
+            close(fds[i]);
+    }
+    /* Anything that came in behind the offer is ordinary input */
+    if (res > used) {
+        memmove(buf, buf + used, res - used);
+        ndn_digest_input(h, buf, res - used);
+    }
+Finish:
+    ndn_charbuf_destroy(&c);
+}
+
 int
 ndn_get_connection_fd(struct ndn *h)
 {
@@ -460,6 +554,8 @@ ndn_disconnect(struct ndn *h)
     }
     ndn_charbuf_destroy(&h->inbuf);
     ndn_charbuf_destroy(&h->outbuf);
+    ndn_shm_destroy(&h->shm);
+    h->shm_spill = 0;
     /* a stored ndndid may no longer be valid */
     ndn_charbuf_destroy(&h->ndndid);
     /* all interest filters expire */
@@ -1139,6 +1235,17 @@ ndn_put(struct ndn *h, const void *p, size_t length)
         ndn_charbuf_append(h->outbuf, p, length); // XXX - check res
         return (ndn_pushout(h));
     }
+    /*
+     * When the ring is full, the socket is still there, and later
+     * messages follow that way until ndnd has emptied the ring.
+     */
+    if (h->shm != NULL && h->shm_spill && ndn_shm_drained(h->shm))
+        h->shm_spill = 0;
+    if (h->shm != NULL && !h->shm_spill) {
+        if (ndn_shm_put(h->shm, p, length, NULL, 0) == 0)
+            return(0);
+        h->shm_spill = 1;
+    }
     if (h->sock == -1)
         res = 0;
     else
@@ -1730,7 +1837,6 @@ static int
 ndn_process_input(struct ndn *h)
 {
     ssize_t res;
-    ssize_t msgstart;
     unsigned char *buf;
     struct ndn_skeleton_decoder *d = &h->decoder;
     struct ndn_charbuf *inbuf = h->inbuf;
@@ -1750,6 +1856,45 @@ ndn_process_input(struct ndn *h)
         else
             return(NOTE_ERRNO(h));
     }
+    return(ndn_digest_input(h, buf, res));
+}
+
+/**
+ * Dispatch the messages waiting in the shared-memory ring from ndnd.
+ *
+ * They are parsed where they lie; the space is handed back to ndnd
+ * once each has been dealt with.
+ */
+static int
+ndn_process_shm_input(struct ndn *h)
+{
+    struct ndn_shm *shm = h->shm;
+    const unsigned char *msg;
+    size_t size;
+    int res;
+    
+    ndn_shm_clear_wakeup(shm);
+    while ((res = ndn_shm_peek(shm, &msg, &size)) == 1) {
+        ndn_dispatch_message(h, (unsigned char *)msg, size);
+        if (h->shm != shm)
+            return(-1); /* an upcall disconnected */
+        ndn_shm_consume(shm);
+    }
+    if (res < 0)
+        return(NOTE_ERR(h, ENOTCONN));
+    return(0);
+}
+
+/**
+ * Parse and dispatch the messages completed by res new bytes at buf,
+ * which have just been placed at the end of h->inbuf.
+ */
+static int
+ndn_digest_input(struct ndn *h, unsigned char *buf, ssize_t res)
+{
+    ssize_t msgstart;
+    struct ndn_skeleton_decoder *d = &h->decoder;
+    struct ndn_charbuf *inbuf = h->inbuf;
     inbuf->length += res;
     msgstart = 0;
     ndn_skeleton_decode(d, buf, res);
@@ -2008,7 +2153,8 @@ int
 ndn_run(struct ndn *h, int timeout)
 {
     struct timeval start;
-    struct pollfd fds[1];
+    struct pollfd fds[2];
+    int nfds;
     int microsec;
     int s_microsec = -1;
     int millisec;
@@ -2044,10 +2190,16 @@ ndn_run(struct ndn *h, int timeout)
         fds[0].events = POLLIN;
         if (ndn_output_is_pending(h))
             fds[0].events |= POLLOUT;
+        nfds = 1;
+        if (h->shm != NULL) {
+            fds[1].fd = ndn_shm_rx_fd(h->shm);
+            fds[1].events = POLLIN;
+            nfds = 2;
+        }
         millisec = microsec / 1000;
         if (timeout >= 0 && timeout < millisec)
             millisec = timeout;
-        res = poll(fds, 1, millisec);
+        res = poll(fds, nfds, millisec);
         if (res < 0 && errno != EINTR) {
             res = NOTE_ERRNO(h);
             break;
@@ -2057,6 +2209,8 @@ ndn_run(struct ndn *h, int timeout)
                 ndn_pushout(h);
             if ((fds[0].revents | POLLIN) != 0)
                 ndn_process_input(h);
+            if (nfds > 1 && fds[1].revents != 0 && h->shm != NULL)
+                ndn_process_shm_input(h);
         }
         if (h->err == ENOTCONN)
             ndn_disconnect(h);
@@ -29,6 +29,52 @@
  */
 #define XML(goop) ((void)0)
 
+/**
+ * Longest token header handled by the fast path.
+ * This keeps numval well clear of overflow even with a 32-bit size_t.
+ */
+#define NDN_FAST_HEADER_MAX 4
+
+/**
+ * Decode a token header that lies entirely within the buffer.
+ *
+ * Used by the fast path of ndn_skeleton_decode() for the common tokens
+ * of a well-formed message; anything else is left to the state machine.
+ *
+ * @returns the length of the header, or 0 if the header is not complete
+ *          within the avail bytes, is too long, or is not a DTAG, BLOB,
+ *          or UDATA.
+ */
+static size_t
+fast_header(const unsigned char *p, size_t avail, size_t *numvalp, int *ttp)
+{
+    size_t numval = 0;
+    size_t k;
+    unsigned char c;
+    
+    if (avail > NDN_FAST_HEADER_MAX)
+        avail = NDN_FAST_HEADER_MAX;
+    for (k = 0; k < avail; k++) {
+        c = p[k];
+        if ((c & NDN_TT_HBIT) == NDN_CLOSE) {
+            numval = (numval << 7) + c;
+            continue;
+        }
+        switch (c & NDN_TT_MASK) {
+            case NDN_DTAG:
+            case NDN_BLOB:
+            case NDN_UDATA:
+                *numvalp = (numval << (7 - NDN_TT_BITS)) +
+                           ((c >> NDN_TT_BITS) & NDN_MAX_TINY);
+                *ttp = c & NDN_TT_MASK;
+                return(k + 1);
+            default:
+                return(0);
+        }
+    }
+    return(0);
+}
+
 /**
  * Decodes ndnb decoded data
  *
@@ -54,6 +100,12 @@
  *
  * Once an error state is entered, no addition input is processed.
  *
+ * When not pausing, the headers of DTAG, BLOB, and UDATA tokens that
+ * lie entirely within the buffer are decoded by a fast path, and the
+ * data of BLOB and UDATA tokens is skipped in one step.  The state
+ * machine handles everything else, including tokens that straddle
+ * the end of the buffer.
+ *
  * @see ndn_buf_decoder_start(), ndn_buf_advance(), ndn_buf_check_close()
  */
 ssize_t
@@ -66,6 +118,8 @@ ndn_skeleton_decode(struct ndn_skeleton_decoder *d,
     ssize_t i = 0;
     unsigned char c;
     size_t chunk;
+    size_t hlen;
+    int tt;
     int pause = 0;
     if (d->state >= 0) {
         pause = d->state & NDN_DSTATE_PAUSE;
@@ -73,6 +127,26 @@ ndn_skeleton_decode(struct ndn_skeleton_decoder *d,
         state = d->state & 0xFF;
     }
     while (i < n) {
+        if (state == NDN_DSTATE_NEWTOKEN && pause == 0 && tagstate < 2 &&
+            p[i] != NDN_CLOSE &&
+            (hlen = fast_header(p + i, n - i, &numval, &tt)) != 0) {
+            d->token_index = i + d->index;
+            i += hlen;
+            if (tt == NDN_DTAG) {
+                d->nest += 1;
+                d->element_index = d->token_index;
+                tagstate = 1;
+                continue;
+            }
+            tagstate = 0;
+            if (numval <= n - i) {
+                i += numval;
+                numval = 0;
+            }
+            else
+                state = (tt == NDN_BLOB) ? NDN_DSTATE_BLOB : NDN_DSTATE_UDATA;
+            continue;
+        }
         switch (state) {
             case NDN_DSTATE_INITIAL:
             case NDN_DSTATE_NEWTOKEN: /* start new thing */
@@ -133,6 +133,17 @@ static const struct ndn_dict_entry ndn_tagdict[] = {
     {NDN_DTAG_SyncConfigSliceList, "SyncConfigSliceList"},
     {NDN_DTAG_SyncConfigSliceOp, "SyncConfigSliceOp"},
     {NDN_DTAG_SyncNodeDeltas, "SyncNodeDeltas"},
+    {NDN_DTAG_RateLimit, "RateLimit"},
+    {NDN_DTAG_RateBurst, "RateBurst"},
+    {NDN_DTAG_LinkFragment, "LinkFragment"},
+    {NDN_DTAG_FragIndex, "FragIndex"},
+    {NDN_DTAG_FragCount, "FragCount"},
+    {NDN_DTAG_LinkAck, "LinkAck"},
+    {NDN_DTAG_CoalesceMicros, "CoalesceMicros"},
+    {NDN_DTAG_CoalesceBytes, "CoalesceBytes"},
+    {NDN_DTAG_CongestionMark, "CongestionMark"},
+    {NDN_DTAG_ShmRequest, "ShmRequest"},
+    {NDN_DTAG_ShmOffer, "ShmOffer"},
     {NDN_DTAG_SequenceNumber, "SequenceNumber"},
     {NDN_DTAG_NDNProtocolDataUnit, "NDNProtocolDataUnit"},
     {0, 0}
@@ -87,6 +87,10 @@ ndn_face_instance_parse(const unsigned char *p, size_t size)
         mcast_off = ndn_parse_tagged_string(d, NDN_DTAG_MulticastInterface, store);
         result->descr.mcast_ttl = ndn_parse_optional_tagged_nonNegativeInteger(d, NDN_DTAG_MulticastTTL);
         result->lifetime = ndn_parse_optional_tagged_nonNegativeInteger(d, NDN_DTAG_FreshnessSeconds);
+        result->rate_limit = ndn_parse_optional_tagged_nonNegativeInteger(d, NDN_DTAG_RateLimit);
+        result->rate_burst = ndn_parse_optional_tagged_nonNegativeInteger(d, NDN_DTAG_RateBurst);
+        result->coalesce_usec = ndn_parse_optional_tagged_nonNegativeInteger(d, NDN_DTAG_CoalesceMicros);
+        result->coalesce_bytes = ndn_parse_optional_tagged_nonNegativeInteger(d, NDN_DTAG_CoalesceBytes);
         ndn_buf_check_close(d);
     }
     else
@@ -118,7 +122,7 @@ ndn_face_instance_destroy(struct ndn_face_instance **pfi)
     *pfi = NULL;
 }
 
-//<!ELEMENT FaceInstance  (Action?, PublisherPublicKeyDigest?, FaceID?, IPProto?, Host?, Port?, MulticastInterface?, MulticastTTL?, FreshnessSeconds?)>
+//<!ELEMENT FaceInstance  (Action?, PublisherPublicKeyDigest?, FaceID?, IPProto?, Host?, Port?, MulticastInterface?, MulticastTTL?, FreshnessSeconds?, RateLimit?, RateBurst?, CoalesceMicros?, CoalesceBytes?)>
 /**
  * Marshal an internal face instance representation into ndnb form
  */
@@ -155,6 +159,18 @@ ndnb_append_face_instance(struct ndn_charbuf *c,
     if (fi->lifetime >= 0)
         res |= ndnb_tagged_putf(c, NDN_DTAG_FreshnessSeconds, "%d",
                                    fi->lifetime);    
+    if (fi->rate_limit > 0)
+        res |= ndnb_tagged_putf(c, NDN_DTAG_RateLimit, "%d",
+                                   fi->rate_limit);
+    if (fi->rate_burst > 0)
+        res |= ndnb_tagged_putf(c, NDN_DTAG_RateBurst, "%d",
+                                   fi->rate_burst);
+    if (fi->coalesce_usec > 0)
+        res |= ndnb_tagged_putf(c, NDN_DTAG_CoalesceMicros, "%d",
+                                   fi->coalesce_usec);
+    if (fi->coalesce_bytes > 0)
+        res |= ndnb_tagged_putf(c, NDN_DTAG_CoalesceBytes, "%d",
+                                   fi->coalesce_bytes);
     res |= ndnb_element_end(c);
     return(res);
 }
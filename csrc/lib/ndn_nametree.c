@@ -0,0 +1,520 @@
+/**
+ * @file ndn_nametree.c
+ * @brief In-memory name-ordered index.
+ *
+ * Part of the NDNx C Library.
+ *
+ * Portions Copyright (C) 2013 Regents of the University of California.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 2.1
+ * as published by the Free Software Foundation.
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details. You should have received
+ * a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street,
+ * Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <ndn/ndn.h>
+#include <ndn/charbuf.h>
+#include <ndn/coding.h>
+#include <ndn/nametree.h>
+
+/**
+ * In both leaf and interior nodes, lo[i] is the least entry at or
+ * below slot i.  Leaves are chained together in name order.
+ */
+struct ndn_nametree_node {
+    struct ndn_nametree_node *parent;
+    struct ndn_nametree_node *prev; /**< previous leaf in name order */
+    struct ndn_nametree_node *next; /**< next leaf in name order */
+    int leaf;                       /**< nonzero for leaf nodes */
+    int n;                          /**< number of slots in use */
+    struct ndn_nametree_entry *lo[NDN_NAMETREE_FANOUT];
+    struct ndn_nametree_node *child[NDN_NAMETREE_FANOUT]; /**< interior */
+};
+
+struct ndn_nametree {
+    struct ndn_nametree_node *root;
+};
+
+static void nametree_delete_slot(struct ndn_nametree *tree,
+                                 struct ndn_nametree_node *node, int i);
+
+struct ndn_nametree *
+ndn_nametree_create(void)
+{
+    struct ndn_nametree *tree;
+
+    tree = calloc(1, sizeof(*tree));
+    if (tree == NULL)
+        return(NULL);
+    tree->root = calloc(1, sizeof(*tree->root));
+    if (tree->root == NULL) {
+        free(tree);
+        return(NULL);
+    }
+    tree->root->leaf = 1;
+    return(tree);
+}
+
+static void
+nametree_destroy_node(struct ndn_nametree_node *node)
+{
+    int i;
+
+    if (!node->leaf)
+        for (i = 0; i < node->n; i++)
+            nametree_destroy_node(node->child[i]);
+    else
+        for (i = 0; i < node->n; i++)
+            node->lo[i]->leaf = NULL;
+    free(node);
+}
+
+void
+ndn_nametree_destroy(struct ndn_nametree **ptree)
+{
+    struct ndn_nametree *tree = *ptree;
+
+    if (tree == NULL)
+        return;
+    nametree_destroy_node(tree->root);
+    free(tree);
+    *ptree = NULL;
+}
+
+int
+ndn_nametree_namekey(struct ndn_charbuf *dst,
+                     const unsigned char *name, size_t size)
+{
+    struct ndn_buf_decoder decoder;
+    struct ndn_buf_decoder *d;
+    const unsigned char *comp;
+    size_t compsize;
+
+    d = ndn_buf_decoder_start(&decoder, name, size);
+    if (!ndn_buf_match_dtag(d, NDN_DTAG_Name))
+        return(-1);
+    ndn_buf_advance(d);
+    while (ndn_buf_match_dtag(d, NDN_DTAG_Component)) {
+        ndn_buf_advance(d);
+        comp = NULL;
+        compsize = 0;
+        if (ndn_buf_match_blob(d, &comp, &compsize))
+            ndn_buf_advance(d);
+        ndn_buf_check_close(d);
+        if (d->decoder.state < 0 || compsize > 0xFFFF)
+            return(-1);
+        ndn_charbuf_append_value(dst, compsize, 2);
+        ndn_charbuf_append(dst, comp, compsize);
+    }
+    ndn_buf_check_close(d);
+    if (d->decoder.state < 0)
+        return(-1);
+    return(0);
+}
+
+/**
+ * Compare namekeys.
+ */
+static int
+nametree_compare(const unsigned char *a, size_t asize,
+                 const unsigned char *b, size_t bsize)
+{
+    int res;
+
+    res = memcmp(a, b, asize < bsize ? asize : bsize);
+    if (res != 0 || asize == bsize)
+        return(res);
+    return(asize < bsize ? -1 : 1);
+}
+
+/**
+ * Count the slots of node whose least entry is not above key.
+ */
+static int
+nametree_rank(struct ndn_nametree_node *node,
+              const unsigned char *key, size_t keysize)
+{
+    struct ndn_nametree_entry *c;
+    int lo = 0;
+    int hi = node->n;
+    int mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        c = node->lo[mid];
+        if (nametree_compare(c->key, c->keysize, key, keysize) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return(lo);
+}
+
+/**
+ * Locate the leaf in which key belongs.
+ */
+static struct ndn_nametree_node *
+nametree_leaf(struct ndn_nametree *tree,
+              const unsigned char *key, size_t keysize)
+{
+    struct ndn_nametree_node *node = tree->root;
+    int i;
+
+    while (!node->leaf) {
+        i = nametree_rank(node, key, keysize);
+        node = node->child[i > 0 ? i - 1 : 0];
+    }
+    return(node);
+}
+
+/**
+ * Find the slot of a node that holds the given entry or child.
+ */
+static int
+nametree_slot(struct ndn_nametree_node *node, void *p)
+{
+    int i;
+
+    if (node->leaf) {
+        for (i = 0; i < node->n; i++)
+            if (node->lo[i] == p)
+                return(i);
+    }
+    else {
+        for (i = 0; i < node->n; i++)
+            if (node->child[i] == p)
+                return(i);
+    }
+    abort();
+}
+
+/**
+ * Propagate a change in the least entry of node to its ancestors.
+ */
+static void
+nametree_fixmin(struct ndn_nametree_node *node)
+{
+    struct ndn_nametree_node *p;
+    int i;
+
+    for (p = node->parent; p != NULL && node->n > 0; node = p, p = p->parent) {
+        i = nametree_slot(p, node);
+        p->lo[i] = node->lo[0];
+        if (i != 0)
+            break;
+    }
+}
+
+struct ndn_nametree_entry *
+ndn_nametree_findfirst(struct ndn_nametree *tree,
+                       const unsigned char *key, size_t keysize)
+{
+    struct ndn_nametree_node *leaf;
+    int i;
+
+    leaf = nametree_leaf(tree, key, keysize);
+    i = nametree_rank(leaf, key, keysize);
+    /* Back up over any entries equal to key */
+    for (;;) {
+        while (i > 0 &&
+               nametree_compare(leaf->lo[i - 1]->key, leaf->lo[i - 1]->keysize,
+                                key, keysize) == 0)
+            i--;
+        if (i > 0 || leaf->prev == NULL)
+            break;
+        if (nametree_compare(leaf->prev->lo[leaf->prev->n - 1]->key,
+                             leaf->prev->lo[leaf->prev->n - 1]->keysize,
+                             key, keysize) != 0)
+            break;
+        leaf = leaf->prev;
+        i = leaf->n;
+    }
+    if (i < leaf->n)
+        return(leaf->lo[i]);
+    if (leaf->next == NULL)
+        return(NULL);
+    return(leaf->next->lo[0]);
+}
+
+/**
+ * Split a full node, moving the upper half of its slots to a new sibling.
+ *
+ * @returns the new right-hand sibling, or NULL if out of memory.
+ */
+static struct ndn_nametree_node *
+nametree_split(struct ndn_nametree *tree, struct ndn_nametree_node *node)
+{
+    struct ndn_nametree_node *parent = node->parent;
+    struct ndn_nametree_node *right = NULL;
+    int half = node->n / 2;
+    int i;
+
+    if (parent != NULL && parent->n == NDN_NAMETREE_FANOUT) {
+        if (nametree_split(tree, parent) == NULL)
+            return(NULL);
+        parent = node->parent;
+    }
+    right = calloc(1, sizeof(*right));
+    if (right == NULL)
+        return(NULL);
+    if (parent == NULL) {
+        parent = calloc(1, sizeof(*parent));
+        if (parent == NULL) {
+            free(right);
+            return(NULL);
+        }
+        parent->n = 1;
+        parent->lo[0] = node->lo[0];
+        parent->child[0] = node;
+        node->parent = parent;
+        tree->root = parent;
+    }
+    right->leaf = node->leaf;
+    right->parent = parent;
+    right->n = node->n - half;
+    for (i = 0; i < right->n; i++) {
+        right->lo[i] = node->lo[half + i];
+        if (node->leaf)
+            right->lo[i]->leaf = right;
+        else {
+            right->child[i] = node->child[half + i];
+            right->child[i]->parent = right;
+        }
+    }
+    node->n = half;
+    if (node->leaf) {
+        right->prev = node;
+        right->next = node->next;
+        if (node->next != NULL)
+            node->next->prev = right;
+        node->next = right;
+    }
+    i = nametree_slot(parent, node) + 1;
+    memmove(&parent->lo[i + 1], &parent->lo[i],
+            (parent->n - i) * sizeof(parent->lo[0]));
+    memmove(&parent->child[i + 1], &parent->child[i],
+            (parent->n - i) * sizeof(parent->child[0]));
+    parent->lo[i] = right->lo[0];
+    parent->child[i] = right;
+    parent->n++;
+    return(right);
+}
+
+int
+ndn_nametree_insert(struct ndn_nametree *tree, struct ndn_nametree_entry *entry)
+{
+    struct ndn_nametree_node *leaf;
+    struct ndn_nametree_node *right;
+    int i;
+
+    if (entry->leaf != NULL || entry->key == NULL) abort();
+    leaf = nametree_leaf(tree, entry->key, entry->keysize);
+    if (leaf->n == NDN_NAMETREE_FANOUT) {
+        right = nametree_split(tree, leaf);
+        if (right == NULL)
+            return(-1);
+        if (nametree_compare(right->lo[0]->key, right->lo[0]->keysize,
+                             entry->key, entry->keysize) <= 0)
+            leaf = right;
+    }
+    i = nametree_rank(leaf, entry->key, entry->keysize);
+    memmove(&leaf->lo[i + 1], &leaf->lo[i], (leaf->n - i) * sizeof(leaf->lo[0]));
+    leaf->lo[i] = entry;
+    leaf->n++;
+    entry->leaf = leaf;
+    if (i == 0)
+        nametree_fixmin(leaf);
+    return(0);
+}
+
+/**
+ * Move all the slots of right into its left-hand sibling, then drop right.
+ */
+static void
+nametree_merge(struct ndn_nametree *tree,
+               struct ndn_nametree_node *left,
+               struct ndn_nametree_node *right)
+{
+    struct ndn_nametree_node *parent = right->parent;
+    int i;
+
+    for (i = 0; i < right->n; i++) {
+        left->lo[left->n] = right->lo[i];
+        if (right->leaf)
+            right->lo[i]->leaf = left;
+        else {
+            left->child[left->n] = right->child[i];
+            right->child[i]->parent = left;
+        }
+        left->n++;
+    }
+    if (right->leaf) {
+        left->next = right->next;
+        if (right->next != NULL)
+            right->next->prev = left;
+    }
+    nametree_fixmin(left);
+    i = nametree_slot(parent, right);
+    free(right);
+    nametree_delete_slot(tree, parent, i);
+}
+
+/**
+ * Remove slot i from node, merging or freeing nodes that become sparse.
+ */
+static void
+nametree_delete_slot(struct ndn_nametree *tree,
+                     struct ndn_nametree_node *node, int i)
+{
+    struct ndn_nametree_node *parent = node->parent;
+    int j;
+
+    node->n--;
+    memmove(&node->lo[i], &node->lo[i + 1], (node->n - i) * sizeof(node->lo[0]));
+    if (!node->leaf)
+        memmove(&node->child[i], &node->child[i + 1],
+                (node->n - i) * sizeof(node->child[0]));
+    if (parent == NULL) {
+        /* A root with only one child is not needed */
+        while (!node->leaf && node->n == 1) {
+            tree->root = node->child[0];
+            tree->root->parent = NULL;
+            free(node);
+            node = tree->root;
+        }
+        return;
+    }
+    if (i == 0)
+        nametree_fixmin(node);
+    if (node->n >= NDN_NAMETREE_FANOUT / 4)
+        return;
+    j = nametree_slot(parent, node);
+    if (j + 1 < parent->n &&
+          node->n + parent->child[j + 1]->n <= NDN_NAMETREE_FANOUT)
+        nametree_merge(tree, node, parent->child[j + 1]);
+    else if (j > 0 &&
+          parent->child[j - 1]->n + node->n <= NDN_NAMETREE_FANOUT)
+        nametree_merge(tree, parent->child[j - 1], node);
+    else if (node->n == 0) {
+        if (node->prev != NULL)
+            node->prev->next = node->next;
+        if (node->next != NULL)
+            node->next->prev = node->prev;
+        free(node);
+        nametree_delete_slot(tree, parent, j);
+    }
+}
+
+void
+ndn_nametree_remove(struct ndn_nametree *tree, struct ndn_nametree_entry *entry)
+{
+    struct ndn_nametree_node *leaf = entry->leaf;
+
+    if (leaf == NULL)
+        return;
+    nametree_delete_slot(tree, leaf, nametree_slot(leaf, entry));
+    entry->leaf = NULL;
+}
+
+struct ndn_nametree_entry *
+ndn_nametree_next(struct ndn_nametree_entry *entry)
+{
+    struct ndn_nametree_node *leaf;
+    int i;
+
+    if (entry == NULL || entry->leaf == NULL)
+        return(NULL);
+    leaf = entry->leaf;
+    i = nametree_slot(leaf, entry) + 1;
+    if (i < leaf->n)
+        return(leaf->lo[i]);
+    if (leaf->next == NULL)
+        return(NULL);
+    return(leaf->next->lo[0]);
+}
+
+/**
+ * Check the subtree at node, whose leaves should all be at given depth.
+ *
+ * @returns the number of entries, or -1.
+ */
+static long
+nametree_check_node(struct ndn_nametree_node *node, int depth,
+                    struct ndn_nametree_node **pleaf)
+{
+    struct ndn_nametree_entry *c;
+    long count = 0;
+    long k;
+    int i;
+
+    if (node->n < 0 || node->n > NDN_NAMETREE_FANOUT)
+        return(-1);
+    if (node->leaf) {
+        if (depth != 0 || node->prev != *pleaf)
+            return(-1);
+        if (*pleaf != NULL && (*pleaf)->next != node)
+            return(-1);
+        *pleaf = node;
+        for (i = 0; i < node->n; i++) {
+            c = node->lo[i];
+            if (c->leaf != node)
+                return(-1);
+            if (i > 0 && nametree_compare(node->lo[i - 1]->key,
+                                          node->lo[i - 1]->keysize,
+                                          c->key, c->keysize) > 0)
+                return(-1);
+        }
+        return(node->n);
+    }
+    if (depth == 0 || node->n == 0)
+        return(-1);
+    for (i = 0; i < node->n; i++) {
+        if (node->child[i]->parent != node)
+            return(-1);
+        if (node->child[i]->n == 0 || node->lo[i] != node->child[i]->lo[0])
+            return(-1);
+        k = nametree_check_node(node->child[i], depth - 1, pleaf);
+        if (k < 0)
+            return(-1);
+        count += k;
+    }
+    return(count);
+}
+
+long
+ndn_nametree_check(struct ndn_nametree *tree)
+{
+    struct ndn_nametree_node *node;
+    struct ndn_nametree_node *leaf = NULL;
+    long count;
+    int depth = 0;
+
+    if (tree->root->parent != NULL)
+        return(-1);
+    if (!tree->root->leaf && tree->root->n < 2)
+        return(-1);
+    for (node = tree->root; !node->leaf; node = node->child[0])
+        depth++;
+    count = nametree_check_node(tree->root, depth, &leaf);
+    if (count < 0 || leaf->next != NULL)
+        return(-1);
+    /* Keys must also be in order across leaf boundaries */
+    for (node = tree->root; !node->leaf; node = node->child[0])
+        continue;
+    for (; node->next != NULL; node = node->next)
+        if (node->n > 0 && node->next->n > 0 &&
+            nametree_compare(node->lo[node->n - 1]->key,
+                             node->lo[node->n - 1]->keysize,
+                             node->next->lo[0]->key,
+                             node->next->lo[0]->keysize) > 0)
+            return(-1);
+    return(count);
+}
@@ -0,0 +1,171 @@
+/**
+ * @file ndn_reasm.c
+ * @brief Reassembly of messages sent in numbered pieces.
+ *
+ * Part of the NDNx C Library.
+ *
+ * Portions Copyright (C) 2013 Regents of the University of California.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 2.1
+ * as published by the Free Software Foundation.
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details. You should have received
+ * a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street,
+ * Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <ndn/charbuf.h>
+#include <ndn/reasm.h>
+
+/** A message being put back together from its pieces */
+struct reasm_slot {
+    unsigned seq0;                  /**< sequence number of piece 0 */
+    unsigned count;                 /**< number of pieces, or 0 if free */
+    unsigned have;                  /**< bitmask of pieces received */
+    unsigned stamp;                 /**< clock at first arrival */
+    unsigned start[NDN_REASM_MAXPIECES]; /**< where each piece is in buf */
+    unsigned len[NDN_REASM_MAXPIECES];   /**< size of each piece */
+    struct ndn_charbuf *buf;        /**< pieces in order of arrival */
+};
+
+struct ndn_reasm {
+    int nslots;
+    size_t maxbytes;
+    unsigned timeout;
+    unsigned long dropped;          /**< partial messages given up */
+    unsigned *done;                 /**< seq0 of recently completed messages */
+    unsigned done_next;
+    struct reasm_slot slot[1];      /**< actually nslots of these */
+};
+
+struct ndn_reasm *
+ndn_reasm_create(int nslots, size_t maxbytes, unsigned timeout)
+{
+    struct ndn_reasm *r;
+    
+    if (nslots < 1)
+        return(NULL);
+    r = calloc(1, sizeof(*r) + (nslots - 1) * sizeof(r->slot[0]));
+    if (r == NULL)
+        return(NULL);
+    r->done = calloc(nslots, sizeof(r->done[0]));
+    if (r->done == NULL) {
+        free(r);
+        return(NULL);
+    }
+    r->nslots = nslots;
+    r->maxbytes = maxbytes;
+    r->timeout = timeout;
+    return(r);
+}
+
+void
+ndn_reasm_destroy(struct ndn_reasm **pr)
+{
+    struct ndn_reasm *r = *pr;
+    int i;
+    
+    if (r == NULL)
+        return;
+    for (i = 0; i < r->nslots; i++)
+        ndn_charbuf_destroy(&r->slot[i].buf);
+    free(r->done);
+    free(r);
+    *pr = NULL;
+}
+
+unsigned long
+ndn_reasm_dropped(struct ndn_reasm *r)
+{
+    return(r->dropped);
+}
+
+/**
+ * Find the slot for a message, starting a new one if needed.
+ *
+ * Partial messages that have waited too long are dropped, and if
+ * every slot is busy the oldest one is reused.
+ */
+static struct reasm_slot *
+reasm_slot(struct ndn_reasm *r, unsigned seq0, unsigned count, unsigned now)
+{
+    struct reasm_slot *s = NULL;
+    struct reasm_slot *x = NULL;
+    int i;
+    
+    for (i = 0; i < r->nslots; i++) {
+        x = &r->slot[i];
+        if (x->count != 0 && now - x->stamp > r->timeout) {
+            x->count = 0;
+            r->dropped++;
+        }
+        if (x->count != 0 && x->seq0 == seq0)
+            return(x);
+    }
+    for (i = 0; i < r->nslots; i++) {
+        x = &r->slot[i];
+        if (x->count == 0) {
+            s = x;
+            break;
+        }
+        if (s == NULL || now - x->stamp > now - s->stamp)
+            s = x;
+    }
+    if (s->count != 0)
+        r->dropped++;
+    if (s->buf == NULL)
+        s->buf = ndn_charbuf_create();
+    if (s->buf == NULL)
+        return(NULL);
+    s->buf->length = 0;
+    s->seq0 = seq0;
+    s->count = count;
+    s->have = 0;
+    s->stamp = now;
+    return(s);
+}
+
+int
+ndn_reasm_add(struct ndn_reasm *r, unsigned seq0, int index, int count,
+              const unsigned char *piece, size_t size, unsigned now,
+              struct ndn_charbuf *dst)
+{
+    struct reasm_slot *s;
+    int i;
+    
+    if (count < 1 || count > NDN_REASM_MAXPIECES || index < 0 || index >= count)
+        return(-1);
+    for (i = 0; i < r->nslots && (unsigned)i < r->done_next; i++)
+        if (r->done[i] == seq0)
+            return(0); /* a late copy of something completed */
+    s = reasm_slot(r, seq0, count, now);
+    if (s == NULL || s->count != (unsigned)count)
+        return(-1);
+    if ((s->have & (1U << index)) != 0)
+        return(0);
+    if (s->buf->length + size > r->maxbytes) {
+        s->count = 0;
+        r->dropped++;
+        return(-1);
+    }
+    s->start[index] = s->buf->length;
+    s->len[index] = size;
+    if (ndn_charbuf_append(s->buf, piece, size) < 0)
+        return(-1);
+    s->have |= (1U << index);
+    if (s->have != (~0U >> (NDN_REASM_MAXPIECES - count)))
+        return(0);
+    /* All here - put the pieces in order */
+    s->count = 0;
+    r->done[r->done_next++ % r->nslots] = seq0;
+    for (i = 0; i < count; i++)
+        if (ndn_charbuf_append(dst, s->buf->buf + s->start[i], s->len[i]) < 0)
+            return(-1);
+    return(1);
+}
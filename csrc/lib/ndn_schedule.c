@@ -27,53 +27,55 @@
 #include <ndn/schedule.h>
 
 /**
- * Use this unsigned type to keep track of time in the heap.
+ * Use this unsigned type to keep track of time in the wheel.
  *
- * 32 bits can work, but 64 bits are preferable.
+ * It is wide enough that it will not wrap in practice.
  */
-typedef uintptr_t heapmicros;
-static const heapmicros epochmax = ((heapmicros)(~0))/2;
+typedef uint64_t wheelmicros;
 
 /**
- * We use a heap structure (as in heapsort) to
- * keep track of the scheduled events to get O(log n)
- * behavior.
+ * Events are kept in a hierarchical timing wheel, giving O(1)
+ * insertion and cancellation.
+ *
+ * Level 0 has one slot per micro for the current block of WHEEL_SLOTS
+ * micros; each higher level has slots that are WHEEL_SLOTS times wider.
+ * An event goes in the lowest level at which its time shares all the
+ * higher-order bits with the wheel's cursor, so a slot at level k > 0
+ * is always later than the cursor's own slot at that level.  When the
+ * cursor reaches the start of such a slot, its events are cascaded to
+ * lower levels.  The rare events beyond the top level are kept on an
+ * overflow list.  A bitmap per level finds the next busy slot quickly.
+ */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 6
+#define WHEEL_OVERFLOW (WHEEL_LEVELS * WHEEL_SLOTS)
+
+/**
+ * The client sees only the ev member.
  */
-struct ndn_schedule_heap_item {
-    heapmicros event_time;
-    struct ndn_scheduled_event *ev;
+struct ndn_schedule_wheel_item {
+    struct ndn_scheduled_event ev;   /* must be first */
+    struct ndn_schedule_wheel_item *next;
+    struct ndn_schedule_wheel_item **pprev; /* NULL if not in the wheel */
+    wheelmicros event_time;
+    int slot;
 };
 
 struct ndn_schedule {
     void *clienth;
     const struct ndn_gettime *clock;
-    struct ndn_schedule_heap_item *heap;
-    int heap_n;
-    int heap_limit;
-    int heap_height;    /* this is validated just before use */
-    heapmicros now;     /* internal micros corresponding to lasttime  */
+    struct ndn_schedule_wheel_item *head[WHEEL_OVERFLOW + 1];
+    struct ndn_schedule_wheel_item **tail[WHEEL_OVERFLOW + 1];
+    uint64_t busy[WHEEL_LEVELS]; /* bitmap of non-empty slots */
+    wheelmicros cursor; /* everything before this has been run */
+    wheelmicros now;    /* internal micros corresponding to lasttime  */
     struct ndn_timeval lasttime; /* actual time when we last checked  */
     int time_leap;      /* number of times clock took a large jump */
     int time_ran_backward; /* number of times clock ran backwards */
 };
 
-/*
- * update_epoch: reset sched->now to avoid wrapping
- */
-static void
-update_epoch(struct ndn_schedule *sched)
-{
-    struct ndn_schedule_heap_item *heap;
-    int n;
-    int i;
-    heapmicros t = sched->now;
-    heap = sched->heap;
-    n = sched->heap_n;
-    for (i = 0; i < n; i++)
-        heap[i].event_time -= t;
-    sched->now = 0;
-}
-
 static void
 update_time(struct ndn_schedule *sched)
 {
@@ -93,23 +95,138 @@ update_time(struct ndn_schedule *sched)
         elapsed = 0;
         sched->time_ran_backward++;
     }
-    else if (elapsed >= epochmax - sched->now)
-        update_epoch(sched);
     sched->now += elapsed;
     sched->lasttime = now;
 }
 
+static int
+lowest_bit(uint64_t w)
+{
+#if defined(__GNUC__)
+    return(__builtin_ctzll(w));
+#else
+    int i;
+    for (i = 0; (w & 1) == 0; i++)
+        w >>= 1;
+    return(i);
+#endif
+}
+
+/*
+ * wheel_insert: file an item according to its event_time
+ */
+static void
+wheel_insert(struct ndn_schedule *sched, struct ndn_schedule_wheel_item *item)
+{
+    wheelmicros x = item->event_time ^ sched->cursor;
+    int level;
+    int s;
+    
+    for (level = 0; level < WHEEL_LEVELS; level++)
+        if ((x >> (WHEEL_BITS * (level + 1))) == 0)
+            break;
+    if (level == WHEEL_LEVELS)
+        s = WHEEL_OVERFLOW;
+    else {
+        s = (item->event_time >> (WHEEL_BITS * level)) & WHEEL_MASK;
+        sched->busy[level] |= (uint64_t)1 << s;
+        s += level * WHEEL_SLOTS;
+    }
+    item->slot = s;
+    item->next = NULL;
+    item->pprev = sched->tail[s];
+    *(sched->tail[s]) = item;
+    sched->tail[s] = &item->next;
+}
+
+static void
+wheel_unlink(struct ndn_schedule *sched, struct ndn_schedule_wheel_item *item)
+{
+    int s = item->slot;
+    *(item->pprev) = item->next;
+    if (item->next != NULL)
+        item->next->pprev = item->pprev;
+    else
+        sched->tail[s] = item->pprev;
+    item->pprev = NULL;
+    item->next = NULL;
+    if (sched->head[s] == NULL && s < WHEEL_OVERFLOW)
+        sched->busy[s / WHEEL_SLOTS] &= ~((uint64_t)1 << (s % WHEEL_SLOTS));
+}
+
+/*
+ * wheel_peek: find the earliest non-empty slot
+ * For a level 0 slot, *tp is the time of its events; otherwise it is
+ * the time at which the slot needs to be cascaded.
+ * Returns the slot number, or -1 if the wheel is empty.
+ */
+static int
+wheel_peek(struct ndn_schedule *sched, wheelmicros *tp)
+{
+    wheelmicros c = sched->cursor;
+    uint64_t bits;
+    int level;
+    int shift;
+    int i;
+    
+    bits = sched->busy[0] >> (c & WHEEL_MASK);
+    if (bits != 0) {
+        i = (c & WHEEL_MASK) + lowest_bit(bits);
+        *tp = (c & ~(wheelmicros)WHEEL_MASK) | i;
+        return(i);
+    }
+    for (level = 1; level < WHEEL_LEVELS; level++) {
+        shift = WHEEL_BITS * level;
+        i = (c >> shift) & WHEEL_MASK;
+        bits = sched->busy[level] >> i >> 1;
+        if (bits != 0) {
+            i += 1 + lowest_bit(bits);
+            *tp = ((c >> (shift + WHEEL_BITS)) << (shift + WHEEL_BITS)) |
+                  ((wheelmicros)i << shift);
+            return(level * WHEEL_SLOTS + i);
+        }
+    }
+    if (sched->head[WHEEL_OVERFLOW] == NULL)
+        return(-1);
+    shift = WHEEL_BITS * WHEEL_LEVELS;
+    *tp = ((c >> shift) + 1) << shift;
+    return(WHEEL_OVERFLOW);
+}
+
+/*
+ * wheel_cascade: redistribute the events of a slot the cursor has reached
+ */
+static void
+wheel_cascade(struct ndn_schedule *sched, int s)
+{
+    struct ndn_schedule_wheel_item *item = sched->head[s];
+    struct ndn_schedule_wheel_item *next;
+    
+    sched->head[s] = NULL;
+    sched->tail[s] = &sched->head[s];
+    if (s < WHEEL_OVERFLOW)
+        sched->busy[s / WHEEL_SLOTS] &= ~((uint64_t)1 << (s % WHEEL_SLOTS));
+    for (; item != NULL; item = next) {
+        next = item->next;
+        wheel_insert(sched, item);
+    }
+}
+
 struct ndn_schedule *
 ndn_schedule_create(void *clienth, const struct ndn_gettime *ndnclock)
 {
     struct ndn_schedule *sched;
+    int s;
     if (ndnclock == NULL)
         return(NULL);
     sched = calloc(1, sizeof(*sched));
     if (sched != NULL) {
         sched->clienth = clienth;
         sched->clock = ndnclock;
+        for (s = 0; s <= WHEEL_OVERFLOW; s++)
+            sched->tail[s] = &sched->head[s];
         update_time(sched);
+        sched->cursor = sched->now;
         sched->time_leap = 0;
     }
     return(sched);
@@ -119,24 +236,18 @@ void
 ndn_schedule_destroy(struct ndn_schedule **schedp)
 {
     struct ndn_schedule *sched;
-    struct ndn_scheduled_event *ev;
-    struct ndn_schedule_heap_item *heap;
-    int n;
-    int i;
+    struct ndn_schedule_wheel_item *item;
+    int s;
     sched = *schedp;
     if (sched == NULL)
         return;
     *schedp = NULL;
-    heap = sched->heap;
-    if (heap != NULL) {
-        n = sched->heap_n;
-        sched->heap = NULL;
-        for (i = 0; i < n; i++) {
-            ev = heap[i].ev;
-            (ev->action)(sched, sched->clienth, ev, NDN_SCHEDULE_CANCEL);
-            free(ev);
+    for (s = 0; s <= WHEEL_OVERFLOW; s++) {
+        while ((item = sched->head[s]) != NULL) {
+            wheel_unlink(sched, item);
+            (item->ev.action)(sched, sched->clienth, &item->ev, NDN_SCHEDULE_CANCEL);
+            free(item);
         }
-        free(heap);
     }
     free(sched);
 }
@@ -146,54 +257,6 @@ ndn_schedule_get_gettime(struct ndn_schedule *schedp) {
     return(schedp->clock);
 }
 
-/*
- * heap_insert: insert a new item
- * n is the total heap size, counting the new item
- * h must satisfy (n >> h) == 1
- */
-static void
-heap_insert(struct ndn_schedule_heap_item *heap, heapmicros micros,
-            struct ndn_scheduled_event *ev, int h, int n)
-{
-    int i;
-    for (i = (n >> h); i < n; i = (n >> --h)) {
-        if (micros <= heap[i-1].event_time) {
-            heapmicros d = heap[i-1].event_time;
-            struct ndn_scheduled_event *e = heap[i-1].ev;
-            heap[i-1].ev = ev;
-            heap[i-1].event_time = micros;
-            micros = d;
-            ev = e;
-        }
-    }
-    heap[n-1].event_time = micros;
-    heap[n-1].ev = ev;
-}
-
-/*
- * heap_sift: remove topmost element
- * n is the total heap size, before removal
- */
-static void
-heap_sift(struct ndn_schedule_heap_item *heap, int n)
-{
-    int i, j;
-    heapmicros micros;
-    if (n < 1)
-        return;
-    micros = heap[n-1].event_time;
-    for (i = 1, j = 2; j < n; i = j, j = 2 * j) {
-        if (j + 1 < n && heap[j-1].event_time > heap[j].event_time)
-            j += 1;
-        if (micros < heap[j-1].event_time)
-            break;
-        heap[i-1] = heap[j-1];
-    }
-    heap[i-1] = heap[n-1];
-    heap[n-1].ev = NULL;
-    heap[n-1].event_time = 0;
-}
-
 /*
  * reschedule_event: schedule an event
  * ev is already set up and initialized
@@ -202,32 +265,11 @@ static struct ndn_scheduled_event *
 reschedule_event(
     struct ndn_schedule *sched,
     int micros,
-    struct ndn_scheduled_event *ev)
+    struct ndn_schedule_wheel_item *item)
 {
-    int lim;
-    int n;
-    int h;
-    struct ndn_schedule_heap_item *heap;
-    if (micros >= epochmax - sched->now)
-        update_epoch(sched);
-    heap = sched->heap;
-    n = sched->heap_n + 1;
-    if (n > sched->heap_limit) {
-        lim = sched->heap_limit + n;
-        heap = realloc(sched->heap, lim * sizeof(heap[0]));
-        if (heap == NULL) return(NULL);
-        memset(&(heap[sched->heap_limit]), 0, (lim - n) * sizeof(heap[0]));
-        sched->heap_limit = lim;
-        sched->heap = heap;
-    }
-    sched->heap_n = n;
-    h = sched->heap_height;
-    while ((n >> h) > 1)
-        sched->heap_height = ++h;
-    while ((n >> h) < 1)
-        sched->heap_height = --h;
-    heap_insert(heap, sched->now + micros, ev, h, n);
-    return(ev);
+    item->event_time = sched->now + micros;
+    wheel_insert(sched, item);
+    return(&item->ev);
 }
 
 /*
@@ -241,16 +283,16 @@ ndn_schedule_event(
     void *evdata,
     intptr_t evint)
 {
-    struct ndn_scheduled_event *ev;
+    struct ndn_schedule_wheel_item *item;
     if (micros < 0)
         return(NULL);
-    ev = calloc(1, sizeof(*ev));
-    if (ev == NULL) return(NULL);
-    ev->action = action;
-    ev->evdata = evdata;
-    ev->evint = evint;
+    item = calloc(1, sizeof(*item));
+    if (item == NULL) return(NULL);
+    item->ev.action = action;
+    item->ev.evdata = evdata;
+    item->ev.evint = evint;
     update_time(sched);
-    return(reschedule_event(sched, micros, ev));
+    return(reschedule_event(sched, micros, item));
 }
 
 /* Use a dummy action in cancelled events */ 
@@ -264,18 +306,26 @@ ndn_schedule_cancelled_event(struct ndn_schedule *sched, void *clienth,
 /**
  * Cancel a scheduled event.
  *
- * Cancels the event (calling action with NDN_SCHEDULE_CANCEL set)
+ * Cancels the event (calling action with NDN_SCHEDULE_CANCEL set).
+ * The event is freed, so the caller must not refer to it afterwards.
  * @returns 0 if OK, or -1 if this is not possible.
  */
 int
 ndn_schedule_cancel(struct ndn_schedule *sched, struct ndn_scheduled_event *ev)
 {
+    struct ndn_schedule_wheel_item *item = (void *)ev;
     int res;
     if (ev == NULL)
         return(-1);
     res = (ev->action)(sched, sched->clienth, ev, NDN_SCHEDULE_CANCEL);
     if (res > 0)
         abort(); /* Bug in ev->action - bad return value */
+    if (item->pprev != NULL) {
+        wheel_unlink(sched, item);
+        free(item);
+        return(0);
+    }
+    /* Its action is running; it will be freed when that returns */
     ev->action = &ndn_schedule_cancelled_event;
     ev->evdata = NULL;
     ev->evint = 0;
@@ -283,19 +333,16 @@ ndn_schedule_cancel(struct ndn_schedule *sched, struct ndn_scheduled_event *ev)
 }
 
 static void
-ndn_schedule_run_next(struct ndn_schedule *sched)
+ndn_schedule_run_next(struct ndn_schedule *sched,
+                      struct ndn_schedule_wheel_item *item)
 {
-    struct ndn_scheduled_event *ev;
-    heapmicros late;
+    wheelmicros late;
     int res;
-    if (sched->heap_n == 0) return;
-    ev = sched->heap[0].ev;
-    sched->heap[0].ev = NULL;
-    late = sched->now - sched->heap[0].event_time;
-    heap_sift(sched->heap, sched->heap_n--);
-    res = (ev->action)(sched, sched->clienth, ev, 0);
-    if (res <= 0) {
-        free(ev);
+    wheel_unlink(sched, item);
+    late = sched->now - item->event_time;
+    res = (item->ev.action)(sched, sched->clienth, &item->ev, 0);
+    if (res <= 0 || item->ev.action == &ndn_schedule_cancelled_event) {
+        free(item);
         return;
     }
     /*
@@ -307,7 +354,31 @@ ndn_schedule_run_next(struct ndn_schedule *sched)
         res = 1;
     else if (late <= sched->clock->micros_per_base)
         res -= late;
-    reschedule_event(sched, res, ev);
+    reschedule_event(sched, res, item);
+}
+
+/*
+ * wheel_advance: move the cursor up to now, running events as they come due
+ */
+static void
+wheel_advance(struct ndn_schedule *sched)
+{
+    wheelmicros t;
+    int s;
+    for (;;) {
+        s = wheel_peek(sched, &t);
+        if (s < 0) {
+            sched->cursor = sched->now;
+            return;
+        }
+        if (t > sched->now)
+            return;
+        sched->cursor = t;
+        if (s < WHEEL_SLOTS)
+            ndn_schedule_run_next(sched, sched->head[s]);
+        else
+            wheel_cascade(sched, s);
+    }
 }
 
 /*
@@ -319,15 +390,17 @@ ndn_schedule_run_next(struct ndn_schedule *sched)
 int
 ndn_schedule_run(struct ndn_schedule *sched)
 {
-    heapmicros ans;
-    do {
-        while (sched->heap_n > 0 && sched->heap[0].event_time <= sched->now)
-            ndn_schedule_run_next(sched);
+    wheelmicros t;
+    wheelmicros ans;
+    for (;;) {
+        wheel_advance(sched);
         update_time(sched);
-    } while (sched->heap_n > 0 && sched->heap[0].event_time <= sched->now);
-    if (sched->heap_n == 0)
-        return(-1);
-    ans = sched->heap[0].event_time - sched->now;
+        if (wheel_peek(sched, &t) < 0)
+            return(-1);
+        if (t > sched->now)
+            break;
+    }
+    ans = t - sched->now;
     if (ans < INT_MAX)
         return(ans);
     return(INT_MAX);
@@ -353,9 +426,16 @@ static struct ndn_gettime gt = {"getTOD", &my_gettime, 1000000, NULL};
 static void
 testtick(struct ndn_schedule *sched)
 {
-    sched->now = sched->heap[0].event_time + 1;
-    printf("%ld: ", (long)sched->heap[0].event_time);
-    ndn_schedule_run_next(sched);
+    wheelmicros t;
+    while (wheel_peek(sched, &t) >= WHEEL_SLOTS) {
+        sched->now = t;
+        wheel_advance(sched);
+    }
+    if (wheel_peek(sched, &t) < 0)
+        return;
+    sched->now = t;
+    printf("%ld: ", (long)t);
+    wheel_advance(sched);
     printf("\n");
 }
 static char dd[] = "ABDEFGHI";
@@ -389,7 +469,7 @@ int TESTSCHEDULE(int argc, char **argv)
             i = ndn_schedule_run(s);
             if (i < 0)
                 break;
-            printf("    %d usec until %ld\n", i, (long)s->heap[0].event_time);
+            printf("    %d usec\n", i);
             usleep(i); /* not posix, but this is not compiled by default */
         }
     }
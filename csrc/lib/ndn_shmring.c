@@ -0,0 +1,391 @@
+/**
+ * @file ndn_shmring.c
+ * @brief Shared-memory message rings between ndnd and local clients.
+ *
+ * Part of the NDNx C Library.
+ *
+ * Portions Copyright (C) 2013 Regents of the University of California.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 2.1
+ * as published by the Free Software Foundation.
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details. You should have received
+ * a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street,
+ * Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ndn/shmring.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#if defined(SYS_memfd_create)
+#define NDN_SHM_SUPPORTED 1
+#endif
+#endif
+
+#if NDN_SHM_SUPPORTED
+/* Older C libraries do not have these yet */
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS (1024 + 9)
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+#endif
+
+#define SHM_MAGIC 0x4e444e52U   /* "NDNR" */
+#define SHM_WRAP 0xFFFFFFFFU    /* length field meaning "skip to start" */
+#define SHM_ALIGN(n) (((n) + 7U) & ~7U)
+
+/**
+ * Indices for one ring, each on its own cache line so that the
+ * producer and the consumer do not keep stealing the line from
+ * each other.  The indices run freely and wrap at 2**32.
+ */
+struct ndn_shm_ctl {
+    volatile uint32_t head;     /**< advanced by the producer */
+    unsigned char pad1[60];
+    volatile uint32_t tail;     /**< advanced by the consumer */
+    unsigned char pad2[60];
+};
+
+/**
+ * Start of the shared segment.
+ *
+ * Ring 0 carries messages from the client to ndnd, ring 1 the other way.
+ * The ring data follow this header, ring 0 first.
+ */
+struct ndn_shm_header {
+    uint32_t magic;
+    uint32_t ringsize;
+    unsigned char pad[56];
+    struct ndn_shm_ctl ctl[2];
+};
+
+/**
+ * Our view of one direction.
+ *
+ * The position is kept privately as well as in the shared control
+ * block, so that a misbehaving peer cannot make us skip around.
+ */
+struct ndn_shm_ring {
+    struct ndn_shm_ctl *ctl;
+    unsigned char *data;
+    uint32_t mask;              /**< ring size - 1 */
+    uint32_t pos;               /**< our head (tx) or tail (rx) */
+    uint32_t pending;           /**< rx: bytes covered by peeked message */
+    int efd;                    /**< tx: peer's eventfd, rx: ours */
+};
+
+struct ndn_shm {
+    void *base;
+    size_t maplen;
+    int fds[NDN_SHM_NFDS];      /**< memfd, ndnd's eventfd, client's eventfd */
+    struct ndn_shm_ring tx;
+    struct ndn_shm_ring rx;
+};
+
+static void
+shm_ring_init(struct ndn_shm_ring *r, struct ndn_shm *shm, int which, int efd)
+{
+    struct ndn_shm_header *hdr = shm->base;
+    unsigned char *data = (unsigned char *)(hdr + 1);
+
+    r->ctl = &hdr->ctl[which];
+    r->data = data + which * hdr->ringsize;
+    r->mask = hdr->ringsize - 1;
+    r->efd = efd;
+    r->pending = 0;
+}
+
+static void
+shm_signal(int efd)
+{
+    uint64_t one = 1;
+    ssize_t res;
+
+    res = write(efd, &one, sizeof(one));
+    (void)res; /* EAGAIN means it is signalled already */
+}
+
+static struct ndn_shm *
+shm_new(void)
+{
+    struct ndn_shm *shm;
+    int i;
+
+    shm = calloc(1, sizeof(*shm));
+    if (shm == NULL)
+        return(NULL);
+    shm->base = MAP_FAILED;
+    for (i = 0; i < NDN_SHM_NFDS; i++)
+        shm->fds[i] = -1;
+    return(shm);
+}
+
+struct ndn_shm *
+ndn_shm_create(size_t ringsize)
+{
+#if NDN_SHM_SUPPORTED
+    struct ndn_shm *shm;
+    struct ndn_shm_header *hdr;
+    size_t size;
+    int fd;
+
+    for (size = NDN_SHM_RING_MIN; size < ringsize && size < NDN_SHM_RING_MAX;)
+        size <<= 1;
+    shm = shm_new();
+    if (shm == NULL)
+        return(NULL);
+    shm->maplen = sizeof(*hdr) + 2 * size;
+    fd = syscall(SYS_memfd_create, "ndn-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    shm->fds[0] = fd;
+    if (fd == -1 || ftruncate(fd, shm->maplen) == -1)
+        goto Bail;
+    /* The peer must not be able to shrink the pages out from under us */
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1)
+        goto Bail;
+    shm->base = mmap(NULL, shm->maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm->base == MAP_FAILED)
+        goto Bail;
+    shm->fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shm->fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shm->fds[1] == -1 || shm->fds[2] == -1)
+        goto Bail;
+    hdr = shm->base;
+    hdr->magic = SHM_MAGIC;
+    hdr->ringsize = size;
+    shm_ring_init(&shm->rx, shm, 0, shm->fds[1]);
+    shm_ring_init(&shm->tx, shm, 1, shm->fds[2]);
+    return(shm);
+Bail:
+    ndn_shm_destroy(&shm);
+#endif
+    return(NULL);
+}
+
+struct ndn_shm *
+ndn_shm_attach(const int *fds, int nfds)
+{
+#if NDN_SHM_SUPPORTED
+    struct ndn_shm *shm;
+    struct ndn_shm_header *hdr;
+    struct stat st;
+    uint32_t size;
+    int i;
+
+    if (nfds != NDN_SHM_NFDS)
+        return(NULL);
+    if (fstat(fds[0], &st) == -1 || st.st_size < (off_t)sizeof(*hdr))
+        return(NULL);
+    shm = shm_new();
+    if (shm == NULL)
+        return(NULL);
+    shm->maplen = st.st_size;
+    shm->base = mmap(NULL, shm->maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    if (shm->base == MAP_FAILED)
+        goto Bail;
+    hdr = shm->base;
+    size = hdr->ringsize;
+    if (hdr->magic != SHM_MAGIC || size < NDN_SHM_RING_MIN ||
+          size > NDN_SHM_RING_MAX || (size & (size - 1)) != 0 ||
+          shm->maplen != sizeof(*hdr) + 2 * (size_t)size)
+        goto Bail;
+    for (i = 0; i < NDN_SHM_NFDS; i++)
+        shm->fds[i] = fds[i];
+    shm_ring_init(&shm->tx, shm, 0, shm->fds[1]);
+    shm_ring_init(&shm->rx, shm, 1, shm->fds[2]);
+    shm->tx.pos = shm->tx.ctl->head;
+    shm->rx.pos = shm->rx.ctl->tail;
+    return(shm);
+Bail:
+    ndn_shm_destroy(&shm);
+#endif
+    return(NULL);
+}
+
+void
+ndn_shm_destroy(struct ndn_shm **pshm)
+{
+    struct ndn_shm *shm = *pshm;
+    int i;
+
+    if (shm == NULL)
+        return;
+    if (shm->base != MAP_FAILED)
+        munmap(shm->base, shm->maplen);
+    for (i = 0; i < NDN_SHM_NFDS; i++)
+        if (shm->fds[i] != -1)
+            close(shm->fds[i]);
+    free(shm);
+    *pshm = NULL;
+}
+
+int
+ndn_shm_fds(struct ndn_shm *shm, int *fds)
+{
+    int i;
+
+    for (i = 0; i < NDN_SHM_NFDS; i++)
+        fds[i] = shm->fds[i];
+    return(NDN_SHM_NFDS);
+}
+
+size_t
+ndn_shm_ring_size(struct ndn_shm *shm)
+{
+    return((size_t)shm->rx.mask + 1);
+}
+
+int
+ndn_shm_rx_fd(struct ndn_shm *shm)
+{
+    return(shm->rx.efd);
+}
+
+/**
+ * Append a message to the output ring.
+ *
+ * Each message is a 4-byte length followed by the message bytes,
+ * padded to a multiple of 8.  A message never wraps around the end of
+ * the ring; if it would, a length of SHM_WRAP is left instead and the
+ * message goes at the start.
+ *
+ * The peer is woken only when the ring was empty as far as we can tell.
+ * The full barrier between publishing the head and looking at the tail
+ * pairs with the one in ndn_shm_consume, so that either we see that the
+ * consumer has caught up with us, or it sees our new message before it
+ * goes back to sleep.
+ */
+int
+ndn_shm_put(struct ndn_shm *shm,
+            const void *data1, size_t size1,
+            const void *data2, size_t size2)
+{
+    struct ndn_shm_ring *r = &shm->tx;
+    uint32_t ringsize = r->mask + 1;
+    uint32_t head = r->pos;
+    uint32_t used;
+    uint32_t off;
+    uint32_t need;
+    uint32_t skip = 0;
+    uint32_t len;
+    size_t size = size1 + size2;
+
+    if (size > ringsize / 2)
+        return(-1);
+    need = SHM_ALIGN(4 + size);
+    used = head - r->ctl->tail;
+    off = head & r->mask;
+    if (need > ringsize - off)
+        skip = ringsize - off;
+    if (used > ringsize || skip + need > ringsize - used)
+        return(-1);
+    if (skip != 0) {
+        len = SHM_WRAP;
+        memcpy(r->data + off, &len, 4);
+        off = 0;
+    }
+    len = size;
+    memcpy(r->data + off, &len, 4);
+    if (size1 != 0)
+        memcpy(r->data + off + 4, data1, size1);
+    if (size2 != 0)
+        memcpy(r->data + off + 4 + size1, data2, size2);
+    r->pos = head + skip + need;
+    __sync_synchronize();
+    r->ctl->head = r->pos;
+    __sync_synchronize();
+    if (r->ctl->tail == head)
+        shm_signal(r->efd);
+    return(0);
+}
+
+int
+ndn_shm_drained(struct ndn_shm *shm)
+{
+    return(shm->tx.ctl->tail == shm->tx.pos);
+}
+
+int
+ndn_shm_peek(struct ndn_shm *shm, const unsigned char **msg, size_t *size)
+{
+    struct ndn_shm_ring *r = &shm->rx;
+    uint32_t ringsize = r->mask + 1;
+    uint32_t avail;
+    uint32_t off;
+    uint32_t skip = 0;
+    uint32_t len;
+    uint32_t need;
+
+    avail = r->ctl->head - r->pos;
+    __sync_synchronize();
+    if (avail == 0)
+        return(0);
+    if (avail > ringsize || (avail & 7) != 0)
+        return(-1);
+    off = r->pos & r->mask;
+    memcpy(&len, r->data + off, 4);
+    if (len == SHM_WRAP) {
+        skip = ringsize - off;
+        if (skip >= avail)
+            return(-1);
+        off = 0;
+        memcpy(&len, r->data, 4);
+    }
+    if (len > ringsize / 2)
+        return(-1);
+    need = SHM_ALIGN(4 + len);
+    if (skip + need > avail || need > ringsize - off)
+        return(-1);
+    r->pending = skip + need;
+    *msg = r->data + off + 4;
+    *size = len;
+    return(1);
+}
+
+void
+ndn_shm_consume(struct ndn_shm *shm)
+{
+    struct ndn_shm_ring *r = &shm->rx;
+
+    r->pos += r->pending;
+    r->pending = 0;
+    __sync_synchronize();
+    r->ctl->tail = r->pos;
+    __sync_synchronize();
+}
+
+void
+ndn_shm_clear_wakeup(struct ndn_shm *shm)
+{
+    uint64_t count;
+    ssize_t res;
+
+    res = read(shm->rx.efd, &count, sizeof(count));
+    (void)res;
+}
+
+void
+ndn_shm_wakeup(struct ndn_shm *shm)
+{
+    shm_signal(shm->rx.efd);
+}
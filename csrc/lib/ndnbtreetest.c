@@ -38,6 +38,7 @@
 #include <ndn/charbuf.h>
 #include <ndn/indexbuf.h>
 #include <ndn/hashtb.h>
+#include <ndn/nametree.h>
 #include <ndn/uri.h>
 
 #define FAILIF(cond) do if (cond) fatal(__func__, __LINE__); while (0)
@@ -992,6 +993,174 @@ test_insert_content(void)
     return(0);
 }
 
+#define NAMETREE_TEST_N 20000
+
+struct nametree_test_item {
+    struct ndn_nametree_entry e;
+    struct ndn_charbuf *key;
+    int i;
+};
+
+/**
+ * Fill in dst with the namekey for /n/%05d, with an optional extra component.
+ */
+static int
+nametree_test_key(struct ndn_charbuf *dst, int i, const char *extra)
+{
+    struct ndn_charbuf *name = ndn_charbuf_create();
+    char buf[12];
+    int res;
+    
+    CHKPTR(name);
+    ndn_name_init(name);
+    ndn_name_append_str(name, "n");
+    snprintf(buf, sizeof(buf), "%05d", i);
+    ndn_name_append_str(name, buf);
+    if (extra != NULL)
+        ndn_name_append_str(name, extra);
+    dst->length = 0;
+    res = ndn_nametree_namekey(dst, name->buf, name->length);
+    ndn_charbuf_destroy(&name);
+    return(res);
+}
+
+/**
+ * Walk the whole tree in order, checking that the items are in sequence.
+ *
+ * @returns the number of items seen.
+ */
+static long
+nametree_test_walk(struct ndn_nametree *tree)
+{
+    struct ndn_nametree_entry *e;
+    struct nametree_test_item *it;
+    long count = 0;
+    int prev = -1;
+    
+    for (e = ndn_nametree_findfirst(tree, (const unsigned char *)"", 0); e != NULL;
+         e = ndn_nametree_next(e)) {
+        it = (struct nametree_test_item *)e;
+        FAILIF(it->i < prev);
+        prev = it->i;
+        count++;
+    }
+    return(count);
+}
+
+/**
+ * Exercise the in-memory name tree through splits and merges.
+ */
+static int
+test_nametree(void)
+{
+    struct ndn_nametree *tree = NULL;
+    struct nametree_test_item *items = NULL;
+    struct ndn_nametree_entry *e;
+    struct ndn_charbuf *key = NULL;
+    const int n = NAMETREE_TEST_N;
+    long count;
+    int i;
+    int j;
+    int res;
+    
+    tree = ndn_nametree_create();
+    CHKPTR(tree);
+    FAILIF(ndn_nametree_check(tree) != 0);
+    FAILIF(ndn_nametree_findfirst(tree, (const unsigned char *)"", 0) != NULL);
+    key = ndn_charbuf_create();
+    CHKPTR(key);
+    items = calloc(n, sizeof(*items));
+    CHKPTR(items);
+    for (i = 0; i < n; i++) {
+        items[i].i = i;
+        items[i].key = ndn_charbuf_create();
+        CHKPTR(items[i].key);
+        res = nametree_test_key(items[i].key, i, NULL);
+        CHKSYS(res);
+        items[i].e.key = items[i].key->buf;
+        items[i].e.keysize = items[i].key->length;
+    }
+    /* Insert in scrambled order, so splits happen all over the tree */
+    for (j = 0; j < n; j++) {
+        i = (int)(((long long)j * 7919) % n);
+        res = ndn_nametree_insert(tree, &items[i].e);
+        CHKSYS(res);
+        if (j % 997 == 0)
+            FAILIF(ndn_nametree_check(tree) != j + 1);
+    }
+    FAILIF(ndn_nametree_check(tree) != n);
+    FAILIF(nametree_test_walk(tree) != n);
+    /* Exact and in-between lookups, and a range walk */
+    for (i = 0; i < n; i += 211) {
+        res = nametree_test_key(key, i, NULL);
+        CHKSYS(res);
+        e = ndn_nametree_findfirst(tree, key->buf, key->length);
+        FAILIF(e != &items[i].e);
+        res = nametree_test_key(key, i, "x");
+        CHKSYS(res);
+        e = ndn_nametree_findfirst(tree, key->buf, key->length);
+        if (i + 1 == n)
+            FAILIF(e != NULL);
+        else
+            FAILIF(e != &items[i + 1].e);
+        for (j = i + 1; j < i + 100 && e != NULL; j++, e = ndn_nametree_next(e))
+            FAILIF(e != &items[j].e);
+    }
+    /* Delete the odd ones, then half of the rest, in scrambled order */
+    for (j = 0; j < n; j++) {
+        i = (int)(((long long)j * 7919) % n);
+        if ((i & 1) != 0)
+            ndn_nametree_remove(tree, &items[i].e);
+        FAILIF(items[i].e.leaf != NULL && (i & 1) != 0);
+    }
+    FAILIF(ndn_nametree_check(tree) != n / 2);
+    FAILIF(nametree_test_walk(tree) != n / 2);
+    res = nametree_test_key(key, 101, NULL);
+    CHKSYS(res);
+    e = ndn_nametree_findfirst(tree, key->buf, key->length);
+    FAILIF(e != &items[102].e);
+    /* Removing something not in the tree does nothing */
+    ndn_nametree_remove(tree, &items[101].e);
+    FAILIF(ndn_nametree_check(tree) != n / 2);
+    for (i = 0; i < n; i += 4)
+        ndn_nametree_remove(tree, &items[i].e);
+    FAILIF(ndn_nametree_check(tree) != n / 4);
+    FAILIF(nametree_test_walk(tree) != n / 4);
+    /* Duplicate keys go after the existing ones */
+    items[3].e.key = items[2].key->buf;
+    items[3].e.keysize = items[2].key->length;
+    res = ndn_nametree_insert(tree, &items[3].e);
+    CHKSYS(res);
+    e = ndn_nametree_findfirst(tree, items[2].key->buf, items[2].key->length);
+    FAILIF(e != &items[2].e);
+    FAILIF(ndn_nametree_next(e) != &items[3].e);
+    ndn_nametree_remove(tree, &items[3].e);
+    /* Empty it from both ends, so the root collapses */
+    for (i = 0, j = n - 1; i <= j; i++, j--) {
+        ndn_nametree_remove(tree, &items[i].e);
+        ndn_nametree_remove(tree, &items[j].e);
+        if (i % 512 == 0) {
+            count = ndn_nametree_check(tree);
+            CHKSYS(count);
+            FAILIF(count != nametree_test_walk(tree));
+        }
+    }
+    FAILIF(ndn_nametree_check(tree) != 0);
+    FAILIF(ndn_nametree_findfirst(tree, (const unsigned char *)"", 0) != NULL);
+    /* And it is still usable */
+    res = ndn_nametree_insert(tree, &items[5].e);
+    CHKSYS(res);
+    FAILIF(ndn_nametree_check(tree) != 1);
+    ndn_nametree_destroy(&tree);
+    FAILIF(tree != NULL);
+    FAILIF(items[5].e.leaf != NULL);
+    for (i = 0; i < n; i++)
+        ndn_charbuf_destroy(&items[i].key);
+    free(items);
+    ndn_charbuf_destroy(&key);
+    return(0);
+}
+
 int
 ndnbtreetest_main(int argc, char **argv)
 {
@@ -1028,6 +1197,8 @@ ndnbtreetest_main(int argc, char **argv)
     CHKSYS(res);
     res = test_flatname();
     CHKSYS(res);
+    res = test_nametree();
+    CHKSYS(res);
     res = test_insert_content();
     CHKSYS(res);
     if (res != 0)
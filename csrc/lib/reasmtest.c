@@ -0,0 +1,257 @@
+/**
+ * @file reasmtest.c
+ * Unit tests for reassembly of pieces (ndn/reasm).
+ *
+ * A NDNx program.
+ *
+ * Portions Copyright (C) 2013 Regents of the University of California.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ndn/charbuf.h>
+#include <ndn/reasm.h>
+
+#define FAILIF(cond) do if (cond) fatal(__func__, __LINE__); while (0)
+#define CHKPTR(p)   FAILIF((p) == NULL)
+
+static void
+fatal(const char *fn, int lineno)
+{
+    fprintf(stderr, "OOPS - function %s, line %d\n", fn, lineno);
+    exit(1);
+}
+
+#define NSLOTS  4
+#define MAXB    1000
+#define TIMEOUT 2000000
+
+/**
+ * The message used throughout, cut into pieces of PIECE bytes
+ * (the last one shorter).
+ */
+#define MSGLEN  230
+#define PIECE   50
+#define NPIECES ((MSGLEN + PIECE - 1) / PIECE)
+static unsigned char msg[MSGLEN];
+
+static int
+add(struct ndn_reasm *r, unsigned seq0, int i, unsigned now,
+    struct ndn_charbuf *dst)
+{
+    size_t size = MSGLEN - i * PIECE;
+
+    if (size > PIECE)
+        size = PIECE;
+    return(ndn_reasm_add(r, seq0, i, NPIECES, msg + i * PIECE, size, now, dst));
+}
+
+static struct ndn_reasm *
+new_reasm(void)
+{
+    struct ndn_reasm *r = ndn_reasm_create(NSLOTS, MAXB, TIMEOUT);
+
+    CHKPTR(r);
+    return(r);
+}
+
+static int
+is_msg(struct ndn_charbuf *c)
+{
+    return(c->length == MSGLEN && memcmp(c->buf, msg, MSGLEN) == 0);
+}
+
+/**
+ * Pieces arriving in any order make the message in the right order,
+ * once the last one is in.
+ */
+static int
+test_out_of_order(void)
+{
+    static const int order[NPIECES] = {3, 0, 4, 2, 1};
+    struct ndn_reasm *r = new_reasm();
+    struct ndn_charbuf *c = ndn_charbuf_create();
+    int i;
+
+    CHKPTR(c);
+    for (i = 0; i < NPIECES - 1; i++)
+        FAILIF(add(r, 100, order[i], 10 * i, c) != 0);
+    FAILIF(c->length != 0);
+    FAILIF(add(r, 100, order[i], 10 * i, c) != 1);
+    FAILIF(!is_msg(c));
+    FAILIF(ndn_reasm_dropped(r) != 0);
+    /* A single piece is a whole message */
+    c->length = 0;
+    FAILIF(ndn_reasm_add(r, 7, 0, 1, msg, 9, 0, c) != 1);
+    FAILIF(c->length != 9 || memcmp(c->buf, msg, 9) != 0);
+    ndn_charbuf_destroy(&c);
+    ndn_reasm_destroy(&r);
+    FAILIF(r != NULL);
+    return(0);
+}
+
+/**
+ * A piece that arrives twice is kept only once, and a late copy of
+ * a piece of a completed message does not start it over.
+ */
+static int
+test_duplicate(void)
+{
+    struct ndn_reasm *r = new_reasm();
+    struct ndn_charbuf *c = ndn_charbuf_create();
+    int i;
+
+    CHKPTR(c);
+    FAILIF(add(r, 200, 1, 0, c) != 0);
+    /* Copies do not count towards the byte limit either */
+    for (i = 0; i < 2 * MAXB / PIECE; i++)
+        FAILIF(add(r, 200, 1, 5, c) != 0);
+    FAILIF(add(r, 200, 0, 6, c) != 0);
+    FAILIF(add(r, 200, 0, 7, c) != 0);
+    for (i = 2; i < NPIECES; i++)
+        FAILIF(add(r, 200, i, 8, c) != (i == NPIECES - 1));
+    FAILIF(!is_msg(c));
+    c->length = 0;
+    for (i = 0; i < NPIECES; i++)
+        FAILIF(add(r, 200, i, 9, c) != 0);
+    FAILIF(c->length != 0);
+    FAILIF(ndn_reasm_dropped(r) != 0);
+    ndn_charbuf_destroy(&c);
+    ndn_reasm_destroy(&r);
+    return(0);
+}
+
+/**
+ * A message with a piece missing is given up after the timeout, and
+ * a piece that turns up after that starts afresh.  The clock may wrap.
+ */
+static int
+test_timeout(void)
+{
+    struct ndn_reasm *r = new_reasm();
+    struct ndn_charbuf *c = ndn_charbuf_create();
+    unsigned t0 = ~0U - 1000;
+    int i;
+
+    CHKPTR(c);
+    for (i = 0; i < NPIECES; i++)
+        if (i != 2)
+            FAILIF(add(r, 300, i, t0 + i, c) != 0);
+    /* Not yet */
+    FAILIF(add(r, 301, 0, t0 + TIMEOUT, c) != 0);
+    FAILIF(ndn_reasm_dropped(r) != 0);
+    /* Now, found by another message's piece */
+    FAILIF(add(r, 301, 1, t0 + TIMEOUT + 1, c) != 0);
+    FAILIF(ndn_reasm_dropped(r) != 1);
+    /* The missing piece alone does not finish the message */
+    FAILIF(add(r, 300, 2, t0 + TIMEOUT + 2, c) != 0);
+    FAILIF(c->length != 0);
+    for (i = 0; i < NPIECES; i++)
+        if (i != 2)
+            FAILIF(add(r, 300, i, t0 + TIMEOUT + 3, c) != (i == NPIECES - 1));
+    FAILIF(!is_msg(c));
+    FAILIF(ndn_reasm_dropped(r) != 1);
+    ndn_charbuf_destroy(&c);
+    ndn_reasm_destroy(&r);
+    return(0);
+}
+
+/**
+ * Pieces that add up to more than the limit drop the partial message,
+ * and so does a piece that is too big on its own.
+ */
+static int
+test_oversize(void)
+{
+    struct ndn_reasm *r = new_reasm();
+    struct ndn_charbuf *c = ndn_charbuf_create();
+    static unsigned char big[MAXB + 1];
+    int i;
+
+    CHKPTR(c);
+    for (i = 0; i < 3; i++)
+        FAILIF(ndn_reasm_add(r, 400, i, 4, big, 300, 0, c) != 0);
+    FAILIF(ndn_reasm_add(r, 400, 3, 4, big, 101, 0, c) != -1);
+    FAILIF(ndn_reasm_dropped(r) != 1);
+    /* The pieces already held are gone */
+    FAILIF(ndn_reasm_add(r, 400, 3, 4, big, 100, 0, c) != 0);
+    FAILIF(c->length != 0);
+    FAILIF(ndn_reasm_add(r, 401, 0, 2, big, MAXB + 1, 0, c) != -1);
+    FAILIF(ndn_reasm_dropped(r) != 2);
+    /* Exactly at the limit is fine */
+    FAILIF(ndn_reasm_add(r, 402, 0, 2, big, MAXB - 1, 0, c) != 0);
+    FAILIF(ndn_reasm_add(r, 402, 1, 2, big, 1, 0, c) != 1);
+    FAILIF(c->length != MAXB);
+    ndn_charbuf_destroy(&c);
+    ndn_reasm_destroy(&r);
+    return(0);
+}
+
+/**
+ * Bad piece numbers and counts that disagree are refused, and when all
+ * the slots are busy the oldest partial message makes way.
+ */
+static int
+test_refused(void)
+{
+    struct ndn_reasm *r = new_reasm();
+    struct ndn_charbuf *c = ndn_charbuf_create();
+    int i;
+
+    CHKPTR(c);
+    FAILIF(ndn_reasm_add(r, 500, 0, 0, msg, 1, 0, c) != -1);
+    FAILIF(ndn_reasm_add(r, 500, 2, 2, msg, 1, 0, c) != -1);
+    FAILIF(ndn_reasm_add(r, 500, -1, 2, msg, 1, 0, c) != -1);
+    FAILIF(ndn_reasm_add(r, 500, 0, NDN_REASM_MAXPIECES + 1, msg, 1, 0, c) != -1);
+    FAILIF(ndn_reasm_add(r, 500, 0, 3, msg, 1, 0, c) != 0);
+    FAILIF(ndn_reasm_add(r, 500, 1, 4, msg, 1, 0, c) != -1);
+    FAILIF(ndn_reasm_dropped(r) != 0);
+    /* Fill the rest of the slots, each later than the last */
+    for (i = 1; i < NSLOTS; i++)
+        FAILIF(add(r, 500 + 10 * i, 0, i, c) != 0);
+    FAILIF(ndn_reasm_dropped(r) != 0);
+    /* Finish the first, and start another in its slot */
+    FAILIF(ndn_reasm_add(r, 500, 1, 3, msg, 1, 5, c) != 0);
+    FAILIF(ndn_reasm_add(r, 500, 2, 3, msg, 1, 5, c) != 1);
+    c->length = 0;
+    FAILIF(ndn_reasm_add(r, 700, 0, 3, msg, 1, 10, c) != 0);
+    FAILIF(add(r, 600, 0, 11, c) != 0);
+    FAILIF(ndn_reasm_dropped(r) != 1);
+    /* 510 is the one that went, and 700 is still there */
+    FAILIF(ndn_reasm_add(r, 700, 1, 3, msg, 1, 12, c) != 0);
+    FAILIF(ndn_reasm_add(r, 700, 2, 3, msg, 1, 12, c) != 1);
+    FAILIF(ndn_reasm_dropped(r) != 1);
+    /* Without its first piece, 510 never finishes */
+    for (i = 1; i < NPIECES; i++)
+        FAILIF(add(r, 510, i, 12, c) != 0);
+    FAILIF(c->length != 3);
+    ndn_charbuf_destroy(&c);
+    ndn_reasm_destroy(&r);
+    return(0);
+}
+
+int
+main(int argc, char **argv)
+{
+    int i;
+
+    for (i = 0; i < MSGLEN; i++)
+        msg[i] = i * 7 + 1;
+    test_out_of_order();
+    test_duplicate();
+    test_timeout();
+    test_oversize();
+    test_refused();
+    return(0);
+}
@@ -0,0 +1,329 @@
+/**
+ * @file scheduletest.c
+ * Unit tests for the event scheduler (ndn/schedule).
+ *
+ * A NDNx program.
+ *
+ * Portions Copyright (C) 2013 Regents of the University of California.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ndn/schedule.h>
+
+#define FAILIF(cond) do if (cond) fatal(__func__, __LINE__); while (0)
+#define CHKPTR(p)   FAILIF((p) == NULL)
+
+static void
+fatal(const char *fn, int lineno)
+{
+    fprintf(stderr, "OOPS - function %s, line %d\n", fn, lineno);
+    exit(1);
+}
+
+/**
+ * A clock that only moves when told to, in micros.
+ */
+static uint64_t fake_now;
+
+static void
+fake_gettime(const struct ndn_gettime *self, struct ndn_timeval *result)
+{
+    result->s = fake_now / 1000000;
+    result->micros = fake_now % 1000000;
+}
+
+static struct ndn_gettime fake_clock = {"fake", &fake_gettime, 1000000, NULL};
+
+/**
+ * Each event appends its evint and the time to the log when it runs.
+ */
+#define LOGMAX 1000
+static struct {
+    intptr_t what;
+    uint64_t when;
+    int flags;
+} evlog[LOGMAX];
+static int nlog;
+
+static void
+note(struct ndn_scheduled_event *ev, int flags)
+{
+    FAILIF(nlog >= LOGMAX);
+    evlog[nlog].what = ev->evint;
+    evlog[nlog].when = fake_now;
+    evlog[nlog].flags = flags;
+    nlog++;
+}
+
+static int
+once(struct ndn_schedule *sched, void *clienth,
+     struct ndn_scheduled_event *ev, int flags)
+{
+    note(ev, flags);
+    return(0);
+}
+
+/**
+ * Run events until there are none left, moving the clock straight to
+ * each one.  Steps are kept short enough not to look like a clock jump.
+ */
+static void
+run_all(struct ndn_schedule *sched)
+{
+    int delta;
+
+    for (;;) {
+        delta = ndn_schedule_run(sched);
+        if (delta < 0)
+            return;
+        if (delta > 100000000)
+            delta = 100000000;
+        fake_now += delta;
+    }
+}
+
+static struct ndn_schedule *
+new_schedule(void)
+{
+    struct ndn_schedule *sched;
+
+    nlog = 0;
+    sched = ndn_schedule_create(NULL, &fake_clock);
+    CHKPTR(sched);
+    return(sched);
+}
+
+/**
+ * Events run in time order, whichever level of the wheel they start in,
+ * and events due at the same time run in the order they were scheduled.
+ */
+static int
+test_ordering(void)
+{
+    static const int delays[] = {
+        4096, 1, 70, 262144, 64, 0, 63, 4095, 262143, 16777216,
+        1, 65, 16777215, 1073741824, 64, 4096, 0, 2000000000
+    };
+    int n = sizeof(delays) / sizeof(delays[0]);
+    struct ndn_schedule *sched = new_schedule();
+    uint64_t t0 = fake_now;
+    int i;
+    int j;
+
+    for (i = 0; i < n; i++)
+        CHKPTR(ndn_schedule_event(sched, delays[i], &once, NULL, i));
+    run_all(sched);
+    FAILIF(nlog != n);
+    for (i = 0; i < n; i++) {
+        j = evlog[i].what;
+        FAILIF(evlog[i].flags != 0);
+        FAILIF(evlog[i].when != t0 + delays[j]);
+        if (i > 0) {
+            FAILIF(evlog[i].when < evlog[i - 1].when);
+            if (evlog[i].when == evlog[i - 1].when)
+                FAILIF(j < evlog[i - 1].what);
+        }
+    }
+    ndn_schedule_destroy(&sched);
+    FAILIF(sched != NULL);
+    return(0);
+}
+
+/**
+ * Events whose time is past the top level of the wheel are still run,
+ * at the right time.  The clock is first brought up near a point where
+ * every level of the wheel turns over.
+ */
+static int
+test_horizon(void)
+{
+    struct ndn_schedule *sched = new_schedule();
+    uint64_t t0 = fake_now;
+    uint64_t top = (uint64_t)1 << 36; /* WHEEL_BITS * WHEEL_LEVELS */
+    int i;
+
+    while (fake_now - t0 < top - 1000) {
+        fake_now += 100000000;
+        if (fake_now - t0 > top - 1000)
+            fake_now = t0 + top - 1000;
+        FAILIF(ndn_schedule_run(sched) != -1);
+    }
+    t0 = fake_now;
+    CHKPTR(ndn_schedule_event(sched, 1500000000, &once, NULL, 3));
+    CHKPTR(ndn_schedule_event(sched, 2000, &once, NULL, 2));
+    CHKPTR(ndn_schedule_event(sched, 999, &once, NULL, 1));
+    CHKPTR(ndn_schedule_event(sched, 1000, &once, NULL, 4));
+    run_all(sched);
+    FAILIF(nlog != 4);
+    for (i = 0; i < nlog; i++)
+        FAILIF(evlog[i].flags != 0);
+    FAILIF(evlog[0].what != 1 || evlog[0].when != t0 + 999);
+    FAILIF(evlog[1].what != 4 || evlog[1].when != t0 + 1000);
+    FAILIF(evlog[2].what != 2 || evlog[2].when != t0 + 2000);
+    FAILIF(evlog[3].what != 3 || evlog[3].when != t0 + 1500000000);
+    ndn_schedule_destroy(&sched);
+    return(0);
+}
+
+/**
+ * An event may cancel others, or itself, from its own action.
+ */
+static struct ndn_scheduled_event *victims[3];
+
+static int
+canceller(struct ndn_schedule *sched, void *clienth,
+          struct ndn_scheduled_event *ev, int flags)
+{
+    int res = 0;
+    int i;
+
+    note(ev, flags);
+    if ((flags & NDN_SCHEDULE_CANCEL) != 0)
+        return(0);
+    for (i = 0; i < 3; i++) {
+        if (victims[i] != NULL) {
+            FAILIF(ndn_schedule_cancel(sched, victims[i]) != 0);
+            res = 10;
+        }
+        victims[i] = NULL;
+    }
+    return(res);
+}
+
+static int
+test_cancel_from_action(void)
+{
+    struct ndn_schedule *sched = new_schedule();
+    struct ndn_scheduled_event *self;
+    uint64_t t0 = fake_now;
+
+    /* Same slot, later slot, and far away, all cancelled at once */
+    victims[0] = ndn_schedule_event(sched, 100, &once, NULL, 11);
+    self = ndn_schedule_event(sched, 100, &canceller, NULL, 10);
+    victims[1] = ndn_schedule_event(sched, 100, &once, NULL, 12);
+    victims[2] = ndn_schedule_event(sched, 5000000, &once, NULL, 13);
+    CHKPTR(self);
+    CHKPTR(ndn_schedule_event(sched, 200, &once, NULL, 14));
+    /* The first victim runs before the canceller, so is gone already */
+    victims[0] = NULL;
+    run_all(sched);
+    /* 11 ran, then 10 cancelled 12 and 13 right away, then 10 ran again */
+    FAILIF(nlog != 6);
+    FAILIF(evlog[0].what != 11 || evlog[0].flags != 0);
+    FAILIF(evlog[1].what != 10 || evlog[1].flags != 0);
+    FAILIF(evlog[2].what != 12 || evlog[2].flags != NDN_SCHEDULE_CANCEL);
+    FAILIF(evlog[3].what != 13 || evlog[3].flags != NDN_SCHEDULE_CANCEL);
+    FAILIF(evlog[2].when != t0 + 100 || evlog[3].when != t0 + 100);
+    FAILIF(evlog[4].what != 10 || evlog[4].when != t0 + 110);
+    FAILIF(evlog[5].what != 14 || evlog[5].when != t0 + 200);
+    ndn_schedule_destroy(&sched);
+    return(0);
+}
+
+/**
+ * An event that cancels itself while running is not rescheduled,
+ * whatever it returns.
+ */
+static struct ndn_scheduled_event *self_ev;
+
+static int
+self_canceller(struct ndn_schedule *sched, void *clienth,
+               struct ndn_scheduled_event *ev, int flags)
+{
+    note(ev, flags);
+    if ((flags & NDN_SCHEDULE_CANCEL) != 0)
+        return(0);
+    FAILIF(ndn_schedule_cancel(sched, self_ev) != 0);
+    return(1000);
+}
+
+static int
+test_cancel_self(void)
+{
+    struct ndn_schedule *sched = new_schedule();
+
+    self_ev = ndn_schedule_event(sched, 50, &self_canceller, NULL, 20);
+    CHKPTR(self_ev);
+    run_all(sched);
+    FAILIF(nlog != 2);
+    FAILIF(evlog[0].what != 20 || evlog[0].flags != 0);
+    FAILIF(evlog[1].what != 20 || evlog[1].flags != NDN_SCHEDULE_CANCEL);
+    ndn_schedule_destroy(&sched);
+    return(0);
+}
+
+/**
+ * A positive return value reschedules the event that far after the
+ * time it was due, and zero ends it.
+ */
+static int
+repeater(struct ndn_schedule *sched, void *clienth,
+         struct ndn_scheduled_event *ev, int flags)
+{
+    note(ev, flags);
+    if ((flags & NDN_SCHEDULE_CANCEL) != 0)
+        return(0);
+    if (--(ev->evint) <= 30)
+        return(0);
+    return(70000);
+}
+
+static int
+test_reschedule(void)
+{
+    struct ndn_schedule *sched = new_schedule();
+    uint64_t t0 = fake_now;
+    int delta;
+    int i;
+
+    CHKPTR(ndn_schedule_event(sched, 1000, &repeater, NULL, 35));
+    run_all(sched);
+    FAILIF(nlog != 5);
+    for (i = 0; i < 5; i++) {
+        FAILIF(evlog[i].what != 35 - i);
+        FAILIF(evlog[i].when != t0 + 1000 + 70000 * i);
+    }
+    /* When it runs late, the next time is based on when it was due */
+    nlog = 0;
+    t0 = fake_now;
+    CHKPTR(ndn_schedule_event(sched, 1000, &repeater, NULL, 32));
+    fake_now += 1300;
+    delta = ndn_schedule_run(sched);
+    /* It may ask to be woken early, to cascade the wheel */
+    FAILIF(delta <= 0 || delta > 70000 - 300);
+    run_all(sched);
+    FAILIF(nlog != 2);
+    FAILIF(evlog[0].when != t0 + 1300);
+    FAILIF(evlog[1].when != t0 + 71000);
+    /* Events still pending are cancelled by destroy */
+    nlog = 0;
+    CHKPTR(ndn_schedule_event(sched, 1000, &repeater, NULL, 99));
+    ndn_schedule_destroy(&sched);
+    FAILIF(nlog != 1 || evlog[0].flags != NDN_SCHEDULE_CANCEL);
+    return(0);
+}
+
+int
+main(int argc, char **argv)
+{
+    fake_now = 1000000000; /* arbitrary starting point */
+    test_ordering();
+    test_horizon();
+    test_cancel_from_action();
+    test_cancel_self();
+    test_reschedule();
+    return(0);
+}
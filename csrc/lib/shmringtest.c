@@ -0,0 +1,304 @@
+/**
+ * @file shmringtest.c
+ * Unit tests for the shared-memory rings (ndn/shmring).
+ *
+ * A NDNx program.
+ *
+ * Portions Copyright (C) 2013 Regents of the University of California.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <ndn/shmring.h>
+
+#define FAILIF(cond) do if (cond) fatal(__func__, __LINE__); while (0)
+#define CHKPTR(p)   FAILIF((p) == NULL)
+
+static void
+fatal(const char *fn, int lineno)
+{
+    fprintf(stderr, "OOPS - function %s, line %d\n", fn, lineno);
+    exit(1);
+}
+
+/**
+ * Both ends of a segment, as ndnd and a client would have them.
+ * Messages put by the client end are peeked by the ndnd end.
+ */
+struct pair {
+    struct ndn_shm *ndnd;
+    struct ndn_shm *client;
+};
+
+static int
+new_pair(struct pair *p, size_t ringsize)
+{
+    int fds[NDN_SHM_NFDS];
+    int n;
+    int i;
+
+    p->ndnd = ndn_shm_create(ringsize);
+    if (p->ndnd == NULL)
+        return(-1);
+    n = ndn_shm_fds(p->ndnd, fds);
+    FAILIF(n != NDN_SHM_NFDS);
+    for (i = 0; i < n; i++) {
+        fds[i] = dup(fds[i]);
+        FAILIF(fds[i] == -1);
+    }
+    p->client = ndn_shm_attach(fds, n);
+    CHKPTR(p->client);
+    return(0);
+}
+
+static void
+free_pair(struct pair *p)
+{
+    ndn_shm_destroy(&p->ndnd);
+    ndn_shm_destroy(&p->client);
+    FAILIF(p->ndnd != NULL || p->client != NULL);
+}
+
+/**
+ * Fill in the bytes of message number k, of the given size.
+ */
+static void
+fill(unsigned char *buf, size_t size, unsigned k)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        buf[i] = (unsigned char)(k * 31 + i);
+}
+
+/**
+ * Take one message from the ndnd end and check that it is number k.
+ */
+static void
+expect(struct ndn_shm *shm, size_t size, unsigned k)
+{
+    static unsigned char want[NDN_SHM_RING_MIN];
+    const unsigned char *msg = NULL;
+    size_t got = 0;
+
+    FAILIF(ndn_shm_peek(shm, &msg, &got) != 1);
+    FAILIF(got != size);
+    fill(want, size, k);
+    FAILIF(memcmp(msg, want, size) != 0);
+    ndn_shm_consume(shm);
+}
+
+/**
+ * Messages of odd sizes go around the ring many times, with the
+ * consumer a varying distance behind, and come out intact and in
+ * order.  Each is given in two pieces split at a varying point.
+ */
+static int
+test_wraparound(void)
+{
+    static unsigned char buf[NDN_SHM_RING_MIN];
+    struct pair p;
+    size_t sizes[64];
+    unsigned put = 0;
+    unsigned got = 0;
+    size_t size;
+    size_t split;
+    uintmax_t total = 0;
+    const unsigned char *msg;
+
+    if (new_pair(&p, 0) < 0)
+        return(-1);
+    FAILIF(ndn_shm_ring_size(p.ndnd) != NDN_SHM_RING_MIN);
+    FAILIF(ndn_shm_ring_size(p.client) != NDN_SHM_RING_MIN);
+    FAILIF(ndn_shm_peek(p.ndnd, &msg, &size) != 0);
+    while (total < 20 * NDN_SHM_RING_MIN) {
+        /* Put a few, then take fewer, so the distance keeps changing */
+        while (put - got < 64) {
+            size = (put * 7919) % 9000 + (put % 5 == 0 ? 0 : 1);
+            split = (put * 13) % (size + 1);
+            fill(buf, size, put);
+            if (ndn_shm_put(p.client, buf, split, buf + split, size - split) < 0)
+                break;
+            sizes[put % 64] = size;
+            total += size;
+            put++;
+            if (put % 3 == 0)
+                break;
+        }
+        do {
+            expect(p.ndnd, sizes[got % 64], got);
+            got++;
+        } while (got < put && (got * 5 + put) % 7 != 0);
+    }
+    while (got < put) {
+        expect(p.ndnd, sizes[got % 64], got);
+        got++;
+    }
+    FAILIF(ndn_shm_peek(p.ndnd, &msg, &size) != 0);
+    FAILIF(!ndn_shm_drained(p.client));
+    /* The other direction works too */
+    fill(buf, 100, 9);
+    FAILIF(ndn_shm_put(p.ndnd, buf, 100, NULL, 0) != 0);
+    FAILIF(ndn_shm_drained(p.ndnd));
+    FAILIF(ndn_shm_peek(p.client, &msg, &size) != 1);
+    FAILIF(size != 100 || memcmp(msg, buf, 100) != 0);
+    ndn_shm_consume(p.client);
+    FAILIF(!ndn_shm_drained(p.ndnd));
+    free_pair(&p);
+    return(0);
+}
+
+/**
+ * A full ring refuses more until the consumer makes room, and a
+ * message of more than half the ring is never taken.
+ */
+static int
+test_full(void)
+{
+    static unsigned char buf[NDN_SHM_RING_MIN];
+    struct pair p;
+    unsigned n = 0;
+    unsigned i;
+
+    if (new_pair(&p, 0) < 0)
+        return(-1);
+    FAILIF(ndn_shm_put(p.client, buf, NDN_SHM_RING_MIN / 2 + 1, NULL, 0) != -1);
+    FAILIF(ndn_shm_put(p.client, buf, NDN_SHM_RING_MIN / 2, buf, 1) != -1);
+    fill(buf, 1000, 0);
+    while (ndn_shm_put(p.client, buf, 1000, NULL, 0) == 0)
+        n++;
+    /* 1000 bytes and the length take 1008 */
+    FAILIF(n != NDN_SHM_RING_MIN / 1008);
+    FAILIF(ndn_shm_drained(p.client));
+    /* Still full, and nothing was lost */
+    FAILIF(ndn_shm_put(p.client, buf, NDN_SHM_RING_MIN % 1008, NULL, 0) != -1);
+    expect(p.ndnd, 1000, 0);
+    /* There is room for this, but not in one piece, so it has to wait */
+    FAILIF(ndn_shm_put(p.client, buf, 1009, NULL, 0) != -1);
+    FAILIF(ndn_shm_put(p.client, buf, 1000, NULL, 0) != 0);
+    n++;
+    FAILIF(ndn_shm_put(p.client, buf, 1000, NULL, 0) != -1);
+    for (i = 1; i < n; i++)
+        expect(p.ndnd, 1000, 0);
+    FAILIF(!ndn_shm_drained(p.client));
+    /* A message of exactly half the ring fits, once it is empty */
+    FAILIF(ndn_shm_put(p.client, buf, NDN_SHM_RING_MIN / 2 - 1, buf, 1) != 0);
+    free_pair(&p);
+    return(0);
+}
+
+/**
+ * A message that just fits before the end of the ring goes there,
+ * and one that is a little bigger goes to the start.
+ */
+static int
+test_ring_end(void)
+{
+    static unsigned char buf[NDN_SHM_RING_MIN];
+    struct pair p;
+    int round;
+    int i;
+
+    if (new_pair(&p, 0) < 0)
+        return(-1);
+    for (round = 0; round < 2; round++) {
+        /* Leave 1024 bytes before the end */
+        fill(buf, 1016, round);
+        for (i = 0; i < NDN_SHM_RING_MIN / 1024 - 1; i++) {
+            FAILIF(ndn_shm_put(p.client, buf, 1016, NULL, 0) != 0);
+            expect(p.ndnd, 1016, round);
+        }
+        fill(buf, 1021, 7);
+        FAILIF(ndn_shm_put(p.client, buf, 1020 + round, NULL, 0) != 0);
+        expect(p.ndnd, 1020 + round, 7);
+        FAILIF(!ndn_shm_drained(p.client));
+    }
+    free_pair(&p);
+    return(0);
+}
+
+/**
+ * A consumer does not trust a length written by its peer: one that
+ * is too big, or that runs past what the peer has published, makes
+ * the ring count as damaged.
+ */
+static int
+test_bad_length(void)
+{
+    static const uint32_t bad[] = {
+        NDN_SHM_RING_MIN / 2 + 1, 0xFFFFFFF0U, 200
+    };
+    unsigned char buf[64];
+    struct pair p;
+    struct stat st;
+    unsigned char *map;
+    unsigned char *lenp;
+    const unsigned char *msg;
+    size_t size;
+    uint32_t len;
+    int fds[NDN_SHM_NFDS];
+    size_t i;
+    int k;
+
+    for (k = 0; k < (int)(sizeof(bad) / sizeof(bad[0])); k++) {
+        if (new_pair(&p, 0) < 0)
+            return(-1);
+        ndn_shm_fds(p.ndnd, fds);
+        FAILIF(fstat(fds[0], &st) != 0);
+        map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fds[0], 0);
+        FAILIF(map == MAP_FAILED);
+        memset(buf, 0xA5, sizeof(buf));
+        FAILIF(ndn_shm_put(p.client, buf, sizeof(buf), NULL, 0) != 0);
+        /* Find the length word in front of the message, and spoil it */
+        lenp = NULL;
+        for (i = 4; i + sizeof(buf) <= (size_t)st.st_size; i++) {
+            memcpy(&len, map + i - 4, 4);
+            if (len == sizeof(buf) && memcmp(map + i, buf, sizeof(buf)) == 0) {
+                lenp = map + i - 4;
+                break;
+            }
+        }
+        CHKPTR(lenp);
+        len = bad[k];
+        memcpy(lenp, &len, 4);
+        FAILIF(ndn_shm_peek(p.ndnd, &msg, &size) != -1);
+        /* Put right, the message is fine again */
+        len = sizeof(buf);
+        memcpy(lenp, &len, 4);
+        FAILIF(ndn_shm_peek(p.ndnd, &msg, &size) != 1);
+        FAILIF(size != sizeof(buf) || memcmp(msg, buf, size) != 0);
+        munmap(map, st.st_size);
+        free_pair(&p);
+    }
+    return(0);
+}
+
+int
+main(int argc, char **argv)
+{
+    if (test_wraparound() < 0) {
+        fprintf(stderr, "%s: shared-memory rings not supported here\n",
+                argv[0]);
+        return(0);
+    }
+    test_full();
+    test_ring_end();
+    test_bad_length();
+    return(0);
+}
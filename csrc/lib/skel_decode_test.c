@@ -137,6 +137,179 @@ process_file(char *path, int flags)
     return(res);
 }
 
+/*
+ * Differential test of the fast path in ndn_skeleton_decode()
+ *
+ * Random elements are decoded whole, a byte at a time, and in random
+ * pieces, and the results compared with those of the pausing decoder,
+ * which always goes through the state machine.
+ */
+static void
+put_tt(struct ndn_charbuf *c, size_t val, int tt)
+{
+    unsigned char buf[1 + 8 * sizeof(val) / 7];
+    int i = sizeof(buf) - 1;
+    
+    buf[i] = NDN_TT_HBIT | ((val & NDN_MAX_TINY) << NDN_TT_BITS) | tt;
+    for (val >>= 7 - NDN_TT_BITS; val != 0; val >>= 7)
+        buf[--i] = val & 127;
+    ndn_charbuf_append(c, buf + i, sizeof(buf) - i);
+}
+
+/* Mostly small numbers, some needing more than NDN_FAST_HEADER_MAX bytes */
+static size_t
+random_number(void)
+{
+    switch (random() % 4) {
+        case 0: return(random() % 16);
+        case 1: return(random() % 2048);
+        case 2: return(random() % (1 << 25));
+        default: return(((size_t)1 << 25) + random() % (1 << 30));
+    }
+}
+
+static void
+put_data(struct ndn_charbuf *c, int tt)
+{
+    size_t len = random() % 4 ? random() % 20 : random() % 300;
+    size_t i;
+    
+    put_tt(c, len, tt);
+    for (i = 0; i < len; i++)
+        ndn_charbuf_append_value(c, random(), 1);
+}
+
+static void
+gen_element(struct ndn_charbuf *c, int depth)
+{
+    int n = random() % 6;
+    int k;
+    
+    if (random() % 8 == 0) {
+        put_tt(c, 3 - 1, NDN_TAG);
+        ndn_charbuf_append(c, "tag", 3);
+        if (random() % 2) {
+            put_tt(c, 4 - 1, NDN_ATTR);
+            ndn_charbuf_append(c, "attr", 4);
+            put_data(c, NDN_UDATA);
+        }
+    }
+    else {
+        put_tt(c, random_number(), NDN_DTAG);
+        if (random() % 8 == 0) {
+            put_tt(c, random_number(), NDN_DATTR);
+            put_data(c, NDN_UDATA);
+        }
+    }
+    for (k = 0; k < n; k++) {
+        switch (random() % 3) {
+            case 0:
+                if (depth < 6)
+                    gen_element(c, depth + 1);
+                break;
+            case 1:
+                put_data(c, NDN_BLOB);
+                break;
+            default:
+                put_data(c, NDN_UDATA);
+        }
+    }
+    ndn_charbuf_append_value(c, NDN_CLOSE, 1);
+}
+
+enum split { WHOLE, BYTES, RANDOM, PAUSED };
+
+static void
+decode_split(struct ndn_skeleton_decoder *d,
+             const unsigned char *p, size_t n, enum split how)
+{
+    size_t i = 0;
+    size_t chunk;
+    size_t piece;
+    ssize_t s;
+    
+    memset(d, 0, sizeof(*d));
+    if (how == PAUSED)
+        d->state |= NDN_DSTATE_PAUSE;
+    while (i < n) {
+        chunk = n - i;
+        if (how == BYTES)
+            chunk = 1;
+        else if (how == RANDOM) {
+            piece = 1 + random() % (random() % 2 ? 8 : chunk);
+            if (piece < chunk)
+                chunk = piece;
+        }
+        s = ndn_skeleton_decode(d, p + i, chunk);
+        if (s <= 0 || d->state < 0)
+            break;
+        i += s;
+        if (NDN_FINAL_DSTATE(d->state))
+            break;
+    }
+}
+
+static int
+same_result(const struct ndn_skeleton_decoder *a,
+            const struct ndn_skeleton_decoder *b)
+{
+    int sa = a->state < 0 ? a->state : a->state & (NDN_DSTATE_PAUSE - 1);
+    int sb = b->state < 0 ? b->state : b->state & (NDN_DSTATE_PAUSE - 1);
+    
+    return(sa == sb && a->index == b->index && a->nest == b->nest &&
+           a->numval == b->numval && a->element_index == b->element_index);
+}
+
+static int
+check_fast_path(int trials)
+{
+    static const char *how_name[] = {"whole", "bytes", "random", "paused"};
+    struct ndn_charbuf *c = ndn_charbuf_create();
+    struct ndn_skeleton_decoder ref;
+    struct ndn_skeleton_decoder d;
+    size_t n;
+    int how;
+    int t;
+    int k;
+    
+    srandom(1234);
+    for (t = 0; t < trials; t++) {
+        c->length = 0;
+        gen_element(c, 0);
+        for (k = 0; k < 4; k++) {
+            /* The whole element, truncations, and a long header at the end */
+            n = c->length;
+            if (k == 1 || k == 2)
+                n = random() % c->length;
+            if (k == 3) {
+                c->length--;
+                put_tt(c, ((size_t)1 << 30) + random(), NDN_BLOB);
+                n = c->length - random() % 3;
+            }
+            decode_split(&ref, c->buf, n, PAUSED);
+            for (how = WHOLE; how < PAUSED; how++) {
+                decode_split(&d, c->buf, n, how);
+                if (!same_result(&d, &ref)) {
+                    fprintf(stderr, "trial %d.%d (%s, %lu of %lu bytes): "
+                            "state %d/%d index %ld/%ld nest %d/%d "
+                            "numval %lu/%lu\n",
+                            t, k, how_name[how],
+                            (unsigned long)n, (unsigned long)c->length,
+                            d.state, ref.state,
+                            (long)d.index, (long)ref.index,
+                            d.nest, ref.nest,
+                            (unsigned long)d.numval,
+                            (unsigned long)ref.numval);
+                    ndn_charbuf_destroy(&c);
+                    return(1);
+                }
+            }
+        }
+    }
+    ndn_charbuf_destroy(&c);
+    return(0);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -148,6 +321,10 @@ main(int argc, char **argv)
             flags |= NDN_DSTATE_PAUSE;
             continue;
         }
+        if (0 == strcmp(argv[i], "-t")) {
+            res |= check_fast_path(2000);
+            continue;
+        }
         if (0 == strcmp(argv[i], "-D")) {
             flags |= NDN_DSTATE_PAUSE | SHOW_HEX_STATE;
             continue;
@@ -57,6 +57,10 @@ usage(const char *progname)
             "           create or destroy a face identified by parameters\n"
             "       destroy face <faceid>\n"
             "           destroy face identified by number\n"
+            "       setfacerate <faceid> <rate> [<burst>]\n"
+            "           limit face to rate bytes per second (0 for no limit)\n"
+            "       setfacecoalesce <faceid> <usec> [<bytes>]\n"
+            "           pack small messages into one datagram (0 for off)\n"
             "       srv\n"
             "           add ndn:/ prefix to face created from parameters in SRV\n"
             "           record of a domain in DNS search list\n"
@@ -152,6 +152,16 @@ ndndc_dispatch_cmd(struct ndndc_data *ndndc,
             return INT_MIN;
         return ndndc_destroyface(ndndc, check_only, options);
     }
+    if (strcasecmp(cmd, "setfacerate") == 0) {
+        if (num_options >= 0 && (num_options < 2 || num_options > 3))
+            return INT_MIN;
+        return ndndc_setfacerate(ndndc, check_only, options);
+    }
+    if (strcasecmp(cmd, "setfacecoalesce") == 0) {
+        if (num_options >= 0 && (num_options < 2 || num_options > 3))
+            return INT_MIN;
+        return ndndc_setfacecoalesce(ndndc, check_only, options);
+    }
     if (strcasecmp(cmd, "srv") == 0) {
         // attempt to guess parameters using SRV record of a domain in search list
         if (num_options >= 0 && num_options != 0)
@@ -572,6 +582,157 @@ ndndc_destroyface(struct ndndc_data *self,
     return ret_code;
 }
 
+/*
+ *   faceid rate [burst]
+ */
+int
+ndndc_setfacerate(struct ndndc_data *self,
+                  int check_only,
+                  const char *cmd_orig)
+{
+    int ret_code = -1;
+    char *cmd, *cmd_token;
+    char *cmd_faceid = NULL;
+    char *cmd_rate = NULL;
+    char *cmd_burst = NULL;
+    char *endptr;
+    long rate = 0;
+    long burst = 0;
+    struct ndn_face_instance *face = NULL;
+    struct ndn_face_instance *newface = NULL;
+    
+    if (cmd_orig == NULL) {
+        ndndc_warn(__LINE__, "command error\n");
+        return -1;
+    }
+    
+    cmd = strdup(cmd_orig);
+    if (cmd == NULL) {
+        ndndc_warn(__LINE__, "Cannot allocate memory for copy of the command\n");
+        return -1;
+    }            
+    
+    cmd_token = cmd;    
+    GET_NEXT_TOKEN(cmd_token, cmd_faceid);
+    GET_NEXT_TOKEN(cmd_token, cmd_rate);
+    GET_NEXT_TOKEN(cmd_token, cmd_burst);
+    
+    face = parse_ndn_face_instance_from_face(self, cmd_faceid);
+    if (face == NULL)
+        goto Cleanup;
+    if (cmd_rate == NULL) {
+        ndndc_warn(__LINE__, "command error, missing rate for setfacerate\n");
+        goto Cleanup;
+    }
+    rate = strtol(cmd_rate, &endptr, 10);
+    if (*endptr != 0 || rate < 0 || rate > INT_MAX) {
+        ndndc_warn(__LINE__, "command error, invalid rate for setfacerate: %s\n", cmd_rate);
+        goto Cleanup;
+    }
+    if (cmd_burst != NULL) {
+        burst = strtol(cmd_burst, &endptr, 10);
+        if (*endptr != 0 || burst < 0 || burst > INT_MAX) {
+            ndndc_warn(__LINE__, "command error, invalid burst for setfacerate: %s\n", cmd_burst);
+            goto Cleanup;
+        }
+    }
+    face->descr.ipproto = -1;
+    face->descr.mcast_ttl = -1;
+    face->lifetime = -1;
+    face->rate_limit = rate;
+    face->rate_burst = burst;
+    
+    if (!check_only) {
+        newface = ndndc_do_face_action(self, "setfacerate", face);
+        if (newface == NULL) {
+            ndndc_warn(__LINE__, "Cannot set rate of face %u or the face does not exist\n", face->faceid);
+            goto Cleanup;
+        }
+        ndn_face_instance_destroy(&newface);
+    }
+    ret_code = 0;
+Cleanup:
+    ndn_face_instance_destroy(&face);
+    free(cmd);
+    return (ret_code);
+}
+
+
+/*
+ *   faceid usec [bytes]
+ */
+int
+ndndc_setfacecoalesce(struct ndndc_data *self,
+                      int check_only,
+                      const char *cmd_orig)
+{
+    int ret_code = -1;
+    char *cmd, *cmd_token;
+    char *cmd_faceid = NULL;
+    char *cmd_usec = NULL;
+    char *cmd_bytes = NULL;
+    char *endptr;
+    long usec = 0;
+    long bytes = 0;
+    struct ndn_face_instance *face = NULL;
+    struct ndn_face_instance *newface = NULL;
+    
+    if (cmd_orig == NULL) {
+        ndndc_warn(__LINE__, "command error\n");
+        return -1;
+    }
+    
+    cmd = strdup(cmd_orig);
+    if (cmd == NULL) {
+        ndndc_warn(__LINE__, "Cannot allocate memory for copy of the command\n");
+        return -1;
+    }            
+    
+    cmd_token = cmd;    
+    GET_NEXT_TOKEN(cmd_token, cmd_faceid);
+    GET_NEXT_TOKEN(cmd_token, cmd_usec);
+    GET_NEXT_TOKEN(cmd_token, cmd_bytes);
+    
+    face = parse_ndn_face_instance_from_face(self, cmd_faceid);
+    if (face == NULL)
+        goto Cleanup;
+    if (cmd_usec == NULL) {
+        ndndc_warn(__LINE__, "command error, missing usec for setfacecoalesce\n");
+        goto Cleanup;
+    }
+    usec = strtol(cmd_usec, &endptr, 10);
+    if (*endptr != 0 || usec < 0 || usec > INT_MAX) {
+        ndndc_warn(__LINE__, "command error, invalid usec for setfacecoalesce: %s\n", cmd_usec);
+        goto Cleanup;
+    }
+    if (cmd_bytes != NULL) {
+        bytes = strtol(cmd_bytes, &endptr, 10);
+        if (*endptr != 0 || bytes < 0 || bytes > INT_MAX) {
+            ndndc_warn(__LINE__, "command error, invalid bytes for setfacecoalesce: %s\n", cmd_bytes);
+            goto Cleanup;
+        }
+    }
+    face->descr.ipproto = -1;
+    face->descr.mcast_ttl = -1;
+    face->lifetime = -1;
+    face->coalesce_usec = usec;
+    face->coalesce_bytes = bytes;
+    
+    if (!check_only) {
+        newface = ndndc_do_face_action(self, "setfacecoalesce", face);
+        if (newface == NULL) {
+            ndndc_warn(__LINE__, "Cannot set coalescing of face %u or the face does not exist\n", face->faceid);
+            goto Cleanup;
+        }
+        ndn_face_instance_destroy(&newface);
+    }
+    ret_code = 0;
+Cleanup:
+    ndn_face_instance_destroy(&face);
+    free(cmd);
+    return (ret_code);
+}
+
 
 int
 ndndc_srv(struct ndndc_data *self,
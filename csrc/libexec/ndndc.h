@@ -187,6 +187,42 @@ ndndc_destroyface(struct ndndc_data *self,
                   int check_only,
                   const char *cmd);
 
+/**
+ * @brief Set or remove the rate limit of a face
+ *
+ * cmd format:
+ *   faceid rate [burst]
+ *
+ * A rate of 0 removes the limit.
+ *
+ * @param self          data pointer to "this"
+ * @param check_only    flag indicating that only command checking is requested (nothing will be changed)
+ * @param cmd           setfacerate command without leading 'setfacerate' component
+ * @returns 0 on success
+ */
+int
+ndndc_setfacerate(struct ndndc_data *self,
+                  int check_only,
+                  const char *cmd);
+
+/**
+ * @brief Set how a datagram face coalesces small messages
+ *
+ * cmd format:
+ *   faceid usec [bytes]
+ *
+ * A usec of 0 turns coalescing off.
+ *
+ * @param self          data pointer to "this"
+ * @param check_only    flag indicating that only command checking is requested (nothing will be changed)
+ * @param cmd           setfacecoalesce command without leading 'setfacecoalesce' component
+ * @returns 0 on success
+ */
+int
+ndndc_setfacecoalesce(struct ndndc_data *self,
+                      int check_only,
+                      const char *cmd);
+
 /**
  * @brief Get ID of the local NDND
  *
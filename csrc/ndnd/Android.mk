@@ -25,7 +25,7 @@ LOCAL_C_INCLUDES	+= $(LOCAL_PATH)/../include
 LOCAL_C_INCLUDES	+= $(LOCAL_PATH)/../../android/external/openssl-armv5/include
 
 NDNDOBJ := ndnd.o ndnd_msg.o ndnd_internal_client.o ndnd_stats.o \
-			android_main.o
+			ndnd_cs_policy.o android_main.o
 NDNDSRC := $(NDNDOBJ:.o=.c)
 
 LOCAL_SRC_FILES := $(NDNDSRC)
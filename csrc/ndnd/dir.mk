@@ -24,7 +24,8 @@ DEBRIS = anything.ndnb contentobjecthash.ndnb contentmishash.ndnb \
          contenthash.ndnb
 
 BROKEN_PROGRAMS = 
-CSRC = ndnd_main.c ndnd.c ndnd_msg.c ndnd_stats.c ndnd_internal_client.c ndndsmoketest.c
+CSRC = ndnd_main.c ndnd.c ndnd_msg.c ndnd_stats.c ndnd_internal_client.c \
+       ndnd_cs_policy.c ndndsmoketest.c
 HSRC = ndnd_private.h
 SCRIPTSRC = testbasics fortunes.ndnb contentobjecthash.ref anything.ref \
             minsuffix.ref
@@ -35,7 +36,8 @@ all: default $(BROKEN_PROGRAMS)
 
 $(PROGRAMS): $(NDNLIBDIR)/libndn.a
 
-NDND_OBJ = ndnd_main.o ndnd.o ndnd_msg.o ndnd_stats.o ndnd_internal_client.o
+NDND_OBJ = ndnd_main.o ndnd.o ndnd_msg.o ndnd_stats.o ndnd_internal_client.o \
+           ndnd_cs_policy.o
 ndnd: $(NDND_OBJ) ndnd_built.sh
 	$(CC) $(CFLAGS) -o $@ $(NDND_OBJ) $(LDLIBS) $(OPENSSL_LIBS) -lcrypto -lpthread
 	sh ./ndnd_built.sh
@@ -70,6 +72,7 @@ ndnd.o: ndnd.c ndw.h ../include/ndn/bloom.h ../include/ndn/ndn.h \
   ../include/ndn/ndnd.h ../include/ndn/face_mgmt.h \
   ../include/ndn/sockcreate.h ../include/ndn/hashtb.h \
   ../include/ndn/schedule.h ../include/ndn/reg_mgmt.h \
+  ../include/ndn/nametree.h ../include/ndn/reasm.h ../include/ndn/shmring.h \
   ../include/ndn/uri.h ndnd_private.h ../include/ndn/seqwriter.h
 ndnd_msg.o: ndnd_msg.c ../include/ndn/ndn.h ../include/ndn/coding.h \
   ../include/ndn/charbuf.h ../include/ndn/indexbuf.h \
@@ -89,5 +92,10 @@ ndnd_internal_client.o: ndnd_internal_client.c ../include/ndn/ndn.h \
   ../include/ndn/schedule.h ../include/ndn/sockaddrutil.h \
   ../include/ndn/uri.h ndnd_private.h ../include/ndn/reg_mgmt.h \
   ../include/ndn/seqwriter.h
+ndnd_cs_policy.o: ndnd_cs_policy.c ../include/ndn/ndn.h \
+  ../include/ndn/coding.h ../include/ndn/charbuf.h \
+  ../include/ndn/indexbuf.h ../include/ndn/hashtb.h ndnd_private.h \
+  ../include/ndn/ndn_private.h ../include/ndn/reg_mgmt.h \
+  ../include/ndn/schedule.h ../include/ndn/seqwriter.h
 ndndsmoketest.o: ndndsmoketest.c ../include/ndn/ndnd.h \
   ../include/ndn/ndn_private.h
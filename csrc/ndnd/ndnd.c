@@ -39,9 +39,11 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <netinet/in.h>
 
@@ -58,8 +60,11 @@
 #include <ndn/face_mgmt.h>
 #include <ndn/hashtb.h>
 #include <ndn/indexbuf.h>
+#include <ndn/nametree.h>
+#include <ndn/reasm.h>
 #include <ndn/schedule.h>
 #include <ndn/reg_mgmt.h>
+#include <ndn/shmring.h>
 #include <ndn/uri.h>
 
 #include "ndnd_private.h"
@@ -74,6 +79,19 @@ enum ndn_strategy_op {
     NDNST_TIMEOUT,  /* all downstreams timed out, pit entry will go away */
 };
 
+/**
+ * A forwarding strategy
+ *
+ * The callout is told about each step in the life of an interest entry.
+ * For NDNST_SATISFIED, faceid is the upstream that supplied the content,
+ * or NDN_NOFACEID if that is not known.
+ */
+struct ndnd_strategy_class {
+    const char *name;
+    void (*callout)(struct ndnd_handle *h, struct interest_entry *ie,
+                    enum ndn_strategy_op op, unsigned faceid);
+};
+
 static void cleanup_at_exit(void);
 static void unlink_at_exit(const char *path);
 static int create_local_listener(struct ndnd_handle *h, const char *sockname, int backlog);
@@ -85,6 +103,8 @@ static struct face *record_connection(struct ndnd_handle *h,
 static void process_input_message(struct ndnd_handle *h, struct face *face,
                                   unsigned char *msg, size_t size, int pdu_ok);
 static void process_input(struct ndnd_handle *h, int fd);
+static void process_shm_request(struct ndnd_handle *h, struct face *face,
+                                unsigned char *msg, size_t size);
 static int ndn_stuff_interest(struct ndnd_handle *h,
                               struct face *face, struct ndn_charbuf *c);
 static void do_deferred_write(struct ndnd_handle *h, int fd);
@@ -92,14 +112,16 @@ static void clean_needed(struct ndnd_handle *h);
 static struct face *get_dgram_source(struct ndnd_handle *h, struct face *face,
                                      struct sockaddr *addr, socklen_t addrlen,
                                      int why);
-static void content_skiplist_insert(struct ndnd_handle *h,
-                                    struct content_entry *content);
-static void content_skiplist_remove(struct ndnd_handle *h,
-                                    struct content_entry *content);
+static int dgram_faces_seek(struct hashtb_enumerator *e,
+                            const struct sockaddr *addr, socklen_t addrlen);
+static int content_tree_insert(struct ndnd_handle *h,
+                               struct content_entry *content);
+static void content_tree_remove(struct ndnd_handle *h,
+                                struct content_entry *content);
 static void mark_stale(struct ndnd_handle *h,
                        struct content_entry *content);
-static ndn_accession_t content_skiplist_next(struct ndnd_handle *h,
-                                             struct content_entry *content);
+static struct content_entry *content_tree_next(struct ndnd_handle *h,
+                                               struct content_entry *content);
 static void reap_needed(struct ndnd_handle *h, int init_delay_usec);
 static void check_comm_file(struct ndnd_handle *h);
 static int nameprefix_seek(struct ndnd_handle *h,
@@ -108,13 +130,24 @@ static int nameprefix_seek(struct ndnd_handle *h,
                            struct ndn_indexbuf *comps,
                            int ncomps);
 static void register_new_face(struct ndnd_handle *h, struct face *face);
+static int forward_to_stale(struct ndnd_handle *h,
+                            struct nameprefix_entry *npe);
+static void fib_changed(struct ndnd_handle *h, struct nameprefix_entry *npe);
+static void free_forwarding(struct ndnd_handle *h, struct ndn_forwarding *f);
 static void update_forward_to(struct ndnd_handle *h,
                               struct nameprefix_entry *npe);
 static void stuff_and_send(struct ndnd_handle *h, struct face *face,
                            const unsigned char *data1, size_t size1,
                            const unsigned char *data2, size_t size2,
                            const char *tag, int lineno);
+static void ndnd_send_parts(struct ndnd_handle *h, struct face *face,
+                            const void *data1, size_t size1,
+                            const void *data2, size_t size2);
 static void ndn_link_state_init(struct ndnd_handle *h, struct face *face);
+static void link_frag_destroy(struct ndnd_handle *h,
+                              struct ndnd_linkfrag **plf);
+static void face_coalesce_set(struct ndnd_handle *h, struct face *face,
+                              unsigned usec, unsigned bytes);
 static void ndn_append_link_stuff(struct ndnd_handle *h,
                                   struct face *face,
                                   struct ndn_charbuf *c);
@@ -129,6 +162,7 @@ static int nonce_ok(struct ndnd_handle *h, struct face *face,
 static void
 pfi_destroy(struct ndnd_handle *h, struct interest_entry *ie,
             struct pit_face_item *p);
+static void pfi_free(struct ndnd_handle *h, struct pit_face_item *p);
 static struct pit_face_item *
 pfi_set_nonce(struct ndnd_handle *h, struct interest_entry *ie,
              struct pit_face_item *p,
@@ -156,7 +190,7 @@ pfi_seek(struct ndnd_handle *h, struct interest_entry *ie,
          unsigned faceid, unsigned pfi_flag);
 static void strategy_callout(struct ndnd_handle *h,
                              struct interest_entry *ie,
-                             enum ndn_strategy_op op);
+                             enum ndn_strategy_op op, unsigned faceid);
 
 /**
  * Frequency of wrapped timer
@@ -228,16 +262,103 @@ comm_file_ok(void)
     return(1);
 }
 
+/**
+ * Number of objects carved from each pool slab
+ */
+#define NDND_POOL_SLAB_N 128
+
+/**
+ * Set up an empty pool of objects of the given size
+ */
+static void
+pool_init(struct ndnd_pool *pool, size_t size)
+{
+    memset(pool, 0, sizeof(*pool));
+    /* Round up so every object is suitably aligned */
+    pool->size = (size + 15) & ~(size_t)15;
+}
+
+/**
+ * Get a zeroed object from a pool
+ *
+ * @returns NULL if out of memory.
+ */
+static void *
+pool_alloc(struct ndnd_pool *pool)
+{
+    unsigned char *slab;
+    void *ans;
+    int i;
+    
+    if (pool->free == NULL) {
+        /* The first 16 bytes of a slab link it to the next */
+        slab = malloc(16 + NDND_POOL_SLAB_N * pool->size);
+        if (slab == NULL)
+            return(NULL);
+        *(void **)slab = pool->slabs;
+        pool->slabs = slab;
+        for (i = NDND_POOL_SLAB_N - 1; i >= 0; i--) {
+            ans = slab + 16 + i * pool->size;
+            *(void **)ans = pool->free;
+            pool->free = ans;
+        }
+        pool->n_free += NDND_POOL_SLAB_N;
+    }
+    ans = pool->free;
+    pool->free = *(void **)ans;
+    pool->n_free--;
+    pool->n_used++;
+    memset(ans, 0, pool->size);
+    return(ans);
+}
+
+/**
+ * Return an object to its pool
+ */
+static void
+pool_free(struct ndnd_pool *pool, void *p)
+{
+    *(void **)p = pool->free;
+    pool->free = p;
+    pool->n_free++;
+    pool->n_used--;
+}
+
+/**
+ * Release all the storage of a pool
+ */
+static void
+pool_destroy(struct ndnd_pool *pool)
+{
+    void *slab;
+    
+    while ((slab = pool->slabs) != NULL) {
+        pool->slabs = *(void **)slab;
+        free(slab);
+    }
+    pool->free = NULL;
+    pool->n_free = pool->n_used = 0;
+}
+
+/**
+ * Scratch buffers larger than this are not kept for reuse
+ */
+#define NDND_SCRATCH_KEEP 65536
+
 /**
  * Obtain a charbuf for short-term use
+ *
+ * Released charbufs are kept on a small stack, with their storage, so
+ * that the temporaries used while processing a message do not go to
+ * the allocator once things are warmed up.
  */
 static struct ndn_charbuf *
 charbuf_obtain(struct ndnd_handle *h)
 {
-    struct ndn_charbuf *c = h->scratch_charbuf;
-    if (c == NULL)
+    struct ndn_charbuf *c;
+    if (h->n_scratch_charbuf == 0)
         return(ndn_charbuf_create());
-    h->scratch_charbuf = NULL;
+    c = h->scratch_charbuf[--(h->n_scratch_charbuf)];
     c->length = 0;
     return(c);
 }
@@ -249,8 +370,8 @@ static void
 charbuf_release(struct ndnd_handle *h, struct ndn_charbuf *c)
 {
     c->length = 0;
-    if (h->scratch_charbuf == NULL)
-        h->scratch_charbuf = c;
+    if (h->n_scratch_charbuf < NDND_SCRATCH_N && c->limit <= NDND_SCRATCH_KEEP)
+        h->scratch_charbuf[(h->n_scratch_charbuf)++] = c;
     else
         ndn_charbuf_destroy(&c);
 }
@@ -261,10 +382,10 @@ charbuf_release(struct ndnd_handle *h, struct ndn_charbuf *c)
 static struct ndn_indexbuf *
 indexbuf_obtain(struct ndnd_handle *h)
 {
-    struct ndn_indexbuf *c = h->scratch_indexbuf;
-    if (c == NULL)
+    struct ndn_indexbuf *c;
+    if (h->n_scratch_indexbuf == 0)
         return(ndn_indexbuf_create());
-    h->scratch_indexbuf = NULL;
+    c = h->scratch_indexbuf[--(h->n_scratch_indexbuf)];
     c->n = 0;
     return(c);
 }
@@ -276,8 +397,9 @@ static void
 indexbuf_release(struct ndnd_handle *h, struct ndn_indexbuf *c)
 {
     c->n = 0;
-    if (h->scratch_indexbuf == NULL)
-        h->scratch_indexbuf = c;
+    if (h->n_scratch_indexbuf < NDND_SCRATCH_N &&
+          c->limit <= NDND_SCRATCH_KEEP / sizeof(c->buf[0]))
+        h->scratch_indexbuf[(h->n_scratch_indexbuf)++] = c;
     else
         ndn_indexbuf_destroy(&c);
 }
@@ -308,44 +430,97 @@ ndnd_face_from_faceid(struct ndnd_handle *h, unsigned faceid)
 }
 
 /**
- * Assigns the faceid for a nacent face,
- * calls register_new_face() if successful.
+ * Grow the face slot arrays to hold want slots.
+ *
+ * The new slots go on the free ring, which is empty when this is called
+ * (except at startup, when there are no slots at all).
+ * @returns 0 for success, -1 for failure.
  */
 static int
-enroll_face(struct ndnd_handle *h, struct face *face)
+face_slots_grow(struct ndnd_handle *h, unsigned want)
 {
-    unsigned i;
     unsigned n = h->face_limit;
-    struct face **a = h->faces_by_faceid;
-    for (i = h->face_rover; i < n; i++)
-        if (a[i] == NULL) goto use_i;
-    for (i = 0; i < n; i++)
-        if (a[i] == NULL) {
-            /* bump gen only if second pass succeeds */
-            h->face_gen += MAXFACES + 1;
-            goto use_i;
-        }
-    i = (n + 1) * 3 / 2;
-    if (i > MAXFACES) i = MAXFACES;
-    if (i <= n)
+    struct face **a;
+    unsigned *g;
+    unsigned *f;
+    
+    if (want > MAXFACES)
+        want = MAXFACES;
+    if (want <= n || h->face_free_n != 0)
         return(-1); /* overflow */
-    a = realloc(a, i * sizeof(struct face *));
+    a = realloc(h->faces_by_faceid, want * sizeof(a[0]));
     if (a == NULL)
         return(-1); /* ENOMEM */
-    h->face_limit = i;
-    while (--i > n)
-        a[i] = NULL;
     h->faces_by_faceid = a;
-use_i:
-    a[i] = face;
-    h->face_rover = i + 1;
-    face->faceid = i | h->face_gen;
+    g = realloc(h->face_gens, want * sizeof(g[0]));
+    if (g == NULL)
+        return(-1);
+    h->face_gens = g;
+    f = realloc(h->face_free, want * sizeof(f[0]));
+    if (f == NULL)
+        return(-1);
+    h->face_free = f;
+    h->face_limit = want;
+    h->face_free_head = 0;
+    for (; n < want; n++) {
+        a[n] = NULL;
+        g[n] = 0;
+        f[h->face_free_n++] = n;
+    }
+    return(0);
+}
+
+/**
+ * Put a face slot back on the free ring.
+ *
+ * Normally the slot goes to the end of the ring with a new generation
+ * number, so that it is the last to be reused and the old faceid stays
+ * unique.  A recycled slot goes to the front with its faceid unchanged.
+ */
+static void
+face_slot_release(struct ndnd_handle *h, unsigned slot, int recycle)
+{
+    unsigned n = h->face_limit;
+    
+    h->faces_by_faceid[slot] = NULL;
+    if (recycle) {
+        h->face_free_head = (h->face_free_head + n - 1) % n;
+        h->face_free[h->face_free_head] = slot;
+    }
+    else {
+        h->face_gens[slot] += MAXFACES + 1;
+        h->face_free[(h->face_free_head + h->face_free_n) % n] = slot;
+    }
+    h->face_free_n++;
+}
+
+/**
+ * Assigns the faceid for a nacent face,
+ * calls register_new_face() if successful.
+ *
+ * Free slots are kept in a ring, so this takes constant time.
+ */
+static int
+enroll_face(struct ndnd_handle *h, struct face *face)
+{
+    unsigned i;
+    
+    if (h->face_free_n == 0 &&
+          face_slots_grow(h, (h->face_limit + 1) * 3 / 2) < 0)
+        return(-1);
+    i = h->face_free[h->face_free_head];
+    h->face_free_head = (h->face_free_head + 1) % h->face_limit;
+    h->face_free_n--;
+    h->faces_by_faceid[i] = face;
+    face->faceid = i | h->face_gens[i];
     face->meter[FM_BYTI] = ndnd_meter_create(h, "bytein");
     face->meter[FM_BYTO] = ndnd_meter_create(h, "byteout");
     face->meter[FM_INTI] = ndnd_meter_create(h, "intrin");
     face->meter[FM_INTO] = ndnd_meter_create(h, "introut");
     face->meter[FM_DATI] = ndnd_meter_create(h, "datain");
     face->meter[FM_DATO] = ndnd_meter_create(h, "dataout");
+    if ((face->flags & (NDN_FACE_DGRAM | NDN_FACE_LOCAL)) == NDN_FACE_DGRAM)
+        face_coalesce_set(h, face, h->coalesce_usec, h->coalesce_bytes);
     register_new_face(h, face);
     return (face->faceid);
 }
@@ -387,7 +562,10 @@ content_queue_create(struct ndnd_handle *h, struct face *face, enum cq_delay_cla
         q->rand_usec = 2 * usec;
         q->nrun = 0;
         q->send_queue = ndn_indexbuf_create();
-        if (q->send_queue == NULL) {
+        q->enqueued = ndn_indexbuf_create();
+        if (q->send_queue == NULL || q->enqueued == NULL) {
+            ndn_indexbuf_destroy(&q->send_queue);
+            ndn_indexbuf_destroy(&q->enqueued);
             free(q);
             return(NULL);
         }
@@ -406,6 +584,7 @@ content_queue_destroy(struct ndnd_handle *h, struct content_queue **pq)
     if (*pq != NULL) {
         q = *pq;
         ndn_indexbuf_destroy(&q->send_queue);
+        ndn_indexbuf_destroy(&q->enqueued);
         if (q->sender != NULL) {
             ndn_schedule_cancel(h->sched, q->sender);
             q->sender = NULL;
@@ -415,6 +594,241 @@ content_queue_destroy(struct ndnd_handle *h, struct content_queue **pq)
     }
 }
 
+/**
+ * Microsecond clock for the token buckets; wraps every 71 minutes.
+ */
+static unsigned
+shaper_clock(struct ndnd_handle *h)
+{
+    return((unsigned)h->sec * 1000000U + h->usec);
+}
+
+/**
+ * Add tokens to a face's bucket for the time that has passed.
+ */
+static void
+face_shaper_refill(struct ndnd_handle *h, struct face *face)
+{
+    unsigned now = shaper_clock(h);
+    unsigned delta = now - face->rate_stamp;
+    uintmax_t add;
+
+    if (delta > 10000000)
+        delta = 10000000;
+    add = (uintmax_t)delta * face->rate_limit / 1000000;
+    if (add == 0)
+        return; /* leave the stamp so the fraction keeps accruing */
+    if ((intmax_t)face->rate_tokens + (intmax_t)add >= (intmax_t)face->rate_burst) {
+        face->rate_tokens = face->rate_burst;
+        face->rate_stamp = now;
+    }
+    else {
+        face->rate_tokens += add;
+        face->rate_stamp += add * 1000000 / face->rate_limit;
+    }
+}
+
+/**
+ * Set (or with rate 0, remove) the rate limit on a face.
+ */
+static void
+face_shaper_set(struct ndnd_handle *h, struct face *face,
+                unsigned rate, unsigned burst)
+{
+    int k;
+
+    if (rate != 0 && burst == 0)
+        burst = rate / 10; /* 100 milliseconds worth */
+    if (rate != 0 && burst < 2 * NDND_SHAPER_QUANTUM)
+        burst = 2 * NDND_SHAPER_QUANTUM;
+    face->rate_limit = rate;
+    face->rate_burst = burst;
+    face->rate_tokens = burst;
+    face->rate_stamp = shaper_clock(h);
+    face->tc_waiting = 0;
+    for (k = 0; k < NDND_TC_N; k++)
+        face->tc_deficit[k] = 0;
+}
+
+/**
+ * Note that a traffic class has nothing more to send on a face.
+ */
+static void
+face_shaper_idle(struct face *face, int tc)
+{
+    face->tc_waiting &= ~(1U << tc);
+    face->tc_deficit[tc] = 0;
+}
+
+/**
+ * Ask whether a face may send size bytes of traffic class tc now.
+ *
+ * Faces without a rate limit always may.  Otherwise the bucket must not
+ * be empty, and the class must have enough deficit for the current
+ * deficit round robin round.  A new round starts, giving each backlogged
+ * class its quantum, once none of those classes could go.
+ * A class that has not asked in a while is no longer backlogged, so that
+ * a vanished sender cannot stall the others.
+ *
+ * On success the bytes are charged to the face and to the class.
+ * @returns 0 if the send may proceed, otherwise the number of
+ *          microseconds to wait before asking again.
+ */
+static unsigned
+face_shaper_admit(struct ndnd_handle *h, struct face *face,
+                  int tc, unsigned size)
+{
+    unsigned now;
+    unsigned bit;
+    unsigned stale;
+    unsigned usec;
+    int k;
+
+    if (face->rate_limit == 0)
+        return(0);
+    face_shaper_refill(h, face);
+    now = shaper_clock(h);
+    bit = 1U << tc;
+    face->tc_want[tc] = size;
+    face->tc_stamp[tc] = now;
+    face->tc_waiting |= bit;
+    for (k = 0; k < NDND_TC_N; k++) {
+        stale = 100000 + 2 * (uintmax_t)face->tc_want[k] * 1000000 / face->rate_limit;
+        if ((face->tc_waiting & (1U << k)) != 0 && now - face->tc_stamp[k] > stale)
+            face_shaper_idle(face, k);
+    }
+    if (face->tc_deficit[tc] < (int)size) {
+        for (k = 0; k < NDND_TC_N; k++)
+            if ((face->tc_waiting & (1U << k)) != 0 &&
+                  face->tc_deficit[k] >= (int)face->tc_want[k])
+                break;
+        if (k == NDND_TC_N) {
+            /* Nobody can go, so start a new round */
+            for (k = 0; k < NDND_TC_N; k++) {
+                if ((face->tc_waiting & (1U << k)) == 0)
+                    continue;
+                face->tc_deficit[k] += h->tc_quantum[k];
+                if (face->tc_deficit[k] > (int)(h->tc_quantum[k] + face->tc_want[k]))
+                    face->tc_deficit[k] = h->tc_quantum[k] + face->tc_want[k];
+            }
+        }
+    }
+    if (face->rate_tokens > 0 && face->tc_deficit[tc] >= (int)size) {
+        face->rate_tokens -= size;
+        face->tc_deficit[tc] -= size;
+        return(0);
+    }
+    if (face->rate_tokens <= 0)
+        usec = (uintmax_t)(1 - face->rate_tokens) * 1000000 / face->rate_limit;
+    else
+        usec = (uintmax_t)size * 1000000 / face->rate_limit;
+    return(usec + 1);
+}
+
+/**
+ * Ask whether an interest may be sent to a face now (interest shaping).
+ *
+ * A face may be sent interests at the rate that it has been returning
+ * data, as measured by its FM_DATI meter, scaled by the face's gain
+ * but never below the NDND_INTEREST_SHAPING floor.  The gain is more
+ * than one, so the rate keeps probing upward while the data keeps
+ * coming.  The spacing is kept with a virtual clock that may fall as
+ * much as NDND_ISHAPE_BURST behind the real one, so a quiet face can
+ * send a short burst.  Since the clock never runs more than one
+ * spacing ahead, anything further off is left from long ago.
+ *
+ * On success the interest is charged to the face.
+ * @returns 0 if the interest may go, otherwise the number of
+ *          microseconds to wait before asking again.
+ */
+static unsigned
+face_ishape_admit(struct ndnd_handle *h, struct face *face)
+{
+    unsigned rate;
+    unsigned now;
+    int ahead;
+
+    if (h->ishape_floor == 0 || face == h->face0)
+        return(0);
+    if (face->ishape_gain == 0)
+        face->ishape_gain = NDND_ISHAPE_GAIN;
+    rate = (uintmax_t)ndnd_meter_rate(h, face->meter[FM_DATI]) *
+           face->ishape_gain / 256;
+    if (rate < h->ishape_floor)
+        rate = h->ishape_floor;
+    if (rate > 1000000)
+        rate = 1000000;
+    now = shaper_clock(h);
+    ahead = (int)(face->ishape_next - now);
+    if (ahead > 1000000 || ahead < -NDND_ISHAPE_BURST)
+        face->ishape_next = now - NDND_ISHAPE_BURST; /* idle, or new */
+    else if (ahead > 0)
+        return(ahead);
+    face->ishape_next += 1000000 / rate;
+    return(0);
+}
+
+/**
+ * Note that a face has returned a datum without reporting congestion.
+ *
+ * A gain that was cut grows back slowly, by 1/256 per 8 data.
+ */
+static void
+face_ishape_returned(struct face *face)
+{
+    if (face->ishape_gain == 0 || face->ishape_gain >= NDND_ISHAPE_GAIN)
+        return;
+    if (++face->ishape_acks >= 8) {
+        face->ishape_acks = 0;
+        face->ishape_gain++;
+    }
+}
+
+/**
+ * Note a CongestionMark from the peer on a face.
+ *
+ * The gain is cut by a quarter, but only once per round trip, since
+ * the marks of one episode arrive on everything the peer sends back.
+ */
+static void
+face_ishape_congested(struct ndnd_handle *h, struct face *face)
+{
+    unsigned now = shaper_clock(h);
+    unsigned hold = face->srtt > 100000 ? face->srtt : 100000;
+
+    h->cmarks_recvd++;
+    if (face->ishape_gain == 0)
+        face->ishape_gain = NDND_ISHAPE_GAIN;
+    if (now - face->ishape_cut < hold)
+        return;
+    face->ishape_cut = now;
+    face->ishape_acks = 0;
+    face->ishape_gain -= face->ishape_gain / 4;
+    if (face->ishape_gain < NDND_ISHAPE_GAIN_MIN)
+        face->ishape_gain = NDND_ISHAPE_GAIN_MIN;
+}
+
+/**
+ * Arrange to tell the downstreams of an interest that we are congested.
+ *
+ * Only peers that speak link messages are told; the mark goes out
+ * with the next thing sent to them.
+ */
+static void
+ishape_mark_downstreams(struct ndnd_handle *h, struct interest_entry *ie)
+{
+    struct pit_face_item *x;
+    struct face *face;
+
+    for (x = ie->pfl; x != NULL; x = x->next) {
+        if ((x->pfi_flags & NDND_PFI_DNSTREAM) == 0)
+            continue;
+        face = face_from_faceid(h, x->faceid);
+        if (face != NULL && (face->flags & (NDN_FACE_LINK | NDN_FACE_SEQOK)) != 0)
+            face->flags |= NDN_FACE_CM;
+    }
+}
+
 /**
  * Close an open file descriptor quietly.
  */
@@ -640,13 +1054,9 @@ finalize_face(struct hashtb_enumerator *e)
         if ((face->guid) != NULL)
             ndnd_forget_face_guid(h, face);
         ndn_charbuf_destroy(&face->guid_cob);
-        h->faces_by_faceid[i] = NULL;
-        if ((face->flags & NDN_FACE_UNDECIDED) != 0 &&
-              face->faceid == ((h->face_rover - 1) | h->face_gen)) {
-            /* stream connection with no ndn traffic - safe to reuse */
-            recycle = 1;
-            h->face_rover--;
-        }
+        /* stream connection with no ndn traffic - safe to reuse */
+        recycle = ((face->flags & NDN_FACE_UNDECIDED) != 0);
+        face_slot_release(h, i, recycle);
         for (c = 0; c < NDN_CQ_N; c++)
             content_queue_destroy(h, &(face->q[c]));
         ndn_charbuf_destroy(&face->inbuf);
@@ -658,6 +1068,17 @@ finalize_face(struct hashtb_enumerator *e)
     }
     else if (face->faceid != NDN_NOFACEID)
         ndnd_msg(h, "orphaned face %u", face->faceid);
+    link_frag_destroy(h, &face->frag);
+    if (face->shm != NULL) {
+        ndn_shm_destroy(&face->shm);
+        face->shm_spill = 0;
+        h->shm_count--;
+    }
+    if (face->coalesce_flusher != NULL)
+        ndn_schedule_cancel(h->sched, face->coalesce_flusher);
+    if (face->idle_timer != NULL)
+        ndn_schedule_cancel(h->sched, face->idle_timer);
+    ndn_charbuf_destroy(&face->coalesce);
     for (m = 0; m < NDND_FACE_METER_N; m++)
         ndnd_meter_destroy(&face->meter[m]);
 }
@@ -671,26 +1092,33 @@ static struct content_entry *
 content_from_accession(struct ndnd_handle *h, ndn_accession_t accession)
 {
     struct content_entry *ans = NULL;
-    if (accession < h->accession_base) {
-        struct sparse_straggler_entry *entry;
-        entry = hashtb_lookup(h->sparse_straggler_tab,
-                              &accession, sizeof(accession));
-        if (entry != NULL)
-            ans = entry->content;
-    }
-    else if (accession < h->accession_base + h->content_by_accession_window) {
+    struct sparse_straggler_entry *entry;
+    if (accession >= h->accession_base) {
+        if (accession >= h->accession_base + h->content_by_accession_window)
+            return(NULL);
         ans = h->content_by_accession[accession - h->accession_base];
         if (ans != NULL && ans->accession != accession)
             ans = NULL;
-    }
+        /* A straggler sweep may have moved it without shifting the base */
+        if (ans != NULL || accession >= h->straggler_limit)
+            return(ans);
+    }
+    entry = hashtb_lookup(h->sparse_straggler_tab,
+                          &accession, sizeof(accession));
+    if (entry != NULL)
+        ans = entry->content;
     return(ans);
 }
 
 /**
  *  Sweep old entries out of the direct accession-to-content table
+ *
+ * Each entry moved into the sparse table costs one unit of *budget.
+ * A sweep that runs out of budget resumes at h->straggler_cursor.
+ * @returns 1 if the sweep is unfinished, 0 otherwise.
  */
-static void
-cleanout_stragglers(struct ndnd_handle *h)
+static int
+cleanout_stragglers(struct ndnd_handle *h, int *budget)
 {
     ndn_accession_t accession;
     struct hashtb_enumerator ee;
@@ -700,22 +1128,36 @@ cleanout_stragglers(struct ndnd_handle *h)
     unsigned n_direct;
     unsigned n_occupied;
     unsigned window;
-    unsigned i;
-    if (h->accession <= h->accession_base || a[0] == NULL)
-        return;
-    n_direct = h->accession - h->accession_base;
-    if (n_direct < 1000)
-        return;
+    unsigned i = 0;
+    if (h->accession <= h->accession_base || a == NULL) {
+        h->straggler_cursor = 0;
+        return(0);
+    }
+    window = h->content_by_accession_window;
     n_occupied = hashtb_n(h->content_tab) - hashtb_n(h->sparse_straggler_tab);
-    if (n_occupied >= (n_direct / 8))
-        return;
+    if (h->straggler_cursor > h->accession_base)
+        i = h->straggler_cursor - h->accession_base;
+    else {
+        /* Not in the middle of a sweep; see whether one is needed */
+        if (a[0] == NULL)
+            return(0);
+        n_direct = h->accession - h->accession_base;
+        if (n_direct < 1000)
+            return(0);
+        if (n_occupied >= (n_direct / 8))
+            return(0);
+    }
     /* The direct lookup table is too sparse, so sweep stragglers */
     hashtb_start(h->sparse_straggler_tab, e);
-    window = h->content_by_accession_window;
-    for (i = 0; i < window; i++) {
+    for (; i < window; i++) {
         if (a[i] != NULL) {
             if (n_occupied >= ((window - i) / 8))
                 break;
+            if ((*budget)-- <= 0) {
+                h->straggler_cursor = h->accession_base + i;
+                hashtb_end(e);
+                return(1);
+            }
             accession = h->accession_base + i;
             hashtb_seek(e, &accession, sizeof(accession), 0);
             entry = e->data;
@@ -723,10 +1165,13 @@ cleanout_stragglers(struct ndnd_handle *h)
                 entry->content = a[i];
                 a[i] = NULL;
                 n_occupied -= 1;
+                h->straggler_limit = accession + 1;
             }
         }
     }
     hashtb_end(e);
+    h->straggler_cursor = 0;
+    return(0);
 }
 
 /**
@@ -739,9 +1184,12 @@ cleanout_empties(struct ndnd_handle *h)
     unsigned j = 0;
     struct content_entry **a = h->content_by_accession;
     unsigned window = h->content_by_accession_window;
+    int budget = NDND_CLEAN_BUDGET;
     if (a == NULL)
         return(-1);
-    cleanout_stragglers(h);
+    /* Leave the rest of a long sweep to the cleaner */
+    if (cleanout_stragglers(h, &budget))
+        clean_needed(h);
     while (i < window && a[i] == NULL)
         i++;
     if (i == 0)
@@ -790,6 +1238,106 @@ enroll_content(struct ndnd_handle *h, struct content_entry *content)
     h->content_by_accession[content->accession - h->accession_base] = content;
 }
 
+/**
+ * Compute the keyed fingerprint of a ContentObject as received
+ *
+ * This is a word-at-a-time multiplicative hash (after MurmurHash64A),
+ * much cheaper than the SHA-256 digest.
+ */
+static uint64_t
+content_fingerprint(struct ndnd_handle *h, const unsigned char *msg, size_t size)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    uint64_t x = h->fingerprint_key ^ (size * m);
+    uint64_t w;
+    size_t i;
+    
+    for (i = 0; i + 8 <= size; i += 8) {
+        memcpy(&w, msg + i, 8);
+        w *= m;
+        w ^= w >> 47;
+        w *= m;
+        x ^= w;
+        x *= m;
+    }
+    if (i < size) {
+        for (w = 0; i < size; i++)
+            w = (w << 8) | msg[i];
+        x ^= w;
+        x *= m;
+    }
+    x ^= x >> 47;
+    x *= m;
+    x ^= x >> 47;
+    return(x);
+}
+
+/**
+ * Where the digest of stored content is kept, once it is known
+ *
+ * The slot follows the tree key, or ends it once the key includes it.
+ */
+static unsigned char *
+content_digest_slot(struct content_entry *content)
+{
+    unsigned char *end = (unsigned char *)content->tree.key + content->tree.keysize;
+    
+    if ((content->flags & NDN_CONTENT_ENTRY_DIGEST_KEY) != 0)
+        return(end - CONTENT_DIGEST_SIZE);
+    return(end);
+}
+
+/**
+ * Share the digest of stored content with a parse of it
+ *
+ * If the parse already has the digest and the entry does not, the entry
+ * keeps a copy; if it is the other way around, the parse gets one.
+ */
+static void
+content_share_digest(struct ndnd_handle *h, struct content_entry *content,
+                     struct ndn_parsed_ContentObject *pc)
+{
+    if ((content->flags & NDN_CONTENT_ENTRY_DIGEST) != 0) {
+        if (pc->digest_bytes == 0) {
+            memcpy(pc->digest, content_digest_slot(content), CONTENT_DIGEST_SIZE);
+            pc->digest_bytes = CONTENT_DIGEST_SIZE;
+        }
+    }
+    else if (pc->digest_bytes == CONTENT_DIGEST_SIZE) {
+        memcpy(content_digest_slot(content), pc->digest, CONTENT_DIGEST_SIZE);
+        content->flags |= NDN_CONTENT_ENTRY_DIGEST;
+    }
+}
+
+/**
+ * Check whether stored content matches an interest
+ *
+ * The digest counts as an implicit last name component.  It is computed
+ * only when the interest makes it matter, and then kept with the entry.
+ * It is allowed to pass NULL for pc.
+ */
+static int
+content_matches_interest(struct ndnd_handle *h, struct content_entry *content,
+                         struct ndn_parsed_ContentObject *pc,
+                         const unsigned char *msg, size_t size,
+                         const struct ndn_parsed_interest *pi)
+{
+    struct ndn_parsed_ContentObject pc_store;
+    int ans;
+    
+    if (pc == NULL) {
+        if (ndn_parse_ContentObject(content->key, content->size,
+                                    &pc_store, NULL) < 0)
+            return(0);
+        pc = &pc_store;
+    }
+    content_share_digest(h, content, pc);
+    ans = ndn_content_matches_interest(content->key, content->size, 1, pc,
+                                       msg, size, pi);
+    content_share_digest(h, content, pc);
+    return(ans);
+}
+
 // the hash table this is for is going away
 static void
 finalize_content(struct hashtb_enumerator *content_enumerator)
@@ -797,9 +1345,11 @@ finalize_content(struct hashtb_enumerator *content_enumerator)
     struct ndnd_handle *h = hashtb_get_param(content_enumerator->ht, NULL);
     struct content_entry *entry = content_enumerator->data;
     unsigned i = entry->accession - h->accession_base;
+    content_tree_remove(h, entry);
+    ndnd_cs_remove(h, entry);
+    h->cs_bytes -= entry->size;
     if (i < h->content_by_accession_window &&
           h->content_by_accession[i] == entry) {
-        content_skiplist_remove(h, entry);
         h->content_by_accession[i] = NULL;
     }
     else {
@@ -814,119 +1364,140 @@ finalize_content(struct hashtb_enumerator *content_enumerator)
             hashtb_end(e);
             return;
         }
-        content_skiplist_remove(h, entry);
         hashtb_delete(e);
         hashtb_end(e);
     }
-    if (entry->comps != NULL) {
-        free(entry->comps);
-        entry->comps = NULL;
-    }
 }
 
 /**
- * Find the skiplist entries associated with the key.
+ * Recover the content entry from its place in the name-ordered index.
+ */
+static struct content_entry *
+content_from_tree(struct ndn_nametree_entry *t)
+{
+    if (t == NULL)
+        return(NULL);
+    return((struct content_entry *)
+           ((char *)t - offsetof(struct content_entry, tree)));
+}
+
+/**
+ * Find the first entry that is not less than the given namekey.
+ */
+static struct content_entry *
+content_tree_findfirst(struct ndnd_handle *h,
+                       const unsigned char *key, size_t keysize)
+{
+    return(content_from_tree(ndn_nametree_findfirst(h->content_tree,
+                                                    key, keysize)));
+}
+
+/**
+ * Make the digest of stored content the last part of its tree key
+ *
+ * The digest is computed if it is not known yet.  The entry must not
+ * be in the tree while its key changes.
  *
- * @returns the number of entries of ans that were filled in.
+ * @returns 0, or -1 if the digest could not be computed.
  */
 static int
-content_skiplist_findbefore(struct ndnd_handle *h,
-                            const unsigned char *key,
-                            size_t keysize,
-                            struct content_entry *wanted_old,
-                            struct ndn_indexbuf **ans)
+content_digest_key(struct ndnd_handle *h, struct content_entry *content)
 {
-    int i;
-    int n = h->skiplinks->n;
-    struct ndn_indexbuf *c;
-    struct content_entry *content;
-    int order;
-    size_t start;
-    size_t end;
+    struct ndn_parsed_ContentObject pc;
     
-    c = h->skiplinks;
-    for (i = n - 1; i >= 0; i--) {
-        for (;;) {
-            if (c->buf[i] == 0)
-                break;
-            content = content_from_accession(h, c->buf[i]);
-            if (content == NULL)
-                abort();
-            start = content->comps[0];
-            end = content->comps[content->ncomps - 1];
-            order = ndn_compare_names(content->key + start - 1, end - start + 2,
-                                      key, keysize);
-            if (order > 0)
-                break;
-            if (order == 0 && (wanted_old == content || wanted_old == NULL))
-                break;
-            if (content->skiplinks == NULL || i >= content->skiplinks->n)
-                abort();
-            c = content->skiplinks;
-        }
-        ans[i] = c;
+    if ((content->flags & NDN_CONTENT_ENTRY_DIGEST_KEY) != 0)
+        return(0);
+    if ((content->flags & NDN_CONTENT_ENTRY_DIGEST) == 0) {
+        if (ndn_parse_ContentObject(content->key, content->size, &pc, NULL) < 0)
+            return(-1);
+        ndn_digest_ContentObject(content->key, &pc);
+        if (pc.digest_bytes != CONTENT_DIGEST_SIZE)
+            return(-1);
+        content_share_digest(h, content, &pc);
     }
-    return(n);
+    content->tree.keysize += CONTENT_DIGEST_SIZE;
+    content->flags |= NDN_CONTENT_ENTRY_DIGEST_KEY;
+    return(0);
 }
 
 /**
- * Limit for how deep our skiplists can be
+ * Complete the tree key of indexed content with its digest, if need be
  */
-#define NDN_SKIPLIST_MAX_DEPTH 30
+static void
+content_tree_rekey(struct ndnd_handle *h, struct content_entry *content)
+{
+    if ((content->flags & NDN_CONTENT_ENTRY_DIGEST_KEY) != 0)
+        return;
+    content_tree_remove(h, content);
+    content_digest_key(h, content);
+    if (ndn_nametree_insert(h->content_tree, &content->tree) < 0)
+        ndnd_msg(h, "could not reindex ContentObject (accession %llu)",
+                 (unsigned long long)content->accession);
+}
 
 /**
- * Insert a new entry into the skiplist.
+ * Look for indexed content whose tree key is exactly the given one
  */
-static void
-content_skiplist_insert(struct ndnd_handle *h, struct content_entry *content)
+static struct content_entry *
+content_tree_exact(struct ndnd_handle *h,
+                   const unsigned char *key, size_t keysize)
 {
-    int d;
-    int i;
-    size_t start;
-    size_t end;
-    struct ndn_indexbuf *pred[NDN_SKIPLIST_MAX_DEPTH] = {NULL};
-    if (content->skiplinks != NULL) abort();
-    for (d = 1; d < NDN_SKIPLIST_MAX_DEPTH - 1; d++)
-        if ((nrand48(h->seed) & 3) != 0) break;
-    while (h->skiplinks->n < d)
-        ndn_indexbuf_append_element(h->skiplinks, 0);
-    start = content->comps[0];
-    end = content->comps[content->ncomps - 1];
-    i = content_skiplist_findbefore(h,
-                                    content->key + start - 1,
-                                    end - start + 2, NULL, pred);
-    if (i < d)
-        d = i; /* just in case */
-    content->skiplinks = ndn_indexbuf_create();
-    for (i = 0; i < d; i++) {
-        ndn_indexbuf_append_element(content->skiplinks, pred[i]->buf[i]);
-        pred[i]->buf[i] = content->accession;
-    }
-}
-
-/**
- * Remove an entry from the skiplist.
+    struct content_entry *x = content_tree_findfirst(h, key, keysize);
+    
+    if (x != NULL && x->tree.keysize == keysize &&
+        memcmp(x->tree.key, key, keysize) == 0)
+        return(x);
+    return(NULL);
+}
+
+/**
+ * Insert a new entry into the name-ordered content index.
+ *
+ * The entry's key must already be filled in, ending with the length of
+ * the implicit digest component.  That alone puts the entry where its
+ * digest would, except next to content whose key begins with the whole
+ * of its key: content with the same name, or with a longer name that
+ * goes on with a component the size of a digest.  Only then is the
+ * digest computed, to complete the key.  The same is done for stored
+ * content whose whole key the new entry's key begins with.
+ *
+ * @returns 0 for success, -1 for failure.
  */
-static void
-content_skiplist_remove(struct ndnd_handle *h, struct content_entry *content)
+static int
+content_tree_insert(struct ndnd_handle *h, struct content_entry *content)
 {
-    int i;
-    int d;
-    size_t start;
-    size_t end;
-    struct ndn_indexbuf *pred[NDN_SKIPLIST_MAX_DEPTH] = {NULL};
-    if (content->skiplinks == NULL) abort();
-    start = content->comps[0];
-    end = content->comps[content->ncomps - 1];
-    d = content_skiplist_findbefore(h,
-                                    content->key + start - 1,
-                                    end - start + 2, content, pred);
-    if (d > content->skiplinks->n)
-        d = content->skiplinks->n;
-    for (i = 0; i < d; i++) {
-        pred[i]->buf[i] = content->skiplinks->buf[i];
+    const unsigned char *key = content->tree.key;
+    size_t keysize = content->tree.keysize;
+    struct content_entry *x;
+    size_t i;
+    size_t n;
+    
+    x = content_tree_findfirst(h, key, keysize);
+    if (x != NULL && x->tree.keysize >= keysize &&
+        memcmp(x->tree.key, key, keysize) == 0) {
+        if (x->tree.keysize == keysize)
+            content_tree_rekey(h, x);
+        if (content_digest_key(h, content) < 0)
+            return(-1);
+    }
+    for (i = 0; i + 2 < keysize; i += 2 + n) {
+        n = (key[i] << 8) + key[i + 1];
+        if (n == CONTENT_DIGEST_SIZE) {
+            x = content_tree_exact(h, key, i + 2);
+            if (x != NULL)
+                content_tree_rekey(h, x);
+        }
     }
-    ndn_indexbuf_destroy(&content->skiplinks);
+    return(ndn_nametree_insert(h->content_tree, &content->tree));
+}
+
+/**
+ * Remove an entry from the name-ordered content index.
+ */
+static void
+content_tree_remove(struct ndnd_handle *h, struct content_entry *content)
+{
+    ndn_nametree_remove(h->content_tree, &content->tree);
 }
 
 /**
@@ -938,10 +1509,11 @@ find_first_match_candidate(struct ndnd_handle *h,
                            const struct ndn_parsed_interest *pi)
 {
     int res;
-    struct ndn_indexbuf *pred[NDN_SKIPLIST_MAX_DEPTH] = {NULL};
+    struct content_entry *ans = NULL;
     size_t start = pi->offset[NDN_PI_B_Name];
     size_t end = pi->offset[NDN_PI_E_Name];
     struct ndn_charbuf *namebuf = NULL;
+    struct ndn_charbuf *key = NULL;
     if (pi->offset[NDN_PI_B_Exclude] < pi->offset[NDN_PI_E_Exclude]) {
         /* Check for <Exclude><Any/><Component>... fast case */
         struct ndn_buf_decoder decoder;
@@ -961,7 +1533,7 @@ find_first_match_candidate(struct ndnd_handle *h,
                 ndn_buf_advance_past_element(d);
                 ex1end = pi->offset[NDN_PI_B_Exclude] + d->decoder.token_index;
                 if (d->decoder.state >= 0) {
-                    namebuf = ndn_charbuf_create();
+                    namebuf = charbuf_obtain(h);
                     ndn_charbuf_append(namebuf,
                                        interest_msg + start,
                                        end - start);
@@ -977,18 +1549,17 @@ find_first_match_candidate(struct ndnd_handle *h,
             }
         }
     }
-    if (namebuf == NULL) {
-        res = content_skiplist_findbefore(h, interest_msg + start, end - start,
-                                          NULL, pred);
-    }
+    key = charbuf_obtain(h);
+    if (namebuf == NULL)
+        res = ndn_nametree_namekey(key, interest_msg + start, end - start);
     else {
-        res = content_skiplist_findbefore(h, namebuf->buf, namebuf->length,
-                                          NULL, pred);
-        ndn_charbuf_destroy(&namebuf);
+        res = ndn_nametree_namekey(key, namebuf->buf, namebuf->length);
+        charbuf_release(h, namebuf);
     }
-    if (res == 0)
-        return(NULL);
-    return(content_from_accession(h, pred[0]->buf[0]));
+    if (res >= 0)
+        ans = content_tree_findfirst(h, key->buf, key->length);
+    charbuf_release(h, key);
+    return(ans);
 }
 
 /**
@@ -1018,16 +1589,59 @@ content_matches_interest_prefix(struct ndnd_handle *h,
 }
 
 /**
- * Advance to the next entry in the skiplist.
+ * Advance to the next entry in name order.
  */
-static ndn_accession_t
-content_skiplist_next(struct ndnd_handle *h, struct content_entry *content)
+static struct content_entry *
+content_tree_next(struct ndnd_handle *h, struct content_entry *content)
 {
     if (content == NULL)
-        return(0);
-    if (content->skiplinks == NULL || content->skiplinks->n < 1)
-        return(0);
-    return(content->skiplinks->buf[0]);
+        return(NULL);
+    return(content_from_tree(ndn_nametree_next(&content->tree)));
+}
+
+/**
+ * Look for stored content named by an interest that ends with its digest
+ *
+ * The content is stored without the implicit digest component, so the
+ * candidates are those named by the interest prefix less its last
+ * component.  Their tree keys all begin with that name and the length
+ * of a digest component.
+ * @returns the matching entry, or NULL if there is none.
+ */
+static struct content_entry *
+find_digest_match(struct ndnd_handle *h,
+                  const unsigned char *msg, size_t size,
+                  const struct ndn_parsed_interest *pi,
+                  struct ndn_indexbuf *comps)
+{
+    struct content_entry *content = NULL;
+    struct ndn_charbuf *name = charbuf_obtain(h);
+    struct ndn_charbuf *key = charbuf_obtain(h);
+    int n = pi->prefix_comps - 1;
+    int s_ok = (pi->answerfrom & NDN_AOK_STALE) != 0;
+    
+    ndn_name_init(name);
+    if (ndn_name_append_components(name, msg, comps->buf[0], comps->buf[n]) >= 0 &&
+        ndn_nametree_namekey(key, name->buf, name->length) >= 0) {
+        ndn_charbuf_append_value(key, CONTENT_DIGEST_SIZE, 2);
+        content = content_tree_findfirst(h, key->buf, key->length);
+    }
+    for (; content != NULL; content = content_tree_next(h, content)) {
+        if (content->tree.keysize < key->length ||
+            memcmp(content->tree.key, key->buf, key->length) != 0) {
+            content = NULL;
+            break;
+        }
+        /* A longer name may have a component the size of a digest */
+        if (content->ncomps != n + 1)
+            continue;
+        if ((s_ok || (content->flags & NDN_CONTENT_ENTRY_STALE) == 0) &&
+            content_matches_interest(h, content, NULL, msg, size, pi))
+            break;
+    }
+    charbuf_release(h, key);
+    charbuf_release(h, name);
+    return(content);
 }
 
 /**
@@ -1063,10 +1677,12 @@ finalize_nameprefix(struct hashtb_enumerator *e)
     }
     ndn_indexbuf_destroy(&npe->forward_to);
     ndn_indexbuf_destroy(&npe->tap);
+    free(npe->rtt_hist);
+    npe->rtt_hist = NULL;
     while (npe->forwarding != NULL) {
         struct ndn_forwarding *f = npe->forwarding;
         npe->forwarding = f->next;
-        free(f);
+        free_forwarding(h, f);
     }
 }
 
@@ -1077,47 +1693,201 @@ static void
 link_interest_entry_to_nameprefix(struct ndnd_handle *h,
     struct interest_entry *ie, struct nameprefix_entry *npe)
 {
-    struct ielinks *head = &npe->ie_head;
-    struct ielinks *ll = &ie->ll;
-    ll->next = head;
-    ll->prev = head->prev;
-    ll->prev->next = ll->next->prev = ll;
-    ll->npe = npe;
+    struct ielinks *head = &npe->ie_head;
+    struct ielinks *ll = &ie->ll;
+    ll->next = head;
+    ll->prev = head->prev;
+    ll->prev->next = ll->next->prev = ll;
+    ll->npe = npe;
+}
+
+/**
+ * Clean up an interest_entry when it is removed from its hash table.
+ */
+static void
+finalize_interest(struct hashtb_enumerator *e)
+{
+    struct pit_face_item *p = NULL;
+    struct pit_face_item *next = NULL;
+    struct ndnd_handle *h = hashtb_get_param(e->ht, NULL);
+    struct interest_entry *ie = e->data;
+    struct face *face = NULL;
+
+    if (ie->ev != NULL)
+        ndn_schedule_cancel(h->sched, ie->ev);
+    if (ie->strategy.ev != NULL)
+        ndn_schedule_cancel(h->sched, ie->strategy.ev);
+    if (ie->ll.next != NULL) {
+        ie->ll.next->prev = ie->ll.prev;
+        ie->ll.prev->next = ie->ll.next;
+        ie->ll.next = ie->ll.prev = NULL;
+        ie->ll.npe = NULL;
+    }
+    for (p = ie->pfl; p != NULL; p = next) {
+        next = p->next;
+        if ((p->pfi_flags & NDND_PFI_PENDING) != 0) {
+            face = face_from_faceid(h, p->faceid);
+            if (face != NULL)
+                face->pending_interests -= 1;
+        }
+        pfi_free(h, p);
+    }
+    ie->pfl = NULL;
+    ie->interest_msg = NULL; /* part of hashtb, don't free this */
+}
+
+/** How long a nonce is remembered */
+#define NONCE_LIFETIME (6 * WTHZ)
+
+/**
+ * Set up the approximate nonce filter
+ *
+ * @param n is the expected number of interests per nonce lifetime
+ * @param bits is the number of filter bits per interest; more bits
+ *        mean fewer false duplicates.
+ * @returns 0 for success, -1 for failure.
+ */
+static int
+nonce_filter_init(struct ndnd_handle *h, unsigned long n, unsigned bits)
+{
+    struct nonce_filter *nf = NULL;
+    unsigned long nblocks;
+    
+    /* Each interest may add two keys, the nonce and nonce+faceid */
+    nblocks = (2 * n * bits + 511) / 512;
+    if (nblocks == 0 || nblocks > (1UL << 24))
+        return(-1);
+    nf = calloc(1, sizeof(*nf));
+    if (nf == NULL)
+        return(-1);
+    nf->nblocks = nblocks;
+    nf->nhash = (bits * 9 + 6) / 13; /* about bits * ln(2) */
+    if (nf->nhash < 1)
+        nf->nhash = 1;
+    if (nf->nhash > 16)
+        nf->nhash = 16;
+    nf->cur = calloc(nblocks * 8, sizeof(uint64_t));
+    nf->old = calloc(nblocks * 8, sizeof(uint64_t));
+    if (nf->cur == NULL || nf->old == NULL) {
+        free(nf->cur);
+        free(nf->old);
+        free(nf);
+        return(-1);
+    }
+    nf->rotated = h->wtnow;
+    h->nonce_filter = nf;
+    return(0);
+}
+
+static void
+nonce_filter_destroy(struct ndnd_handle *h)
+{
+    struct nonce_filter *nf = h->nonce_filter;
+    if (nf == NULL)
+        return;
+    free(nf->cur);
+    free(nf->old);
+    free(nf);
+    h->nonce_filter = NULL;
+}
+
+/**
+ * Hash a nonce, optionally qualified by a faceid
+ */
+static uint64_t
+nonce_filter_hash(const unsigned char *nonce, size_t size, unsigned salt)
+{
+    uint64_t x = 0xcbf29ce484222325ULL ^ ((uint64_t)salt << 32);
+    size_t i;
+    
+    for (i = 0; i < size; i++)
+        x = (x ^ nonce[i]) * 0x100000001b3ULL;
+    /* FNV alone mixes the high bits poorly, so finish it off */
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return(x);
+}
+
+/**
+ * Test for, or add, a key in one filter
+ * @returns 1 if all of the key's bits were already set
+ */
+static int
+nonce_filter_probe(struct nonce_filter *nf, uint64_t *f, uint64_t x, int add)
+{
+    uint64_t *block = f + 8 * (unsigned)((x >> 32) % nf->nblocks);
+    unsigned b = (unsigned)x;
+    unsigned step = (unsigned)(x >> 41) | 1;
+    unsigned i;
+    uint64_t m;
+    int found = 1;
+    
+    for (i = 0; i < nf->nhash; i++, b += step) {
+        m = 1ULL << (b & 63);
+        if ((block[(b >> 6) & 7] & m) == 0) {
+            if (!add)
+                return(0);
+            found = 0;
+            block[(b >> 6) & 7] |= m;
+        }
+    }
+    return(found);
+}
+
+static int
+nonce_filter_seen(struct nonce_filter *nf, uint64_t x)
+{
+    return(nonce_filter_probe(nf, nf->cur, x, 0) ||
+           nonce_filter_probe(nf, nf->old, x, 0));
 }
 
 /**
- * Clean up an interest_entry when it is removed from its hash table.
+ * Filter-based counterpart of the nonce table lookup
+ *
+ * The nonce is remembered along with the nonce qualified by the
+ * originating faceid, so that a refresh from the same face can be told
+ * apart from a duplicate.  False positives show up as spurious
+ * duplicates; a nonce is never forgotten before its lifetime is up.
  */
-static void
-finalize_interest(struct hashtb_enumerator *e)
-{
-    struct pit_face_item *p = NULL;
-    struct pit_face_item *next = NULL;
-    struct ndnd_handle *h = hashtb_get_param(e->ht, NULL);
-    struct interest_entry *ie = e->data;
-    struct face *face = NULL;
-
-    if (ie->ev != NULL)
-        ndn_schedule_cancel(h->sched, ie->ev);
-    if (ie->strategy.ev != NULL)
-        ndn_schedule_cancel(h->sched, ie->strategy.ev);
-    if (ie->ll.next != NULL) {
-        ie->ll.next->prev = ie->ll.prev;
-        ie->ll.prev->next = ie->ll.next;
-        ie->ll.next = ie->ll.prev = NULL;
-        ie->ll.npe = NULL;
-    }
-    for (p = ie->pfl; p != NULL; p = next) {
-        next = p->next;
-        if ((p->pfi_flags & NDND_PFI_PENDING) != 0) {
-            face = face_from_faceid(h, p->faceid);
-            if (face != NULL)
-                face->pending_interests -= 1;
-        }
-        free(p);
-    }
-    ie->pfl = NULL;
-    ie->interest_msg = NULL; /* part of hashtb, don't free this */
+static int
+nonce_filter_ok(struct ndnd_handle *h, struct face *face,
+                const unsigned char *nonce, size_t noncesize)
+{
+    struct nonce_filter *nf = h->nonce_filter;
+    unsigned faceid = (face != NULL) ? face->faceid : NDN_NO_FACEID;
+    uint64_t *t;
+    uint64_t xn;
+    uint64_t xf;
+    int res;
+    
+    if (wt_compare(h->wtnow, nf->rotated + NONCE_LIFETIME) >= 0) {
+        t = nf->old;
+        nf->old = nf->cur;
+        nf->cur = t;
+        if (wt_compare(h->wtnow, nf->rotated + 2 * NONCE_LIFETIME) >= 0)
+            memset(nf->old, 0, nf->nblocks * 8 * sizeof(uint64_t));
+        memset(nf->cur, 0, nf->nblocks * 8 * sizeof(uint64_t));
+        nf->rotated = h->wtnow;
+        nf->n_inserted = 0;
+        nf->n_rotations++;
+    }
+    xn = nonce_filter_hash(nonce, noncesize, 0);
+    xf = nonce_filter_hash(nonce, noncesize, faceid + 1);
+    if (face != NULL && nonce_filter_seen(nf, xf))
+        res = 2;
+    else if (nonce_filter_seen(nf, xn))
+        res = 0;
+    else
+        res = 1;
+    /* Refresh, but only the originating face gets the qualified key */
+    nonce_filter_probe(nf, nf->cur, xn, 1);
+    if (res != 0)
+        nonce_filter_probe(nf, nf->cur, xf, 1);
+    nf->n_inserted++;
+    return(res);
 }
 
 /**
@@ -1127,7 +1897,8 @@ finalize_interest(struct hashtb_enumerator *e)
  * be used.
  *
  * The nonce will be added to the nonce table if it is not already there.
- * Some expired entries may be trimmed.
+ * Some expired entries may be trimmed.  If NDND_NONCE_FILTER is set,
+ * an approximate filter stands in for the table.
  *
  * @returns 0 if a duplicate, unexpired nonce exists, 1 if nonce is new,
  *          2 if duplicate is from originating face, or 3 if the interest
@@ -1154,6 +1925,8 @@ nonce_ok(struct ndnd_handle *h, struct face *face,
                             pi->offset[NDN_PI_E_Nonce],
                             &nonce, &noncesize);
     }
+    if (h->nonce_filter != NULL)
+        return(nonce_filter_ok(h, face, nonce, noncesize));
     hashtb_start(h->nonce_tab, e);
     /* Remove a few expired nonces */
     for (i = 0; i < 10; i++) {
@@ -1197,7 +1970,7 @@ nonce_ok(struct ndnd_handle *h, struct face *face,
     nce->ll.next = &h->ncehead;
     nce->ll.prev = h->ncehead.prev;
     nce->ll.next->prev = nce->ll.prev->next = &nce->ll;
-    nce->expiry = h->wtnow + 6 * WTHZ; // XXX hardcoded 6 seconds
+    nce->expiry = h->wtnow + NONCE_LIFETIME;
     hashtb_end(e);
     return(res);
 }
@@ -1613,7 +2386,7 @@ shutdown_client_fd(struct ndnd_handle *h, int fd)
 static void
 send_content(struct ndnd_handle *h, struct face *face, struct content_entry *content)
 {
-    int n, a, b, size;
+    int size;
     if ((face->flags & NDN_FACE_NOSEND) != 0) {
         // XXX - should count this.
         return;
@@ -1622,14 +2395,7 @@ send_content(struct ndnd_handle *h, struct face *face, struct content_entry *con
     if (h->debug & 4)
         ndnd_debug_ndnb(h, __LINE__, "content_to", face,
                         content->key, size);
-    /* Excise the message-digest name component */
-    n = content->ncomps;
-    if (n < 2) abort();
-    a = content->comps[n - 2];
-    b = content->comps[n - 1];
-    if (b - a != 36)
-        abort(); /* strange digest length */
-    stuff_and_send(h, face, content->key, a, content->key + b, size - b, 0, 0);
+    stuff_and_send(h, face, content->key, size, NULL, 0, 0, 0);
     ndnd_meter_bump(h, face->meter[FM_DATO], 1);
     h->content_items_sent += 1;
 }
@@ -1690,6 +2456,8 @@ content_sender(struct ndn_schedule *sched,
     int nsec;
     int burst_nsec;
     int burst_max;
+    int tc;
+    unsigned shaped;
     struct ndnd_handle *h = clienth;
     struct content_entry *content = NULL;
     unsigned faceid = ev->evint;
@@ -1706,6 +2474,9 @@ content_sender(struct ndn_schedule *sched,
         goto Bail;
     if ((face->flags & NDN_FACE_NOSEND) != 0)
         goto Bail;
+    for (tc = 0; tc < NDN_CQ_N && face->q[tc] != q; tc++)
+        continue;
+    shaped = 0;
     /* Send the content at the head of the queue */
     if (q->ready > q->send_queue->n ||
         (q->ready == 0 && q->nrun >= 12 && q->nrun < 120))
@@ -1722,6 +2493,12 @@ content_sender(struct ndn_schedule *sched,
         if (content == NULL)
             q->nrun = 0;
         else {
+            shaped = face_shaper_admit(h, face, tc, content->size);
+            if (shaped != 0)
+                break;
+            if (i < q->enqueued->n)
+                ndnd_hist_add(&face->queue_hist,
+                              shaper_clock(h) - q->enqueued->buf[i]);
             send_content(h, face, content);
             /* face may have vanished, bail out if it did */
             if (face_from_faceid(h, faceid) == NULL)
@@ -1733,11 +2510,18 @@ content_sender(struct ndn_schedule *sched,
     if (q->ready < i) abort();
     q->ready -= i;
     /* Update queue */
-    for (j = 0; i < q->send_queue->n; i++, j++)
+    for (j = 0; i < q->send_queue->n; i++, j++) {
         q->send_queue->buf[j] = q->send_queue->buf[i];
+        if (i < q->enqueued->n)
+            q->enqueued->buf[j] = q->enqueued->buf[i];
+    }
     q->send_queue->n = j;
+    if (q->enqueued->n > j)
+        q->enqueued->n = j;
     /* Do a poll before going on to allow others to preempt send. */
     delay = (nsec + 499) / 1000 + 1;
+    if (shaped != 0)
+        delay = shaped; /* over the face's rate limit */
     if (q->ready > 0) {
         if (h->debug & 8)
             ndnd_msg(h, "face %u ready %u delay %i nrun %u",
@@ -1766,7 +2550,9 @@ content_sender(struct ndn_schedule *sched,
             return(delay);
         }
     }
-    q->send_queue->n = q->ready = 0;
+    q->send_queue->n = q->enqueued->n = q->ready = 0;
+    if (tc < NDN_CQ_N)
+        face_shaper_idle(face, tc);
 Bail:
     q->sender = NULL;
     return(0);
@@ -1805,6 +2591,8 @@ face_send_queue_insert(struct ndnd_handle *h,
         }
     }
     ans = ndn_indexbuf_set_insert(q->send_queue, content->accession);
+    if (ans >= 0 && ans == q->enqueued->n)
+        ndn_indexbuf_append_element(q->enqueued, shaper_clock(h));
     if (q->sender == NULL) {
         delay = randomize_content_delay(h, q);
         q->ready = q->send_queue->n;
@@ -1840,6 +2628,7 @@ is_pending_on(struct ndnd_handle *h, struct interest_entry *ie, unsigned faceid)
  * If face is not NULL, pay attention only to interests from that face.
  * It is allowed to pass NULL for pc, but if you have a (valid) one it
  * will avoid a re-parse.
+ * from_face, if not NULL, is where new content came from.
  * @returns number of matches found.
  */
 static int
@@ -1847,7 +2636,8 @@ consume_matching_interests(struct ndnd_handle *h,
                            struct nameprefix_entry *npe,
                            struct content_entry *content,
                            struct ndn_parsed_ContentObject *pc,
-                           struct face *face)
+                           struct face *face,
+                           struct face *from_face)
 {
     int matches = 0;
     struct ielinks *head;
@@ -1855,12 +2645,8 @@ consume_matching_interests(struct ndnd_handle *h,
     struct ielinks *pl;
     struct interest_entry *p;
     struct pit_face_item *x;
-    const unsigned char *content_msg;
-    size_t content_size;
     
     head = &npe->ie_head;
-    content_msg = content->key;
-    content_size = content->size;
     for (pl = head->next; pl != head; pl = next) {
         next = pl->next;
         p = (struct interest_entry *)pl;
@@ -1868,15 +2654,16 @@ consume_matching_interests(struct ndnd_handle *h,
             continue;
         if (face != NULL && is_pending_on(h, p, face->faceid) == 0)
             continue;
-        if (ndn_content_matches_interest(content_msg, content_size, 0, pc,
-                                         p->interest_msg, p->size, NULL)) {
+        if (content_matches_interest(h, content, pc,
+                                     p->interest_msg, p->size, &p->pi)) {
             for (x = p->pfl; x != NULL; x = x->next) {
                 if ((x->pfi_flags & NDND_PFI_PENDING) != 0)
                     face_send_queue_insert(h, face_from_faceid(h, x->faceid),
                                            content);
             }
             matches += 1;
-            strategy_callout(h, p, NDNST_SATISFIED);
+            strategy_callout(h, p, NDNST_SATISFIED,
+                             from_face ? from_face->faceid : NDN_NOFACEID);
             consume_interest(h, p);
         }
     }
@@ -1968,22 +2755,61 @@ match_interests(struct ndnd_handle *h, struct content_entry *content,
     int new_matches;
     int ci;
     int cm = 0;
+    struct ndn_parsed_ContentObject pc_store;
     unsigned c0 = content->comps[0];
     const unsigned char *key = content->key + c0;
     struct nameprefix_entry *npe = NULL;
+    struct nameprefix_entry *dnpe = NULL;
+    struct ndn_charbuf *dkey = NULL;
+    struct ndn_indexbuf *hashes = indexbuf_obtain(h);
+    size_t hash = HASHTB_HASH_INIT;
+    /* Hash all the prefixes in one pass, then look for the longest */
+    for (ci = 0; ci < content->ncomps; ci++) {
+        if (ci > 0)
+            hash = hashtb_hash_more(hash, content->key + content->comps[ci - 1],
+                                    content->comps[ci] - content->comps[ci - 1]);
+        ndn_indexbuf_append_element(hashes, hash);
+    }
     for (ci = content->ncomps - 1; ci >= 0; ci--) {
         int size = content->comps[ci] - c0;
-        npe = hashtb_lookup(h->nameprefix_tab, key, size);
+        npe = hashtb_lookup_hashed(h->nameprefix_tab, key, size, hashes->buf[ci]);
         if (npe != NULL)
             break;
     }
+    indexbuf_release(h, hashes);
+    if (npe != NULL && pc == NULL) {
+        /* Parse once here rather than once per candidate interest */
+        if (ndn_parse_ContentObject(content->key, content->size,
+                                    &pc_store, NULL) >= 0)
+            pc = &pc_store;
+    }
+    if (npe != NULL && pc != NULL &&
+        ci == content->ncomps - 1 && npe->children != 0) {
+        /* There may be interests that name the content by its digest */
+        content_share_digest(h, content, pc);
+        ndn_digest_ContentObject(content->key, pc);
+        content_share_digest(h, content, pc);
+        dkey = charbuf_obtain(h);
+        ndn_charbuf_append(dkey, key, content->comps[ci] - c0);
+        ndn_charbuf_append_tt(dkey, NDN_DTAG_Component, NDN_DTAG);
+        ndn_charbuf_append_tt(dkey, pc->digest_bytes, NDN_BLOB);
+        ndn_charbuf_append(dkey, pc->digest, pc->digest_bytes);
+        ndn_charbuf_append_closer(dkey);
+        dnpe = hashtb_lookup(h->nameprefix_tab, dkey->buf, dkey->length);
+        charbuf_release(h, dkey);
+        if (dnpe != NULL) {
+            npe = dnpe;
+            ci++;
+        }
+    }
     for (; npe != NULL; npe = npe->parent, ci--) {
-        if (npe->fgen != h->forward_to_gen)
+        if (forward_to_stale(h, npe))
             update_forward_to(h, npe);
         if (from_face != NULL && (npe->flags & NDN_FORW_LOCAL) != 0 &&
             (from_face->flags & NDN_FACE_GG) == 0)
             return(-1);
-        new_matches = consume_matching_interests(h, npe, content, pc, face);
+        new_matches = consume_matching_interests(h, npe, content, pc, face,
+                                                 from_face);
         if (from_face != NULL && (new_matches != 0 || ci + 1 == cm))
             note_content_from(h, npe, from_face->faceid, ci);
         if (new_matches != 0) {
@@ -1994,6 +2820,147 @@ match_interests(struct ndnd_handle *h, struct content_entry *content,
     return(n_matched);
 }
 
+/**
+ * Send the messages that have been coalesced on a face, in one PDU.
+ */
+static void
+face_coalesce_flush(struct ndnd_handle *h, struct face *face)
+{
+    struct ndn_charbuf *c = NULL;
+    
+    if (face->coalesce_flusher != NULL) {
+        struct ndn_scheduled_event *ev = face->coalesce_flusher;
+        face->coalesce_flusher = NULL;
+        ndn_schedule_cancel(h->sched, ev);
+    }
+    if (face->coalesce == NULL || face->coalesce->length == 0)
+        return;
+    c = charbuf_obtain(h);
+    ndn_charbuf_reserve(c, face->coalesce->length + 5 + 8);
+    ndn_charbuf_append_tt(c, NDN_DTAG_NDNProtocolDataUnit, NDN_DTAG);
+    ndn_charbuf_append(c, face->coalesce->buf, face->coalesce->length);
+    ndn_stuff_interest(h, face, c);
+    ndn_append_link_stuff(h, face, c);
+    ndn_charbuf_append_closer(c);
+    face->coalesce->length = 0;
+    h->pdus_coalesced++;
+    ndnd_send(h, face, c->buf, c->length);
+    charbuf_release(h, c);
+}
+
+/**
+ * Flush a face's coalesced messages when their deadline comes.
+ */
+static int
+coalesce_flusher(struct ndn_schedule *sched,
+                 void *clienth,
+                 struct ndn_scheduled_event *ev,
+                 int flags)
+{
+    struct ndnd_handle *h = clienth;
+    struct face *face = ev->evdata;
+    (void)(sched);
+    
+    if ((flags & NDN_SCHEDULE_CANCEL) != 0) {
+        if (face->coalesce_flusher == ev)
+            face->coalesce_flusher = NULL;
+        return(0);
+    }
+    face->coalesce_flusher = NULL;
+    face_coalesce_flush(h, face);
+    return(0);
+}
+
+/**
+ * Add a message, which may be in two pieces, to a face's coalescing buffer.
+ *
+ * The buffer goes out as one PDU when it reaches the face's size
+ * threshold or when the oldest message in it has waited coalesce_usec.
+ * @returns 0, or -1 if the message should be sent on its own, in which
+ *          case anything that was waiting has already gone ahead of it.
+ */
+static int
+face_coalesce(struct ndnd_handle *h, struct face *face,
+              const unsigned char *data1, size_t size1,
+              const unsigned char *data2, size_t size2)
+{
+    size_t size = size1 + size2;
+    size_t limit = face->coalesce_bytes;
+    
+    if (limit == 0)
+        limit = NDND_COALESCE_BYTES;
+    if (size >= limit) {
+        face_coalesce_flush(h, face);
+        return(-1);
+    }
+    if (face->coalesce == NULL) {
+        face->coalesce = ndn_charbuf_create();
+        if (face->coalesce == NULL)
+            return(-1);
+    }
+    if (face->coalesce->length + size > limit)
+        face_coalesce_flush(h, face);
+    ndn_charbuf_append(face->coalesce, data1, size1);
+    if (size2 != 0)
+        ndn_charbuf_append(face->coalesce, data2, size2);
+    h->msgs_coalesced++;
+    /* No point waiting if hardly anything else would fit */
+    if (face->coalesce->length + 64 > limit)
+        face_coalesce_flush(h, face);
+    else if (face->coalesce_flusher == NULL)
+        face->coalesce_flusher = ndn_schedule_event(h->sched,
+                                                    face->coalesce_usec,
+                                                    coalesce_flusher,
+                                                    face, face->faceid);
+    return(0);
+}
+
+/**
+ * Set the coalescing deadline and size threshold of a face.
+ *
+ * A deadline of 0 turns coalescing off, sending anything waiting.
+ */
+static void
+face_coalesce_set(struct ndnd_handle *h, struct face *face,
+                  unsigned usec, unsigned bytes)
+{
+    if (usec > 1000000)
+        usec = 1000000;
+    if (bytes > 8800)
+        bytes = 8800;
+    if (usec == 0) {
+        face_coalesce_flush(h, face);
+        bytes = 0;
+    }
+    face->coalesce_usec = usec;
+    face->coalesce_bytes = bytes;
+}
+
+/**
+ * Log a message that is to be sent in two pieces
+ *
+ * The pieces are copied together only for the log line, so that the
+ * message itself can still be gathered on send.
+ */
+static void
+debug_parts(struct ndnd_handle *h, int lineno, const char *tag,
+            struct face *face,
+            const unsigned char *data1, size_t size1,
+            const unsigned char *data2, size_t size2)
+{
+    struct ndn_charbuf *c;
+    
+    if (size2 == 0) {
+        ndnd_debug_ndnb(h, lineno, tag, face, data1, size1);
+        return;
+    }
+    c = charbuf_obtain(h);
+    ndn_charbuf_append(c, data1, size1);
+    ndn_charbuf_append(c, data2, size2);
+    ndnd_debug_ndnb(h, lineno, tag, face, c->buf, c->length);
+    charbuf_release(h, c);
+}
+
 /**
  * Send a message in a PDU, possibly stuffing other interest messages into it.
  * The message may be in two pieces.
@@ -2005,6 +2972,13 @@ stuff_and_send(struct ndnd_handle *h, struct face *face,
                const char *tag, int lineno) {
     struct ndn_charbuf *c = NULL;
     
+    if (face->coalesce_usec != 0 &&
+        (face->flags & (NDN_FACE_DGRAM | NDN_FACE_NOSEND)) == NDN_FACE_DGRAM &&
+        face_coalesce(h, face, data1, size1, data2, size2) == 0) {
+        if (tag != NULL)
+            debug_parts(h, lineno, tag, face, data1, size1, data2, size2);
+        return;
+    }
     if ((face->flags & NDN_FACE_LINK) != 0) {
         c = charbuf_obtain(h);
         ndn_charbuf_reserve(c, size1 + size2 + 5 + 8);
@@ -2018,8 +2992,8 @@ stuff_and_send(struct ndnd_handle *h, struct face *face,
         ndn_append_link_stuff(h, face, c);
         ndn_charbuf_append_closer(c);
     }
-    else if (size2 != 0 || h->mtu > size1 + size2 ||
-             (face->flags & (NDN_FACE_SEQOK | NDN_FACE_SEQPROBE)) != 0 ||
+    else if (h->mtu > size1 + size2 ||
+             (face->flags & (NDN_FACE_SEQOK | NDN_FACE_SEQPROBE | NDN_FACE_CM)) != 0 ||
              face->recvcount == 0) {
         c = charbuf_obtain(h);
         ndn_charbuf_append(c, data1, size1);
@@ -2031,10 +3005,10 @@ stuff_and_send(struct ndnd_handle *h, struct face *face,
         ndn_append_link_stuff(h, face, c);
     }
     else {
-        /* avoid a copy in this case */
+        /* avoid a copy in this case; the pieces are gathered on send */
         if (tag != NULL)
-            ndnd_debug_ndnb(h, lineno, tag, face, data1, size1);
-        ndnd_send(h, face, data1, size1);
+            debug_parts(h, lineno, tag, face, data1, size1, data2, size2);
+        ndnd_send_parts(h, face, data1, size1, data2, size2);
         return;
     }
     ndnd_send(h, face, c->buf, c->length);
@@ -2124,24 +3098,410 @@ ndn_link_state_init(struct ndnd_handle *h, struct face *face)
 }
 
 /**
- * Append a sequence number if appropriate.
+ * Append a congestion mark and a sequence number if appropriate.
+ */
+static void
+ndn_append_link_stuff(struct ndnd_handle *h,
+                      struct face *face,
+                      struct ndn_charbuf *c)
+{
+    if ((face->flags & NDN_FACE_CM) != 0) {
+        ndn_charbuf_append_tt(c, NDN_DTAG_CongestionMark, NDN_DTAG);
+        ndnb_element_end(c);
+        face->flags &= ~NDN_FACE_CM;
+        h->cmarks_sent++;
+    }
+    if ((face->flags & (NDN_FACE_SEQOK | NDN_FACE_SEQPROBE)) == 0)
+        return;
+    ndn_charbuf_append_tt(c, NDN_DTAG_SequenceNumber, NDN_DTAG);
+    ndn_charbuf_append_tt(c, 2, NDN_BLOB);
+    ndn_charbuf_append_value(c, face->pktseq, 2);
+    ndnb_element_end(c);
+    if (0)
+        ndnd_msg(h, "debug.%d pkt_to %u seq %u",
+                 __LINE__, face->faceid, (unsigned)face->pktseq);
+    face->pktseq++;
+    face->flags &= ~NDN_FACE_SEQPROBE;
+}
+
+/**
+ * Append a 4-byte SequenceNumber element.
+ */
+static void
+append_link_seq(struct ndn_charbuf *c, unsigned seq)
+{
+    ndn_charbuf_append_tt(c, NDN_DTAG_SequenceNumber, NDN_DTAG);
+    ndn_charbuf_append_tt(c, 4, NDN_BLOB);
+    ndn_charbuf_append_value(c, seq, 4);
+    ndnb_element_end(c);
+}
+
+/**
+ * Get the fragmentation state of a face, creating it if need be.
+ */
+static struct ndnd_linkfrag *
+link_frag_state(struct ndnd_handle *h, struct face *face)
+{
+    struct ndnd_linkfrag *lf = face->frag;
+    if (lf == NULL) {
+        lf = calloc(1, sizeof(*lf));
+        if (lf == NULL)
+            return(NULL);
+        lf->reasm = ndn_reasm_create(NDND_REASM_N, NDND_REASM_BYTES,
+                                     NDND_REASM_USEC);
+        if (lf->reasm == NULL) {
+            free(lf);
+            return(NULL);
+        }
+        lf->seq = nrand48(h->seed);
+        face->frag = lf;
+    }
+    return(lf);
+}
+
+/**
+ * Discard the fragmentation state of a face.
+ */
+static void
+link_frag_destroy(struct ndnd_handle *h, struct ndnd_linkfrag **plf)
+{
+    struct ndnd_linkfrag *lf = *plf;
+    int i;
+    if (lf == NULL)
+        return;
+    if (lf->arq_ev != NULL)
+        ndn_schedule_cancel(h->sched, lf->arq_ev);
+    ndn_reasm_destroy(&lf->reasm);
+    for (i = 0; i < NDND_ARQ_N; i++)
+        ndn_charbuf_destroy(&lf->arq[i].pdu);
+    free(lf);
+    *plf = NULL;
+}
+
+/**
+ * Retransmission timeout for link fragments, in microseconds.
+ */
+static unsigned
+link_arq_rto(struct ndnd_linkfrag *lf)
+{
+    unsigned rto;
+    if (lf->srtt == 0)
+        return(100000);
+    rto = lf->srtt + 4 * lf->rttvar;
+    if (rto < 5000)
+        rto = 5000;
+    if (rto > 1000000)
+        rto = 1000000;
+    return(rto);
+}
+
+/**
+ * Fold an acknowledgement round-trip time into the link estimates.
+ */
+static void
+link_arq_rtt_sample(struct ndnd_linkfrag *lf, unsigned usec)
+{
+    unsigned err;
+    
+    if (usec == 0)
+        usec = 1;
+    if (lf->srtt == 0) {
+        lf->srtt = usec;
+        lf->rttvar = usec / 2;
+        return;
+    }
+    err = (lf->srtt > usec) ? lf->srtt - usec : usec - lf->srtt;
+    lf->rttvar = lf->rttvar - (lf->rttvar >> 2) + (err >> 2);
+    lf->srtt = lf->srtt - (lf->srtt >> 3) + (usec >> 3);
+}
+
+/**
+ * How long to wait for the acknowledgement of a fragment.
+ *
+ * Backs off with each try, but not past the point where the other
+ * side would have given up on the message anyway.
+ */
+static unsigned
+link_arq_wait(struct ndnd_linkfrag *lf, struct ndnd_arq *a)
+{
+    unsigned wait = link_arq_rto(lf);
+    unsigned i;
+    for (i = 1; i < a->tries && wait < NDND_REASM_USEC / 2; i++)
+        wait *= 2;
+    if (wait > NDND_REASM_USEC / 2)
+        wait = NDND_REASM_USEC / 2;
+    return(wait);
+}
+
+/**
+ * Retransmit link fragments that have not been acknowledged in time.
+ */
+static int
+link_arq_daemon(struct ndn_schedule *sched,
+                void *clienth,
+                struct ndn_scheduled_event *ev,
+                int flags)
+{
+    struct ndnd_handle *h = clienth;
+    struct ndnd_linkfrag *lf = ev->evdata;
+    struct face *face = NULL;
+    struct ndnd_arq *a = NULL;
+    unsigned now;
+    unsigned wait;
+    unsigned age;
+    unsigned next = 0;
+    int i;
+    (void)(sched);
+    
+    if ((flags & NDN_SCHEDULE_CANCEL) != 0) {
+        lf->arq_ev = NULL;
+        return(0);
+    }
+    face = ndnd_face_from_faceid(h, ev->evint);
+    if (face == NULL || face->frag != lf)
+        return(0);
+    now = shaper_clock(h);
+    for (i = 0; i < NDND_ARQ_N; i++) {
+        a = &lf->arq[i];
+        if (a->tries == 0)
+            continue;
+        wait = link_arq_wait(lf, a);
+        age = now - a->sent;
+        if (age >= wait) {
+            if (a->tries > h->frag_retries) {
+                a->tries = 0;
+                h->frags_dropped++;
+                continue;
+            }
+            ndnd_send(h, face, a->pdu->buf, a->pdu->length);
+            a->tries++;
+            a->sent = now;
+            h->frags_resent++;
+            wait = link_arq_wait(lf, a);
+            age = 0;
+        }
+        if (next == 0 || wait - age < next)
+            next = wait - age;
+    }
+    if (next == 0)
+        lf->arq_ev = NULL;
+    return(next);
+}
+
+/**
+ * Send a datagram that is too big for the link as a series of fragments.
+ *
+ * @returns 0 if the fragments were sent, or -1 if the caller should
+ *          send the datagram whole.
+ */
+static int
+ndnd_send_fragments(struct ndnd_handle *h, struct face *face,
+                    const unsigned char *data1, size_t size1,
+                    const unsigned char *data2, size_t size2)
+{
+    struct ndnd_linkfrag *lf = NULL;
+    struct ndnd_arq *a = NULL;
+    struct ndn_charbuf *c = NULL;
+    size_t size = size1 + size2;
+    size_t payload = h->frag_mtu - NDND_FRAG_OVERHEAD;
+    size_t off;
+    size_t len;
+    size_t n;
+    unsigned count;
+    unsigned i;
+    int arq;
+    
+    count = (size + payload - 1) / payload;
+    if (count > NDND_FRAG_MAX)
+        return(-1);
+    lf = link_frag_state(h, face);
+    if (lf == NULL)
+        return(-1);
+    arq = (h->frag_retries > 0 && (face->flags & NDN_FACE_MCAST) == 0);
+    /* Even out the sizes so the last fragment is not a runt */
+    payload = (size + count - 1) / count;
+    for (i = 0, off = 0; i < count; i++, off += len, lf->seq++) {
+        len = (size - off < payload) ? size - off : payload;
+        c = charbuf_obtain(h);
+        ndn_charbuf_append_tt(c, NDN_DTAG_NDNProtocolDataUnit, NDN_DTAG);
+        ndn_charbuf_append_tt(c, NDN_DTAG_LinkFragment, NDN_DTAG);
+        append_link_seq(c, lf->seq);
+        ndnb_tagged_putf(c, NDN_DTAG_FragIndex, "%u", i);
+        ndnb_tagged_putf(c, NDN_DTAG_FragCount, "%u", count);
+        if (arq) {
+            /* An empty LinkAck asks the other side to acknowledge */
+            ndn_charbuf_append_tt(c, NDN_DTAG_LinkAck, NDN_DTAG);
+            ndn_charbuf_append_closer(c);
+        }
+        ndn_charbuf_append_tt(c, NDN_DTAG_Content, NDN_DTAG);
+        ndn_charbuf_append_tt(c, len, NDN_BLOB);
+        n = 0;
+        if (off < size1) {
+            n = (size1 - off < len) ? size1 - off : len;
+            ndn_charbuf_append(c, data1 + off, n);
+        }
+        if (n < len)
+            ndn_charbuf_append(c, data2 + (off + n - size1), len - n);
+        ndn_charbuf_append_closer(c); /* </Content> */
+        ndn_charbuf_append_closer(c); /* </LinkFragment> */
+        ndn_charbuf_append_closer(c); /* </NDNProtocolDataUnit> */
+        ndnd_send(h, face, c->buf, c->length);
+        h->frags_sent++;
+        if (arq) {
+            a = &lf->arq[lf->seq % NDND_ARQ_N];
+            if (a->tries != 0)
+                h->frags_dropped++; /* window full, oldest goes */
+            a->tries = 0;
+            if (a->pdu == NULL)
+                a->pdu = ndn_charbuf_create();
+            if (a->pdu != NULL) {
+                a->pdu->length = 0;
+                ndn_charbuf_append(a->pdu, c->buf, c->length);
+                a->seq = lf->seq;
+                a->sent = shaper_clock(h);
+                a->tries = 1;
+            }
+        }
+        charbuf_release(h, c);
+    }
+    if (arq && lf->arq_ev == NULL)
+        lf->arq_ev = ndn_schedule_event(h->sched, link_arq_rto(lf),
+                                        link_arq_daemon, lf, face->faceid);
+    return(0);
+}
+
+/**
+ * Acknowledge a link fragment.
+ */
+static void
+send_link_ack(struct ndnd_handle *h, struct face *face, unsigned seq)
+{
+    struct ndn_charbuf *c = charbuf_obtain(h);
+    
+    ndn_charbuf_append_tt(c, NDN_DTAG_NDNProtocolDataUnit, NDN_DTAG);
+    ndn_charbuf_append_tt(c, NDN_DTAG_LinkAck, NDN_DTAG);
+    append_link_seq(c, seq);
+    ndn_charbuf_append_closer(c); /* </LinkAck> */
+    ndn_charbuf_append_closer(c); /* </NDNProtocolDataUnit> */
+    ndnd_send(h, face, c->buf, c->length);
+    charbuf_release(h, c);
+}
+
+/**
+ * Handle a reassembled datagram as if it had just been received.
+ */
+static void
+process_reassembled(struct ndnd_handle *h, struct face *face,
+                    unsigned char *msg, size_t size)
+{
+    struct ndn_skeleton_decoder decoder = {0};
+    struct ndn_skeleton_decoder *d = &decoder;
+    ssize_t dres;
+    
+    while (d->index < size) {
+        dres = ndn_skeleton_decode(d, msg + d->index, size - d->index);
+        if (d->state != 0)
+            break;
+        process_input_message(h, face, msg + d->index - dres, dres, 1);
+    }
+    if (d->index != size)
+        ndnd_msg(h, "protocol error on face %u (reassembled), discarding %d bytes",
+                 face->faceid, (int)(size - d->index));
+}
+
+/**
+ * Process an incoming LinkFragment, passing the message up when complete.
+ */
+static int
+process_incoming_fragment(struct ndnd_handle *h, struct face *face,
+                          unsigned char *msg, size_t size)
+{
+    struct ndn_buf_decoder decoder;
+    struct ndn_buf_decoder *d = ndn_buf_decoder_start(&decoder, msg, size);
+    struct ndnd_linkfrag *lf = NULL;
+    struct ndn_charbuf *c = NULL;
+    const unsigned char *piece = NULL;
+    size_t piece_size = 0;
+    unsigned long dropped;
+    unsigned seq;
+    int index;
+    int count;
+    int ackreq = 0;
+    int start;
+    int res;
+    
+    if (!ndn_buf_match_dtag(d, NDN_DTAG_LinkFragment))
+        return(-1);
+    ndn_buf_advance(d);
+    seq = ndn_parse_required_tagged_binary_number(d, NDN_DTAG_SequenceNumber, 1, 6);
+    index = ndn_parse_optional_tagged_nonNegativeInteger(d, NDN_DTAG_FragIndex);
+    count = ndn_parse_optional_tagged_nonNegativeInteger(d, NDN_DTAG_FragCount);
+    if (ndn_buf_match_dtag(d, NDN_DTAG_LinkAck)) {
+        ndn_buf_advance(d);
+        ndn_buf_check_close(d);
+        ackreq = 1;
+    }
+    start = ndn_parse_required_tagged_BLOB(d, NDN_DTAG_Content, 1, -1);
+    if (start >= 0)
+        ndn_ref_tagged_BLOB(NDN_DTAG_Content, msg, start,
+                            d->decoder.token_index, &piece, &piece_size);
+    ndn_buf_check_close(d);
+    if (d->decoder.state < 0 || piece == NULL ||
+        count < 1 || count > NDND_FRAG_MAX || index < 0 || index >= count)
+        return(-1);
+    h->frags_recvd++;
+    if (ackreq && (face->flags & NDN_FACE_MCAST) == 0)
+        send_link_ack(h, face, seq);
+    lf = link_frag_state(h, face);
+    if (lf == NULL || lf->delivering)
+        return(-1);
+    dropped = ndn_reasm_dropped(lf->reasm);
+    c = charbuf_obtain(h);
+    res = ndn_reasm_add(lf->reasm, seq - index, index, count,
+                        piece, piece_size, shaper_clock(h), c);
+    h->frags_dropped += ndn_reasm_dropped(lf->reasm) - dropped;
+    if (res == 1) {
+        /* All here - pass the message up */
+        h->frag_reassembled++;
+        lf->delivering = 1;
+        process_reassembled(h, face, c->buf, c->length);
+        lf->delivering = 0;
+    }
+    charbuf_release(h, c);
+    return(res < 0 ? -1 : 0);
+}
+
+/**
+ * Process an incoming LinkAck, releasing the acknowledged fragments.
  */
-static void
-ndn_append_link_stuff(struct ndnd_handle *h,
-                      struct face *face,
-                      struct ndn_charbuf *c)
+static int
+process_incoming_link_ack(struct ndnd_handle *h, struct face *face,
+                          unsigned char *msg, size_t size)
 {
-    if ((face->flags & (NDN_FACE_SEQOK | NDN_FACE_SEQPROBE)) == 0)
-        return;
-    ndn_charbuf_append_tt(c, NDN_DTAG_SequenceNumber, NDN_DTAG);
-    ndn_charbuf_append_tt(c, 2, NDN_BLOB);
-    ndn_charbuf_append_value(c, face->pktseq, 2);
-    ndnb_element_end(c);
-    if (0)
-        ndnd_msg(h, "debug.%d pkt_to %u seq %u",
-                 __LINE__, face->faceid, (unsigned)face->pktseq);
-    face->pktseq++;
-    face->flags &= ~NDN_FACE_SEQPROBE;
+    struct ndn_buf_decoder decoder;
+    struct ndn_buf_decoder *d = ndn_buf_decoder_start(&decoder, msg, size);
+    struct ndnd_linkfrag *lf = face->frag;
+    struct ndnd_arq *a = NULL;
+    unsigned seq;
+    
+    if (!ndn_buf_match_dtag(d, NDN_DTAG_LinkAck))
+        return(-1);
+    ndn_buf_advance(d);
+    while (ndn_buf_match_dtag(d, NDN_DTAG_SequenceNumber)) {
+        seq = ndn_parse_required_tagged_binary_number(d, NDN_DTAG_SequenceNumber, 1, 6);
+        if (d->decoder.state < 0 || lf == NULL)
+            break;
+        a = &lf->arq[seq % NDND_ARQ_N];
+        if (a->tries == 0 || a->seq != seq)
+            continue;
+        if (a->tries == 1)
+            link_arq_rtt_sample(lf, shaper_clock(h) - a->sent);
+        a->tries = 0;
+    }
+    ndn_buf_check_close(d);
+    if (d->decoder.state < 0)
+        return(-1);
+    return(0);
 }
 
 /**
@@ -2206,6 +3566,19 @@ process_incoming_link_message(struct ndnd_handle *h,
             face->rseq = s;
             face->rrun = 1;
             break;
+        case NDN_DTAG_LinkFragment:
+            return(process_incoming_fragment(h, face, msg, size));
+        case NDN_DTAG_LinkAck:
+            return(process_incoming_link_ack(h, face, msg, size));
+        case NDN_DTAG_CongestionMark:
+            if (!ndn_buf_match_dtag(d, dtag))
+                return(-1);
+            ndn_buf_advance(d);
+            ndn_buf_check_close(d);
+            if (d->decoder.state < 0)
+                return(d->decoder.state);
+            face_ishape_congested(h, face);
+            break;
         default:
             return(-1);
     }
@@ -2213,45 +3586,40 @@ process_incoming_link_message(struct ndnd_handle *h,
 }
 
 /**
- * Checks for inactivity on datagram faces.
- * @returns number of faces that have gone away.
+ * Scheduled event that checks for inactivity on a datagram face.
+ *
+ * Each datagram face has one of these, so the faces that are in use
+ * need no sweep.  A face that has received nothing for a period or two
+ * goes away, unless it is permanent or an adjacency.
  */
 static int
-check_dgram_faces(struct ndnd_handle *h)
+dgram_face_idle(struct ndn_schedule *sched,
+                void *clienth,
+                struct ndn_scheduled_event *ev,
+                int flags)
 {
-    struct hashtb_enumerator ee;
-    struct hashtb_enumerator *e = &ee;
-    int count = 0;
-    int checkflags = NDN_FACE_DGRAM;
-    int wantflags = NDN_FACE_DGRAM;
-    int adj_req = 0;
+    struct ndnd_handle *h = clienth;
+    struct face *face = face_from_faceid(h, ev->evint);
     
-    hashtb_start(h->dgram_faces, e);
-    while (e->data != NULL) {
-        struct face *face = e->data;
-        if (face->addr != NULL && (face->flags & checkflags) == wantflags) {
-            face->flags &= ~NDN_FACE_LC; /* Rate limit link check interests */
-            if (face->recvcount == 0) {
-                if ((face->flags & (NDN_FACE_PERMANENT | NDN_FACE_ADJ)) == 0) {
-                    count += 1;
-                    hashtb_delete(e);
-                    continue;
-                }
-            }
-            else if (face->recvcount == 1) {
-                face->recvcount = 0;
-            }
-            else {
-                face->recvcount = 1; /* go around twice */
-            }
-        }
-        hashtb_next(e);
+    if (face == NULL || face->idle_timer != ev)
+        return(0);
+    if ((flags & NDN_SCHEDULE_CANCEL) != 0) {
+        face->idle_timer = NULL;
+        return(0);
     }
-    hashtb_end(e);
-    if (adj_req) {
-        process_internal_client_buffer(h);
+    face->flags &= ~NDN_FACE_LC; /* Rate limit link check interests */
+    if (face->recvcount == 0) {
+        if ((face->flags & (NDN_FACE_PERMANENT | NDN_FACE_ADJ)) == 0) {
+            face->idle_timer = NULL;
+            ndnd_destroy_face(h, face->faceid);
+            return(0);
+        }
     }
-    return(count);
+    else if (face->recvcount == 1)
+        face->recvcount = 0;
+    else
+        face->recvcount = 1; /* go around twice */
+    return(NDND_DGRAM_IDLE_USEC);
 }
 
 /**
@@ -2272,7 +3640,7 @@ ndnd_destroy_face(struct ndnd_handle *h, unsigned faceid)
         return(-1);
     if ((face->flags & dgram_chk) == dgram_want) {
         hashtb_start(h->dgram_faces, e);
-        hashtb_seek(e, face->addr, face->addrlen, 0);
+        dgram_faces_seek(e, face->addr, face->addrlen);
         if (e->data == face)
             face = NULL;
         hashtb_delete(e);
@@ -2320,12 +3688,25 @@ check_nameprefix_entries(struct ndnd_handle *h)
     struct hashtb_enumerator *e = &ee;
     struct ielinks *head;
     struct nameprefix_entry *npe;    
+    struct ndn_forwarding **p;
+    struct ndn_forwarding *f;
     
     hashtb_start(h->nameprefix_tab, e);
     for (npe = e->data; npe != NULL; npe = e->data) {
+        /* Drop forwarding to faces that have gone away */
+        for (p = &npe->forwarding; (f = *p) != NULL;) {
+            if (face_from_faceid(h, f->faceid) == NULL) {
+                *p = f->next;
+                free_forwarding(h, f);
+                fib_changed(h, npe);
+            }
+            else
+                p = &(f->next);
+        }
         if (  npe->src == NDN_NOFACEID &&
               npe->children == 0 &&
-              npe->forwarding == NULL) {
+              npe->forwarding == NULL &&
+              npe->strategy == NULL) {
             head = &npe->ie_head;
             if (head == head->next) {
                 count += 1;
@@ -2374,7 +3755,6 @@ reap(
         h->reaper = NULL;
         return(0);
     }
-    check_dgram_faces(h);
     check_nameprefix_entries(h);
     check_comm_file(h);
     return(2 * NDN_INTEREST_LIFETIME_MICROSEC);
@@ -2399,8 +3779,10 @@ remove_content(struct ndnd_handle *h, struct content_entry *content)
     if (content == NULL)
         return(-1);
     hashtb_start(h->content_tab, e);
-    res = hashtb_seek(e, content->key,
-                      content->key_size, content->size - content->key_size);
+    /* The hashtb key starts with the fingerprint */
+    res = hashtb_seek(e, content->key - sizeof(uint64_t),
+                      sizeof(uint64_t) + content->key_size,
+                      content->size - content->key_size);
     if (res != HT_OLD_ENTRY)
         abort();
     if ((content->flags & NDN_CONTENT_ENTRY_STALE) != 0)
@@ -2413,8 +3795,22 @@ remove_content(struct ndnd_handle *h, struct content_entry *content)
     return(0);
 }
 
+/**
+ * Check whether the content store is holding more than it should.
+ */
+static int
+content_over_capacity(struct ndnd_handle *h)
+{
+    return((unsigned long)hashtb_n(h->content_tab) > h->capacity ||
+           h->cs_bytes > h->capacity_bytes);
+}
+
 /**
  * Periodic content cleaning
+ *
+ * Each run spends at most NDND_CLEAN_BUDGET units of work and keeps
+ * its place in the handle's cursors, so a large backlog is worked off
+ * over many short runs rather than stalling packet processing.
  */
 static int
 clean_daemon(struct ndn_schedule *sched,
@@ -2426,59 +3822,59 @@ clean_daemon(struct ndn_schedule *sched,
     (void)(sched);
     (void)(ev);
     unsigned long n;
+    unsigned long long b;
     ndn_accession_t limit;
     ndn_accession_t a;
     ndn_accession_t min_stale;
-    int check_limit = 500;  /* Do not run for too long at once */
+    int budget = NDND_CLEAN_BUDGET;  /* Do not run for too long at once */
     struct content_entry *content = NULL;
+    int delay = 0;
     int res = 0;
     int ignore;
     int i;
     
-    /*
-     * If we ran into our processing limit (check_limit) last time,
-     * ev->evint tells us where to restart.
-     */
-    
     if ((flags & NDN_SCHEDULE_CANCEL) != 0) {
         h->clean = NULL;
         return(0);
     }
-    n = hashtb_n(h->content_tab);
-    if (n <= h->capacity) {
-        h->clean = NULL;
-        return(0);
+    h->clean_runs++;
+    if (!content_over_capacity(h)) {
+        h->clean_behind = 0;
+        goto Stragglers;
     }
+    if (h->clean_behind == 0)
+        h->clean_behind = h->sec;
     /* Toss unsolicited content first */
-    for (i = 0; i < h->unsol->n; i++) {
-        if (i == check_limit) {
-            for (i = check_limit; i < h->unsol->n; i++)
-                h->unsol->buf[i-check_limit] = h->unsol->buf[i];
-            h->unsol->n -= check_limit;
-            return(500);
-        }
+    for (i = 0; i < h->unsol->n && budget > 0; i++, budget--) {
         a = h->unsol->buf[i];
         content = content_from_accession(h, a);
         if (content != NULL &&
-            (content->flags & NDN_CONTENT_ENTRY_PRECIOUS) == 0)
-            remove_content(h, content);
+            (content->flags & NDN_CONTENT_ENTRY_PRECIOUS) == 0 &&
+            remove_content(h, content) == 0)
+            h->clean_removed++;
+    }
+    if (i < h->unsol->n) {
+        memmove(h->unsol->buf, h->unsol->buf + i,
+                (h->unsol->n - i) * sizeof(h->unsol->buf[0]));
+        h->unsol->n -= i;
+        delay = 500;
+        goto Finish;
     }
     h->unsol->n = 0;
-    n = hashtb_n(h->content_tab);
     if (h->min_stale <= h->max_stale) {
         /* clean out stale content next */
         limit = h->max_stale;
         if (limit > h->accession)
             limit = h->accession;
         min_stale = ~0;
-        a = ev->evint;
+        a = h->stale_cursor;
         if (a <= h->min_stale || a > h->max_stale)
             a = h->min_stale;
         else
             min_stale = h->min_stale;
-        for (; a <= limit && n > h->capacity; a++) {
-            if (check_limit-- <= 0) {
-                ev->evint = a;
+        for (; a <= limit && content_over_capacity(h); a++) {
+            if (budget-- <= 0) {
+                h->stale_cursor = a;
                 break;
             }
             content = content_from_accession(h, a);
@@ -2490,8 +3886,8 @@ clean_daemon(struct ndn_schedule *sched,
                         min_stale = a;
                 }
                 else {
+                    h->clean_removed++;
                     content = NULL;
-                    n -= 1;
                 }
             }
         }
@@ -2503,25 +3899,58 @@ clean_daemon(struct ndn_schedule *sched,
         }
         else
             h->min_stale = a;
-        if (check_limit <= 0)
-            return(5000);
+        if (budget <= 0 || content_over_capacity(h))
+            delay = 5000;
+    }
+    else if (h->cs_policy != NULL) {
+        /* Let the replacement policy decide what goes */
+        while (content_over_capacity(h)) {
+            if (budget-- <= 0) {
+                delay = 5000;
+                break;
+            }
+            content = ndnd_cs_victim(h);
+            if (content == NULL || remove_content(h, content) < 0)
+                break;
+            h->content_evicted++;
+            h->clean_removed++;
+        }
     }
     else {
         /* Make oldish content stale, for cleanup on next round */
         limit = h->accession;
         ignore = NDN_CONTENT_ENTRY_STALE | NDN_CONTENT_ENTRY_PRECIOUS;
-        for (a = h->accession_base; a <= limit && n > h->capacity; a++) {
+        n = hashtb_n(h->content_tab);
+        b = h->cs_bytes;
+        a = h->mark_cursor;
+        if (a < h->accession_base || a > limit)
+            a = h->accession_base;
+        for (; a <= limit && (n > h->capacity || b > h->capacity_bytes); a++) {
+            if (budget-- <= 0)
+                break;
             content = content_from_accession(h, a);
             if (content != NULL && (content->flags & ignore) == 0) {
                 mark_stale(h, content);
                 n--;
+                b -= content->size;
             }
         }
-        ev->evint = 0;
-        return(5000);
+        h->mark_cursor = a;
+        h->stale_cursor = 0;
+        delay = 5000;
     }
-    h->clean = NULL;
-    return(0);
+Stragglers:
+    if (budget > 0) {
+        if (cleanout_stragglers(h, &budget) && delay == 0)
+            delay = 500;
+    }
+    else if (h->straggler_cursor != 0 && delay == 0)
+        delay = 500;
+Finish:
+    h->clean_visited += NDND_CLEAN_BUDGET - (budget > 0 ? budget : 0);
+    if (delay == 0)
+        h->clean = NULL;
+    return(delay);
 }
 
 /**
@@ -2535,73 +3964,96 @@ clean_needed(struct ndnd_handle *h)
 }
 
 /**
- * Age out the old forwarding table entries
+ * Free a forwarding entry that has been unlinked from its prefix.
+ */
+static void
+free_forwarding(struct ndnd_handle *h, struct ndn_forwarding *f)
+{
+    if (f->ev != NULL)
+        ndn_schedule_cancel(h->sched, f->ev);
+    free(f);
+}
+
+/**
+ * Microseconds to wait for an expiry that is secs away.
  */
 static int
-age_forwarding(struct ndn_schedule *sched,
-             void *clienth,
-             struct ndn_scheduled_event *ev,
-             int flags)
+forwarding_expiry_delay(long secs)
+{
+    if (secs > NDN_FWU_SECS)
+        secs = NDN_FWU_SECS;
+    return(secs <= 0 ? 1 : secs * 1000000);
+}
+
+/**
+ * Scheduled event for the expiry of a forwarding entry
+ *
+ * Each entry with a finite lifetime has one of these, so that only the
+ * entries that are actually due get visited.  A refresh just moves
+ * ev->evint later, and the event rearms itself when it finds that
+ * (or a lifetime too long to wait for in one step) upon waking.
+ */
+static int
+expire_forwarding(struct ndn_schedule *sched,
+                  void *clienth,
+                  struct ndn_scheduled_event *ev,
+                  int flags)
 {
     struct ndnd_handle *h = clienth;
-    struct hashtb_enumerator ee;
-    struct hashtb_enumerator *e = &ee;
-    struct ndn_forwarding *f;
-    struct ndn_forwarding *next;
+    struct ndn_forwarding *f = ev->evdata;
     struct ndn_forwarding **p;
     struct nameprefix_entry *npe;
+    (void)sched;
     
     if ((flags & NDN_SCHEDULE_CANCEL) != 0) {
-        h->age_forwarding = NULL;
+        f->ev = NULL;
         return(0);
     }
-    hashtb_start(h->nameprefix_tab, e);
-    for (npe = e->data; npe != NULL; npe = e->data) {
-        p = &npe->forwarding;
-        for (f = npe->forwarding; f != NULL; f = next) {
-            next = f->next;
-            if ((f->flags & NDN_FORW_REFRESHED) == 0 ||
-                  face_from_faceid(h, f->faceid) == NULL) {
-                if (h->debug & 2) {
-                    struct face *face = face_from_faceid(h, f->faceid);
-                    if (face != NULL) {
-                        struct ndn_charbuf *prefix = ndn_charbuf_create();
-                        ndn_name_init(prefix);
-                        ndn_name_append_components(prefix, e->key, 0, e->keysize);
-                        ndnd_debug_ndnb(h, __LINE__, "prefix_expiry", face,
-                                prefix->buf,
-                                prefix->length);
-                        ndn_charbuf_destroy(&prefix);
-                    }
-                }
-                *p = next;
-                free(f);
-                f = NULL;
-                continue;
-            }
-            f->expires -= NDN_FWU_SECS;
-            if (f->expires <= 0)
-                f->flags &= ~NDN_FORW_REFRESHED;
-            p = &(f->next);
+    if (ev->evint - h->sec > 0)
+        return(forwarding_expiry_delay(ev->evint - h->sec));
+    f->ev = NULL;
+    npe = f->npe;
+    for (p = &npe->forwarding; *p != NULL; p = &(*p)->next) {
+        if (*p == f) {
+            if (h->debug & 2)
+                ndnd_msg(h, "prefix_expiry face %u", f->faceid);
+            *p = f->next;
+            fib_changed(h, npe);
+            break;
         }
-        hashtb_next(e);
     }
-    hashtb_end(e);
-    h->forward_to_gen += 1;
-    return(NDN_FWU_SECS*1000000);
+    free(f);
+    return(0);
 }
 
 /**
- * Make sure a call to age_forwarding is scheduled.
+ * Set the time at which a forwarding entry expires.
  */
 static void
-age_forwarding_needed(struct ndnd_handle *h)
+set_forwarding_expiry(struct ndnd_handle *h, struct ndn_forwarding *f,
+                      int expires)
 {
-    if (h->age_forwarding == NULL)
-        h->age_forwarding = ndn_schedule_event(h->sched,
-                                               NDN_FWU_SECS*1000000,
-                                               age_forwarding,
-                                               NULL, 0);
+    long when;
+    
+    f->expires = expires;
+    if (expires >= NDN_FWU_PERMANENT) {
+        if (f->ev != NULL)
+            ndn_schedule_cancel(h->sched, f->ev);
+        return;
+    }
+    if (expires < 0)
+        expires = 0;
+    when = h->sec + expires;
+    if (f->ev != NULL) {
+        /* The event wakes no later than the old time; it will rearm */
+        if (when - f->ev->evint >= 0) {
+            f->ev->evint = when;
+            return;
+        }
+        ndn_schedule_cancel(h->sched, f->ev);
+    }
+    f->ev = ndn_schedule_event(h->sched, forwarding_expiry_delay(expires),
+                               expire_forwarding, f, when);
 }
 
 /**
@@ -2621,6 +4073,7 @@ seek_forwarding(struct ndnd_handle *h,
         f->faceid = faceid;
         f->flags = (NDN_FORW_CHILD_INHERIT | NDN_FORW_ACTIVE);
         f->expires = 0x7FFFFFFF;
+        f->npe = npe;
         f->next = npe->forwarding;
         npe->forwarding = f;
     }
@@ -2672,10 +4125,13 @@ ndnd_reg_prefix(struct ndnd_handle *h,
         npe = e->data;
         f = seek_forwarding(h, npe, faceid);
         if (f != NULL) {
-            h->forward_to_gen += 1; // XXX - too conservative, should check changes
-            f->expires = expires;
+            set_forwarding_expiry(h, f, expires);
             if (flags < 0)
                 flags = f->flags & NDN_FORW_PUBMASK;
+            /* A plain refresh does not affect forward_to */
+            if ((f->flags & (NDN_FORW_PUBMASK | NDN_FORW_REFRESHED)) !=
+                (NDN_FORW_REFRESHED | flags))
+                fib_changed(h, npe);
             f->flags = (NDN_FORW_REFRESHED | flags);
             res |= flags;
             if (h->debug & (2 | 4)) {
@@ -2683,7 +4139,7 @@ ndnd_reg_prefix(struct ndnd_handle *h,
                 struct ndn_charbuf *debugtag = ndn_charbuf_create();
                 ndn_charbuf_putf(debugtag, "prefix,ff=%s%x",
                                  flags > 9 ? "0x" : "", flags);
-                if (f->expires < (1 << 30))
+                if (f->expires < NDN_FWU_PERMANENT)
                     ndn_charbuf_putf(debugtag, ",sec=%d", expires);
                 ndn_name_init(prefix);
                 ndn_name_append_components(prefix, msg,
@@ -2969,33 +4425,169 @@ ndnd_req_newface(struct ndnd_handle *h,
         if (res > 0)
             res = 0;
     }
-    else
-        res = ndnd_nack(h, reply_body, 450, "could not create face");
+    else
+        res = ndnd_nack(h, reply_body, 450, "could not create face");
+Finish:
+    h->flood = save; /* restore saved flood flag */
+    ndn_face_instance_destroy(&face_instance);
+    if (addrinfo != NULL)
+        freeaddrinfo(addrinfo);
+    return((nackallowed || res <= 0) ? res : -1);
+}
+
+/**
+ * @brief Process a destroyface request for the ndnd internal client.
+ * @param h is the ndnd handle
+ * @param msg points to a ndnd-encoded ContentObject containing a FaceInstance
+            in its Content.
+ * @param size is its size in bytes
+ * @param reply_body is a buffer to hold the Content of the reply, as a
+ *         FaceInstance including faceid
+ * @returns 0 for success, negative for no response, or NDN_CONTENT_NACK to
+ *         set the response type to NACK.
+ *
+ * Is is an error if the face does not exist.
+ */
+int
+ndnd_req_destroyface(struct ndnd_handle *h,
+                     const unsigned char *msg, size_t size,
+                     struct ndn_charbuf *reply_body)
+{
+    struct ndn_parsed_ContentObject pco = {0};
+    int res;
+    int at = 0;
+    const unsigned char *req;
+    size_t req_size;
+    struct ndn_face_instance *face_instance = NULL;
+    struct face *reqface = NULL;
+    int nackallowed = 0;
+
+    res = ndn_parse_ContentObject(msg, size, &pco, NULL);
+    if (res < 0) { at = __LINE__; goto Finish; }
+    res = ndn_content_get_value(msg, size, &pco, &req, &req_size);
+    if (res < 0) { at = __LINE__; goto Finish; }
+    res = -1;
+    face_instance = ndn_face_instance_parse(req, req_size);
+    if (face_instance == NULL) { at = __LINE__; goto Finish; }
+    if (face_instance->action == NULL) { at = __LINE__; goto Finish; }
+    /* consider the source ... */
+    reqface = face_from_faceid(h, h->interest_faceid);
+    if (reqface == NULL) { at = __LINE__; goto Finish; }
+    if ((reqface->flags & NDN_FACE_GG) == 0) { at = __LINE__; goto Finish; }
+    nackallowed = 1;
+    if (strcmp(face_instance->action, "destroyface") != 0)
+        { at = __LINE__; goto Finish; }
+    res = check_face_instance_ndndid(h, face_instance, reply_body);
+    if (res != 0)
+        { at = __LINE__; goto Finish; }
+    if (face_instance->faceid == 0) { at = __LINE__; goto Finish; }
+    res = ndnd_destroy_face(h, face_instance->faceid);
+    if (res < 0) { at = __LINE__; goto Finish; }
+    face_instance->action = NULL;
+    face_instance->ndnd_id = h->ndnd_id;
+    face_instance->ndnd_id_size = sizeof(h->ndnd_id);
+    face_instance->lifetime = 0;
+    res = ndnb_append_face_instance(reply_body, face_instance);
+    if (res < 0) {
+        at = __LINE__;
+    }
+Finish:
+    if (at != 0) {
+        ndnd_msg(h, "ndnd_req_destroyface failed (line %d, res %d)", at, res);
+        if (reqface == NULL || (reqface->flags & NDN_FACE_GG) == 0)
+            res = -1;
+        else
+            res = ndnd_nack(h, reply_body, 450, "could not destroy face");
+    }
+    ndn_face_instance_destroy(&face_instance);
+    return((nackallowed || res <= 0) ? res : -1);
+}
+
+/**
+ * Set the rate limit on a face
+ *
+ * The FaceInstance names the face by FaceID and carries the RateLimit
+ * (bytes per second) and optionally the RateBurst (bytes); without a
+ * RateLimit the face becomes unlimited.
+ * The reply echoes the settings in effect.
+ */
+int
+ndnd_req_setfacerate(struct ndnd_handle *h,
+                     const unsigned char *msg, size_t size,
+                     struct ndn_charbuf *reply_body)
+{
+    struct ndn_parsed_ContentObject pco = {0};
+    int res;
+    int at = 0;
+    const unsigned char *req;
+    size_t req_size;
+    struct ndn_face_instance *face_instance = NULL;
+    struct face *reqface = NULL;
+    struct face *face = NULL;
+    int nackallowed = 0;
+
+    res = ndn_parse_ContentObject(msg, size, &pco, NULL);
+    if (res < 0) { at = __LINE__; goto Finish; }
+    res = ndn_content_get_value(msg, size, &pco, &req, &req_size);
+    if (res < 0) { at = __LINE__; goto Finish; }
+    res = -1;
+    face_instance = ndn_face_instance_parse(req, req_size);
+    if (face_instance == NULL) { at = __LINE__; goto Finish; }
+    if (face_instance->action == NULL) { at = __LINE__; goto Finish; }
+    /* consider the source ... */
+    reqface = face_from_faceid(h, h->interest_faceid);
+    if (reqface == NULL) { at = __LINE__; goto Finish; }
+    if ((reqface->flags & NDN_FACE_GG) == 0) { at = __LINE__; goto Finish; }
+    nackallowed = 1;
+    if (strcmp(face_instance->action, "setfacerate") != 0)
+        { at = __LINE__; goto Finish; }
+    res = check_face_instance_ndndid(h, face_instance, reply_body);
+    if (res != 0)
+        { at = __LINE__; goto Finish; }
+    res = -1;
+    if (face_instance->faceid == 0) { at = __LINE__; goto Finish; }
+    face = face_from_faceid(h, face_instance->faceid);
+    if (face == NULL) { at = __LINE__; goto Finish; }
+    face_shaper_set(h, face,
+                    face_instance->rate_limit > 0 ? face_instance->rate_limit : 0,
+                    face_instance->rate_burst > 0 ? face_instance->rate_burst : 0);
+    ndnd_msg(h, "face %u rate limit %u burst %u",
+             face->faceid, face->rate_limit, face->rate_burst);
+    face_instance->action = NULL;
+    face_instance->ndnd_id = h->ndnd_id;
+    face_instance->ndnd_id_size = sizeof(h->ndnd_id);
+    face_instance->lifetime = 0;
+    face_instance->rate_limit = face->rate_limit;
+    face_instance->rate_burst = face->rate_burst;
+    res = ndnb_append_face_instance(reply_body, face_instance);
+    if (res < 0) {
+        at = __LINE__;
+    }
 Finish:
-    h->flood = save; /* restore saved flood flag */
+    if (at != 0) {
+        ndnd_msg(h, "ndnd_req_setfacerate failed (line %d, res %d)", at, res);
+        if (reqface == NULL || (reqface->flags & NDN_FACE_GG) == 0)
+            res = -1;
+        else
+            res = ndnd_nack(h, reply_body, 450, "could not set face rate");
+    }
     ndn_face_instance_destroy(&face_instance);
-    if (addrinfo != NULL)
-        freeaddrinfo(addrinfo);
     return((nackallowed || res <= 0) ? res : -1);
 }
 
 /**
- * @brief Process a destroyface request for the ndnd internal client.
- * @param h is the ndnd handle
- * @param msg points to a ndnd-encoded ContentObject containing a FaceInstance
-            in its Content.
- * @param size is its size in bytes
- * @param reply_body is a buffer to hold the Content of the reply, as a
- *         FaceInstance including faceid
- * @returns 0 for success, negative for no response, or NDN_CONTENT_NACK to
- *         set the response type to NACK.
+ * Set how a face coalesces small messages
  *
- * Is is an error if the face does not exist.
+ * The FaceInstance names the face by FaceID and carries CoalesceMicros,
+ * the longest a message may wait for company, and optionally
+ * CoalesceBytes, the size at which the PDU is sent without waiting;
+ * without CoalesceMicros the face stops coalescing.
+ * The reply echoes the settings in effect.
  */
 int
-ndnd_req_destroyface(struct ndnd_handle *h,
-                     const unsigned char *msg, size_t size,
-                     struct ndn_charbuf *reply_body)
+ndnd_req_setfacecoalesce(struct ndnd_handle *h,
+                         const unsigned char *msg, size_t size,
+                         struct ndn_charbuf *reply_body)
 {
     struct ndn_parsed_ContentObject pco = {0};
     int res;
@@ -3004,6 +4596,7 @@ ndnd_req_destroyface(struct ndnd_handle *h,
     size_t req_size;
     struct ndn_face_instance *face_instance = NULL;
     struct face *reqface = NULL;
+    struct face *face = NULL;
     int nackallowed = 0;
 
     res = ndn_parse_ContentObject(msg, size, &pco, NULL);
@@ -3019,29 +4612,40 @@ ndnd_req_destroyface(struct ndnd_handle *h,
     if (reqface == NULL) { at = __LINE__; goto Finish; }
     if ((reqface->flags & NDN_FACE_GG) == 0) { at = __LINE__; goto Finish; }
     nackallowed = 1;
-    if (strcmp(face_instance->action, "destroyface") != 0)
+    if (strcmp(face_instance->action, "setfacecoalesce") != 0)
         { at = __LINE__; goto Finish; }
     res = check_face_instance_ndndid(h, face_instance, reply_body);
     if (res != 0)
         { at = __LINE__; goto Finish; }
+    res = -1;
     if (face_instance->faceid == 0) { at = __LINE__; goto Finish; }
-    res = ndnd_destroy_face(h, face_instance->faceid);
-    if (res < 0) { at = __LINE__; goto Finish; }
+    face = face_from_faceid(h, face_instance->faceid);
+    if (face == NULL) { at = __LINE__; goto Finish; }
+    if ((face->flags & NDN_FACE_DGRAM) == 0) { at = __LINE__; goto Finish; }
+    face_coalesce_set(h, face,
+                      face_instance->coalesce_usec > 0 ? face_instance->coalesce_usec : 0,
+                      face_instance->coalesce_bytes > 0 ? face_instance->coalesce_bytes : 0);
+    ndnd_msg(h, "face %u coalesce %u usec %u bytes",
+             face->faceid, face->coalesce_usec, face->coalesce_bytes);
     face_instance->action = NULL;
     face_instance->ndnd_id = h->ndnd_id;
     face_instance->ndnd_id_size = sizeof(h->ndnd_id);
     face_instance->lifetime = 0;
+    face_instance->rate_limit = face->rate_limit;
+    face_instance->rate_burst = face->rate_burst;
+    face_instance->coalesce_usec = face->coalesce_usec;
+    face_instance->coalesce_bytes = face->coalesce_bytes;
     res = ndnb_append_face_instance(reply_body, face_instance);
     if (res < 0) {
         at = __LINE__;
     }
 Finish:
     if (at != 0) {
-        ndnd_msg(h, "ndnd_req_destroyface failed (line %d, res %d)", at, res);
+        ndnd_msg(h, "ndnd_req_setfacecoalesce failed (line %d, res %d)", at, res);
         if (reqface == NULL || (reqface->flags & NDN_FACE_GG) == 0)
             res = -1;
         else
-            res = ndnd_nack(h, reply_body, 450, "could not destroy face");
+            res = ndnd_nack(h, reply_body, 450, "could not set face coalescing");
     }
     ndn_face_instance_destroy(&face_instance);
     return((nackallowed || res <= 0) ? res : -1);
@@ -3262,9 +4866,9 @@ ndnd_req_unreg(struct ndnd_handle *h,
                                 forwarding_entry->name_prefix->buf,
                                 forwarding_entry->name_prefix->length);
             *p = f->next;
-            free(f);
+            free_forwarding(h, f);
             f = NULL;
-            h->forward_to_gen += 1;
+            fib_changed(h, npe);
             break;
         }
         p = &(f->next);
@@ -3285,6 +4889,40 @@ Finish:
     return((nackallowed || res <= 0) ? res : -1);
 }
 
+/**
+ * Note a change to the forwarding entries of npe
+ *
+ * Only the forward_to of npe and of the prefixes below it
+ * need to be recomputed as a result.
+ */
+static void
+fib_changed(struct ndnd_handle *h, struct nameprefix_entry *npe)
+{
+    h->forward_to_gen += 1;
+    npe->fstamp = h->forward_to_gen;
+}
+
+/**
+ * Decide whether npe->forward_to and npe->flags need recomputing
+ *
+ * They are stale only if the forwarding of npe or one of its ancestors
+ * has changed since they were computed, so a change elsewhere in the
+ * FIB costs just this walk up the parent chain.
+ */
+static int
+forward_to_stale(struct ndnd_handle *h, struct nameprefix_entry *npe)
+{
+    struct nameprefix_entry *p;
+    
+    if (npe->fgen == (int)h->forward_to_gen)
+        return(0);
+    for (p = npe; p != NULL; p = p->parent)
+        if ((int)(p->fstamp - (unsigned)npe->fgen) > 0)
+            return(1);
+    npe->fgen = h->forward_to_gen;
+    return(0);
+}
+
 /**
  * Set up forward_to list for a name prefix entry.
  *
@@ -3354,7 +4992,8 @@ update_forward_to(struct ndnd_handle *h, struct nameprefix_entry *npe)
  * @param msg points to the ndnb-encoded interest message
  * @param pi must be the parse information for msg
  * @param npe should be the result of the prefix lookup
- * @result Newly allocated set of outgoing faceids (never NULL)
+ * @result Set of outgoing faceids (never NULL), which the caller
+ *         must give back with indexbuf_release
  */
 static struct ndn_indexbuf *
 get_outbound_faces(struct ndnd_handle *h,
@@ -3373,9 +5012,9 @@ get_outbound_faces(struct ndnd_handle *h,
     
     while (npe->parent != NULL && npe->forwarding == NULL)
         npe = npe->parent;
-    if (npe->fgen != h->forward_to_gen)
+    if (forward_to_stale(h, npe))
         update_forward_to(h, npe);
-    x = ndn_indexbuf_create();
+    x = indexbuf_obtain(h);
     if (pi->scope == 0)
         return(x);
     if (from != NULL && (from->flags & NDN_FACE_GG) != 0) {
@@ -3480,10 +5119,25 @@ send_interest(struct ndnd_handle *h, struct interest_entry *ie,
     intmax_t lifetime = default_life;
     ndn_wrappedtime delta;
     size_t noncesize;
+    unsigned usec;
     
     face = face_from_faceid(h, p->faceid);
     if (face == NULL)
         return(p);
+    usec = face_ishape_admit(h, face);
+    if (usec != 0) {
+        /* More than the upstream has been answering; push back */
+        h->interests_shaped++;
+        ishape_mark_downstreams(h, ie);
+        pfi_set_expiry_from_micros(h, ie, p, usec);
+        return(p);
+    }
+    usec = face_shaper_admit(h, face, NDND_TC_INTEREST, ie->size);
+    if (usec != 0) {
+        /* Over the face's rate limit, do_propagate will try again */
+        pfi_set_expiry_from_micros(h, ie, p, usec);
+        return(p);
+    }
     h->interest_faceid = x->faceid; /* relevant if p is face 0 */
     p = pfi_copy_nonce(h, ie, p, x);
     delta = x->expiry - x->renewed;
@@ -3536,7 +5190,7 @@ strategy_timer(struct ndn_schedule *sched,
         s->ev = NULL;
     if (flags & NDN_SCHEDULE_CANCEL)
         return(0);
-    strategy_callout(h, ie, (enum ndn_strategy_op)ev->evint);
+    strategy_callout(h, ie, (enum ndn_strategy_op)ev->evint, NDN_NOFACEID);
     return(0);
 }
 
@@ -3561,12 +5215,14 @@ strategy_settimer(struct ndnd_handle *h, struct interest_entry *ie,
 /**
  * This implements the default strategy.
  *
- * Eventually there will be a way to have other strategies.
+ * The interest goes first to the face that most recently supplied
+ * matching content, then after a randomized delay to the others.
  */
 static void
-strategy_callout(struct ndnd_handle *h,
+strategy_default(struct ndnd_handle *h,
                  struct interest_entry *ie,
-                 enum ndn_strategy_op op)
+                 enum ndn_strategy_op op,
+                 unsigned faceid)
 {
     struct pit_face_item *x = NULL;
     struct pit_face_item *p = NULL;
@@ -3654,6 +5310,384 @@ strategy_callout(struct ndnd_handle *h,
     }
 }
 
+/**
+ * Record a round-trip time sample for a face
+ *
+ * The smoothing follows RFC 6298.
+ */
+static void
+face_rtt_sample(struct face *face, unsigned usec)
+{
+    unsigned err;
+    
+    if (usec == 0)
+        usec = 1;
+    if (face->srtt == 0) {
+        face->srtt = usec;
+        face->rttvar = usec / 2;
+        return;
+    }
+    err = (face->srtt > usec) ? face->srtt - usec : usec - face->srtt;
+    face->rttvar = face->rttvar - (face->rttvar >> 2) + (err >> 2);
+    face->srtt = face->srtt - (face->srtt >> 3) + (usec >> 3);
+}
+
+/**
+ * Record whether an interest sent to a face went unanswered
+ */
+static void
+face_loss_sample(struct face *face, int lost)
+{
+    unsigned target = lost ? 65536 : 0;
+    
+    if (target > face->loss)
+        face->loss += (target - face->loss) >> 4;
+    else
+        face->loss -= (face->loss - target) >> 4;
+}
+
+/**
+ * Update the per-face estimators that the strategies rely upon
+ *
+ * When content arrives, the upstream that supplied it gets a round-trip
+ * sample measured from when the interest was last sent there, which
+ * also goes into the latency histograms of the face and of the prefix
+ * that the interest was forwarded by.  When an interest times out,
+ * every upstream that it was sent to is charged with a loss.
+ */
+static void
+strategy_estimate(struct ndnd_handle *h, struct interest_entry *ie,
+                  enum ndn_strategy_op op, unsigned faceid)
+{
+    struct pit_face_item *p;
+    struct face *face;
+    struct nameprefix_entry *npe;
+    unsigned usec;
+    
+    if (op != NDNST_SATISFIED && op != NDNST_TIMEOUT)
+        return;
+    for (p = ie->pfl; p != NULL; p = p->next) {
+        if ((p->pfi_flags & NDND_PFI_UPENDING) == 0)
+            continue;
+        if (op == NDNST_SATISFIED && p->faceid != faceid)
+            continue;
+        face = face_from_faceid(h, p->faceid);
+        if (face == NULL)
+            continue;
+        if (op == NDNST_SATISFIED) {
+            usec = (h->wtnow - p->renewed) * (1000000 / WTHZ);
+            face_rtt_sample(face, usec);
+            ndnd_hist_add(&face->rtt_hist, usec);
+            npe = get_fib_npe(h, ie);
+            if (npe != NULL && npe->rtt_hist == NULL)
+                npe->rtt_hist = calloc(1, sizeof(*npe->rtt_hist));
+            if (npe != NULL)
+                ndnd_hist_add(npe->rtt_hist, usec);
+        }
+        face_loss_sample(face, op == NDNST_TIMEOUT);
+    }
+}
+
+/**
+ * Find the pending downstream of a new interest entry
+ */
+static struct pit_face_item *
+strategy_downstream(struct ndnd_handle *h, struct interest_entry *ie)
+{
+    struct pit_face_item *x;
+    
+    for (x = ie->pfl; x != NULL; x = x->next)
+        if ((x->pfi_flags & NDND_PFI_DNSTREAM) != 0)
+            break;
+    if (x == NULL || (x->pfi_flags & NDND_PFI_PENDING) == 0) {
+        ndnd_debug_ndnb(h, __LINE__, "canthappen", NULL,
+                        ie->interest_msg, ie->size);
+        return(NULL);
+    }
+    return(x);
+}
+
+/**
+ * How long to wait for an answer from a face before trying another
+ */
+static unsigned
+strategy_patience(struct ndnd_handle *h, struct interest_entry *ie,
+                  unsigned faceid)
+{
+    struct face *face = face_from_faceid(h, faceid);
+    unsigned usec;
+    
+    if (face != NULL && face->srtt != 0)
+        usec = face->srtt + 4 * face->rttvar;
+    else
+        usec = ie->ll.npe->usec;
+    if (usec < 2 * (1000000 / WTHZ))
+        usec = 2 * (1000000 / WTHZ);
+    if (usec > h->predicted_response_limit)
+        usec = h->predicted_response_limit;
+    return(usec);
+}
+
+/**
+ * Send a new interest to the chosen upstream, and hold back the others
+ *
+ * Taps get the interest right away as well.  The remaining upstreams are
+ * scheduled in FIB order, one patience interval apart, so that each is
+ * tried only if those before it have not answered.
+ */
+static void
+strategy_send_one(struct ndnd_handle *h, struct interest_entry *ie,
+                  struct pit_face_item *x, unsigned best)
+{
+    struct nameprefix_entry *npe;
+    struct ndn_indexbuf *tap = NULL;
+    struct pit_face_item *p;
+    unsigned step;
+    unsigned usec;
+    
+    npe = get_fib_npe(h, ie);
+    if (npe != NULL)
+        tap = npe->tap;
+    step = strategy_patience(h, ie, best);
+    usec = step;
+    for (p = ie->pfl; p != NULL; p = p->next) {
+        if ((p->pfi_flags & NDND_PFI_UPSTREAM) == 0)
+            continue;
+        if (p->faceid == best || ndn_indexbuf_member(tap, p->faceid) >= 0)
+            p = send_interest(h, ie, x, p);
+        else {
+            pfi_set_expiry_from_micros(h, ie, p, usec);
+            usec += step;
+        }
+    }
+}
+
+/**
+ * Weight of a face for load balancing
+ *
+ * Proportional to the rate at which the face answers, i.e. inversely
+ * proportional to its round-trip time and discounted by its losses.
+ * Faces without a measurement yet are assumed to be as good as dflt usec.
+ */
+static unsigned
+strategy_weight(struct face *face, unsigned dflt)
+{
+    unsigned rtt = (face->srtt != 0) ? face->srtt : dflt;
+    unsigned w;
+    
+    if (rtt < 1000)
+        rtt = 1000;
+    w = (1000000U / rtt) * ((65536 - face->loss) >> 8);
+    return(w + 1);
+}
+
+/**
+ * Weighted round-robin strategy
+ *
+ * Spreads new interests across all upstreams in proportion to their
+ * weights, using the smooth weighted round-robin method.  The credits
+ * are kept per face, so load is balanced across prefixes as well.
+ */
+static void
+strategy_wrr(struct ndnd_handle *h,
+             struct interest_entry *ie,
+             enum ndn_strategy_op op,
+             unsigned faceid)
+{
+    struct pit_face_item *x;
+    struct pit_face_item *p;
+    struct face *face;
+    struct face *best = NULL;
+    int total = 0;
+    int w;
+    
+    if (op != NDNST_FIRST)
+        return;
+    x = strategy_downstream(h, ie);
+    if (x == NULL)
+        return;
+    for (p = ie->pfl; p != NULL; p = p->next) {
+        if ((p->pfi_flags & NDND_PFI_UPSTREAM) == 0)
+            continue;
+        face = face_from_faceid(h, p->faceid);
+        if (face == NULL)
+            continue;
+        w = strategy_weight(face, ie->ll.npe->usec);
+        face->wrr_credit += w;
+        total += w;
+        if (best == NULL || face->wrr_credit > best->wrr_credit)
+            best = face;
+    }
+    if (best == NULL)
+        return;
+    best->wrr_credit -= total;
+    strategy_send_one(h, ie, x, best->faceid);
+}
+
+/**
+ * Every so many interests, the lowest-RTT strategy also probes another face
+ */
+#define NDND_STRATEGY_PROBE 32
+
+/**
+ * Lowest round-trip time strategy
+ *
+ * Sends to the upstream with the lowest smoothed RTT, discounted by
+ * losses.  Faces that have never answered are tried first, and now and
+ * then a random other upstream is probed in parallel so that its
+ * estimate does not go stale.
+ */
+static void
+strategy_rtt(struct ndnd_handle *h,
+             struct interest_entry *ie,
+             enum ndn_strategy_op op,
+             unsigned faceid)
+{
+    struct pit_face_item *x;
+    struct pit_face_item *p;
+    struct face *face;
+    unsigned probe = NDN_NOFACEID;
+    unsigned best = NDN_NOFACEID;
+    unsigned bestw = 0;
+    unsigned w;
+    unsigned n = 0;
+    
+    if (op != NDNST_FIRST)
+        return;
+    x = strategy_downstream(h, ie);
+    if (x == NULL)
+        return;
+    for (p = ie->pfl; p != NULL; p = p->next) {
+        if ((p->pfi_flags & NDND_PFI_UPSTREAM) == 0)
+            continue;
+        face = face_from_faceid(h, p->faceid);
+        if (face == NULL)
+            continue;
+        w = (face->srtt == 0) ? ~0U : strategy_weight(face, 0);
+        if (best == NDN_NOFACEID || w > bestw) {
+            best = face->faceid;
+            bestw = w;
+        }
+        n++;
+    }
+    if (best == NDN_NOFACEID)
+        return;
+    if (n > 1 && nrand48(h->seed) % NDND_STRATEGY_PROBE == 0) {
+        n = nrand48(h->seed) % (n - 1);
+        for (p = ie->pfl; p != NULL; p = p->next) {
+            if ((p->pfi_flags & NDND_PFI_UPSTREAM) == 0 || p->faceid == best)
+                continue;
+            if (face_from_faceid(h, p->faceid) == NULL)
+                continue;
+            if (n-- == 0) {
+                probe = p->faceid;
+                break;
+            }
+        }
+    }
+    strategy_send_one(h, ie, x, best);
+    for (p = ie->pfl; p != NULL && probe != NDN_NOFACEID; p = p->next) {
+        if ((p->pfi_flags & NDND_PFI_UPSTREAM) != 0 && p->faceid == probe) {
+            if ((p->pfi_flags & NDND_PFI_UPENDING) == 0)
+                send_interest(h, ie, x, p);
+            break;
+        }
+    }
+}
+
+/**
+ * Best-route strategy with failover
+ *
+ * Sends to the first upstream in FIB order that is not losing most of
+ * what it is sent, and falls back to the others in order if it does
+ * not answer.
+ */
+static void
+strategy_failover(struct ndnd_handle *h,
+                  struct interest_entry *ie,
+                  enum ndn_strategy_op op,
+                  unsigned faceid)
+{
+    struct pit_face_item *x;
+    struct pit_face_item *p;
+    struct face *face;
+    unsigned first = NDN_NOFACEID;
+    unsigned best = NDN_NOFACEID;
+    
+    if (op != NDNST_FIRST)
+        return;
+    x = strategy_downstream(h, ie);
+    if (x == NULL)
+        return;
+    for (p = ie->pfl; p != NULL && best == NDN_NOFACEID; p = p->next) {
+        if ((p->pfi_flags & NDND_PFI_UPSTREAM) == 0)
+            continue;
+        face = face_from_faceid(h, p->faceid);
+        if (face == NULL)
+            continue;
+        if (first == NDN_NOFACEID)
+            first = face->faceid;
+        if (face->loss < 32768)
+            best = face->faceid;
+    }
+    if (best == NDN_NOFACEID)
+        best = first;
+    if (best != NDN_NOFACEID)
+        strategy_send_one(h, ie, x, best);
+}
+
+/**
+ * The built-in strategies, which may be chosen by name
+ */
+static const struct ndnd_strategy_class ndnd_strategies[] = {
+    {"default", &strategy_default},
+    {"wrr", &strategy_wrr},
+    {"rtt", &strategy_rtt},
+    {"failover", &strategy_failover},
+    {NULL, NULL}
+};
+
+/**
+ * Look up a strategy by name
+ *
+ * @returns NULL if there is no such strategy.
+ */
+static const struct ndnd_strategy_class *
+strategy_from_name(const char *name, size_t size)
+{
+    const struct ndnd_strategy_class *sc;
+    
+    for (sc = ndnd_strategies; sc->name != NULL; sc++)
+        if (strlen(sc->name) == size && 0 == memcmp(sc->name, name, size))
+            return(sc);
+    return(NULL);
+}
+
+/**
+ * Invoke the strategy for an interest entry
+ *
+ * The strategy is the one set on the longest enclosing name prefix,
+ * or the ndnd-wide default.
+ */
+static void
+strategy_callout(struct ndnd_handle *h,
+                 struct interest_entry *ie,
+                 enum ndn_strategy_op op,
+                 unsigned faceid)
+{
+    const struct ndnd_strategy_class *sc = h->strategy;
+    struct nameprefix_entry *npe;
+    
+    strategy_estimate(h, ie, op, faceid);
+    for (npe = ie->ll.npe; npe != NULL; npe = npe->parent) {
+        if (npe->strategy != NULL) {
+            sc = npe->strategy;
+            break;
+        }
+    }
+    (sc->callout)(h, ie, op, faceid);
+}
+
 /**
  * Execute the next timed action on a propagating interest.
  */
@@ -3760,7 +5794,7 @@ do_propagate(struct ndn_schedule *sched,
         }
     }
     if (pending == 0 && upstreams == 0) {
-        strategy_callout(h, ie, NDNST_TIMEOUT);
+        strategy_callout(h, ie, NDNST_TIMEOUT, NDN_NOFACEID);
         consume_interest(h, ie);
         return(0);
     }
@@ -3848,14 +5882,19 @@ pfi_create(struct ndnd_handle *h,
     size_t nsize = TYPICAL_NONCE_SIZE;
     
     if (noncesize > NDND_PFI_NONCESZ) return(NULL);
-    if (noncesize > nsize)
+    flags &= ~(NDND_PFI_NONCESZ | NDND_PFI_BIGNONCE);
+    if (noncesize > nsize) {
         nsize = noncesize;
-    p = calloc(1, sizeof(*p) + nsize - TYPICAL_NONCE_SIZE);
+        p = calloc(1, sizeof(*p) + nsize - TYPICAL_NONCE_SIZE);
+        flags |= NDND_PFI_BIGNONCE;
+    }
+    else
+        p = pool_alloc(&h->pfi_pool);
     if (p == NULL) return(NULL);
     p->faceid = faceid;
     p->renewed = h->wtnow;
     p->expiry = h->wtnow;
-    p->pfi_flags = (flags & ~NDND_PFI_NONCESZ) + noncesize;
+    p->pfi_flags = flags + noncesize;
     memcpy(p->nonce, nonce, noncesize);
     if (pp != NULL) {
         p->next = *pp;
@@ -3864,6 +5903,16 @@ pfi_create(struct ndnd_handle *h,
     return(p);    
 }
 
+/** Release the storage of a pit face item */
+static void
+pfi_free(struct ndnd_handle *h, struct pit_face_item *p)
+{
+    if ((p->pfi_flags & NDND_PFI_BIGNONCE) != 0)
+        free(p);
+    else
+        pool_free(&h->pfi_pool, p);
+}
+
 /** Remove the pit face item from the interest entry */
 static void
 pfi_destroy(struct ndnd_handle *h, struct interest_entry *ie,
@@ -3881,7 +5930,7 @@ pfi_destroy(struct ndnd_handle *h, struct interest_entry *ie,
             face->pending_interests -= 1;
     }
     *pp = p->next;
-    free(p);
+    pfi_free(h, p);
 }
 
 /**
@@ -3901,7 +5950,7 @@ pfi_seek(struct ndnd_handle *h, struct interest_entry *ie,
         if (p->faceid == faceid && (p->pfi_flags & pfi_flag) != 0)
             return(p);
     }
-    p = calloc(1, sizeof(*p));
+    p = pool_alloc(&h->pfi_pool);
     if (p != NULL) {
         p->faceid = faceid;
         p->pfi_flags = pfi_flag;
@@ -3977,7 +6026,8 @@ pfi_set_nonce(struct ndnd_handle *h, struct interest_entry *ie,
             if (q != NULL) {
                 q->renewed = p->renewed;
                 q->expiry = p->expiry;
-                p->pfi_flags = 0; /* preserve pending interest accounting */
+                /* preserve pending interest accounting */
+                p->pfi_flags &= NDND_PFI_BIGNONCE;
                 pfi_destroy(h, ie, p);
             }
             return(q);
@@ -4079,14 +6129,14 @@ propagate_interest(struct ndnd_handle *h,
         ie->strategy.renewals = 0;
     }
     if (ie->interest_msg == NULL) {
-        struct ndn_parsed_interest xpi = {0};
         int xres;
         link_interest_entry_to_nameprefix(h, ie, npe);
         ie->interest_msg = e->key;
         ie->size = pi->offset[NDN_PI_B_InterestLifetime] + 1;
         /* Ugly bit, this.  Clear the extension byte. */
         ((unsigned char *)(intptr_t)ie->interest_msg)[ie->size - 1] = 0;
-        xres = ndn_parse_interest(ie->interest_msg, ie->size, &xpi, NULL);
+        /* Keep the parse so matching need not decode the interest again */
+        xres = ndn_parse_interest(ie->interest_msg, ie->size, &ie->pi, NULL);
         if (xres < 0) abort();
     }
     lifetime = ndn_interest_lifetime(msg, pi);
@@ -4128,7 +6178,7 @@ propagate_interest(struct ndnd_handle *h,
         }
     }
     if (res == HT_NEW_ENTRY)
-        strategy_callout(h, ie, NDNST_FIRST);
+        strategy_callout(h, ie, NDNST_FIRST, NDN_NOFACEID);
     usec = ie_next_usec(h, ie, &expiry);
     if (ie->ev != NULL && wt_compare(expiry + 2, ie->ev->evint) < 0)
         ndn_schedule_cancel(h->sched, ie->ev);
@@ -4136,11 +6186,13 @@ propagate_interest(struct ndnd_handle *h,
         ie->ev = ndn_schedule_event(h->sched, usec, do_propagate, ie, expiry);
 Bail:
     hashtb_end(e);
-    ndn_indexbuf_destroy(&outbound);
+    if (outbound != NULL)
+        indexbuf_release(h, outbound);
 
     /*modified by zhy on 20141031*/
-    flatname = ndn_charbuf_create();
+    flatname = charbuf_obtain(h);
     ndn_flatname_append_from_ndnb(flatname, msg, pi->offset[NDN_PI_E_Name], 0, -1);
+    ndn_charbuf_as_string(flatname);
     DEBUG printf("msg=%s\n", msg);
     DEBUG printf("flatname=%s\n", flatname->buf);
     int ii;
@@ -4161,9 +6213,11 @@ Bail:
         //DEBUG printf("the effective name = %s\n", effective_name);
          printf("printf the flatname cut to interest:%s\n",flatname->buf+2+NAME_PREFIX_LEN);
 
+         h->backbone_requests++;
          request_from_backbone(flatname->buf+2+NAME_PREFIX_LEN);//指针偏移的长度为“wsn/”的长度
         
     }
+    charbuf_release(h, flatname);
     /*modified end*/
 
     return(res);
@@ -4178,7 +6232,6 @@ update_npe_children(struct ndnd_handle *h, struct nameprefix_entry *npe, unsigne
     struct hashtb_enumerator ee;
     struct hashtb_enumerator *e = &ee;
     struct face *fface = NULL;
-    struct ndn_parsed_interest pi;
     struct pit_face_item *p = NULL;
     struct interest_entry *ie = NULL;
     struct nameprefix_entry *x = NULL;
@@ -4203,9 +6256,8 @@ update_npe_children(struct ndnd_handle *h, struct nameprefix_entry *npe, unsigne
                     }
                 }
                 if (fface != NULL) {
-                    ndn_parse_interest(ie->interest_msg, ie->size, &pi, NULL);
                     ob = get_outbound_faces(h, fface, ie->interest_msg,
-                                            &pi, ie->ll.npe);
+                                            &ie->pi, ie->ll.npe);
                     for (i = 0; i < ob->n; i++) {
                         if (ob->buf[i] == faceid) {
                             p = pfi_seek(h, ie, faceid, NDND_PFI_UPSTREAM);
@@ -4220,7 +6272,7 @@ update_npe_children(struct ndnd_handle *h, struct nameprefix_entry *npe, unsigne
                             break;
                         }
                     }
-                    ndn_indexbuf_destroy(&ob);
+                    indexbuf_release(h, ob);
                 }
                 break;
             }
@@ -4241,6 +6293,7 @@ nameprefix_seek(struct ndnd_handle *h, struct hashtb_enumerator *e,
     int i;
     int base;
     int res = -1;
+    size_t hash = HASHTB_HASH_INIT;
     struct nameprefix_entry *parent = NULL;
     struct nameprefix_entry *npe = NULL;
     struct ielinks *head = NULL;
@@ -4249,7 +6302,11 @@ nameprefix_seek(struct ndnd_handle *h, struct hashtb_enumerator *e,
         return(-1);
     base = comps->buf[0];
     for (i = 0; i <= ncomps; i++) {
-        res = hashtb_seek(e, msg + base, comps->buf[i] - base, 0);
+        /* Extend the hash of the parent rather than starting over */
+        if (i > 0)
+            hash = hashtb_hash_more(hash, msg + comps->buf[i - 1],
+                                    comps->buf[i] - comps->buf[i - 1]);
+        res = hashtb_seek_hashed(e, msg + base, comps->buf[i] - base, 0, hash);
         if (res < 0)
             break;
         npe = e->data;
@@ -4260,6 +6317,7 @@ nameprefix_seek(struct ndnd_handle *h, struct hashtb_enumerator *e,
             head->npe = NULL;
             npe->parent = parent;
             npe->forwarding = NULL;
+            npe->fstamp = h->forward_to_gen;
             npe->fgen = h->forward_to_gen - 1;
             npe->forward_to = NULL;
             if (parent != NULL) {
@@ -4287,15 +6345,17 @@ next_child_at_level(struct ndnd_handle *h,
 {
     struct content_entry *next = NULL;
     struct ndn_charbuf *name;
-    struct ndn_indexbuf *pred[NDN_SKIPLIST_MAX_DEPTH] = {NULL};
-    int d;
+    struct ndn_charbuf *key;
     int res;
     
     if (content == NULL)
         return(NULL);
-    if (content->ncomps <= level + 1)
+    if (content->ncomps < level + 1)
         return(NULL);
-    name = ndn_charbuf_create();
+    /* Content named by the prefix itself differs only in the digest */
+    if (content->ncomps == level + 1)
+        return(content_tree_next(h, content));
+    name = charbuf_obtain(h);
     ndn_name_init(name);
     res = ndn_name_append_components(name, content->key,
                                      content->comps[0],
@@ -4306,15 +6366,18 @@ next_child_at_level(struct ndnd_handle *h,
     if (h->debug & 8)
         ndnd_debug_ndnb(h, __LINE__, "child_successor", NULL,
                         name->buf, name->length);
-    d = content_skiplist_findbefore(h, name->buf, name->length,
-                                    NULL, pred);
-    next = content_from_accession(h, pred[0]->buf[0]);
+    key = charbuf_obtain(h);
+    res = ndn_nametree_namekey(key, name->buf, name->length);
+    if (res < 0) abort();
+    next = content_tree_findfirst(h, key->buf, key->length);
+    charbuf_release(h, key);
     if (next == content) {
         // XXX - I think this case should not occur, but just in case, avoid a loop.
-        next = content_from_accession(h, content_skiplist_next(h, content));
-        ndnd_debug_ndnb(h, __LINE__, "bump", NULL, next->key, next->size);
+        next = content_tree_next(h, content);
+        if (next != NULL)
+            ndnd_debug_ndnb(h, __LINE__, "bump", NULL, next->key, next->size);
     }
-    ndn_charbuf_destroy(&name);
+    charbuf_release(h, name);
     return(next);
 }
 
@@ -4326,7 +6389,7 @@ drop_nonlocal_interest(struct ndnd_handle *h, struct nameprefix_entry *npe,
                        struct face *face,
                        unsigned char *msg, size_t size)
 {
-    if (npe->fgen != h->forward_to_gen)
+    if (forward_to_stale(h, npe))
         update_forward_to(h, npe);
     if ((npe->flags & NDN_FORW_LOCAL) != 0 &&
         (face->flags & NDN_FACE_GG) == 0) {
@@ -4435,7 +6498,13 @@ process_incoming_interest(struct ndnd_handle *h, struct face *face,
             goto Bail;
         if ((pi->answerfrom & NDN_AOK_CS) != 0) {
             last_match = NULL;
-            content = find_first_match_candidate(h, msg, pi);
+            content = NULL;
+            if (pi->prefix_comps > 0 &&
+                comps->buf[pi->prefix_comps] -
+                comps->buf[pi->prefix_comps - 1] == 1 + 2 + 32 + 1)
+                last_match = find_digest_match(h, msg, size, pi, comps);
+            if (last_match == NULL)
+                content = find_first_match_candidate(h, msg, pi);
             if (content != NULL && (h->debug & 8))
                 ndnd_debug_ndnb(h, __LINE__, "first_candidate", NULL,
                                 content->key,
@@ -4450,9 +6519,7 @@ process_incoming_interest(struct ndnd_handle *h, struct face *face,
             }
             for (try = 0; content != NULL; try++) {
                 if ((s_ok || (content->flags & NDN_CONTENT_ENTRY_STALE) == 0) &&
-                    ndn_content_matches_interest(content->key,
-                                       content->size,
-                                       0, NULL, msg, size, pi)) {
+                    content_matches_interest(h, content, NULL, msg, size, pi)) {
                     if (h->debug & 8)
                         ndnd_debug_ndnb(h, __LINE__, "matches", NULL,
                                         content->key,
@@ -4463,7 +6530,7 @@ process_incoming_interest(struct ndnd_handle *h, struct face *face,
                     content = next_child_at_level(h, content, comps->n - 1);
                     goto check_next_prefix;
                 }
-                content = content_from_accession(h, content_skiplist_next(h, content));
+                content = content_tree_next(h, content);
             check_next_prefix:
                 if (content != NULL &&
                     !content_matches_interest_prefix(h, content, msg,
@@ -4492,6 +6559,7 @@ process_incoming_interest(struct ndnd_handle *h, struct face *face,
                     /* Any other matched interests need to be consumed, too. */
                     match_interests(h, content, NULL, face, NULL);
                 }
+                ndnd_cs_hit(h, content);
                 if ((pi->answerfrom & NDN_AOK_EXPIRE) != 0)
                     mark_stale(h, content);
                 matched = 1;
@@ -4523,6 +6591,7 @@ mark_stale(struct ndnd_handle *h, struct content_entry *content)
         h->min_stale = accession;
     if (accession > h->max_stale)
         h->max_stale = accession;
+    ndnd_cs_update(h, content);
 }
 
 /**
@@ -4542,14 +6611,17 @@ expire_content(struct ndn_schedule *sched,
     struct content_entry *content = NULL;
     int res;
     unsigned n;
+    unsigned long long b;
     if ((flags & NDN_SCHEDULE_CANCEL) != 0)
         return(0);
     content = content_from_accession(h, accession);
     if (content != NULL) {
         n = hashtb_n(h->content_tab);
+        b = h->cs_bytes;
         /* The fancy test here lets existing stale content go away, too. */
         if ((n - (n >> 3)) > h->capacity ||
-            (n > h->capacity && h->min_stale > h->max_stale)) {
+            (b - (b >> 3)) > h->capacity_bytes ||
+            (content_over_capacity(h) && h->min_stale > h->max_stale)) {
             res = remove_content(h, content);
             if (res == 0)
                 return(0);
@@ -4594,19 +6666,140 @@ set_content_timer(struct ndnd_handle *h, struct content_entry *content,
     }
     microseconds = seconds * 1000000;
 Finish:
+    content->stale_at = h->sec + (microseconds + 999999) / 1000000;
     ndn_schedule_event(h->sched, microseconds,
                        &expire_content, NULL, content->accession);
 }
 
+/**
+ * Handle the arrival of content that is already in the store
+ *
+ * Stale content is made fresh again; otherwise it is a duplicate.
+ */
+static void
+content_arrived_again(struct ndnd_handle *h, struct face *face,
+                      struct content_entry *content,
+                      struct ndn_parsed_ContentObject *obj)
+{
+    if ((content->flags & NDN_CONTENT_ENTRY_STALE) != 0) {
+        /* When old content arrives after it has gone stale, freshen it */
+        // XXX - ought to do mischief checks before this
+        content->flags &= ~NDN_CONTENT_ENTRY_STALE;
+        h->n_stale--;
+        ndnd_cs_update(h, content);
+        set_content_timer(h, content, obj);
+        /* Record the new arrival face only if the old face is gone */
+        // XXX - it is not clear that this is the most useful choice
+        if (face_from_faceid(h, content->arrival_faceid) == NULL)
+            content->arrival_faceid = face->faceid;
+        // XXX - no counter for this case
+    }
+    else {
+        h->content_dups_recvd++;
+        ndnd_msg(h, "received duplicate ContentObject from %u (accession %llu)",
+                 face->faceid, (unsigned long long)content->accession);
+        ndnd_debug_ndnb(h, __LINE__, "dup", face, content->key, content->size);
+    }
+}
+
+/**
+ * Look up a ContentObject in content_tab, adding it if it is new
+ *
+ * The hashtb key is the fingerprint followed by the first keysize bytes
+ * of the object; the rest of the object goes in the extension, with
+ * room after it for the comps and the tree key, which is the namekey
+ * and the implicit digest component.
+ *
+ * For a new object this is the one copy made of it on the way into the
+ * store: the tail comes straight from msg, and only the head passes
+ * through a scratch buffer, to follow the fingerprint.
+ *
+ * @returns the hashtb_seek_ext result.
+ */
+static int
+content_seek(struct ndnd_handle *h, struct hashtb_enumerator *e, uint64_t fp,
+             const unsigned char *msg, size_t size, size_t keysize,
+             struct ndn_indexbuf *comps, struct ndn_charbuf *namekey)
+{
+    struct ndn_charbuf *cb = charbuf_obtain(h);
+    size_t extsize;
+    int res;
+    
+    ndn_charbuf_append(cb, &fp, sizeof(fp));
+    ndn_charbuf_append(cb, msg, keysize);
+    extsize = CONTENT_COMPS_OFFSET(size) - keysize +
+              (comps->n + 1) * sizeof(unsigned short) + namekey->length +
+              2 + CONTENT_DIGEST_SIZE;
+    res = hashtb_seek_ext(e, cb->buf, cb->length,
+                          msg + keysize, size - keysize, extsize);
+    if (res == HT_OLD_ENTRY && extsize != e->extsize)
+        res = -1;
+    charbuf_release(h, cb);
+    return(res);
+}
+
+/**
+ * Fill in a content entry just added to content_tab, and index it.
+ *
+ * The enumerator e is positioned at the new entry, as made by
+ * content_seek, holding the ContentObject of keysize + tailsize bytes;
+ * comps are its component offsets and namekey its name in comparable
+ * form.  The caller takes care of staleness and the cs_policy.
+ *
+ * @returns the entry, or NULL if it could not be indexed, in which
+ *          case it has been deleted again.
+ */
+static struct content_entry *
+content_enter(struct ndnd_handle *h, struct hashtb_enumerator *e,
+              size_t keysize, size_t tailsize,
+              struct ndn_indexbuf *comps, struct ndn_charbuf *namekey,
+              unsigned faceid)
+{
+    struct content_entry *content = e->data;
+    unsigned long n = hashtb_n(h->content_tab);
+    size_t size = keysize + tailsize;
+    unsigned char *key;
+    int i;
+    
+    if (n > h->capacity + (h->capacity >> 3) ||
+        h->cs_bytes > h->capacity_bytes + (h->capacity_bytes >> 3))
+        clean_needed(h);
+    content->accession = ++(h->accession);
+    content->arrival_faceid = faceid;
+    enroll_content(h, content);
+    content->key_size = keysize;
+    content->size = size;
+    content->key = (const unsigned char *)e->key + sizeof(uint64_t);
+    h->cs_bytes += content->size;
+    content->ncomps = comps->n;
+    content->comps = (unsigned short *)(content->key + CONTENT_COMPS_OFFSET(size));
+    for (i = 0; i < comps->n; i++)
+        content->comps[i] = comps->buf[i];
+    key = (unsigned char *)(content->comps + comps->n);
+    memcpy(key, namekey->buf, namekey->length);
+    /* The digest component's length; the digest itself may come later */
+    key[namekey->length] = CONTENT_DIGEST_SIZE >> 8;
+    key[namekey->length + 1] = CONTENT_DIGEST_SIZE & 0xFF;
+    content->tree.key = key;
+    content->tree.keysize = namekey->length + 2;
+    if (content_tree_insert(h, content) < 0) {
+        ndnd_msg(h, "could not index ContentObject (accession %llu)",
+                 (unsigned long long)content->accession);
+        hashtb_delete(e);
+        return(NULL);
+    }
+    return(content);
+}
+
 /**
  * Process an arriving ContentObject.
  *
  * Parse the ContentObject and discard if it is not well-formed.
  *
- * Compute the digest.
- *
- * Look it up in the content store.  It it is already there, but is stale,
- * make it fresh again.  If it is not there, add it.
+ * Look it up in the content store, by fingerprint and the part of the
+ * object ahead of the Content.  It it is already there, but is stale,
+ * make it fresh again.  If it is not there, add it.  The digest is not
+ * computed here; it waits until something asks for it.
  *
  * Find the matching pending interests in the PIT and consume them,
  * queueing the ContentObject to be sent on the associated faces.
@@ -4630,158 +6823,505 @@ process_incoming_content(struct ndnd_handle *h, struct face *face,
     size_t tailsize = 0;
     unsigned char *tail = NULL;
     struct content_entry *content = NULL;
+    struct ndn_charbuf *namekey = NULL;
+    uint64_t fp;
     int i;
     struct ndn_indexbuf *comps = indexbuf_obtain(h);
-    struct ndn_charbuf *cb = charbuf_obtain(h);
     
     msg = wire_msg;
     size = wire_size;
     
-    res = ndn_parse_ContentObject(msg, size, &obj, comps);
-    if (res < 0) {
-        ndnd_msg(h, "error parsing ContentObject - code %d", res);
+    res = ndn_parse_ContentObject(msg, size, &obj, comps);
+    if (res < 0) {
+        ndnd_msg(h, "error parsing ContentObject - code %d", res);
+        goto Bail;
+    }
+    ndnd_meter_bump(h, face->meter[FM_DATI], 1);
+    face_ishape_returned(face);
+    if (comps->n < 1 ||
+        (keysize = comps->buf[comps->n - 1]) > 65535 - 36) {
+        ndnd_msg(h, "ContentObject with keysize %lu discarded",
+                 (unsigned long)keysize);
+        ndnd_debug_ndnb(h, __LINE__, "oversize", face, msg, size);
+        res = -__LINE__;
+        goto Bail;
+    }
+    if (obj.magic != 20090415) {
+        if (++(h->oldformatcontent) == h->oldformatcontentgrumble) {
+            h->oldformatcontentgrumble *= 10;
+            ndnd_msg(h, "downrev content items received: %d (%d)",
+                     h->oldformatcontent,
+                     obj.magic);
+        }
+    }
+    keysize = obj.offset[NDN_PCO_B_Content];
+    tail = msg + keysize;
+    tailsize = size - keysize;
+    /* The namekey and component offsets are kept after the object */
+    namekey = charbuf_obtain(h);
+    res = ndn_nametree_namekey(namekey, msg + obj.offset[NDN_PCO_B_Name],
+                               obj.offset[NDN_PCO_E_Name] -
+                               obj.offset[NDN_PCO_B_Name]);
+    if (res < 0) {
+        ndnd_debug_ndnb(h, __LINE__, "unnameable", face, msg, size);
+        goto Bail;
+    }
+    fp = content_fingerprint(h, msg, size);
+    hashtb_start(h->content_tab, e);
+    res = content_seek(h, e, fp, msg, size, keysize, comps, namekey);
+    content = e->data;
+    if (res == HT_OLD_ENTRY && (content->size != size ||
+          0 != memcmp(tail, content->key + keysize, tailsize))) {
+        ndnd_msg(h, "ContentObject name collision!!!!!");
+        ndnd_debug_ndnb(h, __LINE__, "new", face, msg, size);
+        ndnd_debug_ndnb(h, __LINE__, "old", NULL, content->key, content->size);
+        content = NULL;
+        hashtb_delete(e); /* XXX - Mercilessly throw away both of them. */
+        res = -__LINE__;
+    }
+    if (res >= 0 && (h->debug & 4))
+        ndnd_debug_ndnb(h, __LINE__, "content_from", face, msg, size);
+    if (res == HT_OLD_ENTRY)
+        content_arrived_again(h, face, content, &obj);
+    else if (res == HT_NEW_ENTRY) {
+        content = content_enter(h, e, keysize, tailsize, comps, namekey,
+                                face->faceid);
+        if (content == NULL) {
+            res = -__LINE__;
+            hashtb_end(e);
+            goto Bail;
+        }
+        set_content_timer(h, content, &obj);
+        /* Mark public keys supplied at startup as precious. */
+        if (obj.type == NDN_CONTENT_KEY && content->accession <= (h->capacity + 7)/8)
+            content->flags |= NDN_CONTENT_ENTRY_PRECIOUS;
+        ndnd_cs_insert(h, content);
+    }
+    hashtb_end(e);
+Bail:
+    indexbuf_release(h, comps);
+    if (namekey != NULL)
+        charbuf_release(h, namekey);
+    if (res >= 0 && content != NULL) {
+        int n_matches;
+        enum cq_delay_class c;
+        struct content_queue *q;
+        n_matches = match_interests(h, content, &obj, NULL, face);
+        if (res == HT_OLD_ENTRY && n_matches > 0)
+            ndnd_cs_hit(h, content);
+        if (res == HT_NEW_ENTRY) {
+            if (n_matches < 0) {
+                remove_content(h, content);
+                return;
+            }
+            if (n_matches == 0 && (face->flags & NDN_FACE_GG) == 0) {
+                content->flags |= NDN_CONTENT_ENTRY_SLOWSEND;
+                ndn_indexbuf_append_element(h->unsol, content->accession);
+            }
+        }
+        // ZZZZ - review whether the following is actually needed
+        for (c = 0; c < NDN_CQ_N; c++) {
+            q = face->q[c];
+            if (q != NULL) {
+                i = ndn_indexbuf_member(q->send_queue, content->accession);
+                if (i >= 0) {
+                    /*
+                     * In the case this consumed any interests from this source,
+                     * don't send the content back
+                     */
+                    if (h->debug & 8)
+                        ndnd_debug_ndnb(h, __LINE__, "content_nosend", face, msg, size);
+                    q->send_queue->buf[i] = 0;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Content store snapshots
+ *
+ * With NDND_CS_SNAPSHOT set, the content store is written to that file
+ * when ndnd stops cleanly or gets SIGUSR1, and is read back in when it
+ * starts.  The file is a header followed by one record per object in
+ * arrival order, each holding the object as stored, its digest, and what
+ * is needed to restore its freshness, padded to a multiple of 8 bytes.
+ * Numbers are in native byte order; a snapshot is only meant for the
+ * machine that wrote it.
+ *
+ * Each object is checked against its digest as it is read back, and
+ * those that do not match are skipped.
+ */
+#define CS_SNAPSHOT_MAGIC "NDNDCS3\n"
+#define CS_SNAPSHOT_BATCH 200   /**< records loaded per scheduled run */
+#define CS_SNAPSHOT_PAUSE 1000  /**< microseconds between runs */
+#define CS_SNAPSHOT_PAD(n) (((n) + 7) & ~(size_t)7)
+
+struct cs_snapshot_header {
+    char magic[8];
+    uint64_t count;             /**< number of records */
+    int64_t saved;              /**< when it was written, in seconds */
+};
+
+struct cs_snapshot_record {
+    uint32_t size;              /**< of the ContentObject that follows */
+    uint32_t flags;             /**< STALE and PRECIOUS content entry flags */
+    int32_t ttl;                /**< seconds until stale, or -1 for never */
+    uint32_t cs_hits;
+    unsigned char digest[CONTENT_DIGEST_SIZE]; /**< of the ContentObject */
+};
+
+struct cs_snapshot_loader {
+    unsigned char *map;         /**< the snapshot file, mapped read-only */
+    size_t mapsize;
+    size_t pos;                 /**< offset of the next record */
+    uint64_t remaining;         /**< records not yet looked at */
+    long downtime;              /**< seconds since the snapshot was saved */
+    unsigned long skipped;      /**< records that failed their check */
+    struct ndn_scheduled_event *ev;
+};
+
+static volatile sig_atomic_t cs_snapshot_wanted = 0;
+
+static void
+cs_snapshot_signal(int sig)
+{
+    cs_snapshot_wanted = 1;
+}
+
+/**
+ * Add one snapshot record to the content store
+ *
+ * Objects that are already present are left alone.
+ *
+ * @returns 0, or -1 if the record does not hold a usable ContentObject
+ *          or the object does not match the digest that was saved with it.
+ */
+static int
+cs_snapshot_enter(struct ndnd_handle *h, const struct cs_snapshot_record *rec,
+                  const unsigned char *msg, long downtime)
+{
+    struct ndn_parsed_ContentObject obj = {0};
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct content_entry *content = NULL;
+    struct ndn_indexbuf *comps = indexbuf_obtain(h);
+    struct ndn_charbuf *namekey = charbuf_obtain(h);
+    size_t size = rec->size;
+    size_t keysize;
+    uint64_t fp;
+    long ttl;
+    int res;
+    
+    res = ndn_parse_ContentObject(msg, size, &obj, comps);
+    if (res < 0 || comps->n < 1 || comps->buf[comps->n - 1] > 65535 - 36 ||
+        obj.offset[NDN_PCO_E] != size) {
+        res = -1;
+        goto Bail;
+    }
+    ndn_digest_ContentObject(msg, &obj);
+    if (memcmp(obj.digest, rec->digest, CONTENT_DIGEST_SIZE) != 0) {
+        res = -1;
+        goto Bail;
+    }
+    res = ndn_nametree_namekey(namekey, msg + obj.offset[NDN_PCO_B_Name],
+                               obj.offset[NDN_PCO_E_Name] -
+                               obj.offset[NDN_PCO_B_Name]);
+    if (res < 0)
+        goto Bail;
+    keysize = obj.offset[NDN_PCO_B_Content];
+    fp = content_fingerprint(h, msg, size);
+    hashtb_start(h->content_tab, e);
+    res = content_seek(h, e, fp, msg, size, keysize, comps, namekey);
+    if (res == HT_NEW_ENTRY)
+        content = content_enter(h, e, keysize, size - keysize, comps,
+                                namekey, NDN_NOFACEID);
+    hashtb_end(e);
+    res = 0;
+    if (content == NULL)
+        goto Bail;
+    h->cs_snapshot_loaded++;
+    content_share_digest(h, content, &obj);
+    content->cs_hits = rec->cs_hits;
+    content->flags |= (rec->flags & NDN_CONTENT_ENTRY_PRECIOUS);
+    ndnd_cs_insert(h, content);
+    ttl = (long)rec->ttl - downtime;
+    if ((rec->flags & NDN_CONTENT_ENTRY_STALE) != 0 || (rec->ttl >= 0 && ttl <= 0))
+        mark_stale(h, content);
+    else if (rec->ttl >= 0) {
+        if (ttl > (1U<<31) / 1000000)
+            ttl = (1U<<31) / 1000000;
+        content->stale_at = h->sec + ttl;
+        ndn_schedule_event(h->sched, ttl * 1000000,
+                           &expire_content, NULL, content->accession);
+    }
+Bail:
+    indexbuf_release(h, comps);
+    charbuf_release(h, namekey);
+    return(res);
+}
+
+/**
+ * Release the snapshot that was being loaded
+ */
+static void
+cs_snapshot_load_done(struct ndnd_handle *h)
+{
+    struct cs_snapshot_loader *ld = h->cs_loader;
+    
+    if (ld == NULL)
+        return;
+    h->cs_loader = NULL;
+    munmap(ld->map, ld->mapsize);
+    ndnd_msg(h, "restored %lu content objects from %s",
+             h->cs_snapshot_loaded, h->cs_snapshot);
+    if (ld->skipped != 0)
+        ndnd_msg(h, "%s: skipped %lu damaged records",
+                 h->cs_snapshot, ld->skipped);
+    free(ld);
+}
+
+/**
+ * Load up to n records from the snapshot
+ *
+ * Loading stops early once the store is full, or at a record whose size
+ * does not fit in the file.  A record that is the right size but fails
+ * its check is skipped.
+ *
+ * @returns 1 if there is more to do, 0 if the load is finished.
+ */
+static int
+cs_snapshot_load_some(struct ndnd_handle *h, int n)
+{
+    struct cs_snapshot_loader *ld = h->cs_loader;
+    const struct cs_snapshot_record *rec;
+    size_t recsize;
+    
+    if (ld == NULL)
+        return(0);
+    for (; n > 0; n--) {
+        if (ld->remaining == 0 ||
+            hashtb_n(h->content_tab) >= h->capacity ||
+            h->cs_bytes >= h->capacity_bytes)
+            break;
+        rec = (const void *)(ld->map + ld->pos);
+        if (ld->mapsize - ld->pos < sizeof(*rec) ||
+            ld->mapsize - ld->pos - sizeof(*rec) < rec->size) {
+            ndnd_msg(h, "%s: damaged record at offset %lu",
+                     h->cs_snapshot, (unsigned long)ld->pos);
+            break;
+        }
+        if (cs_snapshot_enter(h, rec, ld->map + ld->pos + sizeof(*rec),
+                              ld->downtime) < 0)
+            ld->skipped++;
+        recsize = sizeof(*rec) + CS_SNAPSHOT_PAD(rec->size);
+        if (ld->mapsize - ld->pos < recsize)
+            recsize = ld->mapsize - ld->pos;
+        ld->pos += recsize;
+        ld->remaining--;
+    }
+    if (n > 0) {
+        cs_snapshot_load_done(h);
+        return(0);
+    }
+    return(1);
+}
+
+/**
+ * Scheduled event that loads the snapshot a batch at a time
+ *
+ * This lets ndnd serve its faces while a large snapshot comes in.
+ */
+static int
+cs_snapshot_loader(struct ndn_schedule *sched,
+                   void *clienth,
+                   struct ndn_scheduled_event *ev,
+                   int flags)
+{
+    struct ndnd_handle *h = clienth;
+    
+    if ((flags & NDN_SCHEDULE_CANCEL) != 0) {
+        if (h->cs_loader != NULL && h->cs_loader->ev == ev)
+            cs_snapshot_load_done(h);
+        return(0);
+    }
+    if (cs_snapshot_load_some(h, CS_SNAPSHOT_BATCH) > 0)
+        return(CS_SNAPSHOT_PAUSE);
+    return(0);
+}
+
+/**
+ * Finish loading the snapshot right away
+ */
+static void
+cs_snapshot_load_all(struct ndnd_handle *h)
+{
+    struct ndn_scheduled_event *ev;
+    
+    if (h->cs_loader == NULL)
+        return;
+    ev = h->cs_loader->ev;
+    h->cs_loader->ev = NULL;
+    if (ev != NULL)
+        ndn_schedule_cancel(h->sched, ev);
+    while (cs_snapshot_load_some(h, CS_SNAPSHOT_BATCH) > 0)
+        continue;
+}
+
+/**
+ * Map the snapshot file and schedule its loading
+ *
+ * A missing file is not an error; there is nothing to restore.
+ */
+static void
+cs_snapshot_load_start(struct ndnd_handle *h)
+{
+    struct cs_snapshot_loader *ld = NULL;
+    const struct cs_snapshot_header *hdr;
+    struct stat statbuf;
+    void *map = MAP_FAILED;
+    int fd;
+    
+    fd = open(h->cs_snapshot, O_RDONLY);
+    if (fd == -1) {
+        if (errno != ENOENT)
+            ndnd_msg(h, "%s: %s", h->cs_snapshot, strerror(errno));
+        return;
+    }
+    if (fstat(fd, &statbuf) == -1 ||
+        statbuf.st_size < (off_t)sizeof(*hdr) ||
+        (map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+            == MAP_FAILED) {
+        ndnd_msg(h, "%s: cannot map snapshot", h->cs_snapshot);
+        goto Bail;
+    }
+    madvise(map, statbuf.st_size, MADV_SEQUENTIAL);
+    madvise(map, statbuf.st_size, MADV_WILLNEED);
+    hdr = map;
+    if (memcmp(hdr->magic, CS_SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0) {
+        ndnd_msg(h, "%s: not a content store snapshot", h->cs_snapshot);
+        goto Bail;
+    }
+    ld = calloc(1, sizeof(*ld));
+    if (ld == NULL)
+        goto Bail;
+    ld->map = map;
+    ld->mapsize = statbuf.st_size;
+    ld->pos = sizeof(*hdr);
+    ld->remaining = hdr->count;
+    ld->downtime = (h->sec > hdr->saved) ? h->sec - hdr->saved : 0;
+    h->cs_loader = ld;
+    ld->ev = ndn_schedule_event(h->sched, 0, &cs_snapshot_loader, NULL, 0);
+    ndnd_msg(h, "restoring %llu content objects from %s, saved %ld seconds ago",
+             (unsigned long long)ld->remaining, h->cs_snapshot, ld->downtime);
+    map = MAP_FAILED;
+Bail:
+    if (map != MAP_FAILED)
+        munmap(map, statbuf.st_size);
+    close(fd);
+}
+
+static int
+cs_snapshot_compare(const void *a, const void *b)
+{
+    const struct content_entry *x = *(struct content_entry * const *)a;
+    const struct content_entry *y = *(struct content_entry * const *)b;
+    
+    return((x->accession > y->accession) - (x->accession < y->accession));
+}
+
+/**
+ * Write the content store to the snapshot file
+ *
+ * The snapshot is built in a temporary file that then replaces the
+ * old one, so an interrupted save leaves the previous snapshot intact.
+ * An unfinished load is completed first, so nothing is lost.
+ *
+ * @returns the number of objects written, or -1 for an error.
+ */
+static int
+cs_snapshot_save(struct ndnd_handle *h)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct content_entry **v = NULL;
+    struct cs_snapshot_header *hdr;
+    struct cs_snapshot_record *rec;
+    struct ndn_parsed_ContentObject obj = {0};
+    struct ndn_charbuf *temp = NULL;
+    unsigned char *map = MAP_FAILED;
+    size_t mapsize = sizeof(*hdr);
+    size_t pos;
+    size_t n = 0;
+    size_t i;
+    int fd = -1;
+    int res = -1;
+    
+    if (h->cs_snapshot == NULL || h->content_tab == NULL)
+        return(-1);
+    cs_snapshot_load_all(h);
+    v = calloc(hashtb_n(h->content_tab) + 1, sizeof(v[0]));
+    temp = ndn_charbuf_create();
+    if (v == NULL || temp == NULL)
         goto Bail;
+    for (hashtb_start(h->content_tab, e); e->data != NULL; hashtb_next(e)) {
+        v[n] = e->data;
+        mapsize += sizeof(*rec) + CS_SNAPSHOT_PAD(v[n]->size);
+        n++;
     }
-    ndnd_meter_bump(h, face->meter[FM_DATI], 1);
-    if (comps->n < 1 ||
-        (keysize = comps->buf[comps->n - 1]) > 65535 - 36) {
-        ndnd_msg(h, "ContentObject with keysize %lu discarded",
-                 (unsigned long)keysize);
-        ndnd_debug_ndnb(h, __LINE__, "oversize", face, msg, size);
-        res = -__LINE__;
+    hashtb_end(e);
+    qsort(v, n, sizeof(v[0]), &cs_snapshot_compare);
+    ndn_charbuf_putf(temp, "%s.%d", h->cs_snapshot, h->logpid);
+    fd = open(ndn_charbuf_as_string(temp), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1 || ftruncate(fd, mapsize) == -1)
         goto Bail;
-    }
-    /* Make the ContentObject-digest name component explicit */
-    ndn_digest_ContentObject(msg, &obj);
-    if (obj.digest_bytes != 32) {
-        ndnd_debug_ndnb(h, __LINE__, "indigestible", face, msg, size);
+    map = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
         goto Bail;
-    }
-    i = comps->buf[comps->n - 1];
-    ndn_charbuf_append(cb, msg, i);
-    ndn_charbuf_append_tt(cb, NDN_DTAG_Component, NDN_DTAG);
-    ndn_charbuf_append_tt(cb, obj.digest_bytes, NDN_BLOB);
-    ndn_charbuf_append(cb, obj.digest, obj.digest_bytes);
-    ndn_charbuf_append_closer(cb);
-    ndn_charbuf_append(cb, msg + i, size - i);
-    msg = cb->buf;
-    size = cb->length;
-    res = ndn_parse_ContentObject(msg, size, &obj, comps);
-    if (res < 0) abort(); /* must have just messed up */
-    
-    if (obj.magic != 20090415) {
-        if (++(h->oldformatcontent) == h->oldformatcontentgrumble) {
-            h->oldformatcontentgrumble *= 10;
-            ndnd_msg(h, "downrev content items received: %d (%d)",
-                     h->oldformatcontent,
-                     obj.magic);
-        }
-    }
-    if (h->debug & 4)
-        ndnd_debug_ndnb(h, __LINE__, "content_from", face, msg, size);
-    keysize = obj.offset[NDN_PCO_B_Content];
-    tail = msg + keysize;
-    tailsize = size - keysize;
-    hashtb_start(h->content_tab, e);
-    res = hashtb_seek(e, msg, keysize, tailsize);
-    content = e->data;
-    if (res == HT_OLD_ENTRY) {
-        if (tailsize != e->extsize ||
-              0 != memcmp(tail, ((unsigned char *)e->key) + keysize, tailsize)) {
-            ndnd_msg(h, "ContentObject name collision!!!!!");
-            ndnd_debug_ndnb(h, __LINE__, "new", face, msg, size);
-            ndnd_debug_ndnb(h, __LINE__, "old", NULL, e->key, e->keysize + e->extsize);
-            content = NULL;
-            hashtb_delete(e); /* XXX - Mercilessly throw away both of them. */
-            res = -__LINE__;
-        }
-        else if ((content->flags & NDN_CONTENT_ENTRY_STALE) != 0) {
-            /* When old content arrives after it has gone stale, freshen it */
-            // XXX - ought to do mischief checks before this
-            content->flags &= ~NDN_CONTENT_ENTRY_STALE;
-            h->n_stale--;
-            set_content_timer(h, content, &obj);
-            /* Record the new arrival face only if the old face is gone */
-            // XXX - it is not clear that this is the most useful choice
-            if (face_from_faceid(h, content->arrival_faceid) == NULL)
-                content->arrival_faceid = face->faceid;
-            // XXX - no counter for this case
-        }
-        else {
-            h->content_dups_recvd++;
-            ndnd_msg(h, "received duplicate ContentObject from %u (accession %llu)",
-                     face->faceid, (unsigned long long)content->accession);
-            ndnd_debug_ndnb(h, __LINE__, "dup", face, msg, size);
-        }
-    }
-    else if (res == HT_NEW_ENTRY) {
-        unsigned long n = hashtb_n(h->content_tab);
-        if (n > h->capacity + (h->capacity >> 3))
-            clean_needed(h);
-        content->accession = ++(h->accession);
-        content->arrival_faceid = face->faceid;
-        enroll_content(h, content);
-        if (content == content_from_accession(h, content->accession)) {
-            content->ncomps = comps->n;
-            content->comps = calloc(comps->n, sizeof(comps[0]));
-            if (content->comps == NULL) {
-                ndnd_msg(h, "could not enroll ContentObject (accession %llu)",
-                         (unsigned long long)content->accession);
-                content = NULL;
-                hashtb_delete(e);
-                res = -__LINE__;
-                hashtb_end(e);
-                goto Bail;
-            }
+    hdr = (struct cs_snapshot_header *)map;
+    memcpy(hdr->magic, CS_SNAPSHOT_MAGIC, sizeof(hdr->magic));
+    hdr->count = n;
+    hdr->saved = h->sec;
+    /* The file is zero-filled, so the padding takes care of itself */
+    for (i = 0, pos = sizeof(*hdr); i < n; i++) {
+        rec = (struct cs_snapshot_record *)(map + pos);
+        rec->size = v[i]->size;
+        rec->flags = v[i]->flags & (NDN_CONTENT_ENTRY_STALE |
+                                    NDN_CONTENT_ENTRY_PRECIOUS);
+        rec->ttl = -1;
+        if ((v[i]->flags & NDN_CONTENT_ENTRY_STALE) == 0 && v[i]->stale_at != 0)
+            rec->ttl = ((long)v[i]->stale_at > h->sec) ?
+                       (long)v[i]->stale_at - h->sec : 0;
+        rec->cs_hits = v[i]->cs_hits;
+        if ((v[i]->flags & NDN_CONTENT_ENTRY_DIGEST) == 0 &&
+            ndn_parse_ContentObject(v[i]->key, v[i]->size, &obj, NULL) >= 0) {
+            ndn_digest_ContentObject(v[i]->key, &obj);
+            content_share_digest(h, v[i], &obj);
         }
-        content->key_size = e->keysize;
-        content->size = e->keysize + e->extsize;
-        content->key = e->key;
-        for (i = 0; i < comps->n; i++)
-            content->comps[i] = comps->buf[i];
-        content_skiplist_insert(h, content);
-        set_content_timer(h, content, &obj);
-        /* Mark public keys supplied at startup as precious. */
-        if (obj.type == NDN_CONTENT_KEY && content->accession <= (h->capacity + 7)/8)
-            content->flags |= NDN_CONTENT_ENTRY_PRECIOUS;
+        memcpy(rec->digest, content_digest_slot(v[i]), CONTENT_DIGEST_SIZE);
+        memcpy(map + pos + sizeof(*rec), v[i]->key, v[i]->size);
+        pos += sizeof(*rec) + CS_SNAPSHOT_PAD(v[i]->size);
     }
-    hashtb_end(e);
+    if (msync(map, mapsize, MS_SYNC) == -1 ||
+        rename(ndn_charbuf_as_string(temp), h->cs_snapshot) == -1)
+        goto Bail;
+    res = n;
+    h->cs_snapshot_saved = n;
+    ndnd_msg(h, "saved %d content objects to %s", res, h->cs_snapshot);
 Bail:
-    indexbuf_release(h, comps);
-    charbuf_release(h, cb);
-    cb = NULL;
-    if (res >= 0 && content != NULL) {
-        int n_matches;
-        enum cq_delay_class c;
-        struct content_queue *q;
-        n_matches = match_interests(h, content, &obj, NULL, face);
-        if (res == HT_NEW_ENTRY) {
-            if (n_matches < 0) {
-                remove_content(h, content);
-                return;
-            }
-            if (n_matches == 0 && (face->flags & NDN_FACE_GG) == 0) {
-                content->flags |= NDN_CONTENT_ENTRY_SLOWSEND;
-                ndn_indexbuf_append_element(h->unsol, content->accession);
-            }
-        }
-        // ZZZZ - review whether the following is actually needed
-        for (c = 0; c < NDN_CQ_N; c++) {
-            q = face->q[c];
-            if (q != NULL) {
-                i = ndn_indexbuf_member(q->send_queue, content->accession);
-                if (i >= 0) {
-                    /*
-                     * In the case this consumed any interests from this source,
-                     * don't send the content back
-                     */
-                    if (h->debug & 8)
-                        ndnd_debug_ndnb(h, __LINE__, "content_nosend", face, msg, size);
-                    q->send_queue->buf[i] = 0;
-                }
-            }
-        }
-    }
+    if (res < 0) {
+        ndnd_msg(h, "%s: snapshot not saved: %s", h->cs_snapshot,
+                 strerror(errno));
+        if (fd != -1)
+            unlink(ndn_charbuf_as_string(temp));
+    }
+    if (map != MAP_FAILED)
+        munmap(map, mapsize);
+    if (fd != -1)
+        close(fd);
+    ndn_charbuf_destroy(&temp);
+    free(v);
+    return(res);
 }
 
 /**
@@ -4845,8 +7385,14 @@ process_input_message(struct ndnd_handle *h, struct face *face,
             process_incoming_content(h, face, msg, size);
             return;
         case NDN_DTAG_SequenceNumber:
+        case NDN_DTAG_LinkFragment:
+        case NDN_DTAG_LinkAck:
+        case NDN_DTAG_CongestionMark:
             process_incoming_link_message(h, face, dtag, msg, size);
             return;
+        case NDN_DTAG_ShmRequest:
+            process_shm_request(h, face, msg, size);
+            return;
         default:
             break;
     }
@@ -4917,6 +7463,71 @@ scrub_sockaddr(struct sockaddr *addr, socklen_t addrlen,
     return((struct sockaddr *)dst);
 }
 
+#define DGRAM_KEY_MAX 24 /**< largest compact dgram_faces key */
+
+/**
+ * Make the dgram_faces key for a peer address.
+ *
+ * IPv4 and IPv6 peers are keyed by just their address, port, family
+ * and scope, which is less to hash and compare than the sockaddr.
+ *
+ * @returns the key size, or 0 if the sockaddr itself should be the key.
+ */
+static size_t
+dgram_key(unsigned char *key, const struct sockaddr *addr, socklen_t addrlen)
+{
+    const struct sockaddr_in *sin;
+    const struct sockaddr_in6 *sin6;
+    uint16_t family = addr->sa_family;
+    
+    if (addr->sa_family == AF_INET && addrlen == sizeof(*sin)) {
+        sin = (const void *)addr;
+        memcpy(key, &sin->sin_addr, 4);
+        memcpy(key + 4, &sin->sin_port, 2);
+        memcpy(key + 6, &family, 2);
+        return(8);
+    }
+    if (addr->sa_family == AF_INET6 && addrlen == sizeof(*sin6)) {
+        sin6 = (const void *)addr;
+        memcpy(key, &sin6->sin6_addr, 16);
+        memcpy(key + 16, &sin6->sin6_port, 2);
+        memcpy(key + 18, &family, 2);
+        memcpy(key + 20, &sin6->sin6_scope_id, 4);
+        return(24);
+    }
+    return(0);
+}
+
+/**
+ * Find (or add) the dgram_faces entry for a scrubbed sockaddr.
+ *
+ * The sockaddr is kept after the compact key, if there is one;
+ * see dgram_face_addr.
+ */
+static int
+dgram_faces_seek(struct hashtb_enumerator *e,
+                 const struct sockaddr *addr, socklen_t addrlen)
+{
+    unsigned char key[DGRAM_KEY_MAX];
+    size_t keysize;
+    
+    keysize = dgram_key(key, addr, addrlen);
+    if (keysize == 0)
+        return(hashtb_seek(e, addr, addrlen, 0));
+    return(hashtb_seek_ext(e, key, keysize, addr, addrlen, addrlen));
+}
+
+/**
+ * Locate the sockaddr of the dgram_faces entry at e.
+ */
+static const struct sockaddr *
+dgram_face_addr(struct hashtb_enumerator *e)
+{
+    if (e->extsize == 0)
+        return(e->key);
+    return((const void *)((const unsigned char *)e->key + e->keysize));
+}
+
 /**
  * Get (or create) the face associated with a given sockaddr.
  */
@@ -4934,13 +7545,13 @@ get_dgram_source(struct ndnd_handle *h, struct face *face,
     if ((face->flags & NDN_FACE_MCAST) != 0)
         return(face);
     hashtb_start(h->dgram_faces, e);
-    res = hashtb_seek(e, scrub_sockaddr(addr, addrlen, &space), addrlen, 0);
+    res = dgram_faces_seek(e, scrub_sockaddr(addr, addrlen, &space), addrlen);
     if (res >= 0) {
         source = e->data;
         source->recvcount++;
         if (source->addr == NULL) {
-            source->addr = e->key;
-            source->addrlen = e->keysize;
+            source->addr = dgram_face_addr(e);
+            source->addrlen = addrlen;
             source->recv_fd = face->recv_fd;
             source->sendface = face->faceid;
             init_face_flags(h, source, NDN_FACE_DGRAM);
@@ -4951,8 +7562,13 @@ get_dgram_source(struct ndnd_handle *h, struct face *face,
                 hashtb_delete(e);
                 source = NULL;
             }
-            else
+            else {
+                source->idle_timer = ndn_schedule_event(h->sched,
+                                                        NDND_DGRAM_IDLE_USEC,
+                                                        &dgram_face_idle, NULL,
+                                                        source->faceid);
                 ndnd_new_face_msg(h, source);
+            }
         }
     }
     hashtb_end(e);
@@ -5051,6 +7667,11 @@ process_input(struct ndnd_handle *h, int fd)
         shutdown_client_fd(h, fd);
     else {
         source = get_dgram_source(h, face, addr, addrlen, (res == 1) ? 1 : 2);
+        if (source == NULL) {
+            ndnd_msg(h, "no face available for datagram on face %u",
+                     face->faceid);
+            return;
+        }
         ndnd_meter_bump(h, source->meter[FM_BYTI], res);
         source->recvcount++;
         source->surplus = 0; // XXX - we don't actually use this, except for some obscure messages.
@@ -5106,6 +7727,150 @@ process_input(struct ndnd_handle *h, int fd)
     }
 }
 
+/**
+ * Answer a ShmRequest from a local client.
+ *
+ * The descriptors for the new shared-memory rings go back as SCM_RIGHTS
+ * ancillary data on the ShmOffer, so only a unix-domain stream face
+ * with nothing already waiting in its outbuf can be given them.
+ * If the rings cannot be made, the offer is of size 0 and carries
+ * no descriptors, and the client keeps using the socket.
+ */
+static void
+process_shm_request(struct ndnd_handle *h, struct face *face,
+                    unsigned char *msg, size_t size)
+{
+    struct ndn_buf_decoder decoder;
+    struct ndn_buf_decoder *d;
+    struct ndn_charbuf *c = NULL;
+    struct ndn_shm *shm = NULL;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(NDN_SHM_NFDS * sizeof(int))];
+    } cbuf;
+    struct msghdr mh = {0};
+    struct iovec iov;
+    struct cmsghdr *cm;
+    int fds[NDN_SHM_NFDS];
+    int ringsize = -1;
+    ssize_t res;
+    
+    if ((face->flags & (NDN_FACE_DGRAM | NDN_FACE_LOCAL)) != NDN_FACE_LOCAL ||
+        face->outbuf != NULL || face->shm != NULL) {
+        ndnd_msg(h, "ShmRequest not possible on face %u", face->faceid);
+        return;
+    }
+    d = ndn_buf_decoder_start(&decoder, msg, size);
+    if (ndn_buf_match_dtag(d, NDN_DTAG_ShmRequest)) {
+        ndn_buf_advance(d);
+        ringsize = ndn_parse_nonNegativeInteger(d);
+        ndn_buf_check_close(d);
+    }
+    if (d->decoder.state < 0 || ringsize < 0) {
+        ndnd_msg(h, "bad ShmRequest on face %u", face->faceid);
+        return;
+    }
+    shm = ndn_shm_create(ringsize);
+    c = charbuf_obtain(h);
+    ndnb_tagged_putf(c, NDN_DTAG_ShmOffer, "%u",
+                     shm == NULL ? 0U : (unsigned)ndn_shm_ring_size(shm));
+    iov.iov_base = c->buf;
+    iov.iov_len = c->length;
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (shm != NULL) {
+        ndn_shm_fds(shm, fds);
+        mh.msg_control = cbuf.buf;
+        mh.msg_controllen = sizeof(cbuf.buf);
+        cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    }
+    res = sendmsg(face->recv_fd, &mh, 0);
+    if (res == -1) {
+        ndnd_msg(h, "ShmOffer to face %u: %s", face->faceid, strerror(errno));
+        ndn_shm_destroy(&shm);
+    }
+    else if (res < c->length) {
+        /* The descriptors went with the first part */
+        face->outbufindex = 0;
+        face->outbuf = ndn_charbuf_create();
+        ndn_charbuf_append(face->outbuf, c->buf + res, c->length - res);
+    }
+    if (shm != NULL) {
+        face->shm = shm;
+        h->shm_count++;
+        ndnd_msg(h, "shared-memory rings of %u bytes for face %u",
+                 (unsigned)ndn_shm_ring_size(shm), face->faceid);
+    }
+    charbuf_release(h, c);
+}
+
+#define NDND_SHM_BUDGET 64
+
+/**
+ * Take the messages a local client has left in its shared-memory ring.
+ *
+ * Each one is copied out before it is parsed, because the client can
+ * still scribble on those pages.  Only NDND_SHM_BUDGET messages are
+ * handled per call so that one busy client cannot starve the other
+ * faces; if more are waiting, the eventfd is made readable again.
+ *
+ * The fd is that of the face's socket.
+ */
+static void
+process_shm_input(struct ndnd_handle *h, int fd)
+{
+    struct face *face = NULL;
+    struct ndn_charbuf *c = NULL;
+    struct ndn_skeleton_decoder dd;
+    const unsigned char *msg;
+    size_t size;
+    int n;
+    int res = 0;
+    
+    face = hashtb_lookup(h->faces_by_fd, &fd, sizeof(fd));
+    if (face == NULL || face->shm == NULL)
+        return;
+    ndn_shm_clear_wakeup(face->shm);
+    c = charbuf_obtain(h);
+    for (n = 0; n < NDND_SHM_BUDGET; n++) {
+        res = ndn_shm_peek(face->shm, &msg, &size);
+        if (res <= 0)
+            break;
+        c->length = 0;
+        ndn_charbuf_append(c, msg, size);
+        ndn_shm_consume(face->shm);
+        memset(&dd, 0, sizeof(dd));
+        ndn_skeleton_decode(&dd, c->buf, c->length);
+        if (size == 0 || dd.state != 0 || dd.index != size) {
+            res = -1;
+            break;
+        }
+        ndnd_meter_bump(h, face->meter[FM_BYTI], size);
+        face->recvcount++;
+        face->surplus = 0;
+        h->shm_msgs_in++;
+        process_input_message(h, face, c->buf, size, 1);
+        /* The face may have gone away meanwhile */
+        face = hashtb_lookup(h->faces_by_fd, &fd, sizeof(fd));
+        if (face == NULL || face->shm == NULL)
+            break;
+    }
+    charbuf_release(h, c);
+    if (face == NULL || face->shm == NULL)
+        return;
+    if (res < 0) {
+        ndnd_msg(h, "protocol error in shared-memory ring of face %u",
+                 face->faceid);
+        shutdown_client_fd(h, fd);
+    }
+    else if (n == NDND_SHM_BUDGET)
+        ndn_shm_wakeup(face->shm);
+}
+
 /**
  * Process messages from our internal client.
  *
@@ -5230,37 +7995,100 @@ ndnd_send(struct ndnd_handle *h,
           struct face *face,
           const void *data, size_t size)
 {
+    ndnd_send_parts(h, face, data, size, NULL, 0);
+}
+
+/**
+ * Send data that is in two pieces to the face.
+ *
+ * The pieces are handed to the kernel together with sendmsg(), so
+ * the caller does not need to assemble them in a scratch buffer first.
+ * Either piece may be empty.
+ */
+static void
+ndnd_send_parts(struct ndnd_handle *h, struct face *face,
+                const void *data1, size_t size1,
+                const void *data2, size_t size2)
+{
+    struct iovec iov[2];
+    struct msghdr mh = {0};
+    struct ndn_charbuf *c = NULL;
+    size_t size = size1 + size2;
     ssize_t res;
     int fd;
     int bcast = 0;
     
     if ((face->flags & NDN_FACE_NOSEND) != 0)
         return;
+    /* Messages held for coalescing were sent first, so they go first */
+    if (face->coalesce != NULL && face->coalesce->length != 0)
+        face_coalesce_flush(h, face);
     face->surplus++;
     if (face->outbuf != NULL) {
-        ndn_charbuf_append(face->outbuf, data, size);
+        ndn_charbuf_append(face->outbuf, data1, size1);
+        if (size2 != 0)
+            ndn_charbuf_append(face->outbuf, data2, size2);
         return;
     }
     if (face == h->face0) {
         ndnd_meter_bump(h, face->meter[FM_BYTO], size);
-        ndn_dispatch_message(h->internal_client, (void *)data, size);
+        if (size2 == 0)
+            ndn_dispatch_message(h->internal_client, (void *)data1, size1);
+        else {
+            c = charbuf_obtain(h);
+            ndn_charbuf_append(c, data1, size1);
+            ndn_charbuf_append(c, data2, size2);
+            ndn_dispatch_message(h->internal_client, c->buf, c->length);
+            charbuf_release(h, c);
+        }
         ndnd_internal_client_has_somthing_to_say(h);
         return;
     }
+    /*
+     * When the ring is full, the socket is still there.  Once a message
+     * has gone that way, later ones follow it until the client has
+     * emptied the ring, so the two paths take turns rather than
+     * interleaving message by message.  The client may still see a few
+     * messages out of order around each switch, which does no harm since
+     * each one stands on its own.
+     */
+    if (face->shm != NULL && face->shm_spill && ndn_shm_drained(face->shm))
+        face->shm_spill = 0;
+    if (face->shm != NULL && !face->shm_spill) {
+        if (ndn_shm_put(face->shm, data1, size1, data2, size2) == 0) {
+            ndnd_meter_bump(h, face->meter[FM_BYTO], size);
+            h->shm_msgs_out++;
+            return;
+        }
+        face->shm_spill = 1;
+    }
+    if (h->frag_mtu != 0 && size > h->frag_mtu &&
+        (face->flags & (NDN_FACE_DGRAM | NDN_FACE_LOCAL)) == NDN_FACE_DGRAM &&
+        (face->flags & (NDN_FACE_LINK | NDN_FACE_SEQOK)) != 0 &&
+        ndnd_send_fragments(h, face, data1, size1, data2, size2) == 0)
+        return;
+    iov[0].iov_base = (void *)data1;
+    iov[0].iov_len = size1;
+    iov[1].iov_base = (void *)data2;
+    iov[1].iov_len = size2;
+    mh.msg_iov = iov;
+    mh.msg_iovlen = (size2 == 0) ? 1 : 2;
     if ((face->flags & NDN_FACE_DGRAM) == 0)
-        res = send(face->recv_fd, data, size, 0);
+        res = sendmsg(face->recv_fd, &mh, 0);
     else {
         fd = sending_fd(h, face);
+        mh.msg_name = (void *)face->addr;
+        mh.msg_namelen = face->addrlen;
         if ((face->flags & NDN_FACE_BC) != 0) {
             bcast = 1;
             setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &bcast, sizeof(bcast));
         }
-        res = sendto(fd, data, size, 0, face->addr, face->addrlen);
+        res = sendmsg(fd, &mh, 0);
         if (res == -1 && errno == EACCES &&
             (face->flags & (NDN_FACE_BC | NDN_FACE_NBC)) == 0) {
             bcast = 1;
             setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &bcast, sizeof(bcast));
-            res = sendto(fd, data, size, 0, face->addr, face->addrlen);
+            res = sendmsg(fd, &mh, 0);
             if (res == -1)
                 face->flags |= NDN_FACE_NBC; /* did not work, do not try */
             else
@@ -5276,7 +8104,7 @@ ndnd_send(struct ndnd_handle *h,
     if (res == size)
         return;
     if (res == -1) {
-        res = handle_send_error(h, errno, face, data, size);
+        res = handle_send_error(h, errno, face, data1, size1);
         if (res == -1)
             return;
     }
@@ -5290,8 +8118,14 @@ ndnd_send(struct ndnd_handle *h,
         ndnd_msg(h, "do_write: %s", strerror(errno));
         return;
     }
+    if (res < size1) {
+        ndn_charbuf_append(face->outbuf,
+                           ((const unsigned char *)data1) + res, size1 - res);
+        res = size1;
+    }
     ndn_charbuf_append(face->outbuf,
-                       ((const unsigned char *)data) + res, size - res);
+                       ((const unsigned char *)data2) + (res - size1),
+                       size - res);
 }
 
 /**
@@ -5357,13 +8191,17 @@ prepare_poll_fds(struct ndnd_handle *h)
 {
     struct hashtb_enumerator ee;
     struct hashtb_enumerator *e = &ee;
-    int i, j, k;
-    if (hashtb_n(h->faces_by_fd) != h->nfds) {
-        h->nfds = hashtb_n(h->faces_by_fd);
+    int i, j, k, n;
+    n = hashtb_n(h->faces_by_fd);
+    if (n + h->shm_count != h->nfds) {
+        h->nfds = n + h->shm_count;
         h->fds = realloc(h->fds, h->nfds * sizeof(h->fds[0]));
         memset(h->fds, 0, h->nfds * sizeof(h->fds[0]));
     }
-    for (i = 0, k = h->nfds, hashtb_start(h->faces_by_fd, e);
+    if (h->shm_fds == NULL)
+        h->shm_fds = ndn_indexbuf_create();
+    h->shm_fds->n = 0;
+    for (i = 0, k = n, hashtb_start(h->faces_by_fd, e);
          i < k && e->data != NULL; hashtb_next(e)) {
         struct face *face = e->data;
         if (face->flags & NDN_FACE_MCAST)
@@ -5374,9 +8212,18 @@ prepare_poll_fds(struct ndnd_handle *h)
         h->fds[j].events = ((face->flags & NDN_FACE_NORECV) == 0) ? POLLIN : 0;
         if ((face->outbuf != NULL || (face->flags & NDN_FACE_CLOSING) != 0))
             h->fds[j].events |= POLLOUT;
+        if (face->shm != NULL) {
+            /* The ring eventfds go after all the sockets */
+            if (h->shm_fds->n >= h->shm_count)
+                abort();
+            j = n + h->shm_fds->n;
+            h->fds[j].fd = ndn_shm_rx_fd(face->shm);
+            h->fds[j].events = POLLIN;
+            ndn_indexbuf_append_element(h->shm_fds, face->recv_fd);
+        }
     }
     hashtb_end(e);
-    if (i < k)
+    if (i < k || h->shm_fds->n != h->shm_count)
         abort();
 }
 
@@ -5391,9 +8238,16 @@ ndnd_run(struct ndnd_handle *h)
     int timeout_ms = -1;
     int prev_timeout_ms = -1;
     int usec;
+    nfds_t nsock;
     for (h->running = 1; h->running;) {
+        if (cs_snapshot_wanted) {
+            cs_snapshot_wanted = 0;
+            cs_snapshot_save(h);
+        }
         process_internal_client_buffer(h);
         usec = ndn_schedule_run(h->sched);
+        h->loop_runs++;
+        h->loop_next_usec = usec;
         timeout_ms = (usec < 0) ? -1 : ((usec + 960) / 1000);
         if (timeout_ms == 0 && prev_timeout_ms == 0)
             timeout_ms = 1;
@@ -5403,6 +8257,8 @@ ndnd_run(struct ndnd_handle *h)
         res = poll(h->fds, h->nfds, timeout_ms);
         prev_timeout_ms = ((res == 0) ? timeout_ms : 1);
         if (-1 == res) {
+            if (errno == EINTR)
+                continue;
             ndnd_msg(h, "poll: %s (errno = %d)", strerror(errno), errno);
             sleep(1);
             continue;
@@ -5412,9 +8268,15 @@ ndnd_run(struct ndnd_handle *h)
             struct ndn_timeval dummy;
             h->ticktock.gettime(&h->ticktock, &dummy);
         }
+        nsock = h->nfds - h->shm_fds->n;
         for (i = 0; res > 0 && i < h->nfds; i++) {
             if (h->fds[i].revents != 0) {
                 res--;
+                h->loop_fds++;
+                if (i >= nsock) {
+                    process_shm_input(h, h->shm_fds->buf[i - nsock]);
+                    continue;
+                }
                 if (h->fds[i].revents & (POLLERR | POLLNVAL | POLLHUP)) {
                     if (h->fds[i].revents & (POLLIN))
                         process_input(h, h->fds[i].fd);
@@ -5743,6 +8605,108 @@ ndnd_listen_on(struct ndnd_handle *h, const char *addrs)
     return(res);
 }
 
+/**
+ * Set the forwarding strategy for a name prefix
+ *
+ * @returns 0 for success, -1 for failure.
+ */
+static int
+ndnd_set_prefix_strategy(struct ndnd_handle *h, const char *uri,
+                         const struct ndnd_strategy_class *sc)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct ndn_charbuf *name = charbuf_obtain(h);
+    struct ndn_indexbuf *comps = indexbuf_obtain(h);
+    int res;
+    
+    ndn_name_init(name);
+    res = ndn_name_from_uri(name, uri);
+    if (res >= 0)
+        res = ndn_name_split(name, comps);
+    if (res >= 0) {
+        hashtb_start(h->nameprefix_tab, e);
+        res = nameprefix_seek(h, e, name->buf, comps, comps->n - 1);
+        if (res >= 0) {
+            ((struct nameprefix_entry *)e->data)->strategy = sc;
+            res = 0;
+        }
+        hashtb_end(e);
+    }
+    charbuf_release(h, name);
+    indexbuf_release(h, comps);
+    return(res);
+}
+
+/**
+ * Configure forwarding strategies from the NDND_STRATEGY value
+ *
+ * This is a list of items separated by whitespace, commas, or semicolons.
+ * An item of the form uri=name selects a strategy for that prefix and
+ * the names below it; a bare name sets the default.
+ * Errors are logged.
+ */
+static void
+ndnd_strategy_config(struct ndnd_handle *h, const char *s)
+{
+    const struct ndnd_strategy_class *sc;
+    struct ndn_charbuf *uri = charbuf_obtain(h);
+    size_t i;
+    size_t j;
+    size_t k;
+    
+    for (i = 0; s[i] != 0; i = j) {
+        while ((0 < s[i] && s[i] <= ' ') || s[i] == ',' || s[i] == ';')
+            i++;
+        for (j = i, k = i; s[j] > ' ' && s[j] != ',' && s[j] != ';'; j++)
+            if (s[j] == '=')
+                k = j + 1;
+        if (j == i)
+            break;
+        /* the strategy name is s[k..j), the uri (if any) is s[i..k-1) */
+        sc = strategy_from_name(s + k, j - k);
+        if (sc == NULL)
+            ndnd_msg(h, "NDND_STRATEGY: unknown strategy %.*s",
+                     (int)(j - k), s + k);
+        else if (k == i)
+            h->strategy = sc;
+        else {
+            uri->length = 0;
+            ndn_charbuf_append(uri, s + i, k - 1 - i);
+            if (ndnd_set_prefix_strategy(h, ndn_charbuf_as_string(uri), sc) < 0)
+                ndnd_msg(h, "NDND_STRATEGY: invalid ndnx URI: %s",
+                         ndn_charbuf_as_string(uri));
+        }
+    }
+    charbuf_release(h, uri);
+}
+
+/**
+ * Configure the deficit round robin weights from NDND_SHAPER_WEIGHTS
+ *
+ * This is a list of up to NDND_TC_N small integers, for the asap, normal,
+ * and slow content classes and for interests, in that order.
+ * Missing or invalid entries keep their defaults.
+ */
+static void
+ndnd_shaper_config(struct ndnd_handle *h, const char *s)
+{
+    char *end;
+    long w;
+    int k;
+    
+    for (k = 0; k < NDND_TC_N && *s != 0; k++) {
+        while ((0 < *s && *s <= ' ') || *s == ',')
+            s++;
+        w = strtol(s, &end, 10);
+        if (end == s)
+            break;
+        if (0 < w && w <= 100)
+            h->tc_quantum[k] = w * NDND_SHAPER_QUANTUM;
+        s = end;
+    }
+}
+
 /**
  * Parse a list of ndnx URIs
  *
@@ -5806,11 +8770,25 @@ ndnd_create(const char *progname, ndnd_logger logger, void *loggerdata)
     const char *portstr;
     const char *debugstr;
     const char *entrylimit;
+    const char *bytelimit;
+    const char *cs_policy;
+    const char *strategy;
+    const char *nonce_filter;
+    const char *nonce_bits;
     const char *mtu;
+    const char *frag_mtu;
+    const char *frag_retries;
     const char *data_pause;
     const char *tts_default;
     const char *tts_limit;
     const char *predicted_response_limit;
+    const char *shaper_weights;
+    const char *coalesce;
+    const char *ishape;
+    const char *metrics_max_age;
+    const char *metrics_prefixes;
+    const char *metrics_faces;
+    const char *cs_snapshot;
     const char *autoreg;
     const char *listen_on;
     int fd;
@@ -5827,24 +8805,34 @@ ndnd_create(const char *progname, ndnd_logger logger, void *loggerdata)
     h->logpid = (int)getpid();
     h->progname = progname;
     h->debug = -1;
-    h->skiplinks = ndn_indexbuf_create();
+    pool_init(&h->pfi_pool, sizeof(struct pit_face_item));
+    h->content_tree = ndn_nametree_create();
+    if (h->content_tree == NULL) {
+        free(h);
+        return(NULL);
+    }
     param.finalize_data = h;
-    h->face_limit = 1024; /* soft limit */
-    h->faces_by_faceid = calloc(h->face_limit, sizeof(h->faces_by_faceid[0]));
+    face_slots_grow(h, 1024); /* soft limit */
     param.finalize = &finalize_face;
     h->faces_by_fd = hashtb_create(sizeof(struct face), &param);
     h->dgram_faces = hashtb_create(sizeof(struct face), &param);
     param.finalize = &finalize_nonce;
+    param.pool = 1;
     h->nonce_tab = hashtb_create(sizeof(struct nonce_entry), &param);
+    param.pool = 0;
     h->ncehead.next = h->ncehead.prev = &h->ncehead;
     param.finalize = 0;
     h->faceid_by_guid = hashtb_create(sizeof(unsigned), &param);
     param.finalize = &finalize_content;
+    param.pool = 1;
     h->content_tab = hashtb_create(sizeof(struct content_entry), &param);
+    param.pool = 0;
     param.finalize = &finalize_nameprefix;
     h->nameprefix_tab = hashtb_create(sizeof(struct nameprefix_entry), &param);
     param.finalize = &finalize_interest;
+    param.pool = 1;
     h->interest_tab = hashtb_create(sizeof(struct interest_entry), &param);
+    param.pool = 0;
     param.finalize = &finalize_guest;
     h->guest_tab = hashtb_create(sizeof(struct guest_entry), &param);
     param.finalize = 0;
@@ -5885,6 +8873,46 @@ ndnd_create(const char *progname, ndnd_logger logger, void *loggerdata)
             h->capacity = 10;
     }
     ndnd_msg(h, "NDND_DEBUG=%d NDND_CAP=%lu", h->debug, h->capacity);
+    bytelimit = getenv("NDND_CAP_BYTES");
+    h->capacity_bytes = ~0ULL;
+    if (bytelimit != NULL && bytelimit[0] != 0) {
+        h->capacity_bytes = strtoull(bytelimit, NULL, 10);
+        if (h->capacity_bytes == 0)
+            h->capacity_bytes = ~0ULL;
+    }
+    cs_policy = getenv("NDND_CS_POLICY");
+    if (cs_policy == NULL || cs_policy[0] == 0)
+        cs_policy = "fifo";
+    if (ndnd_cs_policy_set(h, cs_policy) < 0) {
+        ndnd_msg(h, "NDND_CS_POLICY=%s not recognized, using fifo", cs_policy);
+        cs_policy = "fifo";
+    }
+    if (h->capacity_bytes != ~0ULL || h->cs_policy != NULL)
+        ndnd_msg(h, "NDND_CS_POLICY=%s NDND_CAP_BYTES=%llu",
+                 cs_policy, h->capacity_bytes);
+    h->strategy = &ndnd_strategies[0];
+    strategy = getenv("NDND_STRATEGY");
+    if (strategy != NULL && strategy[0] != 0) {
+        ndnd_strategy_config(h, strategy);
+        ndnd_msg(h, "NDND_STRATEGY=%s", strategy);
+    }
+    nonce_filter = getenv("NDND_NONCE_FILTER");
+    if (nonce_filter != NULL && nonce_filter[0] != 0 && atol(nonce_filter) > 0) {
+        unsigned bits = 16;
+        nonce_bits = getenv("NDND_NONCE_FILTER_BITS");
+        if (nonce_bits != NULL && nonce_bits[0] != 0)
+            bits = atoi(nonce_bits);
+        if (bits < 4)
+            bits = 4;
+        if (bits > 64)
+            bits = 64;
+        if (nonce_filter_init(h, atol(nonce_filter), bits) < 0)
+            ndnd_msg(h, "NDND_NONCE_FILTER=%s too large, using nonce table",
+                     nonce_filter);
+        else
+            ndnd_msg(h, "NDND_NONCE_FILTER=%lu NDND_NONCE_FILTER_BITS=%u",
+                     atol(nonce_filter), bits);
+    }
     h->mtu = 0;
     mtu = getenv("NDND_MTU");
     if (mtu != NULL && mtu[0] != 0) {
@@ -5894,6 +8922,26 @@ ndnd_create(const char *progname, ndnd_logger logger, void *loggerdata)
         if (h->mtu > 8800)
             h->mtu = 8800;
     }
+    h->frag_mtu = 0;
+    frag_mtu = getenv("NDND_FRAG_MTU");
+    if (frag_mtu != NULL && frag_mtu[0] != 0) {
+        if (atol(frag_mtu) > 0)
+            h->frag_mtu = atol(frag_mtu);
+        if (h->frag_mtu != 0 && h->frag_mtu < 4 * NDND_FRAG_OVERHEAD)
+            h->frag_mtu = 4 * NDND_FRAG_OVERHEAD;
+        if (h->frag_mtu > 8800)
+            h->frag_mtu = 8800;
+        ndnd_msg(h, "NDND_FRAG_MTU=%u", h->frag_mtu);
+    }
+    h->frag_retries = 0;
+    frag_retries = getenv("NDND_FRAG_RETRIES");
+    if (frag_retries != NULL && frag_retries[0] != 0) {
+        if (atoi(frag_retries) > 0)
+            h->frag_retries = atoi(frag_retries);
+        if (h->frag_retries > 7)
+            h->frag_retries = 7;
+        ndnd_msg(h, "NDND_FRAG_RETRIES=%u", h->frag_retries);
+    }
     h->data_pause_microsec = 10000;
     data_pause = getenv("NDND_DATA_PAUSE_MICROSEC");
     if (data_pause != NULL && data_pause[0] != 0) {
@@ -5931,6 +8979,68 @@ ndnd_create(const char *progname, ndnd_logger logger, void *loggerdata)
             h->predicted_response_limit = 60000000;
         ndnd_msg(h, "NDND_MAX_RTE_MICROSEC=%d", h->predicted_response_limit);
     }
+    h->tc_quantum[NDN_CQ_ASAP] = 4 * NDND_SHAPER_QUANTUM;
+    h->tc_quantum[NDN_CQ_NORMAL] = 2 * NDND_SHAPER_QUANTUM;
+    h->tc_quantum[NDN_CQ_SLOW] = 1 * NDND_SHAPER_QUANTUM;
+    h->tc_quantum[NDND_TC_INTEREST] = 2 * NDND_SHAPER_QUANTUM;
+    shaper_weights = getenv("NDND_SHAPER_WEIGHTS");
+    if (shaper_weights != NULL && shaper_weights[0] != 0) {
+        ndnd_shaper_config(h, shaper_weights);
+        ndnd_msg(h, "NDND_SHAPER_WEIGHTS=%u,%u,%u,%u",
+                 h->tc_quantum[0] / NDND_SHAPER_QUANTUM,
+                 h->tc_quantum[1] / NDND_SHAPER_QUANTUM,
+                 h->tc_quantum[2] / NDND_SHAPER_QUANTUM,
+                 h->tc_quantum[3] / NDND_SHAPER_QUANTUM);
+    }
+    coalesce = getenv("NDND_COALESCE");
+    if (coalesce != NULL && coalesce[0] != 0) {
+        char *sep = NULL;
+        h->coalesce_usec = strtoul(coalesce, &sep, 10);
+        if (sep != NULL && *sep == ',')
+            h->coalesce_bytes = strtoul(sep + 1, NULL, 10);
+        if (h->coalesce_usec > 1000000)
+            h->coalesce_usec = 1000000;
+        if (h->coalesce_bytes > 8800)
+            h->coalesce_bytes = 8800;
+        ndnd_msg(h, "NDND_COALESCE=%u,%u", h->coalesce_usec,
+                 h->coalesce_bytes != 0 ? h->coalesce_bytes : NDND_COALESCE_BYTES);
+    }
+    h->metrics_max_age = 1000;
+    metrics_max_age = getenv("NDND_METRICS_MAX_AGE");
+    if (metrics_max_age != NULL && metrics_max_age[0] != 0) {
+        h->metrics_max_age = strtoul(metrics_max_age, NULL, 10);
+        if (h->metrics_max_age > 3600000)
+            h->metrics_max_age = 3600000;
+        ndnd_msg(h, "NDND_METRICS_MAX_AGE=%u", h->metrics_max_age);
+    }
+    h->metrics_prefixes = 20;
+    metrics_prefixes = getenv("NDND_METRICS_PREFIXES");
+    if (metrics_prefixes != NULL && metrics_prefixes[0] != 0) {
+        h->metrics_prefixes = atoi(metrics_prefixes);
+        if (h->metrics_prefixes < 0)
+            h->metrics_prefixes = 0;
+        ndnd_msg(h, "NDND_METRICS_PREFIXES=%d", h->metrics_prefixes);
+    }
+    h->metrics_faces = 20;
+    metrics_faces = getenv("NDND_METRICS_FACES");
+    if (metrics_faces != NULL && metrics_faces[0] != 0) {
+        h->metrics_faces = atoi(metrics_faces);
+        if (h->metrics_faces < 0)
+            h->metrics_faces = 0;
+        ndnd_msg(h, "NDND_METRICS_FACES=%d", h->metrics_faces);
+    }
+    ishape = getenv("NDND_INTEREST_SHAPING");
+    if (ishape != NULL && ishape[0] != 0) {
+        h->ishape_floor = strtoul(ishape, NULL, 10);
+        if (h->ishape_floor > 1000000)
+            h->ishape_floor = 1000000;
+        ndnd_msg(h, "NDND_INTEREST_SHAPING=%u", h->ishape_floor);
+    }
+    cs_snapshot = getenv("NDND_CS_SNAPSHOT");
+    if (cs_snapshot != NULL && cs_snapshot[0] != 0) {
+        h->cs_snapshot = strdup(cs_snapshot);
+        ndnd_msg(h, "NDND_CS_SNAPSHOT=%s", cs_snapshot);
+    }
     listen_on = getenv("NDND_LISTEN_ON");
     autoreg = getenv("NDND_AUTOREG");
     
@@ -5946,6 +9056,7 @@ ndnd_create(const char *progname, ndnd_logger logger, void *loggerdata)
     /* Do keystore setup early, it takes a while the first time */
     ndnd_init_internal_keystore(h);
     ndnd_reseed(h);
+    h->fingerprint_key = ((uint64_t)nrand48(h->seed) << 32) ^ nrand48(h->seed);
     if (h->face0 == NULL) {
         struct face *face;
         face = calloc(1, sizeof(*face));
@@ -5964,8 +9075,11 @@ ndnd_create(const char *progname, ndnd_logger logger, void *loggerdata)
     h->ipv4_faceid = h->ipv6_faceid = NDN_NOFACEID;
     ndnd_listen_on(h, listen_on);
     reap_needed(h, 55000);
-    age_forwarding_needed(h);
     ndnd_internal_client_start(h);
+    if (h->cs_snapshot != NULL) {
+        cs_snapshot_load_start(h);
+        signal(SIGUSR1, &cs_snapshot_signal);
+    }
     free(sockname);
     sockname = NULL;
     return(h);
@@ -5999,14 +9113,18 @@ ndnd_destroy(struct ndnd_handle **pndnd)
     if (h == NULL)
         return;
     ndnd_shutdown_listeners(h);
+    cs_snapshot_save(h);
     ndnd_internal_client_stop(h);
     ndn_schedule_destroy(&h->sched);
     hashtb_destroy(&h->nonce_tab);
+    nonce_filter_destroy(h);
     hashtb_destroy(&h->dgram_faces);
     hashtb_destroy(&h->faces_by_fd);
     hashtb_destroy(&h->faceid_by_guid);
     hashtb_destroy(&h->content_tab);
+    ndnd_cs_policy_destroy(h);
     hashtb_destroy(&h->interest_tab);
+    pool_destroy(&h->pfi_pool);
     hashtb_destroy(&h->nameprefix_tab);
     hashtb_destroy(&h->sparse_straggler_tab);
     hashtb_destroy(&h->guest_tab);
@@ -6018,7 +9136,11 @@ ndnd_destroy(struct ndnd_handle **pndnd)
     if (h->faces_by_faceid != NULL) {
         free(h->faces_by_faceid);
         h->faces_by_faceid = NULL;
-        h->face_limit = h->face_gen = 0;
+        free(h->face_gens);
+        h->face_gens = NULL;
+        free(h->face_free);
+        h->face_free = NULL;
+        h->face_limit = h->face_free_n = h->face_free_head = 0;
     }
     if (h->content_by_accession != NULL) {
         free(h->content_by_accession);
@@ -6026,11 +9148,17 @@ ndnd_destroy(struct ndnd_handle **pndnd)
         h->content_by_accession_window = 0;
     }
     ndn_charbuf_destroy(&h->send_interest_scratch);
-    ndn_charbuf_destroy(&h->scratch_charbuf);
+    while (h->n_scratch_charbuf > 0)
+        ndn_charbuf_destroy(&h->scratch_charbuf[--(h->n_scratch_charbuf)]);
     ndn_charbuf_destroy(&h->autoreg);
-    ndn_indexbuf_destroy(&h->skiplinks);
-    ndn_indexbuf_destroy(&h->scratch_indexbuf);
+    ndn_charbuf_destroy(&h->metrics);
+    ndn_nametree_destroy(&h->content_tree);
+    while (h->n_scratch_indexbuf > 0)
+        ndn_indexbuf_destroy(&h->scratch_indexbuf[--(h->n_scratch_indexbuf)]);
     ndn_indexbuf_destroy(&h->unsol);
+    ndn_indexbuf_destroy(&h->shm_fds);
+    free(h->cs_snapshot);
+    h->cs_snapshot = NULL;
     if (h->face0 != NULL) {
         int i;
         ndn_charbuf_destroy(&h->face0->inbuf);
@@ -0,0 +1,525 @@
+/**
+ * @file ndnd_cs_policy.c
+ *
+ * Content store replacement policies for ndnd.
+ *
+ * Part of ndnd - the NDNx Daemon.
+ *
+ * Portions Copyright (C) 2013 Regents of the University of California.
+ *
+ * Based on the CCNx C Library by PARC.
+ * Copyright (C) 2008-2013 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ndn/ndn.h>
+#include <ndn/charbuf.h>
+#include <ndn/hashtb.h>
+
+#include "ndnd_private.h"
+
+/**
+ * Number of lists available to a policy
+ */
+#define CS_NLISTS 16
+
+/**
+ * State shared by the policies in this file
+ */
+struct cs_policy_state {
+    struct cslinks list[CS_NLISTS];     /**< most recently used first */
+    unsigned long long lbytes[CS_NLISTS]; /**< bytes on each list */
+    struct hashtb *ghost_tab;           /**< ARC only - keyed by fingerprint */
+    unsigned long long p;               /**< ARC only - target size of T1 */
+    struct content_entry *victim;       /**< ARC only - last victim offered */
+};
+
+/**
+ * Remembers an entry that ARC evicted
+ */
+struct cs_ghost {
+    struct cslinks ll;
+    uint64_t fp;
+    int list;
+    unsigned size;
+};
+
+#define CS_STATE(h) ((struct cs_policy_state *)((h)->cs_policy_data))
+
+static void
+cs_link(struct cs_policy_state *st, int l, struct cslinks *x, unsigned size)
+{
+    struct cslinks *head = &st->list[l];
+    x->next = head->next;
+    x->prev = head;
+    head->next->prev = x;
+    head->next = x;
+    st->lbytes[l] += size;
+}
+
+static void
+cs_unlink(struct cs_policy_state *st, int l, struct cslinks *x, unsigned size)
+{
+    x->next->prev = x->prev;
+    x->prev->next = x->next;
+    x->next = x->prev = NULL;
+    st->lbytes[l] -= size;
+}
+
+/**
+ * @returns the least recently used item on list l, or NULL.
+ */
+static struct cslinks *
+cs_lru(struct cs_policy_state *st, int l)
+{
+    struct cslinks *head = &st->list[l];
+    if (head->prev == head)
+        return(NULL);
+    return(head->prev);
+}
+
+static void
+cs_link_content(struct ndnd_handle *h, int l, struct content_entry *content)
+{
+    cs_link(CS_STATE(h), l, &content->ll, content->size);
+    content->cs_list = l;
+}
+
+static void
+cs_unlink_content(struct ndnd_handle *h, struct content_entry *content)
+{
+    if (content->ll.next == NULL)
+        return;
+    cs_unlink(CS_STATE(h), content->cs_list, &content->ll, content->size);
+}
+
+/**
+ * Victim is the least recently used entry on the lowest non-empty list.
+ */
+static struct content_entry *
+cs_lowest_lru(struct ndnd_handle *h)
+{
+    struct cslinks *x;
+    int l;
+    for (l = 0; l < CS_NLISTS; l++) {
+        x = cs_lru(CS_STATE(h), l);
+        if (x != NULL)
+            return((struct content_entry *)x);
+    }
+    return(NULL);
+}
+
+static int
+cs_init(struct ndnd_handle *h)
+{
+    struct cs_policy_state *st;
+    int l;
+    st = calloc(1, sizeof(*st));
+    if (st == NULL)
+        return(-1);
+    for (l = 0; l < CS_NLISTS; l++)
+        st->list[l].next = st->list[l].prev = &st->list[l];
+    h->cs_policy_data = st;
+    return(0);
+}
+
+static void
+cs_destroy(struct ndnd_handle *h)
+{
+    struct cs_policy_state *st = CS_STATE(h);
+    if (st == NULL)
+        return;
+    hashtb_destroy(&st->ghost_tab);
+    free(st);
+    h->cs_policy_data = NULL;
+}
+
+/*
+ * LRU - a single list in order of last use.
+ */
+
+static void
+lru_insert(struct ndnd_handle *h, struct content_entry *content)
+{
+    cs_link_content(h, 0, content);
+}
+
+static void
+lru_hit(struct ndnd_handle *h, struct content_entry *content)
+{
+    cs_unlink_content(h, content);
+    cs_link_content(h, 0, content);
+}
+
+static const struct ndnd_cs_policy cs_lru_policy = {
+    "lru", &cs_init, &cs_destroy, &lru_insert, &lru_hit, NULL,
+    &cs_unlink_content, &cs_lowest_lru
+};
+
+/*
+ * LFU - one list per power-of-two of the use count, each in LRU order,
+ * so that all the operations are constant time.
+ */
+
+static int
+lfu_list(struct content_entry *content)
+{
+    unsigned n = content->cs_hits + 1;
+    int l;
+    for (l = 0; n > 1 && l < CS_NLISTS - 1; l++)
+        n >>= 1;
+    return(l);
+}
+
+static void
+lfu_insert(struct ndnd_handle *h, struct content_entry *content)
+{
+    cs_link_content(h, lfu_list(content), content);
+}
+
+static void
+lfu_hit(struct ndnd_handle *h, struct content_entry *content)
+{
+    cs_unlink_content(h, content);
+    cs_link_content(h, lfu_list(content), content);
+}
+
+static const struct ndnd_cs_policy cs_lfu_policy = {
+    "lfu", &cs_init, &cs_destroy, &lfu_insert, &lfu_hit, NULL,
+    &cs_unlink_content, &cs_lowest_lru
+};
+
+/*
+ * Priority - stale content goes first, then content that has never
+ * been reused, then everything else; LRU within each class.
+ */
+
+static int
+prio_list(struct content_entry *content)
+{
+    if ((content->flags & NDN_CONTENT_ENTRY_STALE) != 0)
+        return(0);
+    if (content->cs_hits == 0)
+        return(1);
+    return(2);
+}
+
+static void
+prio_insert(struct ndnd_handle *h, struct content_entry *content)
+{
+    cs_link_content(h, prio_list(content), content);
+}
+
+static void
+prio_update(struct ndnd_handle *h, struct content_entry *content)
+{
+    if (content->ll.next == NULL || content->cs_list == prio_list(content))
+        return;
+    cs_unlink_content(h, content);
+    cs_link_content(h, prio_list(content), content);
+}
+
+static void
+prio_hit(struct ndnd_handle *h, struct content_entry *content)
+{
+    cs_unlink_content(h, content);
+    cs_link_content(h, prio_list(content), content);
+}
+
+static const struct ndnd_cs_policy cs_prio_policy = {
+    "prio", &cs_init, &cs_destroy, &prio_insert, &prio_hit, &prio_update,
+    &cs_unlink_content, &cs_lowest_lru
+};
+
+/*
+ * ARC - Adaptive Replacement Cache (Megiddo and Modha), with sizes
+ * reckoned in bytes.  T1 holds content seen once, T2 content that has
+ * been reused; B1 and B2 remember what was recently evicted from each,
+ * by a fingerprint of the name.  The cache size c is taken to be the
+ * number of bytes currently in the store.
+ */
+
+#define ARC_T1 0
+#define ARC_T2 1
+#define ARC_B1 2
+#define ARC_B2 3
+
+static uint64_t
+arc_fingerprint(struct content_entry *content)
+{
+    uint64_t fp = 14695981039346656037ULL;
+    const unsigned char *name = content->key + content->comps[0];
+    int n = content->comps[content->ncomps - 1] - content->comps[0];
+    int i;
+    for (i = 0; i < n; i++) {
+        fp ^= name[i];
+        fp *= 1099511628211ULL;
+    }
+    return(fp);
+}
+
+static int
+arc_init(struct ndnd_handle *h)
+{
+    struct cs_policy_state *st;
+    if (cs_init(h) < 0)
+        return(-1);
+    st = CS_STATE(h);
+    st->ghost_tab = hashtb_create(sizeof(struct cs_ghost), NULL);
+    if (st->ghost_tab == NULL) {
+        cs_destroy(h);
+        return(-1);
+    }
+    return(0);
+}
+
+static void
+arc_forget(struct cs_policy_state *st, struct cs_ghost *g)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    uint64_t fp = g->fp;
+    cs_unlink(st, g->list, &g->ll, g->size);
+    hashtb_start(st->ghost_tab, e);
+    if (hashtb_seek(e, &fp, sizeof(fp), 0) == HT_OLD_ENTRY)
+        hashtb_delete(e);
+    hashtb_end(e);
+}
+
+static void
+arc_drop_ghost(struct cs_policy_state *st, int l)
+{
+    struct cs_ghost *g = (struct cs_ghost *)cs_lru(st, l);
+    if (g != NULL)
+        arc_forget(st, g);
+}
+
+/**
+ * Keep the ghost lists within the bounds that ARC requires.
+ */
+static void
+arc_trim_ghosts(struct ndnd_handle *h)
+{
+    struct cs_policy_state *st = CS_STATE(h);
+    unsigned long long c = h->cs_bytes;
+    while (st->lbytes[ARC_B1] > 0 &&
+           st->lbytes[ARC_T1] + st->lbytes[ARC_B1] > c)
+        arc_drop_ghost(st, ARC_B1);
+    while (st->lbytes[ARC_B2] > 0 &&
+           st->lbytes[ARC_B1] + st->lbytes[ARC_B2] > c)
+        arc_drop_ghost(st, ARC_B2);
+    while (st->lbytes[ARC_B1] > 0 &&
+           st->lbytes[ARC_B1] + st->lbytes[ARC_B2] > c)
+        arc_drop_ghost(st, ARC_B1);
+}
+
+static void
+arc_insert(struct ndnd_handle *h, struct content_entry *content)
+{
+    struct cs_policy_state *st = CS_STATE(h);
+    struct cs_ghost *g;
+    unsigned long long delta;
+    unsigned long long b1;
+    unsigned long long b2;
+    uint64_t fp;
+
+    fp = arc_fingerprint(content);
+    g = hashtb_lookup(st->ghost_tab, &fp, sizeof(fp));
+    if (g == NULL) {
+        cs_link_content(h, ARC_T1, content);
+        arc_trim_ghosts(h);
+        return;
+    }
+    b1 = st->lbytes[ARC_B1];
+    b2 = st->lbytes[ARC_B2];
+    if (g->list == ARC_B1) {
+        delta = (b1 >= b2 || b1 == 0) ? g->size : g->size * (b2 / b1);
+        st->p = (st->p + delta > h->cs_bytes) ? h->cs_bytes : st->p + delta;
+    }
+    else {
+        delta = (b2 >= b1 || b2 == 0) ? g->size : g->size * (b1 / b2);
+        st->p = (st->p > delta) ? st->p - delta : 0;
+    }
+    arc_forget(st, g);
+    cs_link_content(h, ARC_T2, content);
+    arc_trim_ghosts(h);
+}
+
+static void
+arc_hit(struct ndnd_handle *h, struct content_entry *content)
+{
+    if (content->ll.next == NULL)
+        return;
+    cs_unlink_content(h, content);
+    cs_link_content(h, ARC_T2, content);
+}
+
+static void
+arc_remove(struct ndnd_handle *h, struct content_entry *content)
+{
+    struct cs_policy_state *st = CS_STATE(h);
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct cs_ghost *g;
+    uint64_t fp;
+    int l;
+
+    if (content->ll.next == NULL)
+        return;
+    l = content->cs_list;
+    cs_unlink_content(h, content);
+    if (content != st->victim)
+        return;
+    st->victim = NULL;
+    /* Remember what we evicted */
+    fp = arc_fingerprint(content);
+    hashtb_start(st->ghost_tab, e);
+    if (hashtb_seek(e, &fp, sizeof(fp), 0) == HT_NEW_ENTRY) {
+        g = e->data;
+        g->fp = fp;
+        g->size = content->size;
+        g->list = (l == ARC_T1) ? ARC_B1 : ARC_B2;
+        cs_link(st, g->list, &g->ll, g->size);
+    }
+    hashtb_end(e);
+}
+
+static struct content_entry *
+arc_victim(struct ndnd_handle *h)
+{
+    struct cs_policy_state *st = CS_STATE(h);
+    struct cslinks *x;
+
+    x = cs_lru(st, ARC_T1);
+    if (x == NULL || (st->lbytes[ARC_T1] <= st->p && cs_lru(st, ARC_T2) != NULL))
+        x = cs_lru(st, ARC_T2);
+    st->victim = (struct content_entry *)x;
+    return(st->victim);
+}
+
+static const struct ndnd_cs_policy cs_arc_policy = {
+    "arc", &arc_init, &cs_destroy, &arc_insert, &arc_hit, NULL,
+    &arc_remove, &arc_victim
+};
+
+static const struct ndnd_cs_policy *cs_policies[] = {
+    &cs_lru_policy,
+    &cs_lfu_policy,
+    &cs_arc_policy,
+    &cs_prio_policy,
+    NULL
+};
+
+/**
+ * Select the content store replacement policy by name.
+ *
+ * The empty string, or "fifo", selects the traditional accession-ordered
+ * cleaning, which does not use a policy object.
+ * This should be done before any content is stored.
+ * @returns 0 for success, -1 if the name is not known.
+ */
+int
+ndnd_cs_policy_set(struct ndnd_handle *h, const char *name)
+{
+    const struct ndnd_cs_policy *p = NULL;
+    int i;
+
+    if (name != NULL && name[0] != 0 && strcmp(name, "fifo") != 0) {
+        for (i = 0; cs_policies[i] != NULL; i++)
+            if (strcmp(name, cs_policies[i]->name) == 0)
+                p = cs_policies[i];
+        if (p == NULL)
+            return(-1);
+    }
+    ndnd_cs_policy_destroy(h);
+    if (p != NULL && p->init(h) < 0)
+        return(-1);
+    h->cs_policy = p;
+    return(0);
+}
+
+/**
+ * Release the state of the replacement policy.
+ */
+void
+ndnd_cs_policy_destroy(struct ndnd_handle *h)
+{
+    if (h->cs_policy != NULL)
+        h->cs_policy->destroy(h);
+    h->cs_policy = NULL;
+}
+
+/**
+ * Tell the replacement policy about a new entry in the content store.
+ */
+void
+ndnd_cs_insert(struct ndnd_handle *h, struct content_entry *content)
+{
+    if (h->cs_policy == NULL)
+        return;
+    if ((content->flags & NDN_CONTENT_ENTRY_PRECIOUS) != 0)
+        return;
+    h->cs_policy->insert(h, content);
+}
+
+/**
+ * Note that content has been reused from the content store.
+ */
+void
+ndnd_cs_hit(struct ndnd_handle *h, struct content_entry *content)
+{
+    h->content_hits++;
+    if (content->cs_hits + 1 != 0)
+        content->cs_hits++;
+    if (h->cs_policy == NULL || content->ll.next == NULL)
+        return;
+    h->cs_policy->hit(h, content);
+}
+
+/**
+ * Note a change in the flags of content.
+ */
+void
+ndnd_cs_update(struct ndnd_handle *h, struct content_entry *content)
+{
+    if (h->cs_policy == NULL || h->cs_policy->update == NULL)
+        return;
+    h->cs_policy->update(h, content);
+}
+
+/**
+ * Tell the replacement policy that content is leaving the store.
+ */
+void
+ndnd_cs_remove(struct ndnd_handle *h, struct content_entry *content)
+{
+    if (h->cs_policy == NULL)
+        return;
+    h->cs_policy->remove(h, content);
+}
+
+/**
+ * Ask the replacement policy which content should go next.
+ *
+ * @returns the entry to be removed, or NULL if the policy has no opinion.
+ */
+struct content_entry *
+ndnd_cs_victim(struct ndnd_handle *h)
+{
+    if (h->cs_policy == NULL)
+        return(NULL);
+    return(h->cs_policy->victim(h));
+}
@@ -967,6 +967,8 @@ ndnd_req_guest(struct ndn_closure *selfp,
 #define OP_SERVICE     0x0800
 #define OP_ADJACENCY   0x0900
 #define OP_GUEST       0x0A00
+#define OP_SETFACERATE 0x0B00
+#define OP_SETFACECOALESCE 0x0C00
 
 /**
  * Common interest handler for ndnd_internal_client
@@ -1060,6 +1062,14 @@ ndnd_answer_req(struct ndn_closure *selfp,
             reply_body = ndn_charbuf_create();
             res = ndnd_req_destroyface(ndnd, final_comp, final_size, reply_body);
             break;
+        case OP_SETFACERATE:
+            reply_body = ndn_charbuf_create();
+            res = ndnd_req_setfacerate(ndnd, final_comp, final_size, reply_body);
+            break;
+        case OP_SETFACECOALESCE:
+            reply_body = ndn_charbuf_create();
+            res = ndnd_req_setfacecoalesce(ndnd, final_comp, final_size, reply_body);
+            break;
         case OP_PREFIXREG:
             reply_body = ndn_charbuf_create();
             res = ndnd_req_prefixreg(ndnd, final_comp, final_size, reply_body);
@@ -1538,6 +1548,10 @@ ndnd_internal_client_start(struct ndnd_handle *ndnd)
                     &ndnd_answer_req, OP_NEWFACE + MUST_VERIFY1);
     ndnd_uri_listen(ndnd, "ndn:/ndnx/" NDND_ID_TEMPL "/destroyface",
                     &ndnd_answer_req, OP_DESTROYFACE + MUST_VERIFY1);
+    ndnd_uri_listen(ndnd, "ndn:/ndnx/" NDND_ID_TEMPL "/setfacerate",
+                    &ndnd_answer_req, OP_SETFACERATE + MUST_VERIFY1);
+    ndnd_uri_listen(ndnd, "ndn:/ndnx/" NDND_ID_TEMPL "/setfacecoalesce",
+                    &ndnd_answer_req, OP_SETFACECOALESCE + MUST_VERIFY1);
     ndnd_uri_listen(ndnd, "ndn:/ndnx/" NDND_ID_TEMPL "/prefixreg",
                     &ndnd_answer_req, OP_PREFIXREG + MUST_VERIFY1);
     ndnd_uri_listen(ndnd, "ndn:/ndnx/" NDND_ID_TEMPL "/selfreg",
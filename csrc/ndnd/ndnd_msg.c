@@ -283,10 +283,55 @@ const char *ndnd_usage_message =
     "    NDND_CAP=\n"
     "      Capacity limit, in count of ContentObjects.\n"
     "      Not an absolute limit.\n"
+    "    NDND_CAP_BYTES=\n"
+    "      Capacity limit, in total bytes of ContentObjects.\n"
+    "      Not an absolute limit.\n"
+    "    NDND_CS_POLICY=\n"
+    "      Content store replacement policy: fifo (default), lru, lfu, arc, prio.\n"
+    "    NDND_CS_SNAPSHOT=\n"
+    "      File to save the content store in when ndnd stops cleanly or gets\n"
+    "      SIGUSR1.  It is read back in at startup, while ndnd is already serving,\n"
+    "      and objects that fail their digest check are skipped.\n"
+    "      Not set by default.\n"
+    "    NDND_NONCE_FILTER=\n"
+    "      Expected interests per nonce lifetime.  If set, duplicate nonces are\n"
+    "      detected with a fixed-size filter instead of the nonce table.\n"
+    "    NDND_NONCE_FILTER_BITS=\n"
+    "      Filter bits per interest, default 16.  More bits, fewer false duplicates.\n"
+    "    NDND_STRATEGY=\n"
+    "      Forwarding strategy: default, wrr, rtt, failover.  Items of the form\n"
+    "      uri=strategy choose a strategy for a name prefix.\n"
+    "    NDND_SHAPER_WEIGHTS=\n"
+    "      Shares of asap, normal, slow content and interests on faces\n"
+    "      with a rate limit (see ndndc setfacerate).  Default 4,2,1,2\n"
+    "    NDND_COALESCE=\n"
+    "      usec[,bytes] - pack small messages on datagram faces into one PDU,\n"
+    "      waiting at most usec microseconds or until bytes are waiting\n"
+    "      (default 1200).  Off by default; see ndndc setfacecoalesce.\n"
+    "    NDND_INTEREST_SHAPING=\n"
+    "      n - pace interests to each face at the rate it returns data, but at\n"
+    "      least n per second, and send congestion marks to neighboring ndnd\n"
+    "      instances when interests are held back.  0 (the default) turns\n"
+    "      this off.\n"
+    "    NDND_METRICS_FACES=\n"
+    "      Number of faces, busiest first, that get their own series in\n"
+    "      /metrics (default 20); the rest are reported together.\n"
+    "    NDND_METRICS_MAX_AGE=\n"
+    "      Milliseconds that the /metrics document of the status server is\n"
+    "      reused before it is made again (default 1000).\n"
+    "    NDND_METRICS_PREFIXES=\n"
+    "      Number of name prefixes that get their own round-trip histograms\n"
+    "      in /metrics (default 20); the rest are reported together.\n"
     "    NDND_MTU=\n"
     "      Packet size in bytes.\n"
     "      If set, interest stuffing is allowed within this budget.\n"
     "      Single items larger than this are not precluded.\n"
+    "    NDND_FRAG_MTU=\n"
+    "      Largest datagram sent on a link face before it is fragmented.\n"
+    "      Default 0, which turns fragmentation off; 1400 suits most paths.\n"
+    "    NDND_FRAG_RETRIES=\n"
+    "      Retransmissions of an unacknowledged link fragment.  Default 0,\n"
+    "      which does not ask for acknowledgements.\n"
     "    NDND_DATA_PAUSE_MICROSEC=\n"
     "      Adjusts content-send delay time for multicast and udplink faces\n"
     "    NDND_DEFAULT_TIME_TO_STALE=\n"
@@ -34,8 +34,10 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include <ndn/ndn.h>
 #include <ndn/ndn_private.h>
 #include <ndn/coding.h>
+#include <ndn/nametree.h>
 #include <ndn/reg_mgmt.h>
 #include <ndn/schedule.h>
 #include <ndn/seqwriter.h>
@@ -48,6 +50,13 @@ struct ndn_charbuf;
 struct ndn_indexbuf;
 struct hashtb;
 struct ndnd_meter;
+struct ndn_shm;
+struct ndn_reasm;
+
+/*
+ * This one is private to ndnd.c.
+ */
+struct cs_snapshot_loader;
 
 /*
  * These are defined in this header.
@@ -56,12 +65,14 @@ struct ndnd_handle;
 struct face;
 struct content_entry;
 struct nameprefix_entry;
+struct ndnd_hist;
 struct interest_entry;
 struct guest_entry;
 struct pit_face_item;
-struct content_tree_node;
+struct ndnd_cs_policy;
 struct ndn_forwarding;
 struct ndn_strategy;
+struct ndnd_strategy_class;
 
 //typedef uint_least64_t ndn_accession_t;
 typedef unsigned ndn_accession_t;
@@ -81,6 +92,50 @@ struct ncelinks {
     struct ncelinks *prev;           /**< previous in list */
 };
 
+/**
+ * Pool of fixed-size objects
+ *
+ * Objects are carved out of slabs, and freed objects are kept on a free
+ * list for reuse.  Slabs are only returned when the pool is destroyed.
+ */
+struct ndnd_pool {
+    size_t size;                    /**< size of each object */
+    void *free;                     /**< free objects */
+    void *slabs;                    /**< all slabs */
+    unsigned long n_used;           /**< objects in use */
+    unsigned long n_free;           /**< objects on the free list */
+};
+
+/**
+ * Number of scratch charbufs and indexbufs kept for reuse
+ */
+#define NDND_SCRATCH_N 8
+
+enum cq_delay_class {
+    NDN_CQ_ASAP,
+    NDN_CQ_NORMAL,
+    NDN_CQ_SLOW,
+    NDN_CQ_N
+};
+
+/**
+ * Traffic classes for rate-limited faces
+ *
+ * The content delay classes come first, followed by interests.
+ * Each class gets NDND_SHAPER_WEIGHTS quanta per deficit round robin round.
+ */
+#define NDND_TC_INTEREST NDN_CQ_N
+#define NDND_TC_N (NDN_CQ_N + 1)
+#define NDND_SHAPER_QUANTUM 1500
+
+/**
+ * Work budget for one run of the content cleaner
+ *
+ * Each content entry examined or moved costs one unit; the cleaner
+ * keeps its place and comes back for more when this is used up.
+ */
+#define NDND_CLEAN_BUDGET 500
+
 /**
  * We pass this handle almost everywhere within ndnd
  */
@@ -94,22 +149,29 @@ struct ndnd_handle {
     struct hashtb *nameprefix_tab;  /**< keyed by name prefix components */
     struct hashtb *interest_tab;    /**< keyed by interest msg sans Nonce */
     struct hashtb *guest_tab;       /**< keyed by faceid */
-    struct ndn_indexbuf *skiplinks; /**< skiplist for content-ordered ops */
-    unsigned forward_to_gen;        /**< for forward_to updates */
-    unsigned face_gen;              /**< faceid generation number */
-    unsigned face_rover;            /**< for faceid allocation */
+    /** The content store in name order, keyed by namekey (ndn/nametree.h) */
+    struct ndn_nametree *content_tree;
+    unsigned forward_to_gen;        /**< counts FIB changes */
     unsigned face_limit;            /**< current number of face slots */
+    unsigned *face_gens;            /**< generation number of each slot */
+    unsigned *face_free;            /**< ring of free slots, next to use first */
+    unsigned face_free_head;        /**< face_free index of the next to use */
+    unsigned face_free_n;           /**< number of free slots */
     struct face **faces_by_faceid;  /**< array with face_limit elements */
     struct ncelinks ncehead;        /**< list head for expiry-sorted nonces */
+    struct nonce_filter *nonce_filter; /**< replaces nonce_tab if non-NULL */
     struct ndn_scheduled_event *reaper;
     struct ndn_scheduled_event *age;
     struct ndn_scheduled_event *clean;
-    struct ndn_scheduled_event *age_forwarding;
     const char *portstr;            /**< "main" port number */
     unsigned ipv4_faceid;           /**< wildcard IPv4, bound to port */
     unsigned ipv6_faceid;           /**< wildcard IPv6, bound to port */
     nfds_t nfds;                    /**< number of entries in fds array */
     struct pollfd *fds;             /**< used for poll system call */
+    unsigned shm_count;             /**< faces with shared-memory rings */
+    struct ndn_indexbuf *shm_fds;   /**< their socket fds, in fds order */
+    unsigned long shm_msgs_in;      /**< messages taken from shm rings */
+    unsigned long shm_msgs_out;     /**< messages put in shm rings */
     struct ndn_gettime ticktock;    /**< our time generator */
     long sec;                       /**< cached gettime seconds */
     unsigned usec;                  /**< cached gettime microseconds */
@@ -120,8 +182,11 @@ struct ndnd_handle {
     unsigned iserial;               /**< interest serial number (for logs) */
     struct ndn_schedule *sched;     /**< our schedule */
     struct ndn_charbuf *send_interest_scratch; /**< for use by send_interest */
-    struct ndn_charbuf *scratch_charbuf; /**< one-slot scratch cache */
-    struct ndn_indexbuf *scratch_indexbuf; /**< one-slot scratch cache */
+    /** Scratch buffers for per-message temporaries, see charbuf_obtain */
+    struct ndn_charbuf *scratch_charbuf[NDND_SCRATCH_N];
+    int n_scratch_charbuf;
+    struct ndn_indexbuf *scratch_indexbuf[NDND_SCRATCH_N];
+    int n_scratch_indexbuf;
     /** Next three fields are used for direct accession-to-content table */
     ndn_accession_t accession_base;
     unsigned content_by_accession_window;
@@ -133,19 +198,40 @@ struct ndnd_handle {
     ndn_accession_t max_stale;      /**< largest accession of stale content */
     unsigned long capacity;         /**< may toss content if there more than
                                      this many content objects in the store */
+    unsigned long long capacity_bytes; /**< ... or more than this many bytes */
+    unsigned long long cs_bytes;    /**< bytes of content in the store */
+    const struct ndnd_cs_policy *cs_policy; /**< NDND_CS_POLICY, or NULL */
+    void *cs_policy_data;           /**< state private to cs_policy */
+    const struct ndnd_strategy_class *strategy; /**< NDND_STRATEGY default */
     unsigned long n_stale;          /**< Number of stale content objects */
     struct ndn_indexbuf *unsol;     /**< unsolicited content */
+    ndn_accession_t stale_cursor;   /**< where stale removal resumes */
+    ndn_accession_t mark_cursor;    /**< where marking content stale resumes */
+    ndn_accession_t straggler_cursor; /**< where straggler sweep resumes */
+    ndn_accession_t straggler_limit; /**< swept stragglers lie below this */
+    unsigned long clean_runs;       /**< content cleaner invocations */
+    unsigned long clean_visited;    /**< budget units it has used */
+    unsigned long clean_removed;    /**< content objects it has removed */
+    long clean_behind;              /**< sec when cleaner fell behind, or 0 */
+    char *cs_snapshot;              /**< NDND_CS_SNAPSHOT file, or NULL */
+    struct cs_snapshot_loader *cs_loader; /**< snapshot being loaded */
+    unsigned long cs_snapshot_loaded; /**< objects restored at startup */
+    unsigned long cs_snapshot_saved; /**< objects in the last snapshot */
     unsigned long oldformatcontent;
     unsigned long oldformatcontentgrumble;
     unsigned long oldformatinterests;
     unsigned long oldformatinterestgrumble;
     unsigned long content_dups_recvd;
     unsigned long content_items_sent;
+    unsigned long content_hits;     /**< content reused from the store */
+    unsigned long content_evicted;  /**< removed by cs_policy */
     unsigned long interests_accepted;
     unsigned long interests_dropped;
     unsigned long interests_sent;
     unsigned long interests_stuffed;
+    struct ndnd_pool pfi_pool;      /**< for pit_face_items */
     unsigned short seed[3];         /**< for PRNG */
+    uint64_t fingerprint_key;       /**< secret for content fingerprints */
     int running;                    /**< true while should be running */
     int debug;                      /**< For controlling debug output */
     ndnd_logger logger;             /**< For debug output */
@@ -154,6 +240,30 @@ struct ndnd_handle {
     unsigned long logtime;          /**< see ndn_msg() */
     int logpid;                     /**< see ndn_msg() */
     int mtu;                        /**< Target size for stuffing interests */
+    unsigned frag_mtu;              /**< Fragment larger link datagrams */
+    unsigned frag_retries;          /**< Fragment retransmissions (0: no ARQ) */
+    unsigned long frags_sent;       /**< link fragments sent */
+    unsigned long frags_recvd;      /**< link fragments received */
+    unsigned long frags_resent;     /**< link fragments retransmitted */
+    unsigned long frags_dropped;    /**< abandoned fragments and partials */
+    unsigned long frag_reassembled; /**< messages put back together */
+    unsigned coalesce_usec;         /**< NDND_COALESCE default for dgram faces */
+    unsigned coalesce_bytes;        /**< ... and its size threshold */
+    unsigned long msgs_coalesced;   /**< messages sent in coalesced PDUs */
+    unsigned long pdus_coalesced;   /**< coalesced PDUs sent */
+    unsigned ishape_floor;          /**< NDND_INTEREST_SHAPING (0: off) */
+    unsigned long interests_shaped; /**< interest sends held back */
+    unsigned long cmarks_sent;      /**< CongestionMark link messages sent */
+    unsigned long cmarks_recvd;     /**< ... and received */
+    unsigned long loop_runs;        /**< trips around the main loop */
+    unsigned long loop_fds;         /**< fds serviced after poll */
+    int loop_next_usec;             /**< scheduler's last wait (-1: none) */
+    unsigned long backbone_requests; /**< gateway interests to the backbone */
+    struct ndn_charbuf *metrics;    /**< cached /metrics document */
+    unsigned metrics_stamp;         /**< msec clock when it was made */
+    unsigned metrics_max_age;       /**< NDND_METRICS_MAX_AGE, msec */
+    int metrics_prefixes;           /**< NDND_METRICS_PREFIXES */
+    int metrics_faces;              /**< NDND_METRICS_FACES */
     int flood;                      /**< Internal control for auto-reg */
     struct ndn_charbuf *autoreg;    /**< URIs to auto-register */
     int force_zero_freshness;       /**< Simulate freshness=0 on all content */
@@ -173,18 +283,23 @@ struct ndnd_handle {
     int tts_default;                /**< NDND_DEFAULT_TIME_TO_STALE (seconds) */
     int tts_limit;                  /**< NDND_MAX_TIME_TO_STALE (seconds) */
     int predicted_response_limit;   /**< NDND_MAX_RTE_MICROSEC */
+    unsigned tc_quantum[NDND_TC_N]; /**< NDND_SHAPER_WEIGHTS, bytes per round */
 };
 
 /**
  * Each face is referenced by a number, the faceid.  The low-order
  * bits (under the MAXFACES) constitute a slot number that is
  * unique (for this ndnd) among the faces that are alive at a given time.
- * The rest of the bits form a generation number that make the
- * entire faceid unique over time, even for faces that are defunct.
+ * The rest of the bits form a generation number, kept for each slot,
+ * that makes the entire faceid unique over time, even for faces that
+ * are defunct.
  */
 #define FACESLOTBITS 18
 #define MAXFACES ((1U << FACESLOTBITS) - 1)
 
+/** A datagram face that receives nothing for this long may be retired */
+#define NDND_DGRAM_IDLE_USEC (2 * NDN_INTEREST_LIFETIME_MICROSEC)
+
 struct content_queue {
     unsigned burst_nsec;             /**< nsec per KByte, limits burst rate */
     unsigned min_usec;               /**< minimum delay for this queue */
@@ -192,14 +307,50 @@ struct content_queue {
     unsigned ready;                  /**< # that have waited enough */
     unsigned nrun;                   /**< # sent since last randomized delay */
     struct ndn_indexbuf *send_queue; /**< accession numbers of pending content */
+    struct ndn_indexbuf *enqueued;   /**< shaper clock when each was queued */
     struct ndn_scheduled_event *sender;
 };
 
-enum cq_delay_class {
-    NDN_CQ_ASAP,
-    NDN_CQ_NORMAL,
-    NDN_CQ_SLOW,
-    NDN_CQ_N
+/**
+ * Link fragmentation, see doc/technical/LinkMessages.txt
+ */
+#define NDND_FRAG_MAX 32            /**< most fragments in one message */
+#define NDND_FRAG_OVERHEAD 64       /**< allowance for fragment framing */
+#define NDND_REASM_N 4              /**< partial messages kept per face */
+#define NDND_REASM_USEC 2000000     /**< give up on a partial after this */
+#define NDND_REASM_BYTES 65536      /**< most bytes kept for one partial */
+#define NDND_ARQ_N 64               /**< unacknowledged fragments per face */
+
+/**
+ * Interest shaping, see face_ishape_admit() in ndnd.c
+ */
+#define NDND_ISHAPE_GAIN 384        /**< interest/data ratio, in 1/256 */
+#define NDND_ISHAPE_GAIN_MIN 128    /**< lowest ratio after congestion */
+#define NDND_ISHAPE_BURST 100000    /**< usec of interests sent back to back */
+
+/**
+ * Default size threshold for coalescing small messages, leaving room
+ * for the PDU framing within a typical path MTU
+ */
+#define NDND_COALESCE_BYTES 1200
+
+/** A fragment kept for retransmission until it is acknowledged */
+struct ndnd_arq {
+    unsigned seq;                   /**< its sequence number */
+    unsigned sent;                  /**< usec clock at last transmission */
+    unsigned tries;                 /**< transmissions so far */
+    struct ndn_charbuf *pdu;        /**< the framed fragment, or NULL */
+};
+
+/** Per-face fragmentation state, created on first use */
+struct ndnd_linkfrag {
+    unsigned seq;                   /**< next fragment sequence number */
+    int delivering;                 /**< handing a reassembled message up */
+    struct ndn_reasm *reasm;        /**< partial messages from the peer */
+    struct ndnd_arq arq[NDND_ARQ_N]; /**< indexed by seq % NDND_ARQ_N */
+    unsigned srtt;                  /**< ack round-trip time, usec (0: none) */
+    unsigned rttvar;                /**< its variation, usec */
+    struct ndn_scheduled_event *arq_ev; /**< retransmission timer */
 };
 
 /**
@@ -215,6 +366,19 @@ enum ndnd_face_meter_index {
     NDND_FACE_METER_N
 };
 
+/**
+ * Latency histogram, with power-of-two buckets of microseconds.
+ *
+ * Only the ndnd thread writes these, with atomic stores, so another
+ * thread may read one without locking by way of ndnd_hist_snapshot().
+ */
+#define NDND_HIST_N 24
+struct ndnd_hist {
+    unsigned count;                 /**< samples recorded */
+    uintmax_t sum;                  /**< of all samples, usec */
+    unsigned bucket[NDND_HIST_N];   /**< by highest bit of usec */
+};
+
 /**
  * One of our active faces
  */
@@ -240,6 +404,32 @@ struct face {
     struct ndnd_meter *meter[NDND_FACE_METER_N];
     unsigned short pktseq;      /**< sequence number for sent packets */
     unsigned short adjstate;    /**< state of adjacency negotiotiation */
+    unsigned srtt;              /**< smoothed round-trip time, usec (0: none) */
+    unsigned rttvar;            /**< round-trip time variation, usec */
+    unsigned loss;              /**< unanswered fraction, in 1/65536 */
+    int wrr_credit;             /**< for the weighted round-robin strategy */
+    unsigned rate_limit;        /**< bytes per second (0: unlimited) */
+    unsigned rate_burst;        /**< token bucket depth, bytes */
+    int rate_tokens;            /**< bytes that may be sent right now */
+    unsigned rate_stamp;        /**< usec clock at last refill */
+    unsigned tc_waiting;        /**< backlogged traffic classes, bitmask */
+    int tc_deficit[NDND_TC_N];  /**< deficit round robin counters, bytes */
+    unsigned tc_want[NDND_TC_N]; /**< size each class last asked for */
+    unsigned tc_stamp[NDND_TC_N]; /**< usec clock when it last asked */
+    struct ndnd_linkfrag *frag; /**< link fragmentation state, or NULL */
+    unsigned coalesce_usec;     /**< flush deadline for coalescing (0: off) */
+    unsigned coalesce_bytes;    /**< flush when this much is waiting */
+    struct ndn_charbuf *coalesce; /**< messages waiting to go in one PDU */
+    struct ndn_scheduled_event *coalesce_flusher;
+    struct ndn_scheduled_event *idle_timer; /**< retires an idle dgram face */
+    unsigned ishape_gain;       /**< interests per datum returned, in 1/256 */
+    unsigned ishape_next;       /**< usec clock when an interest may go */
+    unsigned ishape_cut;        /**< usec clock when gain was last cut */
+    unsigned ishape_acks;       /**< unmarked data since gain last grew */
+    struct ndnd_hist rtt_hist;  /**< interest to data, usec */
+    struct ndnd_hist queue_hist; /**< time content spent in q, usec */
+    struct ndn_shm *shm;        /**< shared-memory rings to a local client */
+    int shm_spill;              /**< using the socket until the ring drains */
 };
 
 /** face flags */
@@ -266,36 +456,78 @@ struct face {
 #define NDN_FACE_BC    (1 << 20) /** Needs SO_BROADCAST to send */
 #define NDN_FACE_NBC   (1 << 21) /** Don't use SO_BROADCAST to send */
 #define NDN_FACE_ADJ   (1 << 22) /** Adjacency guid has been negotiatied */
+#define NDN_FACE_CM    (1 << 23) /** Owes a CongestionMark to the peer */
 #define NDN_NOFACEID    (~0U)    /** denotes no face */
 
 /**
- *  The content hash table is keyed by the initial portion of the ContentObject
- *  that contains all the parts of the complete name.  The extdata of the hash
- *  table holds the rest of the object, so that the whole ContentObject is
- *  stored contiguously.  The internal form differs from the on-wire form in
- *  that the final content-digest name component is represented explicitly,
- *  which simplifies the matching logic.
- *  The original ContentObject may be reconstructed simply by excising this
- *  last name component, which is easily located via the comps array.
+ *  The content hash table is keyed by the fingerprint of the ContentObject
+ *  followed by the initial portion of the object, up to the Content.
+ *  The fingerprint is a keyed 64-bit hash of the whole object, so objects
+ *  that differ only in their payload land in different entries.
+ *  The extdata of the hash table holds the rest of the object, so that the
+ *  whole ContentObject is stored contiguously, exactly as it arrived.
+ *  The content digest, which serves as an implicit last name component,
+ *  is only computed when something asks for it, or when it is needed to
+ *  keep the content in name order, and is then kept with the entry.
  */
+struct cslinks {
+    struct cslinks *next;
+    struct cslinks *prev;
+};
+
 struct content_entry {
+    struct cslinks ll;          /**< for use by cs_policy */
     ndn_accession_t accession;  /**< assigned in arrival order */
-    unsigned arrival_faceid;    /**< the faceid of first arrival */
     unsigned short *comps;      /**< Name Component byte boundary offsets */
     int ncomps;                 /**< Number of name components plus one */
     int flags;                  /**< see below */
     const unsigned char *key;   /**< ndnb-encoded ContentObject */
     int key_size;               /**< Size of fragment prior to Content */
     int size;                   /**< Size of ContentObject */
-    struct ndn_indexbuf *skiplinks; /**< skiplist for name-ordered ops */
+    unsigned arrival_faceid;    /**< the faceid of first arrival */
+    struct ndn_nametree_entry tree; /**< Name in comparable form, see below */
+    unsigned cs_hits;           /**< times reused from the store */
+    int cs_list;                /**< cs_policy list holding this entry */
+    unsigned stale_at;          /**< sec when it goes stale (0 if never) */
 };
 
+/**
+ * A content_entry and everything it points to live in a single
+ * content_tab node: the entry itself, the fingerprint and ContentObject
+ * (the hashtb key and extension), then the comps array starting at the
+ * next even offset, the namekey, the length of the digest component, and
+ * room for the digest.  Nothing needs to be freed separately.
+ */
+#define CONTENT_COMPS_OFFSET(size) (((size) + 1) & ~(size_t)1)
+#define CONTENT_DIGEST_SIZE 32
+
 /**
  * content_entry flags
  */
 #define NDN_CONTENT_ENTRY_SLOWSEND  1
 #define NDN_CONTENT_ENTRY_STALE     2
 #define NDN_CONTENT_ENTRY_PRECIOUS  4
+#define NDN_CONTENT_ENTRY_DIGEST    8   /**< the digest has been computed */
+#define NDN_CONTENT_ENTRY_DIGEST_KEY 16 /**< and is part of the tree key */
+
+/**
+ * A content store replacement policy.
+ *
+ * The policy sees each entry as it enters and leaves the store, and
+ * is told about reuse and flag changes.  When the store is over
+ * capacity, clean_daemon asks it for victims.  Precious content is
+ * never offered to the policy.
+ */
+struct ndnd_cs_policy {
+    const char *name;
+    int (*init)(struct ndnd_handle *h);
+    void (*destroy)(struct ndnd_handle *h);
+    void (*insert)(struct ndnd_handle *h, struct content_entry *content);
+    void (*hit)(struct ndnd_handle *h, struct content_entry *content);
+    void (*update)(struct ndnd_handle *h, struct content_entry *content);
+    void (*remove)(struct ndnd_handle *h, struct content_entry *content);
+    struct content_entry *(*victim)(struct ndnd_handle *h);
+};
 
 /**
  * The sparse_straggler hash table, keyed by accession, holds scattered
@@ -340,6 +572,7 @@ struct interest_entry {
     const unsigned char *interest_msg; /**< pending interest message */
     unsigned size;                  /**< size of interest message */
     unsigned serial;                /**< used for logging */
+    struct ndn_parsed_interest pi;  /**< interest_msg, parsed on arrival */
 };
 
 /**
@@ -353,6 +586,25 @@ struct nonce_entry {
     ndn_wrappedtime expiry;         /** when this should expire */
 };
 
+/**
+ * Approximate nonce memory, used in place of the nonce table
+ *
+ * A pair of blocked Bloom filters; the current one takes insertions,
+ * and both are consulted.  Every nonce lifetime the older one is
+ * cleared and the roles swap, so a nonce is remembered for between
+ * one and two lifetimes.  Each key sets all of its bits in a single
+ * 64-byte block, so a check touches one cache line per filter.
+ */
+struct nonce_filter {
+    uint64_t *cur;                  /**< receives insertions */
+    uint64_t *old;                  /**< from the previous lifetime */
+    unsigned nblocks;               /**< 512-bit blocks per filter */
+    unsigned nhash;                 /**< bits set per key */
+    ndn_wrappedtime rotated;        /**< when cur was last cleared */
+    unsigned long n_inserted;       /**< keys added since rotation */
+    unsigned long n_rotations;      /**< times the filters were swapped */
+};
+
 /**
  * The guest hash table is keyed by the faceid of the requestor
  *
@@ -389,6 +641,7 @@ struct pit_face_item {
 #define NDND_PFI_PENDING  0x2000    /**< Pending for immediate data */
 #define NDND_PFI_SUPDATA  0x4000    /**< Suppressed data reply */
 #define NDND_PFI_DCFACE  0x10000    /**< This upstream is a DC face */
+#define NDND_PFI_BIGNONCE 0x20000   /**< Not from pfi_pool, has larger nonce */
 
 /**
  * The nameprefix hash table is keyed by the Component elements of
@@ -403,9 +656,12 @@ struct nameprefix_entry {
     int children;                /**< number of children */
     unsigned flags;              /**< NDN_FORW_* flags about namespace */
     int fgen;                    /**< used to decide when forward_to is stale */
+    unsigned fstamp;             /**< forward_to_gen when forwarding changed */
     unsigned src;                /**< faceid of recent content source */
     unsigned osrc;               /**< and of older matching content */
     unsigned usec;               /**< response-time prediction */
+    const struct ndnd_strategy_class *strategy; /**< if set for this prefix */
+    struct ndnd_hist *rtt_hist;  /**< interest to data, if forwarded here */
 };
 
 /**
@@ -415,7 +671,9 @@ struct nameprefix_entry {
 struct ndn_forwarding {
     unsigned faceid;             /**< locally unique number identifying face */
     unsigned flags;              /**< NDN_FORW_* - c.f. <ndn/reg_mgnt.h> */
-    int expires;                 /**< time remaining, in seconds */
+    int expires;                 /**< lifetime when registered, in seconds */
+    struct nameprefix_entry *npe; /**< the prefix this belongs to */
+    struct ndn_scheduled_event *ev; /**< expiry, evint has h->sec when due */
     struct ndn_forwarding *next;
 };
 
@@ -432,6 +690,10 @@ void ndnd_meter_bump(struct ndnd_handle *h, struct ndnd_meter *m, unsigned amt);
 unsigned ndnd_meter_rate(struct ndnd_handle *h, struct ndnd_meter *m);
 uintmax_t ndnd_meter_total(struct ndnd_meter *m);
 
+void ndnd_hist_add(struct ndnd_hist *hist, unsigned usec);
+void ndnd_hist_snapshot(const struct ndnd_hist *hist, struct ndnd_hist *copy);
+unsigned ndnd_hist_quantile(const struct ndnd_hist *hist, unsigned permille);
+
 
 /**
  * Refer to doc/technical/Registration.txt for the meaning of these flags.
@@ -450,9 +712,14 @@ uintmax_t ndnd_meter_total(struct ndnd_meter *m);
 
  
 /**
- * Determines how frequently we age our forwarding entries
+ * Forwarding entries registered for at least this long do not expire
  */
-#define NDN_FWU_SECS 5
+#define NDN_FWU_PERMANENT (1 << 30)
+
+/**
+ * Longest single wait for a forwarding expiry event, in seconds
+ */
+#define NDN_FWU_SECS 1800
 
 /*
  * Internal client
@@ -479,6 +746,22 @@ int ndnd_req_destroyface(struct ndnd_handle *h,
                          const unsigned char *msg, size_t size,
                          struct ndn_charbuf *reply_body);
 
+/*
+ * The internal client calls this with the argument portion ARG of
+ * a face rate-limit request (/ndnx/NDNDID/setfacerate/ARG)
+ */
+int ndnd_req_setfacerate(struct ndnd_handle *h,
+                         const unsigned char *msg, size_t size,
+                         struct ndn_charbuf *reply_body);
+
+/*
+ * The internal client calls this with the argument portion ARG of
+ * a face coalescing request (/ndnx/NDNDID/setfacecoalesce/ARG)
+ */
+int ndnd_req_setfacecoalesce(struct ndnd_handle *h,
+                             const unsigned char *msg, size_t size,
+                             struct ndn_charbuf *reply_body);
+
 /*
  * The internal client calls this with the argument portion ARG of
  * a prefix-registration request (/ndnx/NDNDID/prefixreg/ARG)
@@ -537,6 +820,14 @@ void ndnd_send(struct ndnd_handle *h, struct face *face,
 
 /* Consider a separate header for these */
 int ndnd_stats_handle_http_connection(struct ndnd_handle *, struct face *);
+
+int ndnd_cs_policy_set(struct ndnd_handle *h, const char *name);
+void ndnd_cs_policy_destroy(struct ndnd_handle *h);
+void ndnd_cs_insert(struct ndnd_handle *h, struct content_entry *content);
+void ndnd_cs_hit(struct ndnd_handle *h, struct content_entry *content);
+void ndnd_cs_update(struct ndnd_handle *h, struct content_entry *content);
+void ndnd_cs_remove(struct ndnd_handle *h, struct content_entry *content);
+struct content_entry *ndnd_cs_victim(struct ndnd_handle *h);
 void ndnd_msg(struct ndnd_handle *, const char *, ...);
 void ndnd_debug_ndnb(struct ndnd_handle *h,
                      int lineno,
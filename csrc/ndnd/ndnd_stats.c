@@ -51,6 +51,11 @@
 
 /**
  * Provide a way to monitor rates.
+ *
+ * Only the ndnd thread bumps a meter, but total, rate, and lastupdate
+ * are each stored and loaded atomically, so another thread may read a
+ * meter without locking.  It sees no torn values, though the rate and
+ * its time stamp may come from neighbouring ticks.
  */
 struct ndnd_meter {
     uintmax_t total;
@@ -61,6 +66,8 @@ struct ndnd_meter {
 
 struct ndnd_stats {
     long total_interest_counts;
+    long clean_over;            /**< content objects over capacity */
+    long clean_lag;             /**< seconds the cleaner has been behind */
 };
 
 static int ndnd_collect_stats(struct ndnd_handle *h, struct ndnd_stats *ans);
@@ -70,6 +77,9 @@ static void send_http_response(struct ndnd_handle *h, struct face *face,
                                struct ndn_charbuf *response);
 static struct ndn_charbuf *collect_stats_html(struct ndnd_handle *h);
 static struct ndn_charbuf *collect_stats_xml(struct ndnd_handle *h);
+static struct ndn_charbuf *collect_stats_metrics(struct ndnd_handle *h);
+static void collect_hist_html(struct ndn_charbuf *b, const char *what,
+                              const struct ndnd_hist *hist);
 
 /* HTTP */
 
@@ -144,6 +154,10 @@ ndnd_stats_handle_http_connection(struct ndnd_handle *h, struct face *face)
         response = collect_stats_xml(h);
         send_http_response(h, face, "text/xml", response);
     }
+    else if (0 == strcmp(rbuf, "GET /metrics ")) {
+        send_http_response(h, face, "text/plain; version=0.0.4",
+                           collect_stats_metrics(h));
+    }
     else if (0 == strcmp(rbuf, "GET "))
         ndnd_send(h, face, resp404, strlen(resp404));
     else
@@ -209,6 +223,14 @@ ndnd_collect_stats(struct ndnd_handle *h, struct ndnd_stats *ans)
         ndnd_msg(h, "ndnd_collect_stats found inconsistency %ld != %ld\n",
                  (long)sum, (long)ans->total_interest_counts);
     ans->total_interest_counts = sum;
+    /* How far the content cleaner is behind */
+    ans->clean_over = (long)hashtb_n(h->content_tab) - (long)h->capacity;
+    if (ans->clean_over < 0)
+        ans->clean_over = 0;
+    ans->clean_lag = 0;
+    if (h->clean_behind != 0 &&
+        (ans->clean_over > 0 || h->cs_bytes > h->capacity_bytes))
+        ans->clean_lag = h->sec - h->clean_behind;
     return(0);
 }
 
@@ -235,6 +257,22 @@ collect_faces_html(struct ndnd_handle *h, struct ndn_charbuf *b)
             if (face->recvcount != 0)
                 ndn_charbuf_putf(b, " <b>activity:</b> %d",
                                  face->recvcount);
+            if (face->srtt != 0)
+                ndn_charbuf_putf(b, " <b>rtt:</b> %u&#177;%u us"
+                                 " <b>loss:</b> %u%%",
+                                 face->srtt, face->rttvar,
+                                 face->loss * 100 / 65536);
+            if (face->rate_limit != 0)
+                ndn_charbuf_putf(b, " <b>rate:</b> %u B/s",
+                                 face->rate_limit);
+            if (face->coalesce_usec != 0)
+                ndn_charbuf_putf(b, " <b>coalesce:</b> %u us",
+                                 face->coalesce_usec);
+            if (face->ishape_gain != 0)
+                ndn_charbuf_putf(b, " <b>interest gain:</b> %u/256",
+                                 face->ishape_gain);
+            collect_hist_html(b, "rtt", &face->rtt_hist);
+            collect_hist_html(b, "queued", &face->queue_hist);
             nodebuf->length = 0;
             port = ndn_charbuf_append_sockaddr(nodebuf, face->addr);
             if (port > 0) {
@@ -265,6 +303,24 @@ collect_faces_html(struct ndnd_handle *h, struct ndn_charbuf *b)
     ndn_charbuf_destroy(&nodebuf);
 }
 
+static void
+collect_hist_html(struct ndn_charbuf *b, const char *what,
+                  const struct ndnd_hist *live)
+{
+    struct ndnd_hist snap;
+    const struct ndnd_hist *hist = &snap;
+    
+    if (live == NULL)
+        return;
+    ndnd_hist_snapshot(live, &snap);
+    if (hist->count == 0)
+        return;
+    ndn_charbuf_putf(b, " <b>%s p50/p90/p99:</b> %u/%u/%u us", what,
+                     ndnd_hist_quantile(hist, 500),
+                     ndnd_hist_quantile(hist, 900),
+                     ndnd_hist_quantile(hist, 990));
+}
+
 static void
 collect_face_meter_html(struct ndnd_handle *h, struct ndn_charbuf *b)
 {
@@ -333,7 +389,8 @@ collect_forwarding_html(struct ndnd_handle *h, struct ndn_charbuf *b)
                                  " <b>expires:</b> %d",
                                  f->faceid,
                                  f->flags & NDN_FORW_PUBMASK,
-                                 f->expires);
+                                 f->ev != NULL ?
+                                 (int)(f->ev->evint - h->sec) : f->expires);
                 ndn_charbuf_putf(b, "</li>" NL);
             }
         }
@@ -418,6 +475,63 @@ collect_stats_html(struct ndnd_handle *h)
         hashtb_n(h->nonce_tab),
         h->interests_accepted, h->interests_dropped,
         h->interests_sent, h->interests_stuffed);
+    ndn_charbuf_putf(b,
+        "<div><b>Content store:</b> %s policy,"
+        " %llu bytes, %lu hits, %lu evicted,"
+        " %lu restored, %lu in last snapshot</div>" NL,
+        h->cs_policy != NULL ? h->cs_policy->name : "fifo",
+        h->cs_bytes,
+        h->content_hits,
+        h->content_evicted,
+        h->cs_snapshot_loaded,
+        h->cs_snapshot_saved);
+    ndn_charbuf_putf(b,
+        "<div><b>Cleaner:</b> %lu runs, %lu examined, %lu removed,"
+        " %ld over capacity, lag %ld sec</div>" NL,
+        h->clean_runs,
+        h->clean_visited,
+        h->clean_removed,
+        stats.clean_over,
+        stats.clean_lag);
+    ndn_charbuf_putf(b,
+        "<div><b>Link fragments:</b> %lu sent, %lu received,"
+        " %lu messages reassembled, %lu retransmitted, %lu dropped</div>" NL,
+        h->frags_sent,
+        h->frags_recvd,
+        h->frag_reassembled,
+        h->frags_resent,
+        h->frags_dropped);
+    ndn_charbuf_putf(b,
+        "<div><b>Coalescing:</b> %lu messages in %lu PDUs</div>" NL,
+        h->msgs_coalesced,
+        h->pdus_coalesced);
+    ndn_charbuf_putf(b,
+        "<div><b>Interest shaping:</b> floor %u/s, %lu held back,"
+        " %lu congestion marks sent, %lu received</div>" NL,
+        h->ishape_floor,
+        h->interests_shaped,
+        h->cmarks_sent,
+        h->cmarks_recvd);
+    ndn_charbuf_putf(b,
+        "<div><b>Shared memory:</b> %u faces, %lu messages in, %lu out</div>" NL,
+        h->shm_count,
+        h->shm_msgs_in,
+        h->shm_msgs_out);
+    ndn_charbuf_putf(b,
+        "<div><b>Pools:</b> %lu pit face items in use, %lu free,"
+        " %d interest and %d nonce entries free</div>" NL,
+        h->pfi_pool.n_used,
+        h->pfi_pool.n_free,
+        hashtb_pooled(h->interest_tab),
+        hashtb_pooled(h->nonce_tab));
+    if (h->nonce_filter != NULL)
+        ndn_charbuf_putf(b,
+            "<div><b>Nonce filter:</b> %u blocks, %u hashes,"
+            " %lu recent, %lu rotations</div>" NL,
+            h->nonce_filter->nblocks,
+            h->nonce_filter->nhash,
+            h->nonce_filter->n_inserted,
+            h->nonce_filter->n_rotations);
     if (0)
         ndn_charbuf_putf(b,
                          "<div><b>Active faces and listeners:</b> %d</div>" NL,
@@ -447,6 +561,33 @@ collect_meter_xml(struct ndnd_handle *h, struct ndn_charbuf *b, struct ndnd_mete
         m->what, total, rate, m->what);
 }
 
+static void
+collect_hist_xml(struct ndn_charbuf *b, const char *what,
+                 const struct ndnd_hist *live)
+{
+    struct ndnd_hist snap;
+    const struct ndnd_hist *hist = &snap;
+    int k;
+    int n;
+    
+    if (live == NULL)
+        return;
+    ndnd_hist_snapshot(live, &snap);
+    if (hist->count == 0)
+        return;
+    ndn_charbuf_putf(b, "<%s><count>%u</count>"
+                     "<p50>%u</p50><p90>%u</p90><p99>%u</p99><buckets>",
+                     what, hist->count,
+                     ndnd_hist_quantile(hist, 500),
+                     ndnd_hist_quantile(hist, 900),
+                     ndnd_hist_quantile(hist, 990));
+    for (n = NDND_HIST_N; n > 1 && hist->bucket[n - 1] == 0; n--)
+        continue;
+    for (k = 0; k < n; k++)
+        ndn_charbuf_putf(b, k == 0 ? "%u" : ",%u", hist->bucket[k]);
+    ndn_charbuf_putf(b, "</buckets></%s>", what);
+}
+
 static void
 collect_faces_xml(struct ndnd_handle *h, struct ndn_charbuf *b)
 {
@@ -469,6 +610,25 @@ collect_faces_xml(struct ndnd_handle *h, struct ndn_charbuf *b)
                              face->pending_interests);
             ndn_charbuf_putf(b, "<recvcount>%d</recvcount>",
                              face->recvcount);
+            if (face->srtt != 0)
+                ndn_charbuf_putf(b, "<srtt>%u</srtt><rttvar>%u</rttvar>"
+                                 "<loss>%u</loss>",
+                                 face->srtt, face->rttvar, face->loss);
+            if (face->rate_limit != 0)
+                ndn_charbuf_putf(b, "<ratelimit>%u</ratelimit>"
+                                 "<rateburst>%u</rateburst>",
+                                 face->rate_limit, face->rate_burst);
+            if (face->coalesce_usec != 0)
+                ndn_charbuf_putf(b, "<coalesceusec>%u</coalesceusec>"
+                                 "<coalescebytes>%u</coalescebytes>",
+                                 face->coalesce_usec,
+                                 face->coalesce_bytes != 0 ?
+                                 face->coalesce_bytes : NDND_COALESCE_BYTES);
+            if (face->ishape_gain != 0)
+                ndn_charbuf_putf(b, "<ishapegain>%u</ishapegain>",
+                                 face->ishape_gain);
+            collect_hist_xml(b, "rtthist", &face->rtt_hist);
+            collect_hist_xml(b, "queuehist", &face->queue_hist);
             nodebuf->length = 0;
             port = ndn_charbuf_append_sockaddr(nodebuf, face->addr);
             if (port > 0) {
@@ -515,6 +675,7 @@ collect_forwarding_xml(struct ndnd_handle *h, struct ndn_charbuf *b)
             ndn_charbuf_putf(b, "<prefix>");
             ndn_uri_append(b, name->buf, name->length, 1);
             ndn_charbuf_putf(b, "</prefix>");
+            collect_hist_xml(b, "rtthist", ipe->rtt_hist);
             for (f = ipe->forwarding; f != NULL; f = f->next) {
                 if ((f->flags & (NDN_FORW_ACTIVE | NDN_FORW_PFXO)) != 0) {
                     ndn_charbuf_putf(b,
@@ -525,7 +686,8 @@ collect_forwarding_xml(struct ndnd_handle *h, struct ndn_charbuf *b)
                                      "</dest>",
                                      f->faceid,
                                      f->flags & NDN_FORW_PUBMASK,
-                                     f->expires);
+                                     f->ev != NULL ?
+                                     (int)(f->ev->evint - h->sec) : f->expires);
                 }
             }
             ndn_charbuf_putf(b, "</fentry>");
@@ -589,12 +751,540 @@ collect_stats_xml(struct ndnd_handle *h)
         hashtb_n(h->nonce_tab),
         h->interests_accepted, h->interests_dropped,
         h->interests_sent, h->interests_stuffed);
+    ndn_charbuf_putf(b,
+        "<cs>"
+        "<policy>%s</policy>"
+        "<bytes>%llu</bytes>"
+        "<hits>%lu</hits>"
+        "<evicted>%lu</evicted>"
+        "<restored>%lu</restored>"
+        "<snapshot>%lu</snapshot>"
+        "</cs>",
+        h->cs_policy != NULL ? h->cs_policy->name : "fifo",
+        h->cs_bytes,
+        h->content_hits,
+        h->content_evicted,
+        h->cs_snapshot_loaded,
+        h->cs_snapshot_saved);
+    ndn_charbuf_putf(b,
+        "<cleaner>"
+        "<runs>%lu</runs>"
+        "<examined>%lu</examined>"
+        "<removed>%lu</removed>"
+        "<over>%ld</over>"
+        "<lag>%ld</lag>"
+        "</cleaner>",
+        h->clean_runs,
+        h->clean_visited,
+        h->clean_removed,
+        stats.clean_over,
+        stats.clean_lag);
+    ndn_charbuf_putf(b,
+        "<fragments>"
+        "<sent>%lu</sent>"
+        "<received>%lu</received>"
+        "<reassembled>%lu</reassembled>"
+        "<retransmitted>%lu</retransmitted>"
+        "<dropped>%lu</dropped>"
+        "</fragments>",
+        h->frags_sent,
+        h->frags_recvd,
+        h->frag_reassembled,
+        h->frags_resent,
+        h->frags_dropped);
+    ndn_charbuf_putf(b,
+        "<coalescing>"
+        "<messages>%lu</messages>"
+        "<pdus>%lu</pdus>"
+        "</coalescing>",
+        h->msgs_coalesced,
+        h->pdus_coalesced);
+    ndn_charbuf_putf(b,
+        "<ishaping>"
+        "<floor>%u</floor>"
+        "<held>%lu</held>"
+        "<markssent>%lu</markssent>"
+        "<marksrecvd>%lu</marksrecvd>"
+        "</ishaping>",
+        h->ishape_floor,
+        h->interests_shaped,
+        h->cmarks_sent,
+        h->cmarks_recvd);
+    ndn_charbuf_putf(b,
+        "<shm>"
+        "<faces>%u</faces>"
+        "<msgsin>%lu</msgsin>"
+        "<msgsout>%lu</msgsout>"
+        "</shm>",
+        h->shm_count,
+        h->shm_msgs_in,
+        h->shm_msgs_out);
+    ndn_charbuf_putf(b,
+        "<pools>"
+        "<pfiused>%lu</pfiused>"
+        "<pfifree>%lu</pfifree>"
+        "<interestfree>%d</interestfree>"
+        "<noncefree>%d</noncefree>"
+        "</pools>",
+        h->pfi_pool.n_used,
+        h->pfi_pool.n_free,
+        hashtb_pooled(h->interest_tab),
+        hashtb_pooled(h->nonce_tab));
+    if (h->nonce_filter != NULL)
+        ndn_charbuf_putf(b,
+            "<noncefilter>"
+            "<blocks>%u</blocks>"
+            "<hashes>%u</hashes>"
+            "<recent>%lu</recent>"
+            "<rotations>%lu</rotations>"
+            "</noncefilter>",
+            h->nonce_filter->nblocks,
+            h->nonce_filter->nhash,
+            h->nonce_filter->n_inserted,
+            h->nonce_filter->n_rotations);
     collect_faces_xml(h, b);
     collect_forwarding_xml(h, b);
     ndn_charbuf_putf(b, "</ndnd>" NL);
     return(b);
 }
 
+/* Metrics, in the Prometheus text exposition format */
+
+static void
+metric_head(struct ndn_charbuf *b, const char *name,
+            const char *type, const char *help)
+{
+    ndn_charbuf_putf(b, "# HELP ndnd_%s %s\n# TYPE ndnd_%s %s\n",
+                     name, help, name, type);
+}
+
+static void
+metric_counter(struct ndn_charbuf *b, const char *name,
+               const char *help, uintmax_t value)
+{
+    metric_head(b, name, "counter", help);
+    ndn_charbuf_putf(b, "ndnd_%s %ju\n", name, value);
+}
+
+static void
+metric_gauge(struct ndn_charbuf *b, const char *name,
+             const char *help, intmax_t value)
+{
+    metric_head(b, name, "gauge", help);
+    ndn_charbuf_putf(b, "ndnd_%s %jd\n", name, value);
+}
+
+/**
+ * Append the samples of a latency histogram, in seconds.
+ *
+ * The buckets are cumulative, as the format requires.
+ */
+static void
+metric_hist(struct ndn_charbuf *b, const char *name, const char *labels,
+            const struct ndnd_hist *live)
+{
+    struct ndnd_hist snap;
+    const struct ndnd_hist *hist = &snap;
+    uintmax_t cum = 0;
+    unsigned le;
+    int k;
+    
+    ndnd_hist_snapshot(live, &snap);
+    for (k = 0; k < NDND_HIST_N - 1; k++) {
+        cum += hist->bucket[k];
+        le = (2U << k) - 1;
+        ndn_charbuf_putf(b, "ndnd_%s_bucket{%s,le=\"%u.%06u\"} %ju\n",
+                         name, labels, le / 1000000, le % 1000000, cum);
+    }
+    ndn_charbuf_putf(b, "ndnd_%s_bucket{%s,le=\"+Inf\"} %u\n",
+                     name, labels, hist->count);
+    ndn_charbuf_putf(b, "ndnd_%s_sum{%s} %ju.%06u\n", name, labels,
+                     hist->sum / 1000000, (unsigned)(hist->sum % 1000000));
+    ndn_charbuf_putf(b, "ndnd_%s_count{%s} %u\n", name, labels, hist->count);
+}
+
+static int
+live_face(struct face *face)
+{
+    return(face != NULL &&
+           (face->flags & (NDN_FACE_UNDECIDED | NDN_FACE_PASSIVE)) == 0);
+}
+
+static void
+hist_add(struct ndnd_hist *sum, const struct ndnd_hist *live)
+{
+    struct ndnd_hist snap;
+    const struct ndnd_hist *hist = &snap;
+    int k;
+    
+    ndnd_hist_snapshot(live, &snap);
+    sum->count += hist->count;
+    sum->sum += hist->sum;
+    for (k = 0; k < NDND_HIST_N; k++)
+        sum->bucket[k] += hist->bucket[k];
+}
+
+static uintmax_t
+face_traffic(struct face *face)
+{
+    return(ndnd_meter_total(face->meter[FM_BYTI]) +
+           ndnd_meter_total(face->meter[FM_BYTO]));
+}
+
+static int
+compare_face_traffic(const void *a, const void *b)
+{
+    struct face *x = *(struct face * const *)a;
+    struct face *y = *(struct face * const *)b;
+    uintmax_t tx = face_traffic(x);
+    uintmax_t ty = face_traffic(y);
+    
+    if (tx != ty)
+        return(tx > ty ? -1 : 1);
+    return(x->faceid < y->faceid ? -1 : x->faceid > y->faceid);
+}
+
+/**
+ * Append the per-face series.
+ *
+ * To bound the number of series, only the NDND_METRICS_FACES busiest
+ * faces (by bytes in and out) get their own; the rest are added together
+ * as face="_other".  There is no loss ratio for "_other", since the
+ * ratios of different faces do not add up to anything.
+ */
+static void
+collect_face_metrics(struct ndnd_handle *h, struct ndn_charbuf *b)
+{
+    static const struct {
+        const char *name;
+        const char *help;
+        int in;
+        int out;
+    } m[3] = {
+        { "face_bytes_total", "Bytes through a face.", FM_BYTI, FM_BYTO },
+        { "face_interests_total", "Interests through a face.", FM_INTI, FM_INTO },
+        { "face_data_total", "Content objects through a face.", FM_DATI, FM_DATO }
+    };
+    struct face **v = NULL;
+    struct face *face;
+    struct ndnd_hist other_hist;
+    uintmax_t other_in;
+    uintmax_t other_out;
+    int other_pending = 0;
+    char labels[32];
+    int n = 0;
+    int top;
+    int i;
+    int j;
+    
+    v = calloc(h->face_limit + 1, sizeof(*v));
+    if (v == NULL)
+        return;
+    for (i = 0; i < h->face_limit; i++)
+        if (live_face(h->faces_by_faceid[i]))
+            v[n++] = h->faces_by_faceid[i];
+    qsort(v, n, sizeof(*v), &compare_face_traffic);
+    top = n < h->metrics_faces ? n : h->metrics_faces;
+    for (j = 0; j < 3; j++) {
+        metric_head(b, m[j].name, "counter", m[j].help);
+        other_in = other_out = 0;
+        for (i = 0; i < n; i++) {
+            face = v[i];
+            if (i >= top) {
+                other_in += ndnd_meter_total(face->meter[m[j].in]);
+                other_out += ndnd_meter_total(face->meter[m[j].out]);
+                continue;
+            }
+            ndn_charbuf_putf(b, "ndnd_%s{face=\"%u\",dir=\"in\"} %ju\n",
+                             m[j].name, face->faceid,
+                             ndnd_meter_total(face->meter[m[j].in]));
+            ndn_charbuf_putf(b, "ndnd_%s{face=\"%u\",dir=\"out\"} %ju\n",
+                             m[j].name, face->faceid,
+                             ndnd_meter_total(face->meter[m[j].out]));
+        }
+        if (top < n) {
+            ndn_charbuf_putf(b, "ndnd_%s{face=\"_other\",dir=\"in\"} %ju\n",
+                             m[j].name, other_in);
+            ndn_charbuf_putf(b, "ndnd_%s{face=\"_other\",dir=\"out\"} %ju\n",
+                             m[j].name, other_out);
+        }
+    }
+    metric_head(b, "face_pending_interests", "gauge",
+                "Interests pending from a face.");
+    for (i = 0; i < n; i++) {
+        if (i >= top)
+            other_pending += v[i]->pending_interests;
+        else
+            ndn_charbuf_putf(b, "ndnd_face_pending_interests{face=\"%u\"} %d\n",
+                             v[i]->faceid, v[i]->pending_interests);
+    }
+    if (top < n)
+        ndn_charbuf_putf(b, "ndnd_face_pending_interests{face=\"_other\"} %d\n",
+                         other_pending);
+    metric_head(b, "face_loss_ratio", "gauge",
+                "Smoothed fraction of interests to a face that went unanswered.");
+    for (i = 0; i < top; i++) {
+        face = v[i];
+        if (face->srtt != 0)
+            ndn_charbuf_putf(b, "ndnd_face_loss_ratio{face=\"%u\"} %u.%04u\n",
+                             face->faceid, face->loss / 65536,
+                             (face->loss % 65536) * 10000 / 65536);
+    }
+    metric_head(b, "face_rtt_seconds", "histogram",
+                "Interest to data round-trip times by upstream face.");
+    memset(&other_hist, 0, sizeof(other_hist));
+    for (i = 0; i < n; i++) {
+        face = v[i];
+        if (i >= top)
+            hist_add(&other_hist, &face->rtt_hist);
+        else if (face->rtt_hist.count != 0) {
+            snprintf(labels, sizeof(labels), "face=\"%u\"", face->faceid);
+            metric_hist(b, "face_rtt_seconds", labels, &face->rtt_hist);
+        }
+    }
+    if (other_hist.count != 0)
+        metric_hist(b, "face_rtt_seconds", "face=\"_other\"", &other_hist);
+    metric_head(b, "face_queue_seconds", "histogram",
+                "Time content waited in a face's send queues.");
+    memset(&other_hist, 0, sizeof(other_hist));
+    for (i = 0; i < n; i++) {
+        face = v[i];
+        if (i >= top)
+            hist_add(&other_hist, &face->queue_hist);
+        else if (face->queue_hist.count != 0) {
+            snprintf(labels, sizeof(labels), "face=\"%u\"", face->faceid);
+            metric_hist(b, "face_queue_seconds", labels, &face->queue_hist);
+        }
+    }
+    if (other_hist.count != 0)
+        metric_hist(b, "face_queue_seconds", "face=\"_other\"", &other_hist);
+    free(v);
+}
+
+struct prefix_hist {
+    const unsigned char *key;   /**< name components of the prefix */
+    size_t keysize;
+    const struct ndnd_hist *hist;
+};
+
+static int
+compare_prefix_hist(const void *a, const void *b)
+{
+    const struct prefix_hist *x = a;
+    const struct prefix_hist *y = b;
+    
+    if (x->hist->count != y->hist->count)
+        return(x->hist->count > y->hist->count ? -1 : 1);
+    return(0);
+}
+
+/**
+ * Append the per-prefix round-trip histograms.
+ *
+ * To bound the number of series, only the NDND_METRICS_PREFIXES busiest
+ * prefixes get their own; the rest are added together as "_other".
+ */
+static void
+collect_prefix_metrics(struct ndnd_handle *h, struct ndn_charbuf *b)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct prefix_hist *v = NULL;
+    struct nameprefix_entry *npe;
+    struct ndn_charbuf *name = NULL;
+    struct ndn_charbuf *labels = NULL;
+    struct ndnd_hist other = {0};
+    int n = 0;
+    int i;
+    
+    metric_head(b, "prefix_rtt_seconds", "histogram",
+                "Interest to data round-trip times by forwarding prefix.");
+    if (h->metrics_prefixes == 0)
+        return;
+    v = calloc(hashtb_n(h->nameprefix_tab) + 1, sizeof(*v));
+    name = ndn_charbuf_create();
+    labels = ndn_charbuf_create();
+    if (v == NULL || name == NULL || labels == NULL)
+        goto Finish;
+    hashtb_start(h->nameprefix_tab, e);
+    for (; e->data != NULL; hashtb_next(e)) {
+        npe = e->data;
+        if (npe->rtt_hist != NULL && npe->rtt_hist->count != 0) {
+            v[n].key = e->key;
+            v[n].keysize = e->keysize;
+            v[n].hist = npe->rtt_hist;
+            n++;
+        }
+    }
+    hashtb_end(e);
+    qsort(v, n, sizeof(*v), &compare_prefix_hist);
+    for (i = 0; i < n; i++) {
+        if (i >= h->metrics_prefixes) {
+            hist_add(&other, v[i].hist);
+            continue;
+        }
+        ndn_name_init(name);
+        ndn_name_append_components(name, v[i].key, 0, v[i].keysize);
+        ndn_charbuf_reset(labels);
+        ndn_charbuf_putf(labels, "prefix=\"");
+        ndn_uri_append(labels, name->buf, name->length, 1);
+        ndn_charbuf_putf(labels, "\"");
+        metric_hist(b, "prefix_rtt_seconds", ndn_charbuf_as_string(labels),
+                    v[i].hist);
+    }
+    if (other.count != 0)
+        metric_hist(b, "prefix_rtt_seconds", "prefix=\"_other\"", &other);
+Finish:
+    free(v);
+    ndn_charbuf_destroy(&name);
+    ndn_charbuf_destroy(&labels);
+}
+
+/**
+ * Get the metrics document, making it anew only if the cached one is
+ * older than NDND_METRICS_MAX_AGE.
+ *
+ * Only counts that are kept up to date as ndnd runs are used, so making
+ * the document costs time in proportion to the number of faces, plus a
+ * walk of the name prefix table for the per-prefix histograms.
+ * Frequent scrapes are served from the cache.
+ */
+static struct ndn_charbuf *
+collect_stats_metrics(struct ndnd_handle *h)
+{
+    struct ndn_charbuf *b = h->metrics;
+    unsigned now = (unsigned)h->sec * 1000U + h->usec / 1000U;
+    int nfaces = 0;
+    int i;
+    
+    if (b != NULL && now - h->metrics_stamp < h->metrics_max_age)
+        return(b);
+    if (b == NULL)
+        b = h->metrics = ndn_charbuf_create();
+    ndn_charbuf_reset(b);
+    h->metrics_stamp = now;
+    metric_gauge(b, "start_time_seconds", "When ndnd started.",
+                 h->starttime);
+    for (i = 0; i < h->face_limit; i++)
+        if (live_face(h->faces_by_faceid[i]))
+            nfaces++;
+    metric_gauge(b, "faces", "Active faces.", nfaces);
+    metric_gauge(b, "content_store_objects", "Content objects stored.",
+                 hashtb_n(h->content_tab));
+    metric_gauge(b, "content_store_bytes", "Bytes of content stored.",
+                 h->cs_bytes);
+    metric_gauge(b, "content_store_stale", "Stored content objects that are stale.",
+                 h->n_stale);
+    metric_gauge(b, "content_store_capacity", "Content object capacity.",
+                 h->capacity);
+    metric_counter(b, "content_hits_total", "Interests answered from the store.",
+                   h->content_hits);
+    metric_counter(b, "content_evicted_total", "Content objects evicted by the policy.",
+                   h->content_evicted);
+    metric_counter(b, "content_restored_total", "Content objects restored from the snapshot.",
+                   h->cs_snapshot_loaded);
+    metric_gauge(b, "content_snapshot_objects", "Content objects in the last snapshot saved.",
+                 h->cs_snapshot_saved);
+    metric_counter(b, "content_duplicates_total", "Duplicate content objects received.",
+                   h->content_dups_recvd);
+    metric_counter(b, "content_sent_total", "Content objects sent.",
+                   h->content_items_sent);
+    metric_counter(b, "cleaner_removed_total", "Content objects removed by the cleaner.",
+                   h->clean_removed);
+    metric_gauge(b, "pit_entries", "Pending interest table entries.",
+                 hashtb_n(h->interest_tab));
+    metric_gauge(b, "pit_face_items", "Pit face items in use.",
+                 h->pfi_pool.n_used);
+    metric_gauge(b, "name_prefixes", "Name prefix table entries.",
+                 hashtb_n(h->nameprefix_tab));
+    metric_counter(b, "interests_accepted_total", "Interests accepted.",
+                   h->interests_accepted);
+    metric_counter(b, "interests_dropped_total", "Interests dropped.",
+                   h->interests_dropped);
+    metric_counter(b, "interests_sent_total", "Interests sent.",
+                   h->interests_sent);
+    metric_counter(b, "interests_shaped_total", "Interest sends held back by interest shaping.",
+                   h->interests_shaped);
+    metric_counter(b, "congestion_marks_sent_total", "CongestionMark link messages sent.",
+                   h->cmarks_sent);
+    metric_counter(b, "congestion_marks_received_total", "CongestionMark link messages received.",
+                   h->cmarks_recvd);
+    if (h->nonce_filter != NULL) {
+        metric_gauge(b, "nonces", "Nonces inserted in the filter since it rotated.",
+                     h->nonce_filter->n_inserted);
+        metric_counter(b, "nonce_filter_rotations_total", "Nonce filter rotations.",
+                       h->nonce_filter->n_rotations);
+    }
+    else
+        metric_gauge(b, "nonces", "Nonce table entries.",
+                     hashtb_n(h->nonce_tab));
+    metric_counter(b, "loop_runs_total", "Trips around the main loop.",
+                   h->loop_runs);
+    metric_counter(b, "loop_fds_total", "File descriptors serviced after poll.",
+                   h->loop_fds);
+    metric_gauge(b, "scheduler_next_microseconds", "Time until the next scheduled event (-1: none).",
+                 h->loop_next_usec);
+    metric_counter(b, "link_fragments_sent_total", "Link fragments sent.",
+                   h->frags_sent);
+    metric_counter(b, "link_fragments_received_total", "Link fragments received.",
+                   h->frags_recvd);
+    metric_counter(b, "coalesced_pdus_total", "Coalesced PDUs sent.",
+                   h->pdus_coalesced);
+    metric_gauge(b, "shm_faces", "Faces using shared-memory rings.",
+                 h->shm_count);
+    metric_counter(b, "shm_messages_received_total", "Messages taken from shared-memory rings.",
+                   h->shm_msgs_in);
+    metric_counter(b, "shm_messages_sent_total", "Messages put in shared-memory rings.",
+                   h->shm_msgs_out);
+    metric_counter(b, "gateway_backbone_requests_total", "Interests passed to the backbone by the gateway.",
+                   h->backbone_requests);
+    collect_face_metrics(h, b);
+    collect_prefix_metrics(h, b);
+    return(b);
+}
+
+static const unsigned meterHz = 7; /* 1/ln(8/7) would give RC const of 1 sec */
+#define METER_DECAY_N 167U /* beyond this many ticks the history is gone */
+static unsigned meter_decay[METER_DECAY_N]; /* (7/8)**k, scaled by 2**31 */
+
+/**
+ * Fill in the table of decay factors, once.
+ */
+static void
+meter_decay_init(void)
+{
+    unsigned k;
+    
+    if (meter_decay[0] != 0)
+        return;
+    meter_decay[0] = 1U << 31;
+    for (k = 1; k < METER_DECAY_N; k++)
+        meter_decay[k] = meter_decay[k - 1] - meter_decay[k - 1] / 8;
+}
+
+/**
+ * Current time in meter ticks; wraps, which is OK.
+ */
+static unsigned
+meter_now(struct ndnd_handle *h)
+{
+    return((((unsigned)(h->sec)) * meterHz) + (h->usec * meterHz / 1000000U));
+}
+
+/**
+ * The rate of m as of tick now, decayed exponentially since its last sample.
+ */
+static unsigned
+meter_decayed(struct ndnd_meter *m, unsigned now)
+{
+    unsigned t = now - __atomic_load_n(&m->lastupdate, __ATOMIC_RELAXED);
+    unsigned rate = __atomic_load_n(&m->rate, __ATOMIC_RELAXED);
+    
+    if (t >= METER_DECAY_N)
+        return(0);
+    return((uintmax_t)rate * meter_decay[t] >> 31);
+}
+
 /**
  * create and initialize separately allocated meter.
  */
@@ -632,52 +1322,53 @@ ndnd_meter_init(struct ndnd_handle *h, struct ndnd_meter *m, const char *what)
     memset(m, 0, sizeof(*m));
     if (what != NULL)
         strncpy(m->what, what, sizeof(m->what)-1);
+    meter_decay_init();
     ndnd_meter_bump(h, m, 0);
 }
 
-static const unsigned meterHz = 7; /* 1/ln(8/7) would give RC const of 1 sec */
-
 /**
  * Count something (messages, packets, bytes), and roll up some kind of
  * statistics on it.
+ *
+ * This is called for every message and byte count, so it does constant
+ * work: the decay since the last sample is a single fixed-point multiply.
  */
 void
 ndnd_meter_bump(struct ndnd_handle *h, struct ndnd_meter *m, unsigned amt)
 {
-    unsigned now; /* my ticks, wrap OK */
-    unsigned t;
-    unsigned r;
+    unsigned now;
+    unsigned rate;
+    
     if (m == NULL)
         return;
-    now = (((unsigned)(h->sec)) * meterHz) + (h->usec * meterHz / 1000000U);
-    t = m->lastupdate;
-    m->total += amt;
-    if (now - t > 166U)
-        m->rate = amt; /* history has decayed away */
-    else {
-        /* Decay the old rate exponentially based on time since last sample. */
-        for (r = m->rate; t != now && r != 0; t++)
-            r = r - ((r + 7U) / 8U); /* multiply by 7/8, truncating */
-        m->rate = r + amt;
+    now = meter_now(h);
+    __atomic_store_n(&m->total, m->total + amt, __ATOMIC_RELAXED);
+    rate = m->rate;
+    if (now != m->lastupdate) {
+        rate = meter_decayed(m, now);
+        __atomic_store_n(&m->lastupdate, now, __ATOMIC_RELAXED);
     }
-    m->lastupdate = now;
+    __atomic_store_n(&m->rate, rate + amt, __ATOMIC_RELAXED);
 }
 
 /**
  * Return the average rate (units per second) of a metered quantity.
  *
+ * This does not modify the meter, so it may be used from another thread;
+ * the answer may then be a tick out of date.
  * m may be NULL.
  */
 unsigned
 ndnd_meter_rate(struct ndnd_handle *h, struct ndnd_meter *m)
 {
     unsigned denom = 8;
+    unsigned r;
     if (m == NULL)
         return(0);
-    ndnd_meter_bump(h, m, 0);
-    if (m->rate > 0x0FFFFFFF)
-        return(m->rate / denom * meterHz);
-    return ((m->rate * meterHz + (denom - 1)) / denom);
+    r = meter_decayed(m, meter_now(h));
+    if (r > 0x0FFFFFFF)
+        return(r / denom * meterHz);
+    return ((r * meterHz + (denom - 1)) / denom);
 }
 
 /**
@@ -690,5 +1381,81 @@ ndnd_meter_total(struct ndnd_meter *m)
 {
     if (m == NULL)
         return(0);
-    return (m->total);
+    return(__atomic_load_n(&m->total, __ATOMIC_RELAXED));
+}
+
+/**
+ * Record a latency sample, in microseconds.
+ *
+ * Sample k goes into the bucket for the highest bit set in it, so the
+ * buckets cover [2**k, 2**(k+1)) microseconds, with everything of
+ * 2**(NDND_HIST_N-1) or more in the last one.
+ */
+void
+ndnd_hist_add(struct ndnd_hist *hist, unsigned usec)
+{
+    unsigned k = 0;
+    
+    if (hist == NULL)
+        return;
+    __atomic_store_n(&hist->sum, hist->sum + usec, __ATOMIC_RELAXED);
+    if (usec >= (1U << 16)) { usec >>= 16; k += 16; }
+    if (usec >= (1U << 8)) { usec >>= 8; k += 8; }
+    if (usec >= (1U << 4)) { usec >>= 4; k += 4; }
+    if (usec >= (1U << 2)) { usec >>= 2; k += 2; }
+    if (usec >= (1U << 1)) { k += 1; }
+    if (k >= NDND_HIST_N)
+        k = NDND_HIST_N - 1;
+    __atomic_store_n(&hist->bucket[k], hist->bucket[k] + 1, __ATOMIC_RELAXED);
+    /* Released after the bucket, so a snapshot never counts it first */
+    __atomic_store_n(&hist->count, hist->count + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copy a latency histogram that the ndnd thread may be adding to.
+ *
+ * No field of the copy is torn.  The buckets add up to at least the
+ * count, but may hold a sample or two recorded after it was read, and
+ * so may the sum.
+ */
+void
+ndnd_hist_snapshot(const struct ndnd_hist *hist, struct ndnd_hist *copy)
+{
+    int k;
+    
+    copy->count = __atomic_load_n(&hist->count, __ATOMIC_ACQUIRE);
+    copy->sum = __atomic_load_n(&hist->sum, __ATOMIC_RELAXED);
+    for (k = 0; k < NDND_HIST_N; k++)
+        copy->bucket[k] = __atomic_load_n(&hist->bucket[k], __ATOMIC_RELAXED);
+}
+
+/**
+ * Estimate a quantile of a latency histogram.
+ *
+ * A histogram that another thread may be adding to should be given
+ * as a snapshot (ndnd_hist_snapshot()), so that the count and the
+ * buckets stay put while they are walked.
+ *
+ * @param permille  which quantile, e.g. 500 for the median, 990 for p99.
+ * @returns the upper edge in microseconds of the bucket holding the
+ *          quantile, or 0 if there are no samples.
+ */
+unsigned
+ndnd_hist_quantile(const struct ndnd_hist *hist, unsigned permille)
+{
+    unsigned k;
+    uintmax_t want;
+    uintmax_t seen = 0;
+    
+    if (hist == NULL || hist->count == 0)
+        return(0);
+    want = ((uintmax_t)hist->count * permille + 999) / 1000;
+    if (want == 0)
+        want = 1;
+    for (k = 0; k < NDND_HIST_N - 1; k++) {
+        seen += hist->bucket[k];
+        if (seen >= want)
+            break;
+    }
+    return((2U << k) - 1);
 }
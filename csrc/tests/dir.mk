@@ -26,6 +26,7 @@ ALLTESTS = \
   test_coders \
   test_destroyface \
   test_child_selector \
+  test_same_name_order \
   test_extopt \
   test_final_teardown \
   test_finished \
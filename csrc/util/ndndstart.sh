@@ -41,7 +41,10 @@ export NDN_LOCAL_PORT NDND_CAP NDND_DEBUG NDND_AUTOREG NDND_LISTEN_ON NDND_MTU
 # The following are rarely used, but include them for completeness
 export NDN_LOCAL_SOCKNAME NDND_DATA_PAUSE_MICROSEC NDND_KEYSTORE_DIRECTORY
 export NDND_DEFAULT_TIME_TO_STALE NDND_MAX_TIME_TO_STALE NDND_PREFIX
-export NDND_MAX_RTE_MICROSEC
+export NDND_MAX_RTE_MICROSEC NDND_CAP_BYTES NDND_CS_POLICY
+export NDND_CS_SNAPSHOT NDND_NONCE_FILTER NDND_NONCE_FILTER_BITS
+export NDND_STRATEGY NDND_SHAPER_WEIGHTS NDND_FRAG_MTU NDND_FRAG_RETRIES
+export NDND_COALESCE NDND_INTEREST_SHAPING NDND_METRICS_MAX_AGE NDND_METRICS_PREFIXES
 
 # If a ndnd is already running, try to shut it down cleanly.
 ndndsmoketest kill 2>/dev/null